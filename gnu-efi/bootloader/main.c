@@ -137,6 +137,35 @@ PSF1_FONT* LoadPSF1Font(EFI_FILE* dir, CHAR16* path) {
     return final_font;
 }
 
+// Load a whole file into pages that the kernel keeps (EfiLoaderData).
+VOID* LoadWholeFile(EFI_FILE* dir, CHAR16* path, UINTN* size) {
+    EFI_FILE* file = LoadFile(dir, path);
+    if (file == NULL) { return NULL; }
+
+    EFI_FILE_INFO* info = LibFileInfo(file);
+    if (info == NULL) {
+        file->Close(file);
+        return NULL;
+    }
+    UINTN fileSize = info->FileSize;
+    FreePool(info);
+
+    EFI_PHYSICAL_ADDRESS pages = 0;
+    EFI_STATUS status = gBootServices->AllocatePages(AllocateAnyPages
+                                                     , EfiLoaderData
+                                                     , (fileSize + 0x1000 - 1) / 0x1000
+                                                     , &pages);
+    if (EFI_ERROR(status) || pages == 0) {
+        Print(L"ERROR: Failed to allocate %d bytes for file\n", fileSize);
+        file->Close(file);
+        return NULL;
+    }
+    file->Read(file, &fileSize, (VOID*)pages);
+    file->Close(file);
+    *size = fileSize;
+    return (VOID*)pages;
+}
+
 Framebuffer framebuffer;
 Framebuffer* InitializeGOP() {
     EFI_GUID gopGuid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
@@ -165,6 +194,8 @@ typedef struct {
     UINTN mapSize;
     UINTN mapDescSize;
     void* RSDP;
+    void* initrd;
+    UINTN initrdSize;
 } BootInfo;
 
 EFI_STATUS efi_main (EFI_HANDLE IH, EFI_SYSTEM_TABLE* ST) {
@@ -203,6 +234,16 @@ EFI_STATUS efi_main (EFI_HANDLE IH, EFI_SYSTEM_TABLE* ST) {
               dflt_font->PSF1_Header->CharacterSize);
     }
 
+    // The initial RAM disk is optional.
+    UINTN initrdSize = 0;
+    VOID* initrd = LoadWholeFile(bin, L"initrd", &initrdSize);
+    if (initrd == NULL) {
+        Print(L"No initrd found at /LensorOS/initrd\n");
+    }
+    else {
+        Print(L"LOADED: initrd at 0x%x (%d bytes)\n", initrd, initrdSize);
+    }
+
     // Unload LensorOS directory.
     bin->Close(bin);
 
@@ -333,6 +374,8 @@ EFI_STATUS efi_main (EFI_HANDLE IH, EFI_SYSTEM_TABLE* ST) {
     info.mapSize = MapSize;
     info.mapDescSize = DescriptorSize;
     info.RSDP = rsdp;
+    info.initrd = initrd;
+    info.initrdSize = initrd ? initrdSize : 0;
 
     Print(L"Kernel entry point: 0x%x\n", elf_header.e_entry);
     Print(L"Calculated kernel entry point: 0x%x\n"
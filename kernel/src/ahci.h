@@ -24,14 +24,9 @@
 #include <system.h>
 #include <memory/common.h>
 
-/// Size of AHCI Port buffer (how much the hardware reads/writes at a time)
-/// 128mib = 134217700 bytes = 32768 pages = 0x8000
-/// 1mib = 1048576 bytes = 256 pages = 0x100
-#define MAX_READ_PAGES 0x100
-#define MAX_READ_BYTES (MAX_READ_PAGES * PAGE_SIZE)
-
 #define ATA_DEV_BUSY 0x80
 #define ATA_DEV_DRQ  0x08
+#define ATA_DEV_ERR  0x01
 
 #define ATA_CMD_WRITE_DMA        0xca
 #define ATA_CMD_WRITE_DMA_QUEUED 0xcc
@@ -53,6 +48,16 @@
 #define ATA_CMD_READ_MULTIPLE_EXT   0x29
 #define ATA_CMD_READ_SECTORS_EXT    0x24
 
+/// Native Command Queuing: the device may reorder these, and tells
+/// the host which tags (command slots) are done through `SataActive`.
+#define ATA_CMD_READ_FPDMA_QUEUED  0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+
+#define ATA_CMD_IDENTIFY     0xec
+#define ATA_CMD_READ_LOG_EXT 0x2f
+/// Log page that reports (and clears) a failed queued command.
+#define ATA_LOG_NCQ_ERROR    0x10
+
 #define ATA_CMD_PACKET       0xa0
 #define ATA_CMD_DEVICE_RESET 0x08
 
@@ -111,6 +116,11 @@
 #define SCSI_CMD_READ_CD                        0xbe
 #define SCSI_CMD_SEND_DISC_STRUCTURE            0xbf
 
+// Supports Native Command Queuing.
+#define HBA_CAP_SNCQ (1u << 30)
+// Number of command slots, minus one.
+#define HBA_CAP_NCS(cap) ((((cap) >> 8) & 0x1f) + 1)
+
 #define HBA_PORT_DEVICE_PRESENT 0x3
 #define HBA_PORT_IPM_ACTIVE     0x1
 
@@ -125,7 +135,27 @@
 // Start DMA
 #define HBA_PxCMD_ST   1
 
+// Interrupt Enable (GHC.IE); without it, no port interrupts.
+#define HBA_GHC_IE (1u << 1)
+
+// Device to Host Register FIS received (a non-queued command is done).
+#define HBA_PxIS_DHRS (1 << 0)
+// PIO Setup FIS received.
+#define HBA_PxIS_PSS  (1 << 1)
+// DMA Setup FIS received.
+#define HBA_PxIS_DSS  (1 << 2)
+// Set Device Bits FIS received (queued commands are done).
+#define HBA_PxIS_SDBS (1 << 3)
+// Interface Fatal Error.
+#define HBA_PxIS_IFS  (1 << 27)
+// Host Bus Data Error.
+#define HBA_PxIS_HBDS (1 << 28)
+// Host Bus Fatal Error.
+#define HBA_PxIS_HBFS (1 << 29)
+// Task File Error.
 #define HBA_PxIS_TFES (1 << 30)
+// Errors that stop the port from processing commands.
+#define HBA_PxIS_FATAL (HBA_PxIS_IFS | HBA_PxIS_HBDS | HBA_PxIS_HBFS | HBA_PxIS_TFES)
 
 constexpr u32 HBA_PRDT_INTERRUPT_ON_COMPLETION = (1ul << 31);
 
@@ -32,6 +32,9 @@ struct BootInfo {
     u64 mapSize;
     u64 mapDescSize;
     ACPI::RSDP2* rsdp;
+    /// Contents of `/LensorOS/initrd` on the boot media, or null.
+    void* initrd;
+    u64 initrdSize;
 };
 
 #endif /* LENSOR_OS_BOOT_H */
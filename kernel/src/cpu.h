@@ -112,6 +112,7 @@ public:
     }
 
     void add_cpu(const CPU& cpu) { CPUs.add(cpu); }
+    auto cpu_count() const -> u64 { return CPUs.length(); }
 
     void set_logical_core_bits (u8 bits) { LogicalCoreBits  = bits; }
     void set_physical_core_bits(u8 bits) { PhysicalCoreBits = bits; }
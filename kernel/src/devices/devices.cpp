@@ -30,25 +30,53 @@ Devices::AHCIController::AHCIController(PCI::PCIHeader0* hdr)
 Devices::AHCIPort::AHCIPort(
     std::shared_ptr<AHCIController> controller,
     AHCI::PortType type,
-    uint8_t i,
-    AHCI::HBAPort* port
+    uint8_t i
 ) : SystemDevice(SYSDEV_MAJOR_STORAGE, SYSDEV_MINOR_AHCI_PORT)
   , Controller(std::move(controller))
-  , Driver(std::make_shared<AHCI::PortController>(type, i, port)) {
+  , Driver(std::make_shared<AHCI::PortController>(type, i, reinterpret_cast<AHCI::HBAMemory*>(u64(Controller->Header->BAR5))))
+  , Scheduler(type == AHCI::PortType::SATA ? std::make_shared<IOScheduler>(sdd(Driver)) : nullptr)
+  , Cache(std::make_shared<BlockCacheDriver>(Scheduler ? sdd(Scheduler) : sdd(Driver))) {
     // Search SATA devices further for partitions and filesystems.
     if (type == AHCI::PortType::SATA) set_flag(SYSDEV_MAJOR_STORAGE_SEARCH, true);
 }
 
-Devices::GPTPartition::GPTPartition(std::shared_ptr<AHCIPort> port, GPT::PartitionEntry& part)
-    : SystemDevice(SYSDEV_MAJOR_STORAGE, SYSDEV_MINOR_GPT_PARTITION)
-    , Port(std::move(port))
-    , Driver(std::make_shared<GPTPartitionDriver> (
-        std::static_pointer_cast<StorageDeviceDriver>(Port->Driver),
+Devices::NVMeController::NVMeController(PCI::PCIHeader0* hdr)
+    : SystemDevice(SYSDEV_MAJOR_STORAGE, SYSDEV_MINOR_NVME_CONTROLLER)
+    , Header(hdr)
+    , Driver(std::make_shared<NVMe::Controller>(registers())) {
+    set_flag(SYSDEV_MAJOR_STORAGE_SEARCH, true);
+}
+
+auto Devices::NVMeController::registers() const -> NVMe::Registers* {
+    // BAR0 and BAR1 together are the 64-bit address of the registers.
+    u64 address = Header->BAR0 & ~u64(0xf);
+    if (((Header->BAR0 >> 1) & 0b11) == 0b10) address |= u64(Header->BAR1) << 32;
+    return reinterpret_cast<NVMe::Registers*>(address);
+}
+
+Devices::NVMeNamespace::NVMeNamespace(
+    std::shared_ptr<NVMeController> controller,
+    std::shared_ptr<NVMe::NamespaceDriver> driver
+) : SystemDevice(SYSDEV_MAJOR_STORAGE, SYSDEV_MINOR_NVME_NAMESPACE)
+  , Controller(std::move(controller))
+  , Driver(std::move(driver))
+  , Scheduler(std::make_shared<IOScheduler>(sdd(Driver)))
+  , Cache(std::make_shared<BlockCacheDriver>(sdd(Scheduler))) {
+    set_flag(SYSDEV_MAJOR_STORAGE_SEARCH, true);
+}
+
+Devices::GPTPartition::GPTPartition(
+    std::shared_ptr<SystemDevice> disk,
+    std::shared_ptr<StorageDeviceDriver> driver,
+    GPT::PartitionEntry& part
+) : SystemDevice(SYSDEV_MAJOR_STORAGE, SYSDEV_MINOR_GPT_PARTITION)
+  , Disk(std::move(disk))
+  , Driver(std::make_shared<GPTPartitionDriver> (
+        driver,
         GUID(part.TypeGUID), GUID(part.UniqueGUID),
-        /// TODO: Should we use part.EndLBA or part.EndLBA - part.StartLBA instead of 512?
-        u64(part.StartLBA), 512
+        u64(part.StartLBA), driver->sector_size()
     ))
-    , Partition(part) {
+  , Partition(part) {
     set_flag(SYSDEV_MAJOR_STORAGE_SEARCH, true);
 }
 
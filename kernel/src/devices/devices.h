@@ -22,7 +22,10 @@
 
 #include <gpt.h>
 #include <pci.h>
+#include <storage/device_drivers/block_cache.h>
 #include <storage/device_drivers/gpt_partition.h>
+#include <storage/device_drivers/io_scheduler.h>
+#include <storage/device_drivers/nvme_controller.h>
 #include <storage/device_drivers/port_controller.h>
 #include <system.h>
 
@@ -36,16 +39,43 @@ struct AHCIController : SystemDevice {
 struct AHCIPort : SystemDevice {
     std::shared_ptr<AHCIController> Controller;
     std::shared_ptr<AHCI::PortController> Driver;
+    /// Queues, merges and orders what is submitted to `Driver`. Only
+    /// SATA ports take asynchronous requests, so only they have one.
+    std::shared_ptr<IOScheduler> Scheduler;
+    /// `Driver` behind the block cache; consumers should read through this.
+    std::shared_ptr<BlockCacheDriver> Cache;
 
-    AHCIPort(std::shared_ptr<AHCIController> controller, AHCI::PortType type, uint8_t i, AHCI::HBAPort* port);
+    AHCIPort(std::shared_ptr<AHCIController> controller, AHCI::PortType type, uint8_t i);
+};
+
+struct NVMeController : SystemDevice {
+    PCI::PCIHeader0* Header;
+    std::shared_ptr<NVMe::Controller> Driver;
+    NVMeController(PCI::PCIHeader0* hdr);
+
+    /// Where the controller's registers are mapped.
+    auto registers() const -> NVMe::Registers*;
+};
+
+struct NVMeNamespace : SystemDevice {
+    std::shared_ptr<NVMeController> Controller;
+    std::shared_ptr<NVMe::NamespaceDriver> Driver;
+    std::shared_ptr<IOScheduler> Scheduler;
+    /// `Driver` behind the block cache; consumers should read through this.
+    std::shared_ptr<BlockCacheDriver> Cache;
+
+    NVMeNamespace(std::shared_ptr<NVMeController> controller, std::shared_ptr<NVMe::NamespaceDriver> driver);
 };
 
 struct GPTPartition : SystemDevice {
-    std::shared_ptr<AHCIPort> Port;
+    /// The AHCI port or NVMe namespace the partition is on.
+    std::shared_ptr<SystemDevice> Disk;
     std::shared_ptr<GPTPartitionDriver> Driver;
     GPT::PartitionEntry Partition;
 
-    GPTPartition(std::shared_ptr<AHCIPort> port, GPT::PartitionEntry& part);
+    /// `driver` is how the disk is read; partition sectors are of its
+    /// `sector_size()`.
+    GPTPartition(std::shared_ptr<SystemDevice> disk, std::shared_ptr<StorageDeviceDriver> driver, GPT::PartitionEntry& part);
 };
 
 struct E1000Device : SystemDevice {
@@ -25,6 +25,7 @@
 
 #include <elf.h>
 #include <file.h>
+#include <gdt.h>
 #include <integers.h>
 #include <link_definitions.h>
 #include <memory/common.h>
@@ -34,6 +35,7 @@
 #include <memory/virtual_memory_manager.h>
 #include <scheduler.h>
 #include <system.h>
+#include <time_page.h>
 #include <tss.h>
 #include <virtual_filesystem.h>
 
@@ -213,6 +215,9 @@ namespace ELF {
         u64 stack_top_address = newStackBottom + UserProcessStackSize;
         Memory::map_pages(pageTable, (void*)newStackBottom, (void*)newStackBottom, stack_flags, UserProcessStackSizePages, Memory::ShowDebug::No);
 
+        // Read-only clock calibration data; see `time_page.h`.
+        Time::map_time_page(pageTable);
+
         // Keep track of stack, as it is a memory region that remains
         // for the duration of the process, and should only be freed
         // when it exits.
@@ -292,8 +297,8 @@ namespace ELF {
         // Entry point.
         process->CPU.Frame.ip = elfHeader.e_entry;
         // Ring 3 GDT segment selectors.
-        process->CPU.Frame.cs = 0x18 | 3;
-        process->CPU.Frame.ss = 0x20 | 3;
+        process->CPU.Frame.cs = GDT_RING3_CODE | 3;
+        process->CPU.Frame.ss = GDT_RING3_DATA | 3;
         // Enable interrupts after jump.
         process->CPU.Frame.flags = 0b1010000010;
 
@@ -325,6 +330,9 @@ namespace ELF {
         }
         // Clear memories list.
         while (process->Memories.remove(0));
+        // Submission/completion rings were freed along with the rest of the memories.
+        process->IORing = nullptr;
+        process->IORingEntries = 0;
 
         return LoadUserspaceElf64Process(process, process->CR3, fd, elfHeader, args);
     }
@@ -162,6 +162,28 @@ struct BootRecord {
 
 static_assert(sizeof(BootRecord) == 512, "Boot record must be 512 bytes.");
 
+#define FAT_FSINFO_LEAD_SIGNATURE   0x41615252
+#define FAT_FSINFO_STRUCT_SIGNATURE 0x61417272
+#define FAT_FSINFO_TRAIL_SIGNATURE  0xaa550000
+/// Either count of the FSInfo sector may be this if it isn't known.
+#define FAT_FSINFO_UNKNOWN          0xffffffff
+
+/// FAT32 File System Information sector.
+///   Its sector number is `BootRecordExtension32::FATInformation`.
+///   Both counts are merely hints; they may be stale or unknown.
+struct FATFSInformation {
+    u32 LeadSignature;
+    u8  Reserved0[480];
+    u32 StructSignature;
+    u32 FreeClusters;
+    /// Where to start looking for a free cluster.
+    u32 NextFreeCluster;
+    u8  Reserved1[12];
+    u32 TrailSignature;
+} __attribute__((packed));
+
+static_assert(sizeof(FATFSInformation) == 512, "FSInfo sector must be 512 bytes.");
+
 enum class FATType {
     INVALID = 0,
     FAT12 = 1,
@@ -196,6 +218,11 @@ struct ClusterEntry {
         return result;
     }
 
+    void set_cluster_number(u32 cluster) {
+        ClusterNumberL = u16(cluster);
+        ClusterNumberH = u16(cluster >> 16);
+    }
+
     bool long_file_name() {
         return Attributes & 0b0001
             && Attributes & 0b0010
@@ -346,6 +373,34 @@ struct ExFATBootRecord {
     u8  Reserved1[7];
 }  __attribute__((packed));
 
+/// `Type` byte of exFAT directory entries as stored; the top bit is
+/// set while an entry is in use, and a zero byte ends the directory.
+#define ExFAT_ENTRY_END_OF_DIRECTORY 0x00
+#define ExFAT_ENTRY_IN_USE           0x80
+#define ExFAT_ENTRY_BITMAP           0x81
+#define ExFAT_ENTRY_UPCASE           0x82
+#define ExFAT_ENTRY_VOLUME_LABEL     0x83
+#define ExFAT_ENTRY_FILE             0x85
+#define ExFAT_ENTRY_STREAM           0xc0
+#define ExFAT_ENTRY_FILE_NAME        0xc1
+
+/// ExFATFileEntry Attributes.
+#define ExFAT_ATTR_DIRECTORY 0x10
+
+/// ExFATStreamExtensionEntry SecondaryFlags.
+#define ExFAT_FLAG_ALLOCATION_POSSIBLE 0x01
+/// The clusters are contiguous, and the FAT says nothing about them.
+#define ExFAT_FLAG_NO_FAT_CHAIN        0x02
+
+struct ExFATBitmapEntry {
+    u8  Type;
+    /// Bit zero: which of two FATs (and bitmaps) this is for.
+    u8  Flags;
+    u8  Reserved[18];
+    u32 FirstCluster;
+    u64 DataLength;
+} __attribute__((packed));
+
 struct ExFATFileEntry {
     u8  Type;
     u8  NumSecondaries;
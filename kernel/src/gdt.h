@@ -154,15 +154,23 @@ private:
 ///   however, a ring may not access anything in any ring smaller than itself.
 /// This allows for the kernel (ring zero) to access all programs, drivers, etc.
 ///   but dis-allow userland programs from tampering with the kernel, drivers, etc.
+/// NOTE: The order of the Ring 3 entries is mandated by `sysret`, which
+///   loads SS from STAR[63:48] + 8 and CS from STAR[63:48] + 16.
 struct GDT {
     GDTEntry Null;      // 0x00
     GDTEntry Ring0Code; // 0x08
     GDTEntry Ring0Data; // 0x10
-    GDTEntry Ring3Code; // 0x18
-    GDTEntry Ring3Data; // 0x20
+    GDTEntry Ring3Data; // 0x18
+    GDTEntry Ring3Code; // 0x20
     TSS_GDTEntry TSS;   // 0x28, 0x30
 } __attribute__((aligned(0x1000)));
 
+#define GDT_RING0_CODE 0x08
+#define GDT_RING0_DATA 0x10
+#define GDT_RING3_DATA 0x18
+#define GDT_RING3_CODE 0x20
+#define GDT_TSS        0x28
+
 void setup_gdt();
 
 extern GDT gGDT;
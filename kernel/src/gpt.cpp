@@ -40,7 +40,8 @@ namespace GPT {
         }
         DBGMSG("[GPT]: Checking for valid GPT\n");
         Header hdr;
-        driver->read_raw(512, sizeof hdr, (u8*)&hdr);
+        // The header is at LBA 1, in whatever size the disk's blocks are.
+        driver->read_raw(driver->sector_size(), sizeof hdr, (u8*)&hdr);
         // Validate GPT Header
         if (hdr.Revision == 0) {
             DBGMSG("  ERROR: Revision is not zero\n");
@@ -113,6 +113,10 @@ public:
     void start_main_counter();
     void stop_main_counter();
 
+    bool initialized() { return Initialized; }
+    /// Main counter ticks per second.
+    u64 frequency() { return Frequency; }
+
     /// Get the value of the HPET main counter.
     u64 get();
     /* Get the amount of seconds passed based on main counter.
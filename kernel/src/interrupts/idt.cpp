@@ -53,6 +53,11 @@ void IDTR::install_handler
     interrupt->Selector = selector;
 }
 
+bool IDTR::has_handler(u8 entryOffset) {
+    IDTEntry* interrupt = (IDTEntry*)(Offset + entryOffset * sizeof(IDTEntry));
+    return interrupt->GetOffset() != 0;
+}
+
 void IDTEntry::SetOffset(u64 offset) {
     Offset0 = (u16)(offset & 0x000000000000ffff);
     Offset1 = (u16)((offset & 0x00000000ffff0000) >> 16);
@@ -91,6 +91,10 @@ struct IDTR {
                          , u8 selector = 0x08
                          );
 
+    /// Whether a handler has been installed for vector `entryOffset`;
+    /// the table starts out zeroed.
+    bool has_handler(u8 entryOffset);
+
     void flush() {
         asm volatile ("lidt %0" :: "m"(*this));
     }
@@ -42,6 +42,7 @@
 #include <pit.h>
 #include <rtc.h>
 #include <scheduler.h>
+#include <storage/device_drivers/port_controller.h>
 #include <system.h>
 #include <uart.h>
 #include <vfs_forward.h>
@@ -138,7 +139,7 @@ static void handle_direct_input(char input) {
             auto fd = static_cast<ProcFD>(0);
             auto sysfd = init->FileDescriptors[fd];
             auto f = SYSTEM->virtual_filesystem().file(*sysfd);
-            if (f) f->device_driver()->write(f.get(), 0, sizeof(char), &input);
+            if (f) f->device_driver()->write(f, 0, sizeof(char), &input);
             return;
         }
     }
@@ -224,6 +225,13 @@ void mouse_handler(InterruptFrame* frame) {
     end_of_interrupt(12);
 }
 
+/// AHCI CONTROLLER, on whichever IRQ its PCI interrupt line is routed to.
+__attribute__((interrupt))
+void ahci_handler(InterruptFrame* frame) {
+    AHCI::handle_interrupt();
+    end_of_interrupt(AHCI::interrupt_line());
+}
+
 /// FAULT INTERRUPT HANDLERS
 
 __attribute__((interrupt))
@@ -125,6 +125,7 @@ void keyboard_handler     (InterruptFrame*);
 void uart_com1_handler    (InterruptFrame*);
 void rtc_handler          (InterruptFrame*);
 void mouse_handler        (InterruptFrame*);
+void ahci_handler         (InterruptFrame*);
 // EXCEPTION HANDLING
 void divide_by_zero_handler           (InterruptFrame*);
 void double_fault_handler             (InterruptFrameError*);
@@ -148,4 +149,14 @@ void disable_interrupt(u8 irq);
 // Disable all IRQs within the PIC masks.
 void disable_all_interrupts();
 
+/// Keeps interrupt handlers out for as long as it lives, so state they
+/// share can be touched from outside of them; then restores the
+/// interrupt flag as it was.
+class InterruptsMasked {
+    u64 Flags;
+public:
+    InterruptsMasked() { asm volatile ("pushfq\n\tpop %0\n\tcli" : "=r"(Flags) :: "memory"); }
+    ~InterruptsMasked() { if (Flags & (1 << 9)) asm volatile ("sti" ::: "memory"); }
+};
+
 #endif
@@ -23,6 +23,15 @@
 
 extern syscalls             ; Table of system call functions declared in "syscalls.h"
 extern num_syscalls         ; Number of system call functions defined within syscalls table.
+extern tss                  ; Pointer to 64-bit TSS Entry structure; RSP0 is the kernel stack.
+
+section .bss
+;;; Scratch space for the user stack pointer while `syscall_entry_asm`
+;;; switches to the kernel stack. Interrupts are masked by IA32_FMASK
+;;; for the duration, so a single slot suffices on one CPU.
+syscall_user_rsp: resq 1
+
+section .text
 
 do_swapgs:
     cmp QWORD [rsp + 0x08], 0x08
@@ -62,14 +71,9 @@ system_call_handler_asm:
     push rbx
     push rsp
 ;;; Execute the system call.
-    mov r11, rdx                ; mul and friends clobber RDX, we need to save it.
-    mov rbx, 8                  ; 8 = sizeof(pointer) in 64 bit.
-    mul rbx                     ; Get byte offset within syscall table of syscall entry.
-    mov r10, syscalls           ; Store address of syscalls function table.
-    add r10, rax                ; Add offset to base address.
-    mov rdx, r11                ; Restore clobbered RDX.
-    mov r11, rsp
-    call [rel r10]              ; Call function at syscalls table base address + syscall number offset.
+    lea r10, [rel syscalls]     ; Store address of syscalls function table.
+    mov r11, rsp                ; Syscalls that may block find the saved CPUState in `r11`.
+    call [r10 + rax * 8]        ; Call function at syscalls table base address + syscall number * sizeof(pointer).
 ;;; Restore CPU state, then return from interrupt.
     add rsp, 8                  ; Eat `rsp` off the stack.
     pop rbx
@@ -94,3 +98,90 @@ invalid_syscall:                ; If system call code is invalid, jump directly
     iretq                       ; iretq -> interrupt return quad word (64 bit)
 
 GLOBAL system_call_handler_asm
+
+;;; Fast System Call Handler (entered via `syscall`, see IA32_LSTAR)
+;;; Registers Used:
+;;;   rax  --  System Call Code
+;;;   rcx  --  Userspace return address (set by CPU)
+;;;   r11  --  Userspace RFLAGS (set by CPU)
+;;;   r10  --  4th argument, as `rcx` is taken by the CPU
+;;;
+;;; An interrupt frame identical to the one `int 0x80` would push is
+;;; built on the kernel stack, so a saved CPUState may be resumed by
+;;; the scheduler with `iretq` no matter how the process entered.
+syscall_entry_asm:
+    swapgs
+    mov [rel syscall_user_rsp], rsp
+    mov rsp, [rel tss]
+    mov rsp, [rsp + 4]          ; `l_RSP0` and `h_RSP0` of the TSS form the kernel stack pointer.
+    push 0x18 | 0b11            ; SS: GDT Offset of Ring 3 User Data entry.
+    push QWORD [rel syscall_user_rsp]
+    push r11                    ; RFLAGS
+    push 0x20 | 0b11            ; CS: GDT Offset of Ring 3 User Code entry.
+    push rcx                    ; RIP
+;;; Do nothing if system call code is invalid:
+;;; Syscall code invalid if greater than or equal to total number of syscalls.
+    cmp rax, [rel num_syscalls]
+    jae syscall_entry_return
+;;; Save CPU state to be restored after system call.
+    push rax
+    push gs
+    push fs
+    push r15
+    push r14
+    push r13
+    push r12
+    push r11
+    push r10
+    push r9                     ; 6th argument
+    push r8                     ; 5th argument
+    push rbp
+    push rdi                    ; 1st argument
+    push rsi                    ; 2nd argument
+    push rdx                    ; 3rd argument
+    push rcx
+    push rbx
+    push rsp
+;;; Execute the system call.
+    mov rcx, r10                ; 4th argument
+    lea r10, [rel syscalls]     ; Store address of syscalls function table.
+    mov r11, rsp                ; Syscalls that may block find the saved CPUState in `r11`.
+    call [r10 + rax * 8]        ; Call function at syscalls table base address + syscall number * sizeof(pointer).
+;;; Restore CPU state.
+    add rsp, 8                  ; Eat `rsp` off the stack.
+    pop rbx
+    pop rcx
+    pop rdx
+    pop rsi
+    pop rdi
+    pop rbp
+    pop r8
+    pop r9
+    pop r10
+    pop r11
+    pop r12
+    pop r13
+    pop r14
+    pop r15
+    pop fs
+    pop gs
+    add rsp, 8                  ; Eat `rax` off the stack.
+syscall_entry_return:
+;;; `sysret` is only safe when returning to a canonical, lower-half
+;;; address in the user code segment; otherwise use `iretq`.
+;;; `rcx` and `r11` are clobbered by `syscall`, so they are free here.
+    mov rcx, [rsp]              ; RIP
+    mov r11, rcx
+    shr r11, 47
+    jnz syscall_entry_iretq
+    cmp QWORD [rsp + 8], 0x20 | 0b11
+    jne syscall_entry_iretq
+    mov r11, [rsp + 16]         ; RFLAGS
+    mov rsp, [rsp + 24]         ; Userspace stack pointer.
+    swapgs
+    o64 sysret
+syscall_entry_iretq:
+    swapgs
+    iretq
+
+GLOBAL syscall_entry_asm
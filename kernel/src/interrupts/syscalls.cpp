@@ -23,11 +23,16 @@
 #include <debug.h>
 #include <elf_loader.h>
 #include <file.h>
+#include <gdt.h>
+#include <io.h>
+#include <io_ring.h>
 #include <linked_list.h>
 #include <memory/common.h>
 #include <memory/paging.h>
 #include <memory/region.h>
 #include <memory/virtual_memory_manager.h>
+#include <pit.h>
+#include <poll.h>
 #include <rtc.h>
 #include <scheduler.h>
 #include <system.h>
@@ -51,10 +56,11 @@
 [[maybe_unused]]
 constexpr const char* sys$_dbgfmt = "[SYS$]: {} -- {}\n";
 
-ProcessFileDescriptor sys$0_open(const char* path) {
+/// @param flags VFS_OPEN_* flags.
+ProcessFileDescriptor sys$0_open(const char* path, u32 flags) {
     DBGMSG(sys$_dbgfmt, 0, "open");
     // FIXME: Validate path pointer.
-    return SYSTEM->virtual_filesystem().open(path).Process;
+    return SYSTEM->virtual_filesystem().open(path, flags).Process;
 }
 
 void sys$1_close(ProcessFileDescriptor fd) {
@@ -79,8 +85,12 @@ int sys$2_read(ProcessFileDescriptor fd, u8* buffer, u64 byteCount) {
     // FIXME: Validate buffer pointer.
 
     // Save CPU state in case read blocks, aka calls yield.
-    memcpy(&Scheduler::CurrentProcess->value()->CPU, cpu, sizeof(CPUState));
-    return SYSTEM->virtual_filesystem().read(fd, buffer, byteCount, 0);
+    Process* process = Scheduler::CurrentProcess->value();
+    memcpy(&process->CPU, cpu, sizeof(CPUState));
+    process->Restartable = true;
+    int rc = SYSTEM->virtual_filesystem().read(fd, buffer, byteCount, 0);
+    process->Restartable = false;
+    return rc;
 }
 
 int sys$3_write(ProcessFileDescriptor fd, u8* buffer, u64 byteCount) {
@@ -429,31 +439,32 @@ int sys$14_seek(ProcessFileDescriptor fd, ssz offset, int whence) {
     DBGMSG("[SYS$]:seek(): {}, offset={}, whence={}\n", fd, offset, get_seek_string(whence));
 
     VFS& vfs = SYSTEM->virtual_filesystem();
-    std::shared_ptr<FileMetadata> file = vfs.file(fd);
-    if (!file) return 1;
+    OpenFileDescription* description = vfs.description(fd);
+    if (!description) return 1;
+    const usz file_size = description->file()->file_size();
 
     switch (whence) {
     case SEEK_CUR: {
         if (offset == 0) return 0;
-        usz current_offset = file.get()->offset;
+        usz current_offset = description->Offset;
         // Cannot seek behind beginning of file...
         if (offset < 0 && ((usz)(-offset) > current_offset)) return 1;
         // FIXME: Cannot seek past end of file...
-        else if (current_offset + offset > file.get()->file_size()) return 1;
-        file.get()->offset += offset;
+        else if (current_offset + offset > file_size) return 1;
+        description->Offset += offset;
     } return 0;
 
     case SEEK_END: {
         // FIXME: Cannot seek past end of file...
         if (offset > 0) return 1;
-        file.get()->offset = file.get()->file_size() + offset;
+        description->Offset = file_size + offset;
     } return 0;
 
     case SEEK_SET: {
         if (offset < 0) return 1;
         // FIXME: Cannot seek past end of file...
-        if ((usz)offset >= file.get()->file_size()) return 1;
-        file.get()->offset = offset;
+        if ((usz)offset >= file_size) return 1;
+        description->Offset = offset;
     } return 0;
 
     default: break;
@@ -497,6 +508,338 @@ ProcFD sys$16_dup(ProcessFileDescriptor fd) {
     return fds.Process;
 }
 
+/// Perform a single submission queue entry, returning what the
+/// equivalent system call would.
+static s64 ioring_perform(const IORingSubmission& sqe) {
+    VFS& vfs = SYSTEM->virtual_filesystem();
+    auto fd = static_cast<ProcFD>(sqe.FD);
+    switch (sqe.Opcode) {
+    case IORING_OP_NOP:
+        return 0;
+    case IORING_OP_READ: {
+        // FIXME: Validate buffer pointer.
+        Process* process = Scheduler::CurrentProcess->value();
+        process->Restartable = true;
+        s64 rc = vfs.read(fd, (u8*)sqe.Address, sqe.Length, sqe.Offset);
+        process->Restartable = false;
+        return rc;
+    }
+    case IORING_OP_WRITE:
+        // FIXME: Validate buffer pointer.
+        return vfs.write(fd, (u8*)sqe.Address, sqe.Length, sqe.Offset);
+    case IORING_OP_OPEN:
+        // FIXME: Validate path pointer.
+        if (!sqe.Address) return -1;
+        return (s64)vfs.open((const char*)sqe.Address).Process;
+    case IORING_OP_CLOSE:
+        return vfs.close(fd) ? 0 : -1;
+    case IORING_OP_SEEK:
+        return sys$14_seek(fd, (ssz)sqe.Offset, (int)sqe.Length);
+    default:
+        return -1;
+    }
+}
+
+/// Allocate submission and completion rings shared with the calling
+/// process. The completion queue has twice as many entries as the
+/// submission queue. See `io_ring.h` for the layout.
+/// @param entries  Number of submission queue entries (a power of two).
+/// @return Userspace address of the ring header, or NULL on failure.
+void* sys$17_ioring_setup(u32 entries) {
+    DBGMSG(sys$_dbgfmt, 17, "ioring_setup");
+    DBGMSG("  entries: {}\n", entries);
+    Process* process = Scheduler::CurrentProcess->value();
+    if (process->IORing) return nullptr;
+    if (!entries || entries > IORING_MAX_ENTRIES || (entries & (entries - 1)))
+        return nullptr;
+
+    usz completionEntries = entries * 2;
+    usz size = IORING_HEADER_SIZE
+        + entries * sizeof(IORingSubmission)
+        + completionEntries * sizeof(IORingCompletion);
+    auto* ring = (IORingHeader*)sys$6_map(nullptr, size, 0);
+    if (!ring) return nullptr;
+
+    // Current page map is that of the process, so we can write through the userspace address.
+    memset(ring, 0, size);
+    ring->SubmissionEntries = entries;
+    ring->SubmissionMask = entries - 1;
+    ring->CompletionEntries = completionEntries;
+    ring->CompletionMask = completionEntries - 1;
+
+    process->IORing = ring;
+    process->IORingEntries = entries;
+    return ring;
+}
+
+/// Consume up to `toSubmit` entries from the submission queue, posting
+/// a completion for each. Entries are left queued when the completion
+/// queue is full.
+/// If an operation blocks (i.e. reading an empty pipe), the process
+/// sleeps with that entry still queued, and the syscall returns -2
+/// when woken; completions of the entries before it have been posted.
+/// @return Number of entries consumed, or -1 if no rings are set up.
+ssz sys$18_ioring_enter(u32 toSubmit) {
+    CPUState* cpu = nullptr;
+    asm volatile ("mov %%r11, %0\n"
+                  : "=r"(cpu)
+                  );
+    DBGMSG(sys$_dbgfmt, 18, "ioring_enter");
+    DBGMSG("  to submit: {}\n", toSubmit);
+    Process* process = Scheduler::CurrentProcess->value();
+    IORingHeader* ring = process->IORing;
+    if (!ring) return -1;
+
+    // Save CPU state in case an operation blocks, aka calls yield.
+    memcpy(&process->CPU, cpu, sizeof(CPUState));
+
+    // Never trust the sizes in the header; userspace can write them.
+    const u32 submissionEntries = process->IORingEntries;
+    const u32 completionEntries = submissionEntries * 2;
+    auto* submissions = (IORingSubmission*)((u8*)ring + IORING_HEADER_SIZE);
+    auto* completions = (IORingCompletion*)(submissions + submissionEntries);
+
+    ssz submitted = 0;
+    while ((u32)submitted < toSubmit && ring->SubmissionHead != ring->SubmissionTail) {
+        if (ring->CompletionTail - ring->CompletionHead >= completionEntries)
+            break;
+
+        const IORingSubmission sqe = submissions[ring->SubmissionHead & (submissionEntries - 1)];
+        s64 result = ioring_perform(sqe);
+
+        IORingCompletion& cqe = completions[ring->CompletionTail & (completionEntries - 1)];
+        cqe.UserData = sqe.UserData;
+        cqe.Result = result;
+        // Completion must be visible before the tail moves past it.
+        asm volatile ("" ::: "memory");
+        ring->CompletionTail = ring->CompletionTail + 1;
+        ring->SubmissionHead = ring->SubmissionHead + 1;
+        ++submitted;
+    }
+    return submitted;
+}
+
+/// Upper bound on the number of buffers in one readv/writev call.
+constexpr usz SYSCALL_IOV_MAX = 1024;
+
+ssz sys$19_readv(ProcessFileDescriptor fd, const IOVector* vectors, usz count) {
+    CPUState* cpu = nullptr;
+    asm volatile ("mov %%r11, %0\n"
+                  : "=r"(cpu)
+                  );
+    DBGMSG(sys$_dbgfmt, 19, "readv");
+    DBGMSG("  file descriptor: {}\n"
+           "  vectors address: {}\n"
+           "  vector count:    {}\n"
+           "\n"
+           , fd
+           , (void*) vectors
+           , count
+           );
+    // FIXME: Validate vector and buffer pointers.
+    if (!vectors || count > SYSCALL_IOV_MAX) return -1;
+
+    // Save CPU state in case read blocks, aka calls yield.
+    Process* process = Scheduler::CurrentProcess->value();
+    memcpy(&process->CPU, cpu, sizeof(CPUState));
+    process->Restartable = true;
+    ssz rc = SYSTEM->virtual_filesystem().readv(fd, vectors, count, 0);
+    process->Restartable = false;
+    return rc;
+}
+
+ssz sys$20_writev(ProcessFileDescriptor fd, const IOVector* vectors, usz count) {
+    CPUState* cpu = nullptr;
+    asm volatile ("mov %%r11, %0\n"
+                  : "=r"(cpu)
+                  );
+    DBGMSG(sys$_dbgfmt, 20, "writev");
+    DBGMSG("  file descriptor: {}\n"
+           "  vectors address: {}\n"
+           "  vector count:    {}\n"
+           "\n"
+           , fd
+           , (void*) vectors
+           , count
+           );
+    // FIXME: Validate vector and buffer pointers.
+    if (!vectors || count > SYSCALL_IOV_MAX) return -1;
+
+    // Save CPU state in case write blocks, aka calls yield.
+    memcpy(&Scheduler::CurrentProcess->value()->CPU, cpu, sizeof(CPUState));
+    return SYSTEM->virtual_filesystem().writev(fd, vectors, count, 0);
+}
+
+ssz sys$21_pread(ProcessFileDescriptor fd, u8* buffer, usz byteCount, usz offset) {
+    CPUState* cpu = nullptr;
+    asm volatile ("mov %%r11, %0\n"
+                  : "=r"(cpu)
+                  );
+    DBGMSG(sys$_dbgfmt, 21, "pread");
+    DBGMSG("  file descriptor: {}\n"
+           "  buffer address:  {}\n"
+           "  byte count:      {}\n"
+           "  offset:          {}\n"
+           "\n"
+           , fd
+           , (void*) buffer
+           , byteCount
+           , offset
+           );
+    // FIXME: Validate buffer pointer.
+
+    // Save CPU state in case read blocks, aka calls yield.
+    Process* process = Scheduler::CurrentProcess->value();
+    memcpy(&process->CPU, cpu, sizeof(CPUState));
+    process->Restartable = true;
+    ssz rc = SYSTEM->virtual_filesystem().pread(fd, buffer, byteCount, offset);
+    process->Restartable = false;
+    return rc;
+}
+
+ssz sys$22_pwrite(ProcessFileDescriptor fd, u8* buffer, usz byteCount, usz offset) {
+    CPUState* cpu = nullptr;
+    asm volatile ("mov %%r11, %0\n"
+                  : "=r"(cpu)
+                  );
+    DBGMSG(sys$_dbgfmt, 22, "pwrite");
+    DBGMSG("  file descriptor: {}\n"
+           "  buffer address:  {}\n"
+           "  byte count:      {}\n"
+           "  offset:          {}\n"
+           "\n"
+           , fd
+           , (void*) buffer
+           , byteCount
+           , offset
+           );
+    // FIXME: Validate buffer pointer.
+
+    // Save CPU state in case write blocks, aka calls yield.
+    memcpy(&Scheduler::CurrentProcess->value()->CPU, cpu, sizeof(CPUState));
+    return SYSTEM->virtual_filesystem().pwrite(fd, buffer, byteCount, offset);
+}
+
+
+/// Wait until one of `fds` is ready or `timeoutMilliseconds` elapses.
+/// A negative timeout waits forever; zero never blocks.
+/// @return Number of entries with non-zero `ReturnedEvents`, -1 on
+///         error, or -2 when woken (the caller should call again with
+///         the remaining timeout).
+ssz sys$23_poll(PollFD* fds, usz count, ssz timeoutMilliseconds) {
+    CPUState* cpu = nullptr;
+    asm volatile ("mov %%r11, %0\n"
+                  : "=r"(cpu)
+                  );
+    DBGMSG(sys$_dbgfmt, 23, "poll");
+    DBGMSG("  fds address: {}\n"
+           "  count:       {}\n"
+           "  timeout:     {}ms\n"
+           "\n"
+           , (void*) fds
+           , count
+           , timeoutMilliseconds
+           );
+    // FIXME: Validate fds pointer.
+    if ((!fds && count) || count > POLL_MAX_FDS) return -1;
+
+    Process* process = Scheduler::CurrentProcess->value();
+    VFS& vfs = SYSTEM->virtual_filesystem();
+
+    // SEE COMMENTS ON (B)LOCKING IN VFS::read()
+    auto meta_of = [&](const PollFD& pfd) -> FileMetadata* {
+        if (pfd.FD < 0) return nullptr;
+        return vfs.file(static_cast<ProcFD>(pfd.FD));
+    };
+
+    // Anything left over from the last call that woke us is stale.
+    process->WakeTick = 0;
+
+    ssz ready = 0;
+    for (usz i = 0; i < count; ++i) {
+        PollFD& pfd = fds[i];
+        pfd.ReturnedEvents = 0;
+        if (pfd.FD < 0) continue;
+        FileMetadata* meta = meta_of(pfd);
+        if (!meta) pfd.ReturnedEvents = POLL_NVAL;
+        else {
+            auto driver = meta->device_driver();
+            driver->poll_cancel(meta, process->ProcessID);
+            u16 events = driver->poll(meta);
+            pfd.ReturnedEvents = events & (pfd.Events | POLL_ERR | POLL_HUP | POLL_NVAL);
+        }
+        if (pfd.ReturnedEvents) ++ready;
+    }
+    if (ready || timeoutMilliseconds == 0) return ready;
+
+    // Nothing is ready; ask every driver to wake us, then sleep.
+    for (usz i = 0; i < count; ++i) {
+        FileMetadata* meta = meta_of(fds[i]);
+        if (meta) meta->device_driver()->poll_wait(meta, process->ProcessID);
+    }
+    if (timeoutMilliseconds > 0) {
+        u64 ticks = (u64)timeoutMilliseconds * PIT_FREQUENCY / 1000;
+        process->WakeTick = gPIT.get() + (ticks ? ticks : 1);
+    }
+
+    memcpy(&process->CPU, cpu, sizeof(CPUState));
+    process->CPU.RAX = usz(-2);
+    process->State = Process::SLEEPING;
+    Scheduler::yield();
+}
+
+/// Move up to `count` bytes from `in` to `out` within the kernel; see
+/// `VFS::sendfile`. If `offset` is not null, read from `*offset` and
+/// update it, leaving the offset of `in` alone.
+/// If the source blocks before anything was moved (i.e. an empty
+/// pipe), the process sleeps and the syscall returns -2 when woken.
+/// @return Number of bytes moved, or -1.
+ssz sys$24_sendfile(ProcessFileDescriptor out, ProcessFileDescriptor in, usz* offset, usz count) {
+    CPUState* cpu = nullptr;
+    asm volatile ("mov %%r11, %0\n"
+                  : "=r"(cpu)
+                  );
+    DBGMSG(sys$_dbgfmt, 24, "sendfile");
+    DBGMSG("  out:    {}\n"
+           "  in:     {}\n"
+           "  offset: {}\n"
+           "  count:  {}\n"
+           "\n"
+           , out
+           , in
+           , (void*) offset
+           , count
+           );
+    // FIXME: Validate offset pointer.
+
+    // Save CPU state in case read blocks, aka calls yield.
+    memcpy(&Scheduler::CurrentProcess->value()->CPU, cpu, sizeof(CPUState));
+    return SYSTEM->virtual_filesystem().sendfile(out, in, offset, count);
+}
+/// @return 0 if a directory was created at `path`, otherwise -1.
+int sys$25_mkdir(const char* path) {
+    DBGMSG(sys$_dbgfmt, 25, "mkdir");
+    // FIXME: Validate path pointer.
+    if (!path) return -1;
+    return SYSTEM->virtual_filesystem().make_directory(path) ? 0 : -1;
+}
+
+/// Fill `buffer` with packed `DirectoryEntry` records of the directory
+/// open at `fd`, as many as fit; the next call continues after them.
+/// @return Bytes filled, 0 at the end of the directory, or -1.
+ssz sys$26_getdents(ProcessFileDescriptor fd, void* buffer, usz bytes) {
+    DBGMSG(sys$_dbgfmt, 26, "getdents");
+    DBGMSG("  fd:     {}\n"
+           "  buffer: {}\n"
+           "  bytes:  {}\n"
+           "\n"
+           , fd
+           , buffer
+           , bytes
+           );
+    // FIXME: Validate buffer pointer.
+    return SYSTEM->virtual_filesystem().read_directory(fd, buffer, bytes);
+}
 
 // TODO: Reorder this
 // FIXME: Make it easier to reorder this (maybe separate the number
@@ -533,4 +876,35 @@ void* syscalls[LENSOR_OS_NUM_SYSCALLS] = {
     (void*)sys$15_pwd,
 
     (void*)sys$16_dup,
+
+    // BATCHED I/O
+    (void*)sys$17_ioring_setup,
+    (void*)sys$18_ioring_enter,
+
+    // VECTORED & POSITIONAL I/O
+    (void*)sys$19_readv,
+    (void*)sys$20_writev,
+    (void*)sys$21_pread,
+    (void*)sys$22_pwrite,
+
+    // READINESS
+    (void*)sys$23_poll,
+
+    // IN-KERNEL COPY
+    (void*)sys$24_sendfile,
+
+    (void*)sys$25_mkdir,
+    (void*)sys$26_getdents,
 };
+
+void initialize_fast_syscalls() {
+    write_msr(MSR_IA32_EFER, read_msr(MSR_IA32_EFER) | MSR_IA32_EFER_SCE);
+    // `syscall` loads CS from STAR[47:32] and SS from STAR[47:32] + 8.
+    // `sysret` loads SS from STAR[63:48] + 8 and CS from STAR[63:48] + 16.
+    write_msr(MSR_IA32_STAR, (u64)GDT_RING0_CODE << 32 | (u64)GDT_RING0_DATA << 48);
+    write_msr(MSR_IA32_LSTAR, (u64)syscall_entry_asm);
+    // Clear IF, TF, DF, and AC on entry, just like an interrupt gate would.
+    write_msr(MSR_IA32_FMASK, (1 << 9) | (1 << 8) | (1 << 10) | (1 << 18));
+    std::print("[SYS$]: Fast system calls enabled (LSTAR={:#016x})\n"
+               , (u64)syscall_entry_asm);
+}
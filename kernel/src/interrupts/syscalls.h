@@ -22,7 +22,7 @@
 
 #include <integers.h>
 
-constexpr usz LENSOR_OS_NUM_SYSCALLS = 17;
+constexpr usz LENSOR_OS_NUM_SYSCALLS = 27;
 extern void* syscalls[LENSOR_OS_NUM_SYSCALLS];
 
 // Defined in `syscalls.cpp`
@@ -31,5 +31,11 @@ extern usz num_syscalls;
 
 // Defined in `syscalls.asm`
 extern "C" void system_call_handler_asm();
+extern "C" void syscall_entry_asm();
+
+/// Enable the `syscall`/`sysret` instructions and point them at
+/// `syscall_entry_asm`. Must be called after the TSS is initialized,
+/// as the entry stub switches to the TSS RSP0 kernel stack.
+void initialize_fast_syscalls();
 
 #endif
@@ -50,6 +50,17 @@ u32 in32(u16 port) {
     return retValue;
 }
 
+void write_msr(u32 msr, u64 value) {
+    asm volatile ("wrmsr" : : "c"(msr), "a"((u32)value), "d"((u32)(value >> 32)));
+}
+
+u64 read_msr(u32 msr) {
+    u32 low;
+    u32 high;
+    asm volatile ("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((u64)high << 32) | low;
+}
+
 void io_wait() {
     // Port 0x80 -- Unused port that is safe to read/write
     asm volatile ("outb %%al, $0x80" : : "a"(0));
@@ -29,6 +29,21 @@ u16  in16  (u16 port);
 void out32 (u16 port, u32 value);
 u32  in32  (u16 port);
 
+/// Model Specific Registers
+#define MSR_IA32_EFER           0xc0000080
+#define MSR_IA32_STAR           0xc0000081
+#define MSR_IA32_LSTAR          0xc0000082
+#define MSR_IA32_FMASK          0xc0000084
+#define MSR_IA32_FS_BASE        0xc0000100
+#define MSR_IA32_GS_BASE        0xc0000101
+#define MSR_IA32_KERNEL_GS_BASE 0xc0000102
+
+/// IA32_EFER: System Call Extensions (enables SYSCALL/SYSRET).
+#define MSR_IA32_EFER_SCE (1 << 0)
+
+void write_msr (u32 msr, u64 value);
+u64  read_msr  (u32 msr);
+
 /* By writing to a port that is known to be unused,
  *   it is possible to 'delay' the CPU by a microsecond or two.
  * This is useful for 'slow' hardware (ie. RTC) that needs some
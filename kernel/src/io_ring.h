@@ -0,0 +1,93 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#ifndef LENSOR_OS_IO_RING_H
+#define LENSOR_OS_IO_RING_H
+
+#include <integers.h>
+
+/* Submission/Completion Rings
+ *
+ * A process may set up one pair of rings in memory shared with the
+ * kernel (see `sys$17_ioring_setup`). Userspace fills submission queue
+ * entries and advances `SubmissionTail`, then rings the doorbell
+ * (`sys$18_ioring_enter`). The kernel consumes entries from
+ * `SubmissionHead`, performs each operation, and posts the result to
+ * the completion queue at `CompletionTail`. Userspace consumes
+ * completions by advancing `CompletionHead`.
+ *
+ * Memory layout (starting at the address returned by setup):
+ *   IORingHeader                           (padded to IORING_HEADER_SIZE)
+ *   IORingSubmission[SubmissionEntries]
+ *   IORingCompletion[CompletionEntries]
+ *
+ * NOTE: Layout must match `user/libc/sys/io_ring.h`.
+ */
+
+#define IORING_MAX_ENTRIES 4096
+#define IORING_HEADER_SIZE 64
+
+#define IORING_OP_NOP   0
+#define IORING_OP_READ  1
+#define IORING_OP_WRITE 2
+#define IORING_OP_OPEN  3
+#define IORING_OP_CLOSE 4
+#define IORING_OP_SEEK  5
+
+struct IORingHeader {
+    /// Written by the kernel.
+    volatile u32 SubmissionHead;
+    /// Written by userspace.
+    volatile u32 SubmissionTail;
+    u32 SubmissionMask;
+    u32 SubmissionEntries;
+    /// Written by userspace.
+    volatile u32 CompletionHead;
+    /// Written by the kernel.
+    volatile u32 CompletionTail;
+    u32 CompletionMask;
+    u32 CompletionEntries;
+};
+static_assert(sizeof(IORingHeader) <= IORING_HEADER_SIZE);
+
+struct IORingSubmission {
+    /// One of IORING_OP_*
+    u8 Opcode;
+    u8 Flags;
+    u16 Reserved;
+    /// Process file descriptor operated upon (READ, WRITE, CLOSE, SEEK).
+    s32 FD;
+    /// READ/WRITE: Byte offset from the file's current offset.
+    /// SEEK: Offset to seek to (see `Length` for whence).
+    u64 Offset;
+    /// READ/WRITE: Buffer address. OPEN: NUL-terminated path.
+    u64 Address;
+    /// READ/WRITE: Byte count. SEEK: whence.
+    u64 Length;
+    /// Copied verbatim into the matching completion.
+    u64 UserData;
+};
+
+struct IORingCompletion {
+    u64 UserData;
+    /// Return value of the operation, as the equivalent syscall would.
+    s64 Result;
+};
+
+#endif /* LENSOR_OS_IO_RING_H */
@@ -50,9 +50,15 @@
 #include <random_lfsr.h>
 #include <rtc.h>
 #include <scheduler.h>
+#include <storage/device_drivers/nvme_controller.h>
+#include <storage/device_drivers/port_controller.h>
+#include <storage/device_drivers/ram_disk.h>
 #include <storage/filesystem_drivers/file_allocation_table.h>
+#include <storage/filesystem_drivers/initramfs.h>
+#include <storage/filesystem_drivers/tmpfs.h>
 #include <storage/storage_device_driver.h>
 #include <system.h>
+#include <time_page.h>
 #include <tss.h>
 #include <uart.h>
 
@@ -104,6 +110,61 @@ void draw_boot_gfx() {
     gRend.swap();
 }
 
+/// Create a device for every partition in the GPT of `disk`, if it has
+/// one, read through `driver`; its sectors are the GPT's blocks.
+/// @return Whether there was a GPT.
+static bool probe_gpt(std::shared_ptr<SystemDevice> disk, std::shared_ptr<StorageDeviceDriver> driver) {
+    if (!GPT::is_gpt_present(driver.get())) return false;
+    std::print("  GPT is present!\n");
+    const usz sectorSize = driver->sector_size();
+    GPT::Header gptHeader;
+    std::vector<u8> sector;
+    sector.resize(sectorSize);
+    driver->read_raw(sectorSize, sizeof gptHeader, &gptHeader);
+    for (u32 i = 0; i < gptHeader.NumberOfPartitionsTableEntries; ++i) {
+        u64 byteOffset = u64(gptHeader.PartitionsTableEntrySize) * i;
+        u64 partSector = gptHeader.PartitionsTableLBA + (byteOffset / sectorSize);
+        byteOffset %= sectorSize;
+        driver->read_raw(partSector * sectorSize, sectorSize, sector.data());
+        auto* part = reinterpret_cast<GPT::PartitionEntry*>(sector.data() + byteOffset);
+        if (part->should_ignore())
+            continue;
+
+        if (part->TypeGUID == GPT::NullGUID)
+            continue;
+
+        if (part->EndLBA < part->StartLBA)
+            continue;
+
+        std::print("      Partition {}: {}:\n"
+                   "        Type GUID: {}\n"
+                   "        Unique GUID: {}\n"
+                   "        Sector Offset: {}\n"
+                   "        Sector Count: {}\n"
+                   "        Attributes: {}\n",
+                   i, std::string_view((const char *)part->Name, sizeof(GPT::PartitionEntry) - 0x38),
+                   GUID(part->TypeGUID),
+                   GUID(part->UniqueGUID),
+                   u64(part->StartLBA),
+                   part->size_in_sectors(),
+                   u64(part->Attributes));
+
+
+        // Don't touch partitions with known GUIDs, except for a select few.
+        bool known = false;
+        GUID known_guid;
+        for (auto* reserved_guid = &GPT::ReservedPartitionGUIDs[0]; *reserved_guid != GPT::NullGUID; reserved_guid++) {
+            if (part->TypeGUID == *reserved_guid) {
+                known_guid = *reserved_guid;
+                known = true;
+                break;
+            }
+        }
+        if (!known) SYSTEM->create_device<Devices::GPTPartition>(disk, driver, *part);
+    }
+    return true;
+}
+
 // FXSAVE/FXRSTOR instructions require a pointer to a
 //   512-byte region of memory before use.
 u8 fxsave_region[512] __attribute__((aligned(16)));
@@ -422,12 +483,59 @@ void kstage1(BootInfo* bInfo) {
                     AHCI::HBAPort* port = &ABAR->Ports[i];
                     AHCI::PortType type = get_port_type(port);
                     if (type != AHCI::PortType::None) {
-                        SYSTEM->create_device<Devices::AHCIPort>(std::static_pointer_cast<Devices::AHCIController>(dev), type, i, port);
+                        SYSTEM->create_device<Devices::AHCIPort>(std::static_pointer_cast<Devices::AHCIController>(dev), type, i);
                     }
                 } else break;
             }
+            // Have the ports interrupt when commands complete, if the
+            // firmware routed the controller's interrupt pin to the PIC.
+            // The handler only knows about AHCI, so a line that another
+            // device already interrupts on (or the timer, whose handler
+            // comes later) is left alone, and completions are polled.
+            const u8 line = controller->Header->InterruptLine;
+            if (line < 16 && AHCI::interrupt_line() >= 16) {
+                if (line == IRQ_SYSTEM_TIMER || line == IRQ_CASCADED_PIC
+                    || gIDT.has_handler(PIC_IRQ_VECTOR_OFFSET + line))
+                {
+                    std::print("[kstage1]: AHCI controller shares IRQ {} with another device; polling for completions\n", u32(line));
+                } else {
+                    gIDT.install_handler((u64)ahci_handler, PIC_IRQ_VECTOR_OFFSET + line);
+                    gIDT.flush();
+                    AHCI::enable_interrupts(ABAR, line);
+                }
+            }
             // Don't search AHCI controller any further, already found all ports.
             dev->set_flag(SYSDEV_MAJOR_STORAGE_SEARCH, false);
+        } else if (dev->major() == SYSDEV_MAJOR_STORAGE
+                   && dev->minor() == SYSDEV_MINOR_NVME_CONTROLLER
+                   && dev->flag(SYSDEV_MAJOR_STORAGE_SEARCH) != 0)
+        {
+            std::print("[kstage1]: Probing NVMe Controller\n");
+            auto controller = std::static_pointer_cast<Devices::NVMeController>(dev);
+            // Let the controller reach memory on its own, and be reached.
+            controller->Header->Header.Command |= (1 << 1) | (1 << 2);
+
+            // Map the registers first; how far the doorbells after them
+            // go depends on what's in them.
+            auto* registers = (u8*)controller->registers();
+            Memory::map(registers, registers
+                        , (u64)Memory::PageTableFlag::Present
+                          | (u64)Memory::PageTableFlag::ReadWrite
+                          | (u64)Memory::PageTableFlag::CacheDisabled
+                        );
+            for (usz offset = PAGE_SIZE; offset < controller->Driver->register_bytes(); offset += PAGE_SIZE)
+                Memory::map(registers + offset, registers + offset
+                            , (u64)Memory::PageTableFlag::Present
+                              | (u64)Memory::PageTableFlag::ReadWrite
+                              | (u64)Memory::PageTableFlag::CacheDisabled
+                            );
+
+            if (controller->Driver->initialize()) {
+                for (auto& space : controller->Driver->namespaces())
+                    SYSTEM->create_device<Devices::NVMeNamespace>(controller, space);
+            }
+            // Every namespace has been found.
+            dev->set_flag(SYSDEV_MAJOR_STORAGE_SEARCH, false);
         }
     }
 
@@ -443,53 +551,7 @@ void kstage1(BootInfo* bInfo) {
         {
             auto port = static_cast<Devices::AHCIPort*>(dev.get());
             std::print("[kstage1]: Searching AHCI port {} for a GPT\n", port->Driver->port_number());
-            if (GPT::is_gpt_present(port->Driver.get())) {
-                std::print("  GPT is present!\n");
-                GPT::Header gptHeader;
-                u8 sector[512];
-                port->Driver->read_raw(512, sizeof gptHeader, &gptHeader);
-                for (u32 i = 0; i < gptHeader.NumberOfPartitionsTableEntries; ++i) {
-                    u64 byteOffset = gptHeader.PartitionsTableEntrySize * i;
-                    u32 partSector = gptHeader.PartitionsTableLBA + (byteOffset / 512);
-                    byteOffset %= 512;
-                    port->Driver->read_raw(partSector * 512, 512, sector);
-                    auto* part = reinterpret_cast<GPT::PartitionEntry*>(sector + byteOffset);
-                    if (part->should_ignore())
-                        continue;
-
-                    if (part->TypeGUID == GPT::NullGUID)
-                        continue;
-
-                    if (part->EndLBA < part->StartLBA)
-                        continue;
-
-                    std::print("      Partition {}: {}:\n"
-                               "        Type GUID: {}\n"
-                               "        Unique GUID: {}\n"
-                               "        Sector Offset: {}\n"
-                               "        Sector Count: {}\n"
-                               "        Attributes: {}\n",
-                               i, std::string_view((const char *)part->Name, sizeof(GPT::PartitionEntry) - 0x38),
-                               GUID(part->TypeGUID),
-                               GUID(part->UniqueGUID),
-                               u64(part->StartLBA),
-                               part->size_in_sectors(),
-                               u64(part->Attributes));
-
-
-                    // Don't touch partitions with known GUIDs, except for a select few.
-                    bool known = false;
-                    GUID known_guid;
-                    for (auto* reserved_guid = &GPT::ReservedPartitionGUIDs[0]; *reserved_guid != GPT::NullGUID; reserved_guid++) {
-                        if (part->TypeGUID == *reserved_guid) {
-                            known_guid = *reserved_guid;
-                            known = true;
-                            break;
-                        }
-                    }
-                    if (!known) SYSTEM->create_device<Devices::GPTPartition>(std::static_pointer_cast<Devices::AHCIPort>(dev), *part);
-                }
-
+            if (probe_gpt(dev, sdd(port->Cache))) {
                 /* Don't search port any further, we figured
                  * out it's storage media that is GPT partitioned
                  * and devices have been created for those
@@ -497,6 +559,14 @@ void kstage1(BootInfo* bInfo) {
                  */
                 dev->set_flag(SYSDEV_MAJOR_STORAGE_SEARCH, false);
             }
+        } else if (dev->major() == SYSDEV_MAJOR_STORAGE
+                   && dev->minor() == SYSDEV_MINOR_NVME_NAMESPACE
+                   && dev->flag(SYSDEV_MAJOR_STORAGE_SEARCH) != 0)
+        {
+            auto space = static_cast<Devices::NVMeNamespace*>(dev.get());
+            std::print("[kstage1]: Searching NVMe namespace {} for a GPT\n", space->Driver->id());
+            if (probe_gpt(dev, sdd(space->Cache)))
+                dev->set_flag(SYSDEV_MAJOR_STORAGE_SEARCH, false);
         }
     }
 
@@ -538,7 +608,7 @@ void kstage1(BootInfo* bInfo) {
                 if (controller->Driver) {
                     std::print("[kstage1]: AHCI port {}:\n", controller->Driver->port_number());
                     std::print("  Checking for valid File Allocation Table filesystem\n");
-                    if (auto FAT = FileAllocationTableDriver::try_create(sdd(controller->Driver))) {
+                    if (auto FAT = FileAllocationTableDriver::try_create(sdd(controller->Cache))) {
                         std::print("  Found valid File Allocation Table filesystem\n");
                         // TODO: Name EFI SYSTEM partition something else to make it separate from
                         // regular partitions. Eventually should probably also disallow writing to
@@ -550,11 +620,38 @@ void kstage1(BootInfo* bInfo) {
                         dev->set_flag(SYSDEV_MAJOR_STORAGE_SEARCH, false);
                     }
                 }
+            } else if (dev->minor() == SYSDEV_MINOR_NVME_NAMESPACE) {
+                auto* space = static_cast<Devices::NVMeNamespace*>(dev.get());
+                std::print("[kstage1]: NVMe namespace {}:\n", space->Driver->id());
+                std::print("  Checking for valid File Allocation Table filesystem\n");
+                if (auto FAT = FileAllocationTableDriver::try_create(sdd(space->Cache))) {
+                    std::print("  Found valid File Allocation Table filesystem\n");
+                    vfs.mount(std::format("/fs{}", vfs.mounts().size()), std::move(FAT));
+                    dev->set_flag(SYSDEV_MAJOR_STORAGE_SEARCH, false);
+                }
             }
         }
     }
 
+    // Scratch space that never touches a disk.
+    vfs.mount("/tmp", TemporaryFilesystemDriver::create());
+
+    /* The bootloader may have loaded an initrd: a ustar archive, or a
+     * raw FAT image. Whichever it is becomes the root filesystem, so
+     * the first programs start without touching a disk. It holds every
+     * path, so mount it last; mounts are searched in order.
+     */
+    if (bInfo->initrd && bInfo->initrdSize) {
+        std::print("[kstage1]: initrd of {} bytes at {}\n", bInfo->initrdSize, bInfo->initrd);
+        if (auto initramfs = InitialRamFilesystemDriver::try_create(bInfo->initrd, bInfo->initrdSize))
+            vfs.mount("/", std::move(initramfs));
+        else if (auto FAT = FileAllocationTableDriver::try_create(sdd(std::make_shared<RamDiskDriver>(bInfo->initrd, bInfo->initrdSize))))
+            vfs.mount("/", std::move(FAT));
+        else std::print("  Unrecognised initrd format, not mounting it\n");
+    }
+
     vfs.print_debug();
+    gBlockCache.print_debug();
 
     // Initialize the Programmable Interval Timer.
     gPIT = PIT();
@@ -577,10 +674,16 @@ void kstage1(BootInfo* bInfo) {
     // The Task State Segment in x86_64 is used
     // for switches between privilege levels.
     TSS::initialize();
+    initialize_fast_syscalls();
     Scheduler::initialize();
 
     if (!vfs.mounts().empty()) {
-        constexpr const char* filePath = "/fs0/bin/blazeit";
+        // Load programs from the root filesystem if there is one.
+        std::string_view programPrefix = "/fs0";
+        for (const auto& mount : vfs.mounts())
+            if (mount.Path.size() == 1 && mount.Path[0] == '/') programPrefix = "";
+
+        std::string filePath = std::format("{}/bin/blazeit", programPrefix);
         std::print("Opening {} with VFS\n", filePath);
         auto fds = vfs.open(filePath);
 
@@ -604,7 +707,7 @@ void kstage1(BootInfo* bInfo) {
         }
 
         // Another userspace program
-        constexpr const char *const programTwoFilePath = "/fs0/bin/stdout";
+        std::string programTwoFilePath = std::format("{}/bin/stdout", programPrefix);
 
         // Userspace Framebuffer
         usz fb_phys_addr = (usz)bInfo->framebuffer->BaseAddress;
@@ -660,6 +763,8 @@ void kstage1(BootInfo* bInfo) {
 
     // Initialize High Precision Event Timer.
     (void)gHPET.initialize();
+    // Calibrate clocks and populate the userspace time page.
+    Time::initialize_time_page();
     // Prepare PS2 mouse.
     init_ps2_mouse();
 
@@ -671,6 +776,7 @@ void kstage1(BootInfo* bInfo) {
     enable_interrupt(IRQ_UART_COM1);
     enable_interrupt(IRQ_REAL_TIMER);
     enable_interrupt(IRQ_PS2_MOUSE);
+    if (AHCI::interrupt_line() < 16) enable_interrupt(AHCI::interrupt_line());
 
     //Memory::print_efi_memory_map(bInfo->map, bInfo->mapSize, bInfo->mapDescSize);
     Memory::print_efi_memory_map_summed(bInfo->map, bInfo->mapSize, bInfo->mapDescSize);
@@ -209,6 +209,30 @@ namespace Memory {
         }
     }
 
+    void* physical_address(PageTable* pageMapLevelFour, void* virtualAddress) {
+        if (pageMapLevelFour == nullptr)
+            return nullptr;
+
+        PageMapIndexer indexer((u64)virtualAddress);
+        PageDirectoryEntry PDE;
+        PDE = pageMapLevelFour->entries[indexer.page_directory_pointer()];
+        if (!PDE.flag(PageTableFlag::Present)) return nullptr;
+        auto* PDP = (PageTable*)((u64)PDE.address() << 12);
+        PDE = PDP->entries[indexer.page_directory()];
+        if (!PDE.flag(PageTableFlag::Present)) return nullptr;
+        auto* PD = (PageTable*)((u64)PDE.address() << 12);
+        PDE = PD->entries[indexer.page_table()];
+        if (!PDE.flag(PageTableFlag::Present)) return nullptr;
+        auto* PT = (PageTable*)((u64)PDE.address() << 12);
+        PDE = PT->entries[indexer.page()];
+        if (!PDE.flag(PageTableFlag::Present)) return nullptr;
+        return (void*)(((u64)PDE.address() << 12) + ((u64)virtualAddress & (PAGE_SIZE - 1)));
+    }
+
+    void* physical_address(void* virtualAddress) {
+        return physical_address(active_page_map(), virtualAddress);
+    }
+
     void flush_page_map(PageTable* pageMapLevelFour) {
         asm volatile ("mov %0, %%cr3"
                       : // No outputs
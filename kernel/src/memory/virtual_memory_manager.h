@@ -92,6 +92,15 @@ namespace Memory {
                , ShowDebug d = ShowDebug::No
                );
 
+    /* Return the physical address the given virtual address is mapped
+     *   to within the given page map level four, or nullptr if it isn't.
+     */
+    void* physical_address(PageTable*, void* virtualAddress);
+    /* Return the physical address the given virtual address is mapped
+     *   to within the currently active page map level four.
+     */
+    void* physical_address(void* virtualAddress);
+
     /* Load the given address into control register three to update
      *   the virtual to physical mapping the CPU is using currently.
      */
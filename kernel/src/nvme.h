@@ -0,0 +1,147 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#ifndef LENSOR_OS_NVME_H
+#define LENSOR_OS_NVME_H
+
+#include <integers.h>
+
+/// Fields of the Capabilities register.
+#define NVME_CAP_MQES(cap)   (u32((cap) & 0xffff) + 1)
+#define NVME_CAP_DSTRD(cap)  (u32(((cap) >> 32) & 0xf))
+#define NVME_CAP_CSS_NVM     (1ull << 37)
+#define NVME_CAP_MPSMIN(cap) (u32(((cap) >> 48) & 0xf))
+
+/// Fields of the Controller Configuration register.
+#define NVME_CC_EN           (1 << 0)
+#define NVME_CC_IOSQES(n)    ((n) << 16)
+#define NVME_CC_IOCQES(n)    ((n) << 20)
+
+/// Fields of the Controller Status register.
+#define NVME_CSTS_RDY        (1 << 0)
+#define NVME_CSTS_CFS        (1 << 1)
+
+/// Doorbells follow the registers, a submission queue tail and a
+/// completion queue head for each queue, `4 << CAP.DSTRD` bytes apart.
+#define NVME_DOORBELLS 0x1000
+
+#define NVME_ADMIN_DELETE_SQ    0x00
+#define NVME_ADMIN_CREATE_SQ    0x01
+#define NVME_ADMIN_DELETE_CQ    0x04
+#define NVME_ADMIN_CREATE_CQ    0x05
+#define NVME_ADMIN_IDENTIFY     0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+#define NVME_CMD_WRITE 0x01
+#define NVME_CMD_READ  0x02
+
+/// What IDENTIFY returns, by its Controller or Namespace Structure (CNS).
+#define NVME_IDENTIFY_NAMESPACE         0x00
+#define NVME_IDENTIFY_CONTROLLER        0x01
+#define NVME_IDENTIFY_ACTIVE_NAMESPACES 0x02
+
+#define NVME_FEATURE_NUMBER_OF_QUEUES 0x07
+
+/// Queue creation flags.
+#define NVME_QUEUE_PHYSICALLY_CONTIGUOUS (1 << 0)
+
+namespace NVMe {
+
+/// The controller's registers, at the start of BAR0.
+struct Registers {
+    u64 Capabilities;
+    u32 Version;
+    u32 InterruptMaskSet;
+    u32 InterruptMaskClear;
+    u32 Configuration;
+    u32 Reserved0;
+    u32 Status;
+    u32 SubsystemReset;
+    u32 AdminQueueAttributes;
+    u64 AdminSubmissionQueue;
+    u64 AdminCompletionQueue;
+} __attribute__((packed));
+
+struct SubmissionEntry {
+    u8 Opcode;
+    u8 Flags;
+    u16 CommandID;
+    u32 NamespaceID;
+    u64 Reserved0;
+    u64 Metadata;
+    /// Physical Region Page entries: where the data is. The first may
+    /// start anywhere in a page; the second is either the next page, or
+    /// the address of a list of every page after the first.
+    u64 PRP1;
+    u64 PRP2;
+    u32 CommandDword10;
+    u32 CommandDword11;
+    u32 CommandDword12;
+    u32 CommandDword13;
+    u32 CommandDword14;
+    u32 CommandDword15;
+} __attribute__((packed));
+
+struct CompletionEntry {
+    u32 Result;
+    u32 Reserved0;
+    u16 SubmissionHead;
+    u16 SubmissionID;
+    u16 CommandID;
+    /// Bit 0 is the phase tag, which the controller inverts each time
+    /// it wraps around the queue; the rest is zero on success.
+    u16 Status;
+} __attribute__((packed));
+
+/// The start of IDENTIFY's Controller data structure.
+struct IdentifyController {
+    u16 VendorID;
+    u16 SubsystemVendorID;
+    char SerialNumber[20];
+    char ModelNumber[40];
+    char FirmwareRevision[8];
+    u8 RecommendedArbitrationBurst;
+    u8 IEEE[3];
+    u8 MultiInterfaceCapabilities;
+    /// Largest transfer, as a power of two of the minimum page size;
+    /// zero if there is no limit.
+    u8 MaximumDataTransferSize;
+    u8 Reserved0[516 - 78];
+    u32 NumberOfNamespaces;
+} __attribute__((packed));
+
+/// The start of IDENTIFY's Namespace data structure.
+struct IdentifyNamespace {
+    /// In logical blocks.
+    u64 Size;
+    u64 Capacity;
+    u64 Utilization;
+    u8 Features;
+    u8 NumberOfLBAFormats;
+    /// Low nibble: which of `LBAFormats` the namespace is formatted with.
+    u8 FormattedLBASize;
+    u8 Reserved0[128 - 27];
+    /// Metadata bytes per block in the low 16 bits, and the block size
+    /// as a power of two in the next 8.
+    u32 LBAFormats[16];
+} __attribute__((packed));
+
+}
+
+#endif /* LENSOR_OS_NVME_H */
@@ -107,6 +107,14 @@ namespace PCI {
                     SYSTEM->create_device<Devices::AHCIController>(reinterpret_cast<PCIHeader0*>(pciDevHdr));
                 }
             }
+            // Subclass 0x08 = Non-Volatile Memory Controller
+            else if (pciDevHdr->Subclass == 0x08) {
+                // ProgIF 0x02 = NVM Express
+                if (pciDevHdr->ProgIF == 0x02) {
+                    std::print("[PCI]: Found NVMe controller at {}\n", (void*)pciDevHdr);
+                    SYSTEM->create_device<Devices::NVMeController>(reinterpret_cast<PCIHeader0*>(pciDevHdr));
+                }
+            }
         }
         // Class 0x02 == Network Controller
         else if (pciDevHdr->Class == 0x02) {
@@ -21,9 +21,13 @@
 
 #include <integers.h>
 #include <io.h>
+#include <time_page.h>
 
 PIT gPIT;
-void pit_tick() { gPIT.tick(); }
+void pit_tick() {
+    gPIT.tick();
+    Time::update_time_page();
+}
 
 PIT::PIT() {
     configure_channel(Channel::Zero, Access::HighAndLow, Mode::RateGenerator, PIT_FREQUENCY);
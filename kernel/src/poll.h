@@ -0,0 +1,57 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#ifndef LENSOR_OS_POLL_H
+#define LENSOR_OS_POLL_H
+
+#include <integers.h>
+
+/* Readiness Multiplexing
+ *
+ * `sys$23_poll` asks each file's device driver which events are ready
+ * (see `StorageDeviceDriver::poll`). If none are, it registers the
+ * calling process with every driver (`poll_wait`) and sleeps until one
+ * of them wakes it, or until the timeout expires. Either way, the
+ * syscall returns -2 and userspace calls it again with whatever is
+ * left of its timeout.
+ *
+ * NOTE: Values and layout must match `user/libc/poll.h`.
+ */
+
+#define POLL_IN   0x01
+#define POLL_PRI  0x02
+#define POLL_OUT  0x04
+#define POLL_ERR  0x08
+#define POLL_HUP  0x10
+#define POLL_NVAL 0x20
+
+/// Upper bound on the number of file descriptors in one poll call.
+#define POLL_MAX_FDS 256
+
+struct PollFD {
+    /// Process file descriptor; negative entries are ignored.
+    s32 FD;
+    /// Events the caller is interested in (POLL_*).
+    u16 Events;
+    /// Events that are ready. POLL_ERR, POLL_HUP, and POLL_NVAL are
+    /// always reported, whether requested or not.
+    u16 ReturnedEvents;
+};
+
+#endif /* LENSOR_OS_POLL_H */
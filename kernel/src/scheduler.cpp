@@ -29,6 +29,8 @@
 #include <memory/physical_memory_manager.h>
 #include <memory/virtual_memory_manager.h>
 #include <pit.h>
+#include <storage/device_drivers/nvme_controller.h>
+#include <storage/device_drivers/port_controller.h>
 #include <vfs_forward.h>
 #include <system.h>
 
@@ -289,6 +291,10 @@ namespace Scheduler {
 
         // Update state of CPU that will be restored.
         memcpy(cpu, &CurrentProcess->value()->CPU, sizeof(CPUState));
+        // A process resumes from its saved state, never from inside the
+        // syscall it may have been put to sleep in; a retried syscall
+        // sets this again, anything else must not see it left over.
+        CurrentProcess->value()->Restartable = false;
 
         if (SYSTEM->cpu().fxsr_enabled() && CurrentProcess->value()->CPUExtraSet) {
             // Get 512-byte aligned address.
@@ -337,9 +343,22 @@ namespace Scheduler {
             //std::print("Saved fpu state using fxsave at {}...\n", addr);
         }
 
-        // TODO: Check all processes that called `wait(ms)`, and run/
-        // unstop them if the timestamp is greater than the calculated
-        // one.
+        // Complete finished disk requests; this may wake processes.
+        AHCI::poll_completions();
+        NVMe::poll_completions();
+
+        // Run processes that are sleeping with a timeout that has expired.
+        const u64 ticks = gPIT.get();
+        for (auto* it = ProcessQueue->head(); it; it = it->next()) {
+            Process* process = it->value();
+            if (process->State != Process::SLEEPING || !process->WakeTick)
+                continue;
+            if (ticks < process->WakeTick) continue;
+            process->WakeTick = 0;
+            // Set return value of process to retry syscall.
+            process->CPU.RAX = usz(-2);
+            process->State = Process::RUNNING;
+        }
 
         switch_process_impl(cpu);
     }
@@ -419,9 +438,8 @@ pid_t CopyUserspaceProcess(Process* original) {
     }
 
     // Copy file descriptors.
-    // FIXME: We need a better way of doing this.
-    // ProcFDs need to remain equal, while the values that they index
-    // in the sparse_vector need to be replaced with a new shared ptr.
+    // ProcFDs need to remain equal, and each one references the same
+    // open file description as in the parent (shared offset and flags).
     std::vector<ProcFD> garbage_fds_to_erase;
     for (const auto& [procfd, sysfd] : original->FileDescriptors.pairs()) {
         // In order to account for holes in the file descriptors vector
@@ -434,9 +452,8 @@ pid_t CopyUserspaceProcess(Process* original) {
             garbage_fds_to_erase.push_back(fd);
         }
 
-        auto f = SYSTEM->virtual_filesystem().file(sysfd);
-        //std::print("[FORK]: Copying \"{}\" (ProcFD {}) to process {}\n", f->name(), procfd, newProcess->ProcessID);
-        SYSTEM->virtual_filesystem().add_file(std::move(f), newProcess);
+        //std::print("[FORK]: Sharing SysFD {} (ProcFD {}) with process {}\n", sysfd, procfd, newProcess->ProcessID);
+        SYSTEM->virtual_filesystem().share(static_cast<SysFD>(sysfd), newProcess);
     }
 
     for (auto fd : garbage_fds_to_erase) {
@@ -450,6 +467,9 @@ pid_t CopyUserspaceProcess(Process* original) {
 
     newProcess->CPU = original->CPU;
     newProcess->next_region_vaddr = original->next_region_vaddr;
+    // Rings live in a memory region, so the child has its own copy at the same address.
+    newProcess->IORing = original->IORing;
+    newProcess->IORingEntries = original->IORingEntries;
     // Set child return value for `fork()`.
     newProcess->CPU.RAX = 0;
 
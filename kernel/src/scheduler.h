@@ -37,6 +37,8 @@ namespace Memory {
     class PageTable;
 }
 
+struct IORingHeader;
+
 /// Interrupt handler function found in `scheduler.asm`
 extern "C" void irq0_handler();
 
@@ -99,6 +101,24 @@ struct Process {
     /// exits, if no other process has it open.
     std::sparse_vector<SysFD, -1, ProcFD> FileDescriptors;
 
+    /// Userspace address of this process' submission/completion
+    /// rings, if any; see `io_ring.h`. The entry count is kept here
+    /// as well, as the copy in the ring header is writable by userspace.
+    IORingHeader* IORing { nullptr };
+    u32 IORingEntries { 0 };
+
+    /// While SLEEPING, wake with RAX = -2 once the PIT tick count
+    /// reaches this value. Zero means no timeout.
+    u64 WakeTick { 0 };
+
+    /// Set while the process is in a syscall that userspace retries
+    /// when it returns -2 (the read family). Drivers may then put the
+    /// process to sleep until a device request completes, rather than
+    /// waiting on the device with everything else stopped. Cleared
+    /// whenever the process is switched to, as sleeping abandons the
+    /// syscall that set it.
+    bool Restartable { false };
+
     std::string ExecutablePath { "" };
     std::string WorkingDirectory { "" };
 
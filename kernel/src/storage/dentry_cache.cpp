@@ -0,0 +1,117 @@
+/* Copyright 2022, Contributors To LensorOS.
+* All rights reserved.
+*
+* This file is part of LensorOS.
+*
+* LensorOS is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LensorOS is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LensorOS. If not, see <https://www.gnu.org/licenses
+*/
+
+#include <storage/dentry_cache.h>
+
+#include <integers.h>
+#include <memory.h>
+
+#include <format>
+#include <string_view>
+
+auto DentryCache::bucket(const FilesystemDriver* fs, u64 parent, std::string_view name) -> usz {
+    // FNV-1a over the name, mixed with the filesystem and parent.
+    u64 hash = 0xcbf29ce484222325ull;
+    for (char c : name) {
+        hash ^= u8(c);
+        hash *= 0x100000001b3ull;
+    }
+    hash ^= (u64(fs) >> 4) * 0x9e3779b97f4a7c15ull ^ parent * 0xff51afd7ed558ccdull;
+    return usz(hash ^ (hash >> 29)) % DENTRY_CACHE_BUCKETS;
+}
+
+auto DentryCache::find(const FilesystemDriver* fs, u64 parent, std::string_view name) -> Slot* {
+    for (u32 i = Buckets[bucket(fs, parent, name)]; i; i = Slots[i - 1].Next) {
+        Slot& slot = Slots[i - 1];
+        if (slot.FS == fs && slot.Parent == parent
+            && std::string_view(slot.Name, slot.NameLength) == name)
+            return &slot;
+    }
+    return nullptr;
+}
+
+void DentryCache::unlink(usz index) {
+    Slot& slot = Slots[index];
+    u32* link = &Buckets[bucket(slot.FS, slot.Parent, {slot.Name, slot.NameLength})];
+    while (*link && *link != index + 1) link = &Slots[*link - 1].Next;
+    if (*link) *link = slot.Next;
+    slot.FS = nullptr;
+    slot.Next = 0;
+    slot.Referenced = false;
+}
+
+auto DentryCache::lookup(const FilesystemDriver* fs, u64 parent, std::string_view name) -> const DentryCacheEntry* {
+    Slot* slot = find(fs, parent, name);
+    if (!slot) {
+        ++Statistics.Misses;
+        return nullptr;
+    }
+    if (slot->Entry.Negative) ++Statistics.NegativeHits;
+    else ++Statistics.Hits;
+    slot->Referenced = true;
+    return &slot->Entry;
+}
+
+void DentryCache::insert(const FilesystemDriver* fs, u64 parent, std::string_view name, const DentryCacheEntry& entry) {
+    if (name.size() > DENTRY_CACHE_NAME_MAX) return;
+    if (Slot* existing = find(fs, parent, name)) {
+        existing->Entry = entry;
+        return;
+    }
+
+    // Give every referenced slot a second chance; this terminates
+    // within one sweep as the hand clears references as it goes.
+    while (Slots[Hand].FS && Slots[Hand].Referenced) {
+        Slots[Hand].Referenced = false;
+        Hand = (Hand + 1) % DENTRY_CACHE_ENTRIES;
+    }
+    usz index = Hand;
+    Hand = (Hand + 1) % DENTRY_CACHE_ENTRIES;
+    if (Slots[index].FS) unlink(index);
+
+    Slot& slot = Slots[index];
+    u32& head = Buckets[bucket(fs, parent, name)];
+    slot.FS = fs;
+    slot.Parent = parent;
+    slot.NameLength = name.size();
+    memcpy(slot.Name, name.data(), name.size());
+    slot.Entry = entry;
+    slot.Referenced = true;
+    slot.Next = head;
+    head = u32(index + 1);
+}
+
+void DentryCache::invalidate(const FilesystemDriver* fs) {
+    ++Statistics.Invalidations;
+    for (usz i = 0; i < DENTRY_CACHE_ENTRIES; ++i)
+        if (Slots[i].FS == fs) unlink(i);
+}
+
+void DentryCache::print_debug() const {
+    std::print("  Dentry Cache:\n"
+               "    Hits:          {}\n"
+               "    Negative Hits: {}\n"
+               "    Misses:        {}\n"
+               "    Invalidations: {}\n"
+               , Statistics.Hits
+               , Statistics.NegativeHits
+               , Statistics.Misses
+               , Statistics.Invalidations
+               );
+}
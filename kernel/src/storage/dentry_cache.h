@@ -0,0 +1,96 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#ifndef LENSOR_OS_DENTRY_CACHE_H
+#define LENSOR_OS_DENTRY_CACHE_H
+
+#include <integers.h>
+
+#include <string_view>
+
+#define DENTRY_CACHE_ENTRIES 512
+#define DENTRY_CACHE_BUCKETS (DENTRY_CACHE_ENTRIES * 2)
+/// Longer path components are simply never cached.
+#define DENTRY_CACHE_NAME_MAX 64
+
+struct FilesystemDriver;
+
+/// What a filesystem found when it looked up a name in a directory.
+struct DentryCacheEntry {
+    /// The name does not exist in the directory.
+    bool Negative { false };
+    bool Directory { false };
+    /// Filesystem-specific identity of the entry (FAT: first cluster).
+    /// Used as the parent of names looked up within a directory.
+    u64 Inode { 0 };
+    u64 FileSize { 0 };
+    /// Passed as-is to the `FileMetadata` of the opened file.
+    u64 DriverData { 0 };
+};
+
+struct DentryCacheStatistics {
+    u64 Hits { 0 };
+    u64 NegativeHits { 0 };
+    u64 Misses { 0 };
+    u64 Invalidations { 0 };
+};
+
+/// Path component lookup cache, keyed by (filesystem, parent, name).
+/// Filesystems consult it for each component of a path before reading
+/// and parsing the parent directory, and fill it with what they find,
+/// including names that don't exist. A filesystem must `invalidate`
+/// its entries whenever it modifies a directory or a file's size.
+class DentryCache {
+public:
+    auto lookup(const FilesystemDriver* fs, u64 parent, std::string_view name) -> const DentryCacheEntry*;
+    void insert(const FilesystemDriver* fs, u64 parent, std::string_view name, const DentryCacheEntry& entry);
+
+    /// Forget every entry of `fs`.
+    void invalidate(const FilesystemDriver* fs);
+
+    auto statistics() const -> const DentryCacheStatistics& { return Statistics; }
+
+    void print_debug() const;
+
+private:
+    struct Slot {
+        const FilesystemDriver* FS { nullptr };
+        u64 Parent { 0 };
+        usz NameLength { 0 };
+        char Name[DENTRY_CACHE_NAME_MAX] {};
+        DentryCacheEntry Entry {};
+        /// Index + 1 of the next slot in the same bucket; 0 ends the chain.
+        u32 Next { 0 };
+        /// Second chance for CLOCK; set on every hit.
+        bool Referenced { false };
+    };
+
+    Slot Slots[DENTRY_CACHE_ENTRIES] {};
+    /// Index + 1 of the first slot in each bucket; 0 if empty.
+    u32 Buckets[DENTRY_CACHE_BUCKETS] {};
+    /// CLOCK hand.
+    usz Hand { 0 };
+    DentryCacheStatistics Statistics;
+
+    static auto bucket(const FilesystemDriver* fs, u64 parent, std::string_view name) -> usz;
+    auto find(const FilesystemDriver* fs, u64 parent, std::string_view name) -> Slot*;
+    void unlink(usz index);
+};
+
+#endif /* LENSOR_OS_DENTRY_CACHE_H */
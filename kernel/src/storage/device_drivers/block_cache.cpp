@@ -0,0 +1,365 @@
+/* Copyright 2022, Contributors To LensorOS.
+* All rights reserved.
+*
+* This file is part of LensorOS.
+*
+* LensorOS is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LensorOS is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LensorOS. If not, see <https://www.gnu.org/licenses
+*/
+
+#include <storage/device_drivers/block_cache.h>
+
+#include <integers.h>
+#include <memory.h>
+#include <memory/physical_memory_manager.h>
+#include <scheduler.h>
+
+#include <algorithm>
+#include <format>
+
+// Uncomment the following directive for extra debug information output.
+//#define DEBUG_BLOCK_CACHE
+
+#ifdef DEBUG_BLOCK_CACHE
+#   define DBGMSG(...) std::print(__VA_ARGS__)
+#else
+#   define DBGMSG(...)
+#endif
+
+BlockCache gBlockCache;
+
+auto BlockCache::bucket(const StorageDeviceDriver* device, u64 block) -> usz {
+    u64 key = (u64(device) >> 4) * 0x9e3779b97f4a7c15ull ^ block * 0xff51afd7ed558ccdull;
+    return usz(key ^ (key >> 29)) % BLOCK_CACHE_BUCKETS;
+}
+
+auto BlockCache::find(const StorageDeviceDriver* device, u64 block) -> Entry* {
+    for (u32 i = Buckets[bucket(device, block)]; i; i = Entries[i - 1].Next) {
+        Entry& entry = Entries[i - 1];
+        if (entry.Device == device && entry.Block == block) return &entry;
+    }
+    return nullptr;
+}
+
+void BlockCache::unlink(usz index) {
+    Entry& entry = Entries[index];
+    u32* link = &Buckets[bucket(entry.Device, entry.Block)];
+    while (*link && *link != index + 1) link = &Entries[*link - 1].Next;
+    if (*link) *link = entry.Next;
+    entry.Device = nullptr;
+    entry.Next = 0;
+    entry.Referenced = false;
+}
+
+auto BlockCache::lookup(const StorageDeviceDriver* device, u64 block) -> u8* {
+    Entry* entry = find(device, block);
+    if (!entry) {
+        ++Statistics.Misses;
+        return nullptr;
+    }
+    ++Statistics.Hits;
+    entry->Referenced = true;
+    return entry->Data;
+}
+
+auto BlockCache::peek(const StorageDeviceDriver* device, u64 block) -> u8* {
+    Entry* entry = find(device, block);
+    return entry ? entry->Data : nullptr;
+}
+
+auto BlockCache::insert(const StorageDeviceDriver* device, u64 block) -> u8* {
+    if (Entry* existing = find(device, block)) return existing->Data;
+
+    usz index = 0;
+    if (Used < BLOCK_CACHE_BLOCKS) {
+        index = Used;
+        Entries[index].Data = static_cast<u8*>(Memory::request_page());
+        if (!Entries[index].Data) return nullptr;
+        ++Used;
+    } else {
+        // Give every referenced block a second chance; this terminates
+        // within one sweep as the hand clears references as it goes.
+        while (Entries[Hand].Device && Entries[Hand].Referenced) {
+            Entries[Hand].Referenced = false;
+            Hand = (Hand + 1) % BLOCK_CACHE_BLOCKS;
+        }
+        index = Hand;
+        Hand = (Hand + 1) % BLOCK_CACHE_BLOCKS;
+        if (Entries[index].Device) {
+            DBGMSG("[BCACHE]: Evicting block {} of {}\n", Entries[index].Block, (void*)Entries[index].Device);
+            unlink(index);
+            ++Statistics.Evictions;
+        }
+    }
+
+    Entry& entry = Entries[index];
+    u32& head = Buckets[bucket(device, block)];
+    entry.Device = device;
+    entry.Block = block;
+    entry.Referenced = true;
+    entry.Next = head;
+    head = u32(index + 1);
+    return entry.Data;
+}
+
+void BlockCache::invalidate(const StorageDeviceDriver* device) {
+    for (usz i = 0; i < Used; ++i)
+        if (Entries[i].Device == device) unlink(i);
+}
+
+void BlockCache::print_debug() const {
+    u64 lookups = Statistics.Hits + Statistics.Misses;
+    std::print("[BCACHE]: {} of {} blocks in use\n"
+               "  Hits:      {}\n"
+               "  Misses:    {}\n"
+               "  Hit Rate:  {}%\n"
+               "  Evictions: {}\n"
+               , Used
+               , BLOCK_CACHE_BLOCKS
+               , Statistics.Hits
+               , Statistics.Misses
+               , lookups ? Statistics.Hits * 100 / lookups : 0
+               , Statistics.Evictions
+               );
+}
+
+BlockCacheDriver::BlockCacheDriver(std::shared_ptr<StorageDeviceDriver> driver)
+    : Driver(std::move(driver))
+    , Scratch(static_cast<u8*>(Memory::request_pages(BLOCK_CACHE_MAX_RUN * BLOCK_CACHE_BLOCK_SIZE / PAGE_SIZE))) {}
+
+BlockCacheDriver::~BlockCacheDriver() {
+    gBlockCache.invalidate(Driver.get());
+    if (Scratch) Memory::free_pages(Scratch, BLOCK_CACHE_MAX_RUN * BLOCK_CACHE_BLOCK_SIZE / PAGE_SIZE);
+}
+
+auto BlockCacheDriver::pending(u64 block) -> PendingRead* {
+    for (PendingRead* p = Pending; p; p = p->Next)
+        if (block >= p->Block && block < p->Block + p->Blocks) return p;
+    return nullptr;
+}
+
+bool BlockCacheDriver::read_async(u64 block, usz blocks, u64 pid) {
+    const usz sectorsPerBlock = BLOCK_CACHE_BLOCK_SIZE / Driver->sector_size();
+    auto* data = Memory::request_pages(blocks * BLOCK_CACHE_BLOCK_SIZE / PAGE_SIZE);
+    if (!data) return false;
+
+    auto* p = new PendingRead;
+    p->Cache = this;
+    p->Block = block;
+    p->Blocks = blocks;
+    p->Vector = { data, blocks * BLOCK_CACHE_BLOCK_SIZE };
+    if (pid != BLOCK_CACHE_NO_WAITER) p->PIDsWaiting.push_back(pid);
+    p->Request.Op = StorageRequest::Operation::READ;
+    p->Request.LBA = block * sectorsPerBlock;
+    p->Request.Sectors = blocks * sectorsPerBlock;
+    if (const u64 sectors = Driver->sector_count(); sectors && p->Request.LBA + p->Request.Sectors > sectors) {
+        p->Request.Sectors = sectors - p->Request.LBA;
+        const usz transfer = p->Request.Sectors * Driver->sector_size();
+        memset(static_cast<u8*>(data) + transfer, 0, blocks * BLOCK_CACHE_BLOCK_SIZE - transfer);
+    }
+    p->Request.Vectors = &p->Vector;
+    p->Request.VectorCount = 1;
+    p->Request.Completion = finish;
+    p->Request.Context = p;
+    p->Next = Pending;
+    Pending = p;
+
+    DBGMSG("[BCACHE]: Reading {} blocks at block {} for process {}\n", blocks, block, pid);
+    if (Driver->submit(&p->Request)) return true;
+
+    Pending = p->Next;
+    Memory::free_pages(data, blocks * BLOCK_CACHE_BLOCK_SIZE / PAGE_SIZE);
+    delete p;
+    return false;
+}
+
+auto BlockCacheDriver::device_bytes() -> u64 {
+    const u64 sectors = Driver->sector_count();
+    return sectors ? sectors * Driver->sector_size() : u64(-1);
+}
+
+void BlockCacheDriver::finish(StorageRequest* request) {
+    auto* p = static_cast<PendingRead*>(request->Context);
+    BlockCacheDriver* cache = p->Cache;
+    PendingRead** link = &cache->Pending;
+    while (*link && *link != p) link = &(*link)->Next;
+    if (*link) *link = p->Next;
+
+    auto* data = static_cast<u8*>(p->Vector.Base);
+    if (request->Result >= 0 && !p->Stale) {
+        const StorageDeviceDriver* device = cache->Driver.get();
+        for (usz i = 0; i < p->Blocks; ++i) {
+            // Anything cached meanwhile is at least as recent.
+            if (gBlockCache.peek(device, p->Block + i)) continue;
+            if (u8* slot = gBlockCache.insert(device, p->Block + i))
+                memcpy(slot, data + i * BLOCK_CACHE_BLOCK_SIZE, BLOCK_CACHE_BLOCK_SIZE);
+        }
+    }
+
+    // Wake everyone to retry their read, or fail it if the device did.
+    for (u64 pid : p->PIDsWaiting) {
+        auto* process = Scheduler::process(pid);
+        if (!process) continue;
+        process->CPU.RAX = request->Result < 0 ? usz(-1) : usz(-2);
+        process->State = Process::RUNNING;
+    }
+
+    Memory::free_pages(data, p->Blocks * BLOCK_CACHE_BLOCK_SIZE / PAGE_SIZE);
+    delete p;
+}
+
+ssz BlockCacheDriver::read(FileMetadata*, usz offs, usz byteCount, void* buffer) {
+    const u64 end = device_bytes();
+    if (offs >= end) return 0;
+    byteCount = usz(std::min(u64(byteCount), end - offs));
+
+    Process* process = Scheduler::CurrentProcess ? Scheduler::CurrentProcess->value() : nullptr;
+    if (!process || !process->Restartable || !byteCount || byteCount > BLOCK_CACHE_MAX_ASYNC_READ
+        || Driver->sector_size() > BLOCK_CACHE_BLOCK_SIZE)
+        return read_raw(offs, byteCount, buffer);
+
+    // Start reading every missing block at once, so the device gets
+    // them as one batch, and sleep until the first of them are read.
+    bool waiting = false;
+    Driver->plug();
+    const u64 last = (offs + byteCount - 1) / BLOCK_CACHE_BLOCK_SIZE;
+    for (u64 block = offs / BLOCK_CACHE_BLOCK_SIZE; block <= last; ++block) {
+        if (gBlockCache.peek(Driver.get(), block)) continue;
+
+        // Set state to SLEEPING before submitting, in case the request
+        // completes (and wakes us) right away.
+        process->State = Process::SLEEPING;
+        if (PendingRead* p = pending(block)) {
+            if (std::find(p->PIDsWaiting.begin(), p->PIDsWaiting.end(), process->ProcessID) == p->PIDsWaiting.end())
+                p->PIDsWaiting.push_back(process->ProcessID);
+            block = p->Block + p->Blocks - 1;
+        } else {
+            usz run = 1;
+            while (block + run <= last && run < BLOCK_CACHE_MAX_RUN
+                   && !gBlockCache.peek(Driver.get(), block + run)
+                   && !pending(block + run))
+                ++run;
+            if (!read_async(block, run, process->ProcessID)) break;
+            block += run - 1;
+        }
+        waiting = true;
+    }
+    Driver->unplug();
+
+    // The syscall is retried once woken.
+    if (waiting) Scheduler::yield();
+    process->State = Process::RUNNING;
+    return read_raw(offs, byteCount, buffer);
+}
+
+ssz BlockCacheDriver::read_raw(usz offs, usz byteCount, void* buffer) {
+    if (!buffer || !Scratch) return -1;
+    const u64 end = device_bytes();
+    if (offs >= end) return 0;
+    byteCount = usz(std::min(u64(byteCount), end - offs));
+
+    auto* out = static_cast<u8*>(buffer);
+    u64 block = offs / BLOCK_CACHE_BLOCK_SIZE;
+    usz within = offs % BLOCK_CACHE_BLOCK_SIZE;
+    usz remaining = byteCount;
+    while (remaining) {
+        if (u8* data = gBlockCache.lookup(Driver.get(), block)) {
+            usz chunk = std::min(BLOCK_CACHE_BLOCK_SIZE - within, remaining);
+            memcpy(out, data + within, chunk);
+            out += chunk;
+            remaining -= chunk;
+            within = 0;
+            ++block;
+            continue;
+        }
+
+        // Read as many consecutive uncached blocks as this request
+        // needs in one go, rather than one device request per block.
+        usz needed = (within + remaining + BLOCK_CACHE_BLOCK_SIZE - 1) / BLOCK_CACHE_BLOCK_SIZE;
+        usz run = 1;
+        while (run < needed && run < BLOCK_CACHE_MAX_RUN && !gBlockCache.peek(Driver.get(), block + run))
+            ++run;
+
+        const usz runBytes = run * BLOCK_CACHE_BLOCK_SIZE;
+        const usz transfer = usz(std::min(u64(runBytes), end - block * BLOCK_CACHE_BLOCK_SIZE));
+        if (Driver->read_raw(block * BLOCK_CACHE_BLOCK_SIZE, transfer, Scratch) != ssz(transfer)) {
+            DBGMSG("[BCACHE]: Failed to read {} blocks at block {}\n", run, block);
+            return -1;
+        }
+        memset(Scratch + transfer, 0, runBytes - transfer);
+        for (usz i = 0; i < run; ++i)
+            if (u8* slot = gBlockCache.insert(Driver.get(), block + i))
+                memcpy(slot, Scratch + i * BLOCK_CACHE_BLOCK_SIZE, BLOCK_CACHE_BLOCK_SIZE);
+
+        usz chunk = std::min(runBytes - within, remaining);
+        memcpy(out, Scratch + within, chunk);
+        out += chunk;
+        remaining -= chunk;
+        within = 0;
+        block += run;
+    }
+    return ssz(byteCount);
+}
+
+IOVector BlockCacheDriver::borrow(FileMetadata*, usz offs, usz byteCount) {
+    u8* data = gBlockCache.lookup(Driver.get(), offs / BLOCK_CACHE_BLOCK_SIZE);
+    if (!data) return { nullptr, 0 };
+    usz within = offs % BLOCK_CACHE_BLOCK_SIZE;
+    return { data + within, std::min(BLOCK_CACHE_BLOCK_SIZE - within, byteCount) };
+}
+
+void BlockCacheDriver::prefetch(FileMetadata*, usz offs, usz byteCount) {
+    const u64 end = device_bytes();
+    if (offs >= end) return;
+    byteCount = usz(std::min(u64(byteCount), end - offs));
+    if (!byteCount || Driver->sector_size() > BLOCK_CACHE_BLOCK_SIZE) return;
+    Driver->plug();
+    const u64 last = (offs + byteCount - 1) / BLOCK_CACHE_BLOCK_SIZE;
+    for (u64 block = offs / BLOCK_CACHE_BLOCK_SIZE; block <= last; ++block) {
+        if (gBlockCache.peek(Driver.get(), block) || pending(block)) continue;
+        usz run = 1;
+        while (block + run <= last && run < BLOCK_CACHE_MAX_RUN
+               && !gBlockCache.peek(Driver.get(), block + run)
+               && !pending(block + run))
+            ++run;
+        // A device that can't do it asynchronously won't do it at all;
+        // reading now would only make this read slower.
+        if (!read_async(block, run, BLOCK_CACHE_NO_WAITER)) break;
+        block += run - 1;
+    }
+    Driver->unplug();
+}
+
+ssz BlockCacheDriver::write(FileMetadata* file, usz offs, usz byteCount, void* buffer) {
+    ssz written = Driver->write(file, offs, byteCount, buffer);
+    if (written <= 0) return written;
+
+    // Keep cached copies of the blocks just written in sync.
+    auto* in = static_cast<const u8*>(buffer);
+    u64 block = offs / BLOCK_CACHE_BLOCK_SIZE;
+    const u64 last = (offs + usz(written) - 1) / BLOCK_CACHE_BLOCK_SIZE;
+    for (PendingRead* p = Pending; p; p = p->Next)
+        if (p->Block <= last && block < p->Block + p->Blocks) p->Stale = true;
+    usz within = offs % BLOCK_CACHE_BLOCK_SIZE;
+    usz remaining = usz(written);
+    while (remaining) {
+        usz chunk = std::min(BLOCK_CACHE_BLOCK_SIZE - within, remaining);
+        if (u8* data = gBlockCache.peek(Driver.get(), block))
+            memcpy(data + within, in, chunk);
+        in += chunk;
+        remaining -= chunk;
+        within = 0;
+        ++block;
+    }
+    return written;
+}
@@ -0,0 +1,165 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#ifndef LENSOR_OS_BLOCK_CACHE_H
+#define LENSOR_OS_BLOCK_CACHE_H
+
+#include <integers.h>
+#include <memory/common.h>
+#include <storage/storage_device_driver.h>
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#define BLOCK_CACHE_BLOCK_SIZE PAGE_SIZE
+#define BLOCK_CACHE_BLOCKS 1024
+#define BLOCK_CACHE_BUCKETS (BLOCK_CACHE_BLOCKS * 2)
+/// Longest run of uncached blocks read from a device in one request.
+#define BLOCK_CACHE_MAX_RUN 32
+/// Largest read that may sleep while its blocks are fetched. Each time
+/// the reader wakes it starts over, so everything fetched for it before
+/// must still be cached by then.
+#define BLOCK_CACHE_MAX_ASYNC_READ (BLOCK_CACHE_BLOCKS / 4 * BLOCK_CACHE_BLOCK_SIZE)
+/// Passed to `read_async` for reads that no process waits on.
+#define BLOCK_CACHE_NO_WAITER u64(-1)
+
+struct BlockCacheStatistics {
+    u64 Hits { 0 };
+    u64 Misses { 0 };
+    u64 Evictions { 0 };
+};
+
+/// A fixed-size pool of blocks shared by every cached device, keyed
+/// by (device, block number) and evicted with the CLOCK algorithm.
+/// Pages backing the blocks are only allocated as the cache fills up.
+///
+/// NOTE: Everything is zero-initialised on purpose, so this works as a
+/// global without relying on constructors having run.
+class BlockCache {
+public:
+    /// Return the cached data of `block` on `device`, or nullptr.
+    /// Counts a hit or a miss.
+    auto lookup(const StorageDeviceDriver* device, u64 block) -> u8*;
+
+    /// Like `lookup`, but doesn't affect statistics or eviction.
+    auto peek(const StorageDeviceDriver* device, u64 block) -> u8*;
+
+    /// Return a slot for `block` on `device`, evicting another block if
+    /// the cache is full. The caller must fill the returned block.
+    /// @return nullptr if memory for a new block couldn't be allocated.
+    auto insert(const StorageDeviceDriver* device, u64 block) -> u8*;
+
+    /// Forget every block cached for `device`.
+    void invalidate(const StorageDeviceDriver* device);
+
+    auto statistics() const -> const BlockCacheStatistics& { return Statistics; }
+
+    void print_debug() const;
+
+private:
+    struct Entry {
+        const StorageDeviceDriver* Device { nullptr };
+        u64 Block { 0 };
+        u8* Data { nullptr };
+        /// Index + 1 of the next entry in the same bucket; 0 ends the chain.
+        u32 Next { 0 };
+        /// Second chance for CLOCK; set on every hit.
+        bool Referenced { false };
+    };
+
+    Entry Entries[BLOCK_CACHE_BLOCKS];
+    /// Index + 1 of the first entry in each bucket; 0 if empty.
+    u32 Buckets[BLOCK_CACHE_BUCKETS];
+    /// Entries [0, Used) have had a page allocated for them.
+    usz Used { 0 };
+    /// CLOCK hand.
+    usz Hand { 0 };
+    BlockCacheStatistics Statistics;
+
+    static auto bucket(const StorageDeviceDriver* device, u64 block) -> usz;
+    auto find(const StorageDeviceDriver* device, u64 block) -> Entry*;
+    void unlink(usz index);
+};
+
+extern BlockCache gBlockCache;
+
+/// Sits between a block device and its consumers (partitions,
+/// filesystems), serving reads from `gBlockCache` where possible.
+/// Writes go straight through to the device and update any cached
+/// copies of the blocks written.
+///
+/// When the device supports `submit()` and the reading process may
+/// sleep (see `Process::Restartable`), blocks missing from the cache
+/// are fetched asynchronously while the process sleeps, all of them as
+/// one batch. Once woken it retries the read, which then finds them
+/// cached (or goes back to sleep on those that still aren't).
+struct BlockCacheDriver final : StorageDeviceDriver {
+    explicit BlockCacheDriver(std::shared_ptr<StorageDeviceDriver> driver);
+    ~BlockCacheDriver() override;
+
+    void close(FileMetadata* file) final { Driver->close(file); }
+    auto open(std::string_view name) -> std::shared_ptr<FileMetadata> final { return Driver->open(name); }
+
+    ssz read(FileMetadata*, usz offs, usz byteCount, void* buffer) final;
+    ssz read_raw(usz offs, usz byteCount, void* buffer) final;
+    ssz write(FileMetadata* file, usz offs, usz byteCount, void* buffer) final;
+    IOVector borrow(FileMetadata*, usz offs, usz byteCount) final;
+    /// Read the uncached blocks asynchronously, with nobody waiting.
+    void prefetch(FileMetadata*, usz offs, usz byteCount) final;
+    void plug() final { Driver->plug(); }
+    void unplug() final { Driver->unplug(); }
+    auto sector_size() -> usz final { return Driver->sector_size(); }
+    auto sector_count() -> u64 final { return Driver->sector_count(); }
+
+private:
+    /// A run of uncached blocks being read into `Vector` for processes
+    /// sleeping on it.
+    struct PendingRead {
+        StorageRequest Request;
+        IOVector Vector;
+        BlockCacheDriver* Cache { nullptr };
+        u64 Block { 0 };
+        usz Blocks { 0 };
+        std::vector<u64> PIDsWaiting;
+        /// Set when the blocks are written while being read; the data
+        /// read is then out of date and must not be cached.
+        bool Stale { false };
+        PendingRead* Next { nullptr };
+    };
+
+    std::shared_ptr<StorageDeviceDriver> Driver { nullptr };
+    /// BLOCK_CACHE_MAX_RUN blocks to read runs of uncached blocks into.
+    u8* Scratch { nullptr };
+    PendingRead* Pending { nullptr };
+
+    auto pending(u64 block) -> PendingRead*;
+    /// Bytes on the device, or u64(-1) if it doesn't say. The last
+    /// block may lie partly past the end; only what's on the device is
+    /// read of it, and the rest is cached as zeroes.
+    auto device_bytes() -> u64;
+    /// Start reading `blocks` blocks from `block` for process `pid`, or
+    /// for no one if `pid` is BLOCK_CACHE_NO_WAITER (readahead).
+    /// @return false if the device couldn't take the request.
+    bool read_async(u64 block, usz blocks, u64 pid);
+    /// Completion of a `PendingRead`'s request.
+    static void finish(StorageRequest*);
+};
+
+#endif /* LENSOR_OS_BLOCK_CACHE_H */
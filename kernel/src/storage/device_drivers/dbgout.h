@@ -35,6 +35,18 @@ struct DbgOutDriver final : StorageDeviceDriver {
         dbgmsg_buf(reinterpret_cast<u8*>(buffer) + offs, bytes);
         return ssz(bytes);
     };
+    /// `write` treats `offs` as an offset into `buffer`, so the default
+    /// (which advances `offs` per buffer) would skip data here.
+    ssz writev(FileMetadata*, usz, const IOVector* vectors, usz count) final {
+        ssz total = 0;
+        for (usz i = 0; i < count; ++i) {
+            dbgmsg_buf(reinterpret_cast<u8*>(vectors[i].Base), vectors[i].Length);
+            total += ssz(vectors[i].Length);
+        }
+        return total;
+    }
+    /// Writes never block and there is nothing to read.
+    u16 poll(FileMetadata*) final { return POLL_OUT; }
 };
 
 #endif /* LENSOR_OS_DBGOUT_DRIVER_H */
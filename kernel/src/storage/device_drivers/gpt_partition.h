@@ -48,6 +48,22 @@ struct GPTPartitionDriver final : StorageDeviceDriver {
         return Driver->write(file, offs + Offset, byteCount, buffer);
     }
 
+    ssz readv(FileMetadata* file, usz offs, const IOVector* vectors, usz count) final {
+        return Driver->readv(file, offs + Offset, vectors, count);
+    }
+    ssz writev(FileMetadata* file, usz offs, const IOVector* vectors, usz count) final {
+        return Driver->writev(file, offs + Offset, vectors, count);
+    }
+    IOVector borrow(FileMetadata* file, usz offs, usz byteCount) final {
+        return Driver->borrow(file, offs + Offset, byteCount);
+    }
+    void prefetch(FileMetadata* file, usz offs, usz byteCount) final {
+        Driver->prefetch(file, offs + Offset, byteCount);
+    }
+    void plug() final { Driver->plug(); }
+    void unplug() final { Driver->unplug(); }
+    auto sector_size() -> usz final { return Driver->sector_size(); }
+
     GUID type_guid() { return Type; }
     GUID unique_guid() { return Unique; }
 
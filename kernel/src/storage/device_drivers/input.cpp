@@ -19,10 +19,12 @@
 
 #include <storage/device_drivers/input.h>
 
+#include <scheduler.h>
 #include <storage/file_metadata.h>
 #include <system.h>
 #include <virtual_filesystem.h>
 
+#include <algorithm>
 #include <string_view>
 #include <memory>
 
@@ -44,3 +46,22 @@ std::shared_ptr<FileMetadata> InputDriver::open(std::string_view path) {
     InputBuffers.push_back({f, path, input});
     return f;
 }
+
+void InputDriver::poll_wait(FileMetadata*, u64 pid) {
+    if (std::find(PIDsPolling.begin(), PIDsPolling.end(), pid) == PIDsPolling.end())
+        PIDsPolling.push_back(pid);
+}
+
+void InputDriver::poll_cancel(FileMetadata*, u64 pid) {
+    PIDsPolling.erase(std::remove(PIDsPolling.begin(), PIDsPolling.end(), pid), PIDsPolling.end());
+}
+
+void InputDriver::wake_pollers() {
+    for (u64 pid : PIDsPolling) {
+        auto* process = Scheduler::process(pid);
+        if (!process) continue;
+        process->CPU.RAX = usz(-2);
+        process->State = Process::RUNNING;
+    }
+    PIDsPolling.clear();
+}
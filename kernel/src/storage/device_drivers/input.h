@@ -119,12 +119,32 @@ struct InputDriver final : StorageDeviceDriver {
         }
         memcpy(input->Data + input->Offset, buffer, bytes);
         input->Offset += bytes;
+        if (bytes) wake_pollers();
         return ssz(bytes);
     }
 
+    u16 poll(FileMetadata* file) final {
+        if (!file) return POLL_NVAL;
+        auto* input = static_cast<InputBuffer*>(file->driver_data());
+        if (!input) return POLL_NVAL;
+        u16 events = 0;
+        if (input->Offset) events |= POLL_IN;
+        if (input->Offset < INPUT_BUFSZ) events |= POLL_OUT;
+        return events;
+    }
+
+    void poll_wait(FileMetadata*, u64 pid) final;
+    void poll_cancel(FileMetadata*, u64 pid) final;
+
 private:
     std::vector<NamedInputBuffer> InputBuffers;
     std::vector<InputBuffer*> FreeInputBuffers;
+    /// Processes in `poll` on any input buffer. Input is rare enough
+    /// that waking all of them on every write is cheaper than tracking
+    /// waiters per buffer (which would also grow `InputBuffer`).
+    std::vector<u64> PIDsPolling;
+
+    void wake_pollers();
 };
 
 #undef DBGMSG
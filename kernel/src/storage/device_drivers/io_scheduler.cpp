@@ -0,0 +1,280 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#include <storage/device_drivers/io_scheduler.h>
+
+#include <integers.h>
+#include <interrupts/interrupts.h>
+#include <memory.h>
+#include <memory/virtual_memory_manager.h>
+#include <pit.h>
+
+#include <algorithm>
+#include <format>
+
+// Uncomment the following directive for extra debug information output.
+//#define DEBUG_IO_SCHEDULER
+
+#ifdef DEBUG_IO_SCHEDULER
+#   define DBGMSG(...) std::print(__VA_ARGS__)
+#else
+#   define DBGMSG(...)
+#endif
+
+static auto expire_ticks(StorageRequest::Operation op) -> u64 {
+    const u64 ms = op == StorageRequest::Operation::WRITE
+        ? IO_SCHEDULER_WRITE_EXPIRE_MS
+        : IO_SCHEDULER_READ_EXPIRE_MS;
+    return (ms * PIT_FREQUENCY + 999) / 1000;
+}
+
+/// Append `bytes` of the buffers of `request`, starting `offset` bytes
+/// into them, to `out`.
+static void append_vectors(std::vector<IOVector>& out, const StorageRequest& request, usz offset, usz bytes) {
+    for (usz i = 0; i < request.VectorCount && bytes; ++i) {
+        const IOVector& vector = request.Vectors[i];
+        if (offset >= vector.Length) {
+            offset -= vector.Length;
+            continue;
+        }
+        const usz chunk = std::min(vector.Length - offset, bytes);
+        out.push_back({ static_cast<u8*>(vector.Base) + offset, chunk });
+        offset = 0;
+        bytes -= chunk;
+    }
+}
+
+/// Copy `bytes` from `from`, starting `offset` bytes into it, to the
+/// start of `to`.
+static void copy_vectors(const StorageRequest& to, const std::vector<IOVector>& from, usz offset, usz bytes) {
+    usz f = 0;
+    while (f < from.size() && offset >= from[f].Length) offset -= from[f++].Length;
+    for (usz t = 0; t < to.VectorCount && f < from.size() && bytes; ++t) {
+        auto* out = static_cast<u8*>(to.Vectors[t].Base);
+        usz room = to.Vectors[t].Length;
+        while (room && f < from.size() && bytes) {
+            const usz chunk = std::min(std::min(room, from[f].Length - offset), bytes);
+            memcpy(out, static_cast<const u8*>(from[f].Base) + offset, chunk);
+            out += chunk;
+            room -= chunk;
+            bytes -= chunk;
+            offset += chunk;
+            if (offset == from[f].Length) {
+                offset = 0;
+                ++f;
+            }
+        }
+    }
+}
+
+static bool overlap(const StorageRequest& a, const StorageRequest& b) {
+    return a.LBA < b.LBA + b.Sectors && b.LBA < a.LBA + a.Sectors;
+}
+
+bool IOScheduler::submit(StorageRequest* request) {
+    if (!request || !request->Sectors) return false;
+    if (request->VectorCount && !request->Vectors) return false;
+
+    InterruptsMasked masked;
+    if (!request->PageMap) request->PageMap = Memory::active_page_map();
+    request->Result = 0;
+    request->Done = false;
+
+    usz at = Waiting.size();
+    while (at && Waiting[at - 1].Request->LBA > request->LBA) --at;
+    Waiting.insert(Waiting.begin() + at, Queued{ request, gPIT.get() + expire_ticks(request->Op), Submitted++ });
+
+    // With nothing to merge it with, it goes straight to the device,
+    // which also tells whether the device can take it at all.
+    if (!Plugs && Dispatched < IO_SCHEDULER_MAX_DISPATCHED && Waiting.size() == 1) {
+        if (issue(0, 0)) return true;
+        Waiting.clear();
+        return false;
+    }
+    dispatch();
+    return true;
+}
+
+void IOScheduler::plug() {
+    InterruptsMasked masked;
+    ++Plugs;
+}
+
+void IOScheduler::unplug() {
+    InterruptsMasked masked;
+    if (!Plugs || --Plugs) return;
+    DBGMSG("[IOSCHED]: Unplugged with {} requests waiting\n", Waiting.size());
+    dispatch();
+}
+
+bool IOScheduler::blocked(usz i) const {
+    const Queued& queued = Waiting[i];
+    const bool write = queued.Request->Op == StorageRequest::Operation::WRITE;
+    for (const Queued& other : Waiting) {
+        if (other.Sequence >= queued.Sequence || !overlap(*other.Request, *queued.Request)) continue;
+        if (write || other.Request->Op == StorageRequest::Operation::WRITE) return true;
+    }
+    return false;
+}
+
+auto IOScheduler::pick() const -> usz {
+    // The oldest request is never blocked, and goes first once it has
+    // waited long enough.
+    usz oldest = 0;
+    for (usz i = 1; i < Waiting.size(); ++i)
+        if (Waiting[i].Sequence < Waiting[oldest].Sequence) oldest = i;
+    if (Waiting[oldest].Deadline <= gPIT.get()) return oldest;
+
+    // Otherwise, the first one at or past the head; if there is none,
+    // the head starts over from the lowest one.
+    usz lowest = Waiting.size();
+    for (usz i = 0; i < Waiting.size(); ++i) {
+        if (blocked(i)) continue;
+        if (Waiting[i].Request->LBA >= Head) return i;
+        if (lowest == Waiting.size()) lowest = i;
+    }
+    return lowest == Waiting.size() ? oldest : lowest;
+}
+
+void IOScheduler::dispatch() {
+    const u64 maxSectors = IO_SCHEDULER_MAX_MERGE / Driver->sector_size();
+    while (!Plugs && Dispatched < IO_SCHEDULER_MAX_DISPATCHED && !Waiting.empty()) {
+        const usz at = pick();
+        const StorageRequest& picked = *Waiting[at].Request;
+        u64 start = picked.LBA;
+        u64 end = picked.LBA + picked.Sectors;
+
+        // Whatever waiting requests are next to it (or, for reads, cover
+        // some of the same sectors) go with it, unless they're to wait.
+        auto mergeable = [&](usz i) {
+            const StorageRequest& request = *Waiting[i].Request;
+            if (request.Op != picked.Op || request.PageMap != picked.PageMap || blocked(i)) return false;
+            const u64 first = std::min(start, request.LBA);
+            const u64 last = std::max(end, request.LBA + request.Sectors);
+            if (last - first > maxSectors) return false;
+            if (picked.Op == StorageRequest::Operation::WRITE)
+                return request.LBA + request.Sectors == start || request.LBA == end;
+            return request.LBA <= end && request.LBA + request.Sectors >= start;
+        };
+        usz first = at;
+        usz last = at;
+        while (first && mergeable(first - 1)) {
+            --first;
+            start = std::min(start, Waiting[first].Request->LBA);
+            end = std::max(end, Waiting[first].Request->LBA + Waiting[first].Request->Sectors);
+        }
+        while (last + 1 < Waiting.size() && mergeable(last + 1)) {
+            ++last;
+            end = std::max(end, Waiting[last].Request->LBA + Waiting[last].Request->Sectors);
+        }
+
+        if (issue(first, last)) continue;
+        // The device won't take it; there's nothing else it can go to.
+        for (usz i = first; i <= last; ++i) {
+            StorageRequest* request = Waiting[i].Request;
+            request->Result = -1;
+            request->Done = true;
+            if (request->Completion) request->Completion(request);
+        }
+        Waiting.erase(Waiting.begin() + first, Waiting.begin() + last + 1);
+    }
+}
+
+bool IOScheduler::issue(usz first, usz last) {
+    const usz sectorSize = Driver->sector_size();
+    auto* dispatch = new Dispatch;
+    dispatch->Scheduler = this;
+
+    // Each sector is transferred once, to or from the buffers of the
+    // first part that has it; later parts that have it too get a copy.
+    const StorageRequest& front = *Waiting[first].Request;
+    u64 covered = front.LBA;
+    for (usz i = first; i <= last; ++i) {
+        StorageRequest* request = Waiting[i].Request;
+        const u64 end = request->LBA + request->Sectors;
+        const u64 shared = std::min(covered, end) - request->LBA;
+        if (end > covered) {
+            append_vectors(dispatch->Vectors, *request, shared * sectorSize, (end - covered) * sectorSize);
+            covered = end;
+        }
+        dispatch->Parts.push_back({ request, shared });
+    }
+
+    StorageRequest& merged = dispatch->Request;
+    merged.Op = front.Op;
+    merged.LBA = front.LBA;
+    merged.Sectors = covered - front.LBA;
+    merged.Vectors = dispatch->Vectors.data();
+    merged.VectorCount = dispatch->Vectors.size();
+    merged.PageMap = front.PageMap;
+    merged.Completion = finish;
+    merged.Context = dispatch;
+
+    DBGMSG("[IOSCHED]: {} sectors at {} as {} request(s), {}\n"
+           , merged.Sectors
+           , merged.LBA
+           , last - first + 1
+           , merged.Op == StorageRequest::Operation::WRITE ? "write" : "read"
+           );
+
+    // Count it and move the head first; the device may be done with it
+    // before `submit()` returns, and dispatch more from the completion.
+    std::vector<Queued> taken;
+    for (usz i = first; i <= last; ++i) taken.push_back(Waiting[i]);
+    ++Dispatched;
+    Waiting.erase(Waiting.begin() + first, Waiting.begin() + last + 1);
+    const u64 head = Head;
+    Head = covered;
+    if (Driver->submit(&merged)) return true;
+
+    --Dispatched;
+    Head = head;
+    for (usz i = 0; i < taken.size(); ++i)
+        Waiting.insert(Waiting.begin() + first + i, std::move(taken[i]));
+    delete dispatch;
+    return false;
+}
+
+void IOScheduler::finish(StorageRequest* request) {
+    auto* dispatch = static_cast<Dispatch*>(request->Context);
+    IOScheduler* scheduler = dispatch->Scheduler;
+    const usz sectorSize = scheduler->Driver->sector_size();
+    const bool success = request->Result >= 0;
+
+    // Every part is copied into before any completes, as a completion
+    // may free the buffers the copies come from.
+    if (success) {
+        for (const Dispatch::Part& part : dispatch->Parts) {
+            if (!part.Shared) continue;
+            const usz offset = (part.Request->LBA - request->LBA) * sectorSize;
+            copy_vectors(*part.Request, dispatch->Vectors, offset, part.Shared * sectorSize);
+        }
+    }
+    for (const Dispatch::Part& part : dispatch->Parts) {
+        StorageRequest* done = part.Request;
+        done->Result = success ? ssz(done->Sectors * sectorSize) : -1;
+        done->Done = true;
+        // NOTE: The request may be gone once the completion returns.
+        if (done->Completion) done->Completion(done);
+    }
+
+    --scheduler->Dispatched;
+    delete dispatch;
+    scheduler->dispatch();
+}
@@ -0,0 +1,120 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#ifndef LENSOR_OS_IO_SCHEDULER_H
+#define LENSOR_OS_IO_SCHEDULER_H
+
+#include <integers.h>
+#include <storage/storage_device_driver.h>
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/// Most merged requests the device is given at once. Anything submitted
+/// beyond that waits in the scheduler, where it can still be merged
+/// with what comes after it.
+#define IO_SCHEDULER_MAX_DISPATCHED 4
+/// Largest request made by merging others, in bytes.
+#define IO_SCHEDULER_MAX_MERGE (1024 * 1024)
+/// How long a request may be passed over for others further along the
+/// elevator before it goes first.
+#define IO_SCHEDULER_READ_EXPIRE_MS 50
+#define IO_SCHEDULER_WRITE_EXPIRE_MS 500
+
+/// Sits between a block device and its consumers (the block cache),
+/// queueing what they `submit()`. Requests are handed to the device in
+/// the order of their sectors, sweeping upwards and starting over from
+/// the bottom (C-SCAN), unless one has waited past its deadline. Queued
+/// requests for adjacent sectors, or reads of overlapping ones, are
+/// merged into a single request to the device.
+///
+/// Synchronous transfers aren't queued; they go straight to the device.
+struct IOScheduler final : StorageDeviceDriver {
+    explicit IOScheduler(std::shared_ptr<StorageDeviceDriver> driver)
+        : Driver(std::move(driver)) {}
+
+    void close(FileMetadata* file) final { Driver->close(file); }
+    auto open(std::string_view name) -> std::shared_ptr<FileMetadata> final { return Driver->open(name); }
+
+    ssz read(FileMetadata* file, usz offs, usz byteCount, void* buffer) final {
+        return Driver->read(file, offs, byteCount, buffer);
+    }
+    ssz read_raw(usz offs, usz byteCount, void* buffer) final {
+        return Driver->read_raw(offs, byteCount, buffer);
+    }
+    ssz write(FileMetadata* file, usz offs, usz byteCount, void* buffer) final {
+        return Driver->write(file, offs, byteCount, buffer);
+    }
+
+    bool submit(StorageRequest*) final;
+    void poll_completions() final { Driver->poll_completions(); }
+    void plug() final;
+    void unplug() final;
+    auto sector_size() -> usz final { return Driver->sector_size(); }
+    auto sector_count() -> u64 final { return Driver->sector_count(); }
+
+private:
+    /// A submitted request waiting to be dispatched.
+    struct Queued {
+        StorageRequest* Request { nullptr };
+        /// `gPIT` tick by which it should have been dispatched.
+        u64 Deadline { 0 };
+        /// Order of submission.
+        u64 Sequence { 0 };
+    };
+
+    /// One request to the device, carrying the merged `Parts`.
+    struct Dispatch {
+        StorageRequest Request;
+        std::vector<IOVector> Vectors;
+        struct Part {
+            StorageRequest* Request { nullptr };
+            /// Leading sectors already read into an earlier part's
+            /// buffers, to be copied from there once done.
+            u64 Shared { 0 };
+        };
+        std::vector<Part> Parts;
+        IOScheduler* Scheduler { nullptr };
+    };
+
+    std::shared_ptr<StorageDeviceDriver> Driver { nullptr };
+    /// Waiting requests, sorted by first sector.
+    std::vector<Queued> Waiting;
+    u64 Submitted { 0 };
+    /// Merged requests the device has.
+    usz Dispatched { 0 };
+    /// Where the elevator is: the sector after the last dispatched.
+    u64 Head { 0 };
+    usz Plugs { 0 };
+
+    /// Hand waiting requests to the device while it may take more.
+    void dispatch();
+    /// Index in `Waiting` of the request to dispatch next.
+    auto pick() const -> usz;
+    /// Whether `Waiting[i]` must wait for an earlier submitted request
+    /// it overlaps, as one of the two is a write.
+    bool blocked(usz i) const;
+    /// Submit `Waiting[first, last]` as one request.
+    bool issue(usz first, usz last);
+    /// Completion of a `Dispatch`'s request.
+    static void finish(StorageRequest*);
+};
+
+#endif /* LENSOR_OS_IO_SCHEDULER_H */
@@ -0,0 +1,655 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#include <storage/device_drivers/nvme_controller.h>
+
+#include <algorithm>
+#include <format>
+#include <interrupts/interrupts.h>
+#include <memory.h>
+#include <memory/physical_memory_manager.h>
+#include <memory/virtual_memory_manager.h>
+#include <system.h>
+
+// Uncomment the following directive for extra debug information output.
+//#define DEBUG_NVME
+
+#ifdef DEBUG_NVME
+#   define DBGMSG(...) std::print(__VA_ARGS__)
+#else
+#   define DBGMSG(...) void()
+#endif
+
+namespace NVMe {
+
+/// Every initialized controller, to be polled.
+static Controller* Controllers[8];
+
+void poll_completions() {
+    for (auto* controller : Controllers)
+        if (controller) controller->poll_completions();
+}
+
+/// Copy `bytes` between `buffer` and the buffers of `request`, starting
+/// `offset` bytes into the latter; into the request's buffers if
+/// `scatter` is set, otherwise out of them.
+static void copy_vectors(const StorageRequest& request, usz offset, u8* buffer, usz bytes, bool scatter) {
+    usz done = 0;
+    for (usz i = 0; i < request.VectorCount && done < bytes; ++i) {
+        const IOVector& vector = request.Vectors[i];
+        if (offset >= vector.Length) {
+            offset -= vector.Length;
+            continue;
+        }
+        auto* base = static_cast<u8*>(vector.Base) + offset;
+        usz chunk = std::min(vector.Length - offset, bytes - done);
+        if (scatter) memcpy(base, buffer + done, chunk);
+        else memcpy(buffer + done, base, chunk);
+        offset = 0;
+        done += chunk;
+    }
+}
+
+/// Identify strings are padded with spaces, not terminated.
+static auto trimmed(const char* text, usz length) -> std::string_view {
+    while (length && (text[length - 1] == ' ' || text[length - 1] == 0)) --length;
+    return { text, length };
+}
+
+bool Controller::wait_ready(bool ready) {
+    for (u64 spins = 0; spins < MAX_SPINS; ++spins) {
+        const u32 status = Regs->Status;
+        if (status & NVME_CSTS_CFS) {
+            std::print("[NVMe]: Controller fatal status, sorry\n");
+            return false;
+        }
+        if (bool(status & NVME_CSTS_RDY) == ready) return true;
+        asm volatile ("pause");
+    }
+    std::print("[NVMe]: Controller did not {}, sorry\n", ready ? "become ready" : "reset");
+    return false;
+}
+
+auto Controller::doorbell(u16 queue, bool completion) -> volatile u32* {
+    const u64 index = 2 * u64(queue) + completion;
+    return reinterpret_cast<volatile u32*>(u64(Regs) + NVME_DOORBELLS + index * DoorbellStride);
+}
+
+bool Controller::create_queue(Queue& queue, u16 id, u16 entries) {
+    queue.ID = id;
+    queue.Entries = entries;
+    queue.Submissions = static_cast<SubmissionEntry*>(Memory::request_page());
+    queue.Completions = static_cast<CompletionEntry*>(Memory::request_page());
+    if (!queue.Submissions || !queue.Completions) return false;
+    memset(queue.Submissions, 0, PAGE_SIZE);
+    memset((void*)queue.Completions, 0, PAGE_SIZE);
+    queue.SubmissionDoorbell = doorbell(id, false);
+    queue.CompletionDoorbell = doorbell(id, true);
+    return true;
+}
+
+bool Controller::create_io_queue(IOQueue& queue, u16 id, u16 entries) {
+    if (!create_queue(queue, id, entries)) return false;
+    queue.SlotCount = std::min(32u, u32(entries) - 1);
+    queue.PRPLists = static_cast<u64*>(Memory::request_pages(queue.SlotCount));
+    if (!queue.PRPLists) return false;
+    return open_io_queue(queue);
+}
+
+bool Controller::open_io_queue(IOQueue& queue) {
+    // The completion queue has to be there before anything posts to it.
+    SubmissionEntry command{};
+    command.Opcode = NVME_ADMIN_CREATE_CQ;
+    command.PRP1 = u64(queue.Completions);
+    command.CommandDword10 = u32(queue.Entries - 1) << 16 | queue.ID;
+    command.CommandDword11 = NVME_QUEUE_PHYSICALLY_CONTIGUOUS;
+    if (!admin(command)) return false;
+
+    command = {};
+    command.Opcode = NVME_ADMIN_CREATE_SQ;
+    command.PRP1 = u64(queue.Submissions);
+    command.CommandDword10 = u32(queue.Entries - 1) << 16 | queue.ID;
+    command.CommandDword11 = u32(queue.ID) << 16 | NVME_QUEUE_PHYSICALLY_CONTIGUOUS;
+    return admin(command);
+}
+
+void Controller::push(Queue& queue, const SubmissionEntry& command) {
+    memcpy(&queue.Submissions[queue.SubmissionTail], &command, sizeof command);
+    if (++queue.SubmissionTail == queue.Entries) queue.SubmissionTail = 0;
+    // The entry has to be in memory before the controller looks for it.
+    asm volatile ("" ::: "memory");
+    *queue.SubmissionDoorbell = queue.SubmissionTail;
+}
+
+bool Controller::reap(Queue& queue, u16& commandID, u16& status, u32& result) {
+    volatile CompletionEntry& entry = queue.Completions[queue.CompletionHead];
+    const u16 tagged = entry.Status;
+    if ((tagged & 1) != queue.Phase) return false;
+    commandID = entry.CommandID;
+    status = tagged >> 1;
+    result = entry.Result;
+    if (++queue.CompletionHead == queue.Entries) {
+        queue.CompletionHead = 0;
+        queue.Phase ^= 1;
+    }
+    *queue.CompletionDoorbell = queue.CompletionHead;
+    return true;
+}
+
+bool Controller::admin(SubmissionEntry& command, u32* result) {
+    command.CommandID = ++AdminCommands;
+    push(Admin, command);
+    for (u64 spins = 0; spins < MAX_SPINS; ++spins) {
+        u16 id = 0;
+        u16 status = 0;
+        u32 value = 0;
+        if (!reap(Admin, id, status, value)) {
+            asm volatile ("pause");
+            continue;
+        }
+        if (id != command.CommandID) continue;
+        if (status) {
+            DBGMSG("[NVMe]: Admin command {} failed with status {}\n", u32(command.Opcode), status);
+            return false;
+        }
+        if (result) *result = value;
+        return true;
+    }
+    std::print("[NVMe]: Admin command {} timed out, sorry\n", u32(command.Opcode));
+    return false;
+}
+
+auto Controller::register_bytes() const -> usz {
+    const u64 capabilities = Regs->Capabilities;
+    // The admin queue pair, then every I/O queue pair.
+    return NVME_DOORBELLS + 2 * (MAX_IO_QUEUES + 1) * (4u << NVME_CAP_DSTRD(capabilities));
+}
+
+bool Controller::initialize() {
+    const u64 capabilities = Regs->Capabilities;
+    // Pages are the size of ours, and commands are of the NVM set.
+    if (!(capabilities & NVME_CAP_CSS_NVM) || NVME_CAP_MPSMIN(capabilities) != 0) {
+        std::print("[NVMe]: Unsupported controller, sorry\n");
+        return false;
+    }
+    DoorbellStride = 4u << NVME_CAP_DSTRD(capabilities);
+    const u16 entries = u16(std::min(NVME_CAP_MQES(capabilities), u32(MAX_QUEUE_ENTRIES)));
+
+    // Whatever the firmware left it doing, start over.
+    Regs->Configuration = Regs->Configuration & ~u32(NVME_CC_EN);
+    if (!wait_ready(false)) return false;
+    if (!create_queue(Admin, 0, entries)) return false;
+    Regs->AdminQueueAttributes = u32(entries - 1) << 16 | u32(entries - 1);
+    Regs->AdminSubmissionQueue = u64(Admin.Submissions);
+    Regs->AdminCompletionQueue = u64(Admin.Completions);
+    // Completions are polled, so nothing ever has to interrupt.
+    Regs->InterruptMaskSet = u32(-1);
+    Regs->Configuration = NVME_CC_IOCQES(4) | NVME_CC_IOSQES(6) | NVME_CC_EN;
+    if (!wait_ready(true)) return false;
+
+    Identify = static_cast<u8*>(Memory::request_page());
+    if (!Identify) return false;
+    SubmissionEntry identify{};
+    identify.Opcode = NVME_ADMIN_IDENTIFY;
+    identify.PRP1 = u64(Identify);
+    identify.CommandDword10 = NVME_IDENTIFY_CONTROLLER;
+    if (!admin(identify)) return false;
+    const auto* controller = reinterpret_cast<IdentifyController*>(Identify);
+    if (controller->MaximumDataTransferSize)
+        MaxTransfer = std::min(MaxTransfer, u64(PAGE_SIZE) << controller->MaximumDataTransferSize);
+    const u32 namespaceCount = controller->NumberOfNamespaces;
+    std::print("[NVMe]: {} ({}), {} namespace(s)\n"
+               , trimmed(controller->ModelNumber, sizeof controller->ModelNumber)
+               , trimmed(controller->SerialNumber, sizeof controller->SerialNumber)
+               , namespaceCount
+               );
+
+    // An I/O queue for each CPU, as far as the controller goes along.
+    const u32 wanted = std::min(std::max(u32(SYSTEM->cpu().cpu_count()), 1u), MAX_IO_QUEUES);
+    SubmissionEntry features{};
+    features.Opcode = NVME_ADMIN_SET_FEATURES;
+    features.CommandDword10 = NVME_FEATURE_NUMBER_OF_QUEUES;
+    features.CommandDword11 = (wanted - 1) << 16 | (wanted - 1);
+    u32 granted = 0;
+    if (!admin(features, &granted)) return false;
+    const u32 queues = std::min(wanted, std::min((granted & 0xffff) + 1, (granted >> 16) + 1));
+    for (u32 i = 1; i <= queues; ++i) {
+        auto* queue = new IOQueue;
+        if (!create_io_queue(*queue, u16(i), entries)) {
+            delete queue;
+            break;
+        }
+        IOQueues.push_back(queue);
+    }
+    if (IOQueues.empty()) {
+        std::print("[NVMe]: Could not create an I/O queue, sorry\n");
+        return false;
+    }
+
+    // Controllers before NVMe 1.1 can't list their active namespaces;
+    // then try every one there may be.
+    std::vector<u32> ids;
+    identify.CommandDword10 = NVME_IDENTIFY_ACTIVE_NAMESPACES;
+    if (admin(identify)) {
+        const auto* list = reinterpret_cast<u32*>(Identify);
+        for (usz i = 0; i < PAGE_SIZE / sizeof(u32) && list[i]; ++i) ids.push_back(list[i]);
+    } else for (u32 id = 1; id <= std::min(namespaceCount, 16u); ++id) ids.push_back(id);
+    for (u32 id : ids) add_namespace(id);
+
+    for (auto& slot : Controllers) {
+        if (slot) continue;
+        slot = this;
+        break;
+    }
+
+    DBGMSG("[NVMe]: {} I/O queue(s) of {} entries, {} bytes per command at most\n"
+           , IOQueues.size()
+           , entries
+           , MaxTransfer
+           );
+    return true;
+}
+
+void Controller::add_namespace(u32 id) {
+    SubmissionEntry identify{};
+    identify.Opcode = NVME_ADMIN_IDENTIFY;
+    identify.NamespaceID = id;
+    identify.PRP1 = u64(Identify);
+    identify.CommandDword10 = NVME_IDENTIFY_NAMESPACE;
+    if (!admin(identify)) return;
+    const auto* space = reinterpret_cast<IdentifyNamespace*>(Identify);
+    if (!space->Size) return;
+
+    // Blocks must fit the block cache's, and carry no metadata.
+    const u32 format = space->LBAFormats[space->FormattedLBASize & 0xf];
+    const u32 shift = (format >> 16) & 0xff;
+    if ((format & 0xffff) || shift < 9 || (u64(1) << shift) > PAGE_SIZE) {
+        std::print("[NVMe]: Namespace {} has an unsupported format, sorry\n", id);
+        return;
+    }
+    std::print("  Namespace {}: {} sectors of {} bytes\n", id, u64(space->Size), u64(1) << shift);
+    Namespaces.push_back(std::make_shared<NamespaceDriver>(this, id, space->Size, usz(1) << shift));
+}
+
+auto Controller::io_queue() -> IOQueue& {
+    // Every command is issued on the first queue, whichever CPU submits
+    // it; the others stay idle. To use the queue of the submitting CPU
+    // instead, each queue must only be issued on from its own CPU, and
+    // `conflicts()` must keep checking commands on all of them.
+    return *IOQueues[0];
+}
+
+bool Controller::conflicts(const NamespaceDriver& space, const StorageRequest& request) {
+    const u64 first = request.LBA + request.Issued;
+    const u64 end = request.LBA + request.Sectors;
+    const bool write = request.Op == StorageRequest::Operation::WRITE;
+    for (const IOQueue* queue : IOQueues) {
+        for (u32 slot = 0; slot < queue->SlotCount; ++slot) {
+            const Command& command = queue->Slots[slot];
+            if (!(queue->InFlight & (1u << slot)) || command.Namespace != &space || command.Request == &request)
+                continue;
+            const StorageRequest& other = *command.Request;
+            const u64 otherFirst = other.LBA + command.Sector;
+            if (otherFirst < end && first < otherFirst + command.Sectors
+                && (write || other.Op == StorageRequest::Operation::WRITE))
+                return true;
+        }
+    }
+    return false;
+}
+
+auto Controller::map_vectors(IOQueue& queue, u32 slot, const IOVector* vectors, usz count, Memory::PageTable* map
+                             , usz offset, usz bytes, usz sectorSize, SubmissionEntry& command) -> usz {
+    u64* list = queue.PRPLists + slot * PRP_LIST_ENTRIES;
+    u64 first = 0;
+    u64 end = 0;
+    usz pages = 0;
+    usz total = 0;
+    for (usz i = 0; i < count && total < bytes; ++i) {
+        const IOVector& vector = vectors[i];
+        if (offset >= vector.Length) {
+            offset -= vector.Length;
+            continue;
+        }
+        auto virt = u64(vector.Base) + offset;
+        usz left = std::min(vector.Length - offset, bytes - total);
+        offset = 0;
+        while (left) {
+            const usz chunk = std::min(left, usz(PAGE_SIZE - (virt & (PAGE_SIZE - 1))));
+            const auto physical = map ? u64(Memory::physical_address(map, (void*)virt)) : virt;
+            if (!physical) goto done;
+            if (!pages) {
+                // The first entry only has to be dword aligned.
+                if (physical & 3) goto done;
+                first = physical;
+            } else {
+                // Every other one is a whole page, but for the last,
+                // which may end part way through.
+                if ((physical & (PAGE_SIZE - 1)) || (end & (PAGE_SIZE - 1))) goto done;
+                if (pages > PRP_LIST_ENTRIES) goto done;
+                list[pages - 1] = physical;
+            }
+            ++pages;
+            end = physical + chunk;
+            total += chunk;
+            virt += chunk;
+            left -= chunk;
+        }
+    }
+done:
+    // The command covers whole sectors; what's mapped past the last of
+    // them is left for the next one.
+    total -= total % sectorSize;
+    if (!total) return 0;
+    const usz firstBytes = PAGE_SIZE - (first & (PAGE_SIZE - 1));
+    const usz used = total <= firstBytes ? 1 : 1 + (total - firstBytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    command.PRP1 = first;
+    if (used == 2) command.PRP2 = list[0];
+    else if (used > 2) command.PRP2 = u64(list);
+    return total;
+}
+
+auto Controller::slot_buffer(IOQueue& queue, u32 slot, u64 bytes) -> u8* {
+    const u64 pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (queue.SlotBufferPages[slot] < pages) {
+        if (queue.SlotBuffers[slot]) Memory::free_pages(queue.SlotBuffers[slot], queue.SlotBufferPages[slot]);
+        queue.SlotBuffers[slot] = (u8*)Memory::request_pages(pages);
+        queue.SlotBufferPages[slot] = queue.SlotBuffers[slot] ? pages : 0;
+    }
+    return queue.SlotBuffers[slot];
+}
+
+static void dequeue(StorageRequest*& head, StorageRequest*& tail) {
+    StorageRequest* request = head;
+    head = request->Next;
+    if (!head) tail = nullptr;
+    request->Next = nullptr;
+}
+
+static void finish(StorageRequest* request) {
+    request->Done = true;
+    // NOTE: The request may be gone once the completion returns.
+    if (request->Completion) request->Completion(request);
+}
+
+void Controller::start_next(IOQueue& queue) {
+    const u32 slots = queue.SlotCount == 32 ? u32(-1) : (1u << queue.SlotCount) - 1;
+    for (auto& space : Namespaces) {
+        // Nothing will ever be issued on a queue that couldn't be reset.
+        while (!queue.SlotCount && space->QueueHead) {
+            StorageRequest* request = space->QueueHead;
+            dequeue(space->QueueHead, space->QueueTail);
+            request->Result = -1;
+            if (!request->Commands) finish(request);
+        }
+        const usz sectorSize = space->SectorSize;
+        while (space->QueueHead && (queue.InFlight & slots) != slots) {
+            // Requests are issued in order, so one that has to wait for
+            // another to finish holds up those behind it.
+            StorageRequest* request = space->QueueHead;
+            if (conflicts(*space, *request)) break;
+
+            u32 slot = 0;
+            while (queue.InFlight & (1u << slot)) ++slot;
+            queue.InFlight |= 1u << slot;
+            Command& command = queue.Slots[slot];
+            command.Request = request;
+            command.Namespace = space.get();
+            command.Sector = request->Issued;
+
+            // Hand the request's own pages to the controller if it can
+            // take them, and go through a bounce buffer if not.
+            const bool write = request->Op == StorageRequest::Operation::WRITE;
+            const u64 limit = std::min(request->Sectors - request->Issued, std::min(MaxTransfer / sectorSize, u64(0x10000)));
+            SubmissionEntry entry{};
+            command.Sectors = map_vectors(queue, slot, request->Vectors, request->VectorCount, request->PageMap
+                                          , command.Sector * sectorSize, limit * sectorSize, sectorSize, entry) / sectorSize;
+            command.Bounced = !command.Sectors;
+            u8* bounce = nullptr;
+            if (command.Bounced) {
+                command.Sectors = std::min(limit, MAX_BOUNCE_BYTES / sectorSize);
+                const usz bytes = command.Sectors * sectorSize;
+                bounce = slot_buffer(queue, slot, bytes);
+                if (bounce) {
+                    const IOVector vector { bounce, bytes };
+                    map_vectors(queue, slot, &vector, 1, nullptr, 0, bytes, sectorSize, entry);
+                    if (write) copy_vectors(*request, command.Sector * sectorSize, bounce, bytes, false);
+                }
+            }
+
+            request->Issued += command.Sectors;
+            ++request->Commands;
+            if (request->Issued == request->Sectors) dequeue(space->QueueHead, space->QueueTail);
+            if (command.Bounced && !bounce) {
+                complete(queue, slot, false);
+                continue;
+            }
+
+            const u64 lba = request->LBA + command.Sector;
+            entry.Opcode = write ? NVME_CMD_WRITE : NVME_CMD_READ;
+            entry.CommandID = u16(slot);
+            entry.NamespaceID = space->ID;
+            entry.CommandDword10 = u32(lba);
+            entry.CommandDword11 = u32(lba >> 32);
+            entry.CommandDword12 = u32(command.Sectors - 1);
+            push(queue, entry);
+        }
+    }
+}
+
+void Controller::complete(IOQueue& queue, u32 slot, bool success) {
+    const Command command = queue.Slots[slot];
+    queue.Slots[slot] = {};
+    queue.InFlight &= ~(1u << slot);
+    StorageRequest* request = command.Request;
+    NamespaceDriver* space = command.Namespace;
+    const usz sectorSize = space->SectorSize;
+    if (success && command.Bounced && request->Op == StorageRequest::Operation::READ) {
+        const usz bytes = command.Sectors * sectorSize;
+        copy_vectors(*request, command.Sector * sectorSize, queue.SlotBuffers[slot], bytes, true);
+    }
+    if (!success && request->Result >= 0) {
+        request->Result = -1;
+        // Nothing more of it is issued.
+        if (request->Issued < request->Sectors) dequeue(space->QueueHead, space->QueueTail);
+    }
+    if (--request->Commands) return;
+    if (request->Result >= 0) {
+        if (request->Issued < request->Sectors) return;
+        request->Result = ssz(request->Sectors * sectorSize);
+    }
+    finish(request);
+}
+
+void Controller::poll_completions() {
+    InterruptsMasked masked;
+    for (IOQueue* queue : IOQueues) {
+        u16 id = 0;
+        u16 status = 0;
+        u32 result = 0;
+        while (reap(*queue, id, status, result)) {
+            if (id >= queue->SlotCount || !(queue->InFlight & (1u << id))) continue;
+            if (status) std::print("[NVMe]: Command failed with status {}, sorry\n", status);
+            complete(*queue, id, !status);
+        }
+    }
+    start_next(io_queue());
+}
+
+void Controller::reset_queue(IOQueue& queue) {
+    // Deleting the submission queue aborts the commands in it, and the
+    // controller is done with their buffers once that completes.
+    SubmissionEntry command{};
+    command.Opcode = NVME_ADMIN_DELETE_SQ;
+    command.CommandDword10 = queue.ID;
+    bool reset = admin(command);
+    command.Opcode = NVME_ADMIN_DELETE_CQ;
+    reset = reset && admin(command);
+    if (reset) {
+        memset(queue.Submissions, 0, PAGE_SIZE);
+        memset((void*)queue.Completions, 0, PAGE_SIZE);
+        queue.SubmissionTail = 0;
+        queue.CompletionHead = 0;
+        queue.Phase = 1;
+        reset = open_io_queue(queue);
+    }
+
+    const u32 slots = queue.SlotCount;
+    if (!reset) {
+        std::print("[NVMe]: Could not reset I/O queue {}, sorry\n", queue.ID);
+        queue.SlotCount = 0;
+    }
+    // A completion may submit more, which must not be failed with them.
+    const u32 failed = queue.InFlight;
+    for (u32 slot = 0; slot < slots; ++slot)
+        if (failed & (1u << slot)) complete(queue, slot, false);
+}
+
+void Controller::time_out(NamespaceDriver& space, StorageRequest& request) {
+    std::print("[NVMe]: Namespace {}: Transfer timed out, resetting I/O queue\n", space.ID);
+    reset_queue(io_queue());
+    if (request.Done) return;
+
+    // None of it was issued yet; it's still waiting on the namespace.
+    StorageRequest* previous = nullptr;
+    for (StorageRequest* it = space.QueueHead; it; previous = it, it = it->Next) {
+        if (it != &request) continue;
+        if (previous) previous->Next = it->Next;
+        else space.QueueHead = it->Next;
+        if (space.QueueTail == it) space.QueueTail = previous;
+        it->Next = nullptr;
+        break;
+    }
+    request.Result = -1;
+    request.Done = true;
+}
+
+NamespaceDriver::NamespaceDriver(Controller* controller, u32 id, u64 sectors, usz sectorSize)
+    : Parent(controller), ID(id), Sectors(sectors), SectorSize(sectorSize)
+    , Buffer(static_cast<u8*>(Memory::request_page())) {}
+
+NamespaceDriver::~NamespaceDriver() {
+    if (Buffer) Memory::free_page(Buffer);
+}
+
+bool NamespaceDriver::submit(StorageRequest* request) {
+    if (!request || !request->Sectors || request->LBA + request->Sectors > Sectors) return false;
+    if (request->VectorCount && !request->Vectors) return false;
+    usz capacity = 0;
+    for (usz i = 0; i < request->VectorCount; ++i)
+        capacity += request->Vectors[i].Length;
+    if (capacity < request->Sectors * SectorSize) return false;
+
+    DBGMSG("[NVMe]: Namespace {} -- submit()  {} sectors at {}, {}\n"
+           , ID
+           , request->Sectors
+           , request->LBA
+           , request->Op == StorageRequest::Operation::WRITE ? "write" : "read"
+           );
+
+    InterruptsMasked masked;
+    if (!request->PageMap) request->PageMap = Memory::active_page_map();
+    request->Result = 0;
+    request->Done = false;
+    request->Next = nullptr;
+    request->Issued = 0;
+    request->Commands = 0;
+    if (QueueTail) QueueTail->Next = request;
+    else QueueHead = request;
+    QueueTail = request;
+
+    Parent->start_next(Parent->io_queue());
+    return true;
+}
+
+void NamespaceDriver::poll_completions() {
+    Parent->poll_completions();
+}
+
+ssz NamespaceDriver::transfer(StorageRequest::Operation op, u64 sector, u64 sectors, void* buffer) {
+    IOVector vector { buffer, sectors * SectorSize };
+    StorageRequest request;
+    request.Op = op;
+    request.LBA = sector;
+    request.Sectors = sectors;
+    request.Vectors = &vector;
+    request.VectorCount = 1;
+    // Commands usually complete within microseconds; nothing else
+    // would run in the meantime anyway.
+    InterruptsMasked masked;
+    if (!submit(&request)) return -1;
+    for (u64 polls = 0; !request.Done; ++polls) {
+        // A controller that drops a command would otherwise hang us
+        // here for good.
+        if (polls == Parent->MAX_TRANSFER_POLLS) {
+            Parent->time_out(*this, request);
+            break;
+        }
+        asm volatile ("pause");
+        Parent->poll_completions();
+    }
+    return request.Result;
+}
+
+ssz NamespaceDriver::read_raw(usz byteOffset, usz byteCount, void* buffer) {
+    if (!buffer || !Buffer) return -1;
+    auto* out = static_cast<u8*>(buffer);
+    usz done = 0;
+    while (done < byteCount) {
+        const u64 sector = (byteOffset + done) / SectorSize;
+        const usz within = (byteOffset + done) % SectorSize;
+        usz chunk = 0;
+        if (within || byteCount - done < SectorSize) {
+            // Only part of this sector is wanted.
+            if (transfer(StorageRequest::Operation::READ, sector, 1, Buffer) < 0) return -1;
+            chunk = std::min(SectorSize - within, byteCount - done);
+            memcpy(out + done, Buffer + within, chunk);
+        } else {
+            chunk = (byteCount - done) / SectorSize * SectorSize;
+            if (transfer(StorageRequest::Operation::READ, sector, chunk / SectorSize, out + done) < 0) return -1;
+        }
+        done += chunk;
+    }
+    return ssz(byteCount);
+}
+
+ssz NamespaceDriver::write(FileMetadata*, usz byteOffset, usz byteCount, void* buffer) {
+    if (!buffer || !Buffer) return -1;
+    auto* in = static_cast<u8*>(buffer);
+    usz done = 0;
+    while (done < byteCount) {
+        const u64 sector = (byteOffset + done) / SectorSize;
+        const usz within = (byteOffset + done) % SectorSize;
+        usz chunk = 0;
+        if (within || byteCount - done < SectorSize) {
+            // Keep the rest of a sector only partly written.
+            if (transfer(StorageRequest::Operation::READ, sector, 1, Buffer) < 0) return -1;
+            chunk = std::min(SectorSize - within, byteCount - done);
+            memcpy(Buffer + within, in + done, chunk);
+            if (transfer(StorageRequest::Operation::WRITE, sector, 1, Buffer) < 0) return -1;
+        } else {
+            chunk = (byteCount - done) / SectorSize * SectorSize;
+            if (transfer(StorageRequest::Operation::WRITE, sector, chunk / SectorSize, in + done) < 0) return -1;
+        }
+        done += chunk;
+    }
+    return ssz(byteCount);
+}
+
+}
@@ -0,0 +1,219 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#ifndef LENSOROS_NVME_CONTROLLER_H
+#define LENSOROS_NVME_CONTROLLER_H
+
+#include <integers.h>
+#include <memory/common.h>
+#include <nvme.h>
+#include <storage/storage_device_driver.h>
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace NVMe {
+
+struct Controller;
+
+/// One namespace of an NVMe controller, as a block device.
+struct NamespaceDriver final : StorageDeviceDriver {
+    NamespaceDriver(Controller* controller, u32 id, u64 sectors, usz sectorSize);
+    ~NamespaceDriver() override;
+
+    /// Not valid for this driver, but required by the interface.
+    void close(FileMetadata*) final {}
+    auto open(std::string_view) -> std::shared_ptr<FileMetadata> final {
+        return std::shared_ptr<FileMetadata>{nullptr};
+    }
+
+    /// Transfer whole sectors straight to or from `buffer`, and the
+    /// first and last sector through `Buffer` if the byte range covers
+    /// just part of them.
+    ssz read(FileMetadata*, usz byteOffset, usz byteCount, void* buffer) final {
+        return read_raw(byteOffset, byteCount, buffer);
+    }
+    ssz read_raw(usz byteOffset, usz byteCount, void* buffer) final;
+    ssz write(FileMetadata*, usz byteOffset, usz byteCount, void* buffer) final;
+
+    /// Requests wait on the namespace, in the order submitted, until
+    /// the controller's I/O queue has a free command for them. The
+    /// controller transfers the request's buffers directly, through a
+    /// list of the physical pages behind them.
+    bool submit(StorageRequest*) final;
+    void poll_completions() final;
+    auto sector_size() -> usz final { return SectorSize; }
+    auto sector_count() -> u64 final { return Sectors; }
+
+    auto id() const -> u32 { return ID; }
+
+private:
+    friend struct Controller;
+
+    Controller* Parent { nullptr };
+    u32 ID { 0 };
+    u64 Sectors { 0 };
+    usz SectorSize { 512 };
+    /// One sector, for the partial ones at either end of a transfer.
+    u8* Buffer { nullptr };
+
+    StorageRequest* QueueHead { nullptr };
+    StorageRequest* QueueTail { nullptr };
+
+    /// Submit a request for `sectors` sectors at `sector` and wait until
+    /// it completes. The controller is polled meanwhile.
+    ssz transfer(StorageRequest::Operation op, u64 sector, u64 sectors, void* buffer);
+};
+
+struct Controller {
+    explicit Controller(Registers* registers) : Regs(registers) {}
+
+    /// Reset the controller, create its queues, and find its namespaces.
+    /// @return false if it couldn't be brought up.
+    bool initialize();
+
+    /// How many bytes of registers and doorbells, from the start of
+    /// the registers, the driver may touch. Reads the capabilities, so
+    /// at least the first page of registers must already be mapped.
+    auto register_bytes() const -> usz;
+
+    auto namespaces() -> std::vector<std::shared_ptr<NamespaceDriver>>& { return Namespaces; }
+
+    /// Complete what the controller is done with, and issue what waits.
+    void poll_completions();
+
+private:
+    friend struct NamespaceDriver;
+
+    /// A submission queue and the completion queue it posts to, with
+    /// the same ID.
+    struct Queue {
+        u16 ID { 0 };
+        u16 Entries { 0 };
+        SubmissionEntry* Submissions { nullptr };
+        volatile CompletionEntry* Completions { nullptr };
+        volatile u32* SubmissionDoorbell { nullptr };
+        volatile u32* CompletionDoorbell { nullptr };
+        u16 SubmissionTail { 0 };
+        u16 CompletionHead { 0 };
+        /// Phase tag of completions not seen yet; flips on each wrap.
+        u16 Phase { 1 };
+    };
+
+    /// A command in flight: which sectors of which request it carries.
+    struct Command {
+        StorageRequest* Request { nullptr };
+        NamespaceDriver* Namespace { nullptr };
+        /// First sector of the command, from the start of the request.
+        u64 Sector { 0 };
+        u64 Sectors { 0 };
+        /// Whether the data goes through the slot's bounce buffer, as
+        /// the request's buffers can't be handed to the controller as-is.
+        bool Bounced { false };
+    };
+
+    /// An I/O queue, whose command identifiers are slots as in AHCI.
+    struct IOQueue : Queue {
+        u32 SlotCount { 0 };
+        u32 InFlight { 0 };
+        Command Slots[32] {};
+        /// A page per slot, for the PRP list of commands that span more
+        /// than two pages.
+        u64* PRPLists { nullptr };
+        u8* SlotBuffers[32] {};
+        u64 SlotBufferPages[32] {};
+    };
+
+    volatile Registers* Regs { nullptr };
+    u32 DoorbellStride { 4 };
+    Queue Admin;
+    u16 AdminCommands { 0 };
+    /// A page for what IDENTIFY returns.
+    u8* Identify { nullptr };
+    /// One per CPU, if the controller has that many.
+    std::vector<IOQueue*> IOQueues;
+    std::vector<std::shared_ptr<NamespaceDriver>> Namespaces;
+
+    /// Most entries of any queue.
+    const u16 MAX_QUEUE_ENTRIES = 64;
+    const u32 MAX_IO_QUEUES = 16;
+    /// Pages one PRP list holds.
+    const u64 PRP_LIST_ENTRIES = PAGE_SIZE / sizeof(u64);
+    const u64 MAX_BOUNCE_BYTES = 0x100 * PAGE_SIZE;
+    /// Most bytes per command; the controller may allow fewer.
+    u64 MaxTransfer { PRP_LIST_ENTRIES * PAGE_SIZE };
+    /// How many times to check for the controller to do something
+    /// before giving up on it, during initialization.
+    const u64 MAX_SPINS = 100000000;
+    /// How many times to poll for a synchronous transfer to complete
+    /// before giving up on the commands in flight.
+    const u64 MAX_TRANSFER_POLLS = 100000000;
+
+    bool wait_ready(bool ready);
+    auto doorbell(u16 queue, bool completion) -> volatile u32*;
+    bool create_queue(Queue& queue, u16 id, u16 entries);
+    bool create_io_queue(IOQueue& queue, u16 id, u16 entries);
+    /// Have the controller create the completion and submission queue
+    /// of `queue`, whose memory is already there.
+    bool open_io_queue(IOQueue& queue);
+    /// Delete `queue` on the controller and create it anew, which aborts
+    /// every command in it, then fail those commands. If the queue can't
+    /// be brought back, nothing is issued on it again.
+    void reset_queue(IOQueue& queue);
+    /// Give up on `request` of `space`: fail what's in flight, and take
+    /// what's left of it off the namespace's queue.
+    void time_out(NamespaceDriver& space, StorageRequest& request);
+    void add_namespace(u32 id);
+
+    /// Append `command` to `queue` and ring its doorbell.
+    void push(Queue& queue, const SubmissionEntry& command);
+    /// Take the next completion off of `queue`, if there is one.
+    bool reap(Queue& queue, u16& commandID, u16& status, u32& result);
+    /// Run `command` on the admin queue and spin until it's done.
+    bool admin(SubmissionEntry& command, u32* result = nullptr);
+
+    /// The queue commands are issued on.
+    auto io_queue() -> IOQueue&;
+    /// Issue waiting requests while `queue` has free slots.
+    void start_next(IOQueue& queue);
+    /// Whether what's left of `request` must wait for a command in
+    /// flight on any queue: it overlaps it, and one of the two is a write.
+    bool conflicts(const NamespaceDriver& space, const StorageRequest& request);
+    /// Point the PRPs of `command` at up to `bytes` bytes of `vectors`,
+    /// starting `offset` bytes into them, through the PRP list of `slot`
+    /// if they span more than two pages. Pages are looked up in `map`,
+    /// or taken to be identity mapped if it is null. Returns how many
+    /// bytes are covered, rounded down to whole `sectorSize` sectors;
+    /// zero if the buffers can't be handed to the controller as-is.
+    auto map_vectors(IOQueue& queue, u32 slot, const IOVector* vectors, usz count, Memory::PageTable* map
+                     , usz offset, usz bytes, usz sectorSize, SubmissionEntry& command) -> usz;
+    /// The bounce buffer of `slot`, at least `bytes` large.
+    auto slot_buffer(IOQueue& queue, u32 slot, u64 bytes) -> u8*;
+    /// Free `slot`, and finish its request if that was the last of it.
+    void complete(IOQueue& queue, u32 slot, bool success);
+};
+
+/// Check every controller for finished commands; called on each timer
+/// tick, as completions are polled rather than signalled.
+void poll_completions();
+
+}
+
+#endif // LENSOROS_NVME_CONTROLLER_H
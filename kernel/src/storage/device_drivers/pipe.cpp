@@ -32,6 +32,17 @@
 
 #define get_driver_data(meta) static_cast<PipeEnd*>((meta)->driver_data())
 
+/// Wake every process polling `pipeBuffer` so it re-checks readiness.
+static void wake_pollers(PipeBuffer* pipeBuffer) {
+    for (pid_t pid : pipeBuffer->PIDsPolling) {
+        auto* process = Scheduler::process(pid);
+        if (!process) continue;
+        process->CPU.RAX = usz(-2);
+        process->State = Process::RUNNING;
+    }
+    pipeBuffer->PIDsPolling.clear();
+}
+
 void PipeDriver::close(FileMetadata* meta) {
     if (!meta) return;
 
@@ -66,6 +77,7 @@ void PipeDriver::close(FileMetadata* meta) {
         }
         pipeBuffer->PIDsWaiting.clear();
     }
+    wake_pollers(pipeBuffer);
     //std::print("[PIPE]: close()  Freeing {} pipe end at {}  pipeBuffer={}\n", pipe->End == PipeEnd::READ ? "read" : "write", (void*)pipe, (void*)pipeBuffer);
     delete pipe;
 
@@ -164,9 +176,27 @@ ssz PipeDriver::read(FileMetadata* meta, usz, usz byteCount, void* buffer) {
     memmove(pipe->Buffer->Data, pipe->Buffer->Data + byteCount, PIPE_BUFSZ - byteCount);
     pipe->Buffer->Offset -= byteCount;
 
+    // There is space to write now.
+    if (byteCount) wake_pollers(pipe->Buffer);
+
     return ssz(byteCount);
 };
 
+ssz PipeDriver::readv(FileMetadata* meta, usz, const IOVector* vectors, usz count) {
+    if (!meta) return -1;
+    auto* pipe = get_driver_data(meta);
+    if (!pipe) return -1;
+
+    ssz total = 0;
+    for (usz i = 0; i < count; ++i) {
+        if (!vectors[i].Length) continue;
+        if (total && pipe->Buffer->Offset == 0) break;
+        ssz n = read(meta, 0, vectors[i].Length, vectors[i].Base);
+        if (n < 0) return total ? total : n;
+        total += n;
+    }
+    return total;
+}
 
 ssz PipeDriver::write(FileMetadata* meta, usz, usz byteCount, void* buffer) {
     if (!meta) return -1;
@@ -194,10 +224,52 @@ ssz PipeDriver::write(FileMetadata* meta, usz, usz byteCount, void* buffer) {
         process->State = Process::RUNNING;
     }
     pipe->Buffer->PIDsWaiting.clear();
+    if (byteCount) wake_pollers(pipe->Buffer);
 
     return ssz(byteCount);
 }
 
+usz PipeDriver::space(FileMetadata* meta) {
+    if (!meta) return 0;
+    auto* pipe = get_driver_data(meta);
+    if (!pipe) return 0;
+    return PIPE_BUFSZ - pipe->Buffer->Offset;
+}
+
+u16 PipeDriver::poll(FileMetadata* meta) {
+    if (!meta) return POLL_NVAL;
+    auto* pipe = get_driver_data(meta);
+    if (!pipe) return POLL_NVAL;
+
+    u16 events = 0;
+    if (pipe->End == PipeEnd::READ) {
+        if (pipe->Buffer->Offset) events |= POLL_IN;
+        // Reading won't block once the write end is gone; it returns EOF.
+        if (pipe->Buffer->WriteClosed) events |= POLL_HUP;
+    } else {
+        if (pipe->Buffer->ReadClosed) events |= POLL_ERR;
+        else if (pipe->Buffer->Offset < PIPE_BUFSZ) events |= POLL_OUT;
+    }
+    return events;
+}
+
+void PipeDriver::poll_wait(FileMetadata* meta, pid_t pid) {
+    if (!meta) return;
+    auto* pipe = get_driver_data(meta);
+    if (!pipe) return;
+    auto& polling = pipe->Buffer->PIDsPolling;
+    if (std::find(polling.begin(), polling.end(), pid) == polling.end())
+        polling.push_back(pid);
+}
+
+void PipeDriver::poll_cancel(FileMetadata* meta, pid_t pid) {
+    if (!meta) return;
+    auto* pipe = get_driver_data(meta);
+    if (!pipe) return;
+    auto& polling = pipe->Buffer->PIDsPolling;
+    polling.erase(std::remove(polling.begin(), polling.end(), pid), polling.end());
+}
+
 auto PipeDriver::lay_pipe() -> PipeMetas {
     PipeBuffer* pipe = nullptr;
     if (FreePipeBuffers.empty()) {
@@ -51,6 +51,9 @@ struct PipeBuffer {
     bool ReadClosed{false};
     bool WriteClosed{false};
     std::vector<pid_t> PIDsWaiting;
+    /// Processes in `poll` on either end; woken whenever data or space
+    /// becomes available or an end is closed.
+    std::vector<pid_t> PIDsPolling;
 
     constexpr PipeBuffer() = default;
     ~PipeBuffer() = default;
@@ -64,6 +67,7 @@ struct PipeBuffer {
 
     void clear() {
         PIDsWaiting.clear();
+        PIDsPolling.clear();
         memset(&Data[0], 0, sizeof(Data));
         Offset = 0;
         ReadClosed = false;
@@ -104,6 +108,17 @@ struct PipeDriver final : StorageDeviceDriver {
     ssz read(FileMetadata* meta, usz, usz byteCount, void* buffer) final;
     ssz read_raw(usz, usz, void*) final { return -1; };
     ssz write(FileMetadata* meta, usz, usz byteCount, void* buffer) final;
+    /// Only blocks while the pipe is empty; once the first buffer has
+    /// been filled, the rest take whatever is left without waiting.
+    ssz readv(FileMetadata* meta, usz, const IOVector* vectors, usz count) final;
+
+    /// How many bytes a write to `meta` would take right now; writes
+    /// are cut short to that, rather than waiting for room.
+    usz space(FileMetadata* meta);
+
+    u16 poll(FileMetadata* meta) final;
+    void poll_wait(FileMetadata* meta, pid_t pid) final;
+    void poll_cancel(FileMetadata* meta, pid_t pid) final;
 
     PipeMetas lay_pipe();
 
@@ -19,6 +19,11 @@
 
 #include <storage/device_drivers/port_controller.h>
 
+#include <algorithm>
+#include <interrupts/interrupts.h>
+#include <io.h>
+#include <memory/virtual_memory_manager.h>
+
 // Uncomment the following directive for extra debug information output.
 //#define DEBUG_AHCI
 
@@ -30,12 +35,65 @@
 
 namespace AHCI {
 
-PortController::PortController(PortType type, u64 portNumber, HBAPort* portAddress)
-    : Type(type), PortNumber(portNumber), Port(portAddress)
+/// Every initialized port, indexed by port number.
+static PortController* Ports[32];
+
+/// The controller whose ports interrupt, and on which IRQ.
+static HBAMemory* InterruptingHBA { nullptr };
+static u8 InterruptLine { 0xff };
+
+/// Halt until the AHCI interrupt arrives, with every other IRQ masked
+/// so nothing else (like the scheduler) runs meanwhile. The RTC is let
+/// through too, so a lost interrupt costs a millisecond, not a hang.
+/// Called and returns with interrupts disabled.
+static void wait_for_interrupt() {
+    const u8 parentMasks = in8(PIC1_DATA);
+    const u8 childMasks = in8(PIC2_DATA);
+    const u16 allowed = IRQ_BIT(IRQ_CASCADED_PIC) | IRQ_BIT(IRQ_REAL_TIMER) | IRQ_BIT(InterruptLine);
+    out8(PIC1_DATA, u8(~allowed));
+    out8(PIC2_DATA, u8(~allowed >> 8));
+    // `sti` takes effect after `hlt` starts, so an interrupt that is
+    // already pending wakes it rather than slipping by.
+    asm volatile ("sti\n\thlt\n\tcli" ::: "memory");
+    out8(PIC1_DATA, parentMasks);
+    out8(PIC2_DATA, childMasks);
+}
+
+void poll_completions() {
+    for (PortController* port : Ports)
+        if (port && port->needs_polling()) port->poll_completions();
+}
+
+void enable_interrupts(HBAMemory* hba, u8 line) {
+    if (InterruptingHBA || line >= 16) return;
+    InterruptingHBA = hba;
+    InterruptLine = line;
+    for (PortController* port : Ports)
+        if (port && port->hba() == hba) port->enable_interrupts();
+    hba->InterruptStatus = (u32)-1;
+    hba->GlobalHostControl = hba->GlobalHostControl | HBA_GHC_IE;
+    DBGMSG("[AHCI]: Interrupts on IRQ {}\n", line);
+}
+
+void handle_interrupt() {
+    if (!InterruptingHBA) return;
+    // Each port's status is cleared before the controller's, or the
+    // latter would be set again right away.
+    const u32 pending = InterruptingHBA->InterruptStatus;
+    for (u32 i = 0; i < 32; ++i)
+        if ((pending & (1u << i)) && Ports[i] && Ports[i]->hba() == InterruptingHBA)
+            Ports[i]->poll_completions();
+    InterruptingHBA->InterruptStatus = pending;
+}
+
+auto interrupt_line() -> u8 { return InterruptLine; }
+
+PortController::PortController(PortType type, u64 portNumber, HBAMemory* hba)
+    : Type(type), PortNumber(portNumber), HBA(hba), Port(&hba->Ports[portNumber])
 {
-    // Get contiguous physical memory for
-    // this AHCI port to read to/write from.
-    Buffer = (u8*)Memory::request_pages(PORT_BUFFER_PAGES);
+    // Get contiguous physical memory for the partial sectors at either
+    // end of a transfer.
+    Buffer = (u8*)Memory::request_page();
     // Wait for pending commands to finish, then stop any further commands.
     stop_commands();
     // Allocate memory for command list.
@@ -46,75 +104,441 @@ PortController::PortController(PortType type, u64 portNumber, HBAPort* portAddre
     void* fisBase = Memory::request_page();
     memset(fisBase, 0, 256);
     Port->set_frame_information_structure_base(fisBase);
-    // Populate command list with command tables.
+    // Populate command list with command tables, a page each.
     auto* commandHeader = reinterpret_cast<HBACommandHeader*>(Port->command_list_base());
+    auto* commandTables = reinterpret_cast<u8*>(Memory::request_pages(32));
+    memset(commandTables, 0, 32 * PAGE_SIZE);
     for (u8 i = 0; i < 32; ++i) {
-        // 8 PRDT entries per command table, aka 256 bytes.
-        commandHeader[i].PRDTLength = 8;
-        void* commandTableAddress = Memory::request_page();
-        u64 address = reinterpret_cast<u64>(commandTableAddress) + (i << 8);
-        commandHeader[i].set_command_table_base(address);
-        memset(reinterpret_cast<void*>(address), 0, 256);
+        commandHeader[i].PRDTLength = 0;
+        commandHeader[i].set_command_table_base(commandTables + u64(i) * PAGE_SIZE);
     }
+    // Clear whatever errors were left behind by the firmware.
+    Port->SataError = (u32)-1;
+    Port->InterruptStatus = (u32)-1;
     start_commands();
 
-    DBGMSG("[AHCI]: Port {} initialized.\n", PortNumber);
+    // Use every slot the HBA has if the device can queue commands, and
+    // as many as its queue is deep.
+    const u32 capability = hba->HostCapability;
+    if (Type == PortType::SATA && command(ATA_CMD_IDENTIFY, 0, 0)) {
+        auto* identify = reinterpret_cast<u16*>(Buffer);
+        // Words 100-103 hold the sector count if the device supports
+        // 48-bit addressing (word 83, bit 10), otherwise words 60-61.
+        if (identify[83] & (1 << 10)) {
+            SectorCount = u64(identify[100]) | u64(identify[101]) << 16
+                | u64(identify[102]) << 32 | u64(identify[103]) << 48;
+        } else SectorCount = u64(identify[60]) | u64(identify[61]) << 16;
+        const u32 depth = (identify[75] & 0x1f) + 1u;
+        if ((capability & HBA_CAP_SNCQ) && (identify[76] & (1 << 8)) && depth > 1) {
+            Queued = true;
+            SlotCount = std::min(HBA_CAP_NCS(capability), depth);
+        }
+    }
+
+    if (PortNumber < 32) Ports[PortNumber] = this;
+
+    DBGMSG("[AHCI]: Port {} initialized; {} command slots{}\n"
+           , PortNumber
+           , SlotCount
+           , Queued ? ", NCQ" : ""
+           );
 }
 
-bool PortController::read_low_level(u64 sector, u64 sectors) {
-    // Ensure hardware port is not busy by
-    // spinning until it isn't, or giving up.
-    const u64 maxSpin = 1000000;
-    u64 spin = 0;
-    while ((Port->TaskFileData & (ATA_DEV_BUSY | ATA_DEV_DRQ)) && spin < maxSpin)
-        spin++;
+/// Copy `bytes` between `buffer` and the buffers of `request`, starting
+/// `offset` bytes into the latter; into the request's buffers if
+/// `scatter` is set, otherwise out of them.
+static void copy_vectors(const StorageRequest& request, usz offset, u8* buffer, usz bytes, bool scatter) {
+    usz done = 0;
+    for (usz i = 0; i < request.VectorCount && done < bytes; ++i) {
+        const IOVector& vector = request.Vectors[i];
+        if (offset >= vector.Length) {
+            offset -= vector.Length;
+            continue;
+        }
+        auto* base = static_cast<u8*>(vector.Base) + offset;
+        usz chunk = std::min(vector.Length - offset, bytes - done);
+        if (scatter) memcpy(base, buffer + done, chunk);
+        else memcpy(buffer + done, base, chunk);
+        offset = 0;
+        done += chunk;
+    }
+}
 
-    if (spin >= maxSpin)
-        return false;
+void PortController::enable_interrupts() {
+    Port->InterruptStatus = (u32)-1;
+    Port->InterruptEnable = HBA_PxIS_DHRS | HBA_PxIS_PSS | HBA_PxIS_DSS | HBA_PxIS_SDBS | HBA_PxIS_FATAL;
+    Interrupts = true;
+}
+
+bool PortController::submit(StorageRequest* request) {
+    if (!request || Type != PortType::SATA || !request->Sectors) return false;
+    if (request->VectorCount && !request->Vectors) return false;
+    usz capacity = 0;
+    for (usz i = 0; i < request->VectorCount; ++i)
+        capacity += request->Vectors[i].Length;
+    if (capacity < request->Sectors * BYTES_PER_SECTOR) return false;
+
+    DBGMSG("[AHCI]: Port {} -- submit()  {} sectors at {}, {}\n"
+           , PortNumber
+           , request->Sectors
+           , request->LBA
+           , request->Op == StorageRequest::Operation::WRITE ? "write" : "read"
+           );
+
+    InterruptsMasked masked;
+    if (!request->PageMap) request->PageMap = Memory::active_page_map();
+    request->Result = 0;
+    request->Done = false;
+    request->Next = nullptr;
+    request->Issued = 0;
+    request->Commands = 0;
+    if (QueueTail) QueueTail->Next = request;
+    else QueueHead = request;
+    QueueTail = request;
+
+    start_next();
+    return true;
+}
+
+bool PortController::conflicts(const StorageRequest& request) {
+    const bool write = request.Op == StorageRequest::Operation::WRITE;
+    const u64 first = request.LBA + request.Issued;
+    const u64 end = request.LBA + request.Sectors;
+    for (u32 slot = 0; slot < SlotCount; ++slot) {
+        const Command& command = Slots[slot];
+        if (!command.Request || command.Request == &request) continue;
+        if (!write && command.Request->Op != StorageRequest::Operation::WRITE) continue;
+        const u64 lba = command.Request->LBA + command.Sector;
+        if (first < lba + command.Sectors && lba < end) return true;
+    }
+    return false;
+}
+
+auto PortController::command_table(u32 slot) -> HBACommandTable* {
+    auto* commandHeader = reinterpret_cast<HBACommandHeader*>(Port->command_list_base()) + slot;
+    return reinterpret_cast<HBACommandTable*>(commandHeader->command_table_base());
+}
+
+auto PortController::map_vectors(u32 slot, const StorageRequest& request, u64 sector, u64 sectors, u16& entries) -> u64 {
+    HBA_PRDTEntry* prdt = command_table(slot)->PRDTEntry;
+    usz offset = sector * BYTES_PER_SECTOR;
+    const usz limit = sectors * BYTES_PER_SECTOR;
+    usz total = 0;
+    u64 count = 0;
+    for (usz i = 0; i < request.VectorCount && total < limit; ++i) {
+        const IOVector& vector = request.Vectors[i];
+        if (offset >= vector.Length) {
+            offset -= vector.Length;
+            continue;
+        }
+        auto virt = u64(vector.Base) + offset;
+        usz left = std::min(vector.Length - offset, limit - total);
+        offset = 0;
+        while (left) {
+            const usz bytes = std::min(left, usz(PAGE_SIZE - (virt & (PAGE_SIZE - 1))));
+            const auto physical = u64(Memory::physical_address(request.PageMap, (void*)virt));
+            // The HBA only transfers whole words.
+            if (!physical || (physical & 1) || (bytes & 1)) return 0;
+            HBA_PRDTEntry* last = count ? &prdt[count - 1] : nullptr;
+            if (last && last->data_base() + last->byte_count() + 1 == physical
+                && last->byte_count() + 1 + bytes <= MAX_PRDT_BYTES)
+                last->set_byte_count(last->byte_count() + bytes);
+            else {
+                if (count == PRDT_ENTRIES) goto full;
+                prdt[count] = {};
+                prdt[count].set_data_base(physical);
+                prdt[count].set_byte_count(bytes - 1);
+                ++count;
+            }
+            total += bytes;
+            virt += bytes;
+            left -= bytes;
+        }
+    }
+full:
+    // The command covers whole sectors; what's mapped past the last of
+    // them is left for the next one.
+    usz excess = total % BYTES_PER_SECTOR;
+    while (excess && count) {
+        const usz bytes = prdt[count - 1].byte_count() + 1;
+        if (bytes > excess) {
+            prdt[count - 1].set_byte_count(bytes - excess - 1);
+            break;
+        }
+        excess -= bytes;
+        --count;
+    }
+    entries = u16(count);
+    return total / BYTES_PER_SECTOR;
+}
+
+auto PortController::slot_buffer(u32 slot, u64 bytes) -> u8* {
+    const u64 pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (SlotBufferPages[slot] < pages) {
+        if (SlotBuffers[slot]) Memory::free_pages(SlotBuffers[slot], SlotBufferPages[slot]);
+        SlotBuffers[slot] = (u8*)Memory::request_pages(pages);
+        SlotBufferPages[slot] = SlotBuffers[slot] ? pages : 0;
+    }
+    return SlotBuffers[slot];
+}
+
+void PortController::dequeue() {
+    StorageRequest* request = QueueHead;
+    QueueHead = request->Next;
+    if (!QueueHead) QueueTail = nullptr;
+    request->Next = nullptr;
+}
 
-    // Disable interrupts during command construction.
+void PortController::start_next() {
+    const u32 slots = SlotCount == 32 ? u32(-1) : (1u << SlotCount) - 1;
+    while (QueueHead && (InFlight & slots) != slots) {
+        // Requests are issued in order, so one that has to wait for
+        // another to finish holds up those behind it.
+        StorageRequest* request = QueueHead;
+        if (conflicts(*request)) return;
+        // Before anything of ours is in flight, the device may still be
+        // busy with something else. Rather than spin on it, try again
+        // on the next poll, and give up if it stays that way.
+        const bool busy = !InFlight && (Port->TaskFileData & (ATA_DEV_BUSY | ATA_DEV_DRQ));
+        if (busy && ++BusyPolls < MAX_BUSY_POLLS) return;
+        BusyPolls = 0;
+        if (busy) {
+            std::print("[AHCI]: Port {}: Device busy, sorry\n", PortNumber);
+            dequeue();
+            request->Result = -1;
+            if (!request->Commands) finish(request);
+            continue;
+        }
+
+        u32 slot = 0;
+        while (InFlight & (1u << slot)) ++slot;
+        InFlight |= 1u << slot;
+        Command& command = Slots[slot];
+        command.Request = request;
+        command.Sector = request->Issued;
+
+        // Hand the request's own pages to the device if it can take
+        // them, and go through a bounce buffer if not.
+        const bool write = request->Op == StorageRequest::Operation::WRITE;
+        const u64 left = request->Sectors - request->Issued;
+        u16 entries = 0;
+        command.Sectors = map_vectors(slot, *request, command.Sector, std::min(left, u64(0xffff)), entries);
+        command.Bounced = !command.Sectors;
+        u8* bounce = nullptr;
+        if (command.Bounced) {
+            command.Sectors = std::min(left, MAX_BOUNCE_BYTES / BYTES_PER_SECTOR);
+            const usz bytes = command.Sectors * BYTES_PER_SECTOR;
+            bounce = slot_buffer(slot, bytes);
+            if (bounce) {
+                HBA_PRDTEntry& entry = command_table(slot)->PRDTEntry[0];
+                entry = {};
+                entry.set_data_base((u64)bounce);
+                entry.set_byte_count(bytes - 1);
+                entries = 1;
+                if (write) copy_vectors(*request, command.Sector * BYTES_PER_SECTOR, bounce, bytes, false);
+            }
+        }
+
+        request->Issued += command.Sectors;
+        ++request->Commands;
+        if (request->Issued == request->Sectors) dequeue();
+        if ((command.Bounced && !bounce)
+            || !issue(slot, request->LBA + command.Sector, command.Sectors, entries, write))
+            complete(slot, false);
+    }
+}
+
+void PortController::complete(u32 slot, bool success) {
+    const Command command = Slots[slot];
+    Slots[slot] = {};
+    InFlight &= ~(1u << slot);
+    StorageRequest* request = command.Request;
+    if (success && command.Bounced && request->Op == StorageRequest::Operation::READ) {
+        const usz bytes = command.Sectors * BYTES_PER_SECTOR;
+        copy_vectors(*request, command.Sector * BYTES_PER_SECTOR, SlotBuffers[slot], bytes, true);
+    }
+    if (!success && request->Result >= 0) {
+        request->Result = -1;
+        // Nothing more of it is issued.
+        if (request->Issued < request->Sectors) dequeue();
+    }
+    if (--request->Commands) return;
+    if (request->Result >= 0) {
+        if (request->Issued < request->Sectors) return;
+        request->Result = ssz(request->Sectors * BYTES_PER_SECTOR);
+    }
+    finish(request);
+}
+
+void PortController::finish(StorageRequest* request) {
+    request->Done = true;
+    // NOTE: The request may be gone once the completion returns.
+    if (request->Completion) request->Completion(request);
+}
+
+void PortController::poll_completions() {
+    // Acknowledge what's been reported, which also deasserts the
+    // interrupt; the status bits of the port are write-one-to-clear.
+    const u32 status = Port->InterruptStatus;
+    Port->InterruptStatus = status;
+    if (!InFlight) {
+        start_next();
+        return;
+    }
+    if (status & HBA_PxIS_FATAL) {
+        std::print("[AHCI]: Port {}: {}, sorry\n"
+                   , PortNumber
+                   , status & HBA_PxIS_TFES ? "Task File Error" : "Fatal Error"
+                   );
+        recover();
+    } else {
+        // A queued command is done once the device clears its tag in
+        // `SataActive`, any other once the HBA clears `CommandIssue`.
+        const u32 done = InFlight & ~(Port->CommandIssue | Port->SataActive);
+        for (u32 slot = 0; slot < SlotCount; ++slot)
+            if (done & (1u << slot)) complete(slot, true);
+    }
+    start_next();
+}
+
+void PortController::recover() {
+    stop_commands();
+    Port->SataError = (u32)-1;
     Port->InterruptStatus = (u32)-1;
-    auto* commandHeader = reinterpret_cast<HBACommandHeader*>(Port->command_list_base());
+    start_commands();
+    // A device that had a queued command fail won't take another one
+    // until the error has been read out of its log.
+    if (Queued && !command(ATA_CMD_READ_LOG_EXT, ATA_LOG_NCQ_ERROR, 1))
+        std::print("[AHCI]: Port {}: Could not clear NCQ error, sorry\n", PortNumber);
+    // There is no telling which commands did make it, so none did. A
+    // completion may submit more, which must not be failed with them.
+    const u32 failed = InFlight;
+    for (u32 slot = 0; slot < SlotCount; ++slot)
+        if (failed & (1u << slot)) complete(slot, false);
+}
+
+ssz PortController::transfer(StorageRequest& request) {
+    // TODO: Nothing else can run while we wait here; callers that are
+    // able to sleep should use `submit()` directly.
+    InterruptsMasked masked;
+    if (!submit(&request)) return -1;
+    while (!request.Done) {
+        if (Interrupts) wait_for_interrupt();
+        poll_completions();
+    }
+    return request.Result;
+}
+
+ssz PortController::transfer(StorageRequest::Operation op, u64 sector, u64 sectors, const IOVector* vectors, usz count) {
+    StorageRequest request;
+    request.Op = op;
+    request.LBA = sector;
+    request.Sectors = sectors;
+    request.Vectors = vectors;
+    request.VectorCount = count;
+    return transfer(request);
+}
+
+bool PortController::issue(u32 slot, u64 sector, u64 sectors, u16 entries, bool write) {
+    auto* commandHeader = reinterpret_cast<HBACommandHeader*>(Port->command_list_base()) + slot;
     commandHeader->CommandFISLength = sizeof(FIS_REG_H2D)/sizeof(u32);
-    commandHeader->Write = 0;
-    commandHeader->PRDTLength = 1;
+    commandHeader->Write = write ? 1 : 0;
+    commandHeader->PRDTLength = entries;
 
-    auto* commandTable = reinterpret_cast<HBACommandTable*>(commandHeader->command_table_base());
-    memset(commandTable, 0, sizeof(HBACommandTable) + ((commandHeader->PRDTLength - 1) * sizeof(HBA_PRDTEntry)));
-    commandTable->PRDTEntry[0].set_data_base((u64)Buffer);
-    commandTable->PRDTEntry[0].set_byte_count((sectors << 9) - 1);
-    commandTable->PRDTEntry[0].set_interrupt_on_completion(true);
+    // Only the last entry of the PRDT asks for an interrupt.
+    auto* commandTable = command_table(slot);
+    commandTable->PRDTEntry[entries - 1].set_interrupt_on_completion(true);
+    memset(commandTable, 0, sizeof(HBACommandTable));
     auto* commandFIS = reinterpret_cast<FIS_REG_H2D*>(&commandTable->CommandFIS);
     commandFIS->Type = FIS_TYPE::REG_H2D;
     // Take control of command structure.
     commandFIS->CommandControl = 1;
-    commandFIS->Command = ATA_CMD_READ_DMA_EXT;
     commandFIS->set_logical_block_addresses(sector);
     // Use lba mode.
     commandFIS->DeviceRegister = 1 << 6;
-    // Set sector count.
-    commandFIS->set_count(static_cast<u16>(sectors));
-    // Issue command in first slot.
+    if (Queued) {
+        // Queued commands carry the sector count in the feature
+        // register, and their tag (the slot) in the count register.
+        commandFIS->Command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+        commandFIS->set_feature(static_cast<u16>(sectors));
+        commandFIS->set_count(static_cast<u16>(slot << 3));
+        // The device is told about the tag before the HBA is.
+        Port->SataActive = 1u << slot;
+    } else {
+        commandFIS->Command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+        commandFIS->set_count(static_cast<u16>(sectors));
+    }
+    // Writing a one issues the command in that slot and leaves the
+    // others be; `poll_completions()` notices when it is done.
+    Port->CommandIssue = 1u << slot;
+    return true;
+}
+
+bool PortController::command(u8 command, u64 lba, u16 count) {
+    auto* commandHeader = reinterpret_cast<HBACommandHeader*>(Port->command_list_base());
+    commandHeader->CommandFISLength = sizeof(FIS_REG_H2D)/sizeof(u32);
+    commandHeader->Write = 0;
+    commandHeader->PRDTLength = 1;
+
+    auto* commandTable = command_table(0);
+    memset(commandTable, 0, sizeof(HBACommandTable) + sizeof(HBA_PRDTEntry));
+    commandTable->PRDTEntry[0].set_data_base((u64)Buffer);
+    commandTable->PRDTEntry[0].set_byte_count(BYTES_PER_SECTOR - 1);
+    auto* commandFIS = reinterpret_cast<FIS_REG_H2D*>(&commandTable->CommandFIS);
+    commandFIS->Type = FIS_TYPE::REG_H2D;
+    commandFIS->CommandControl = 1;
+    commandFIS->Command = command;
+    commandFIS->set_logical_block_addresses(lba);
+    commandFIS->set_count(count);
+
+    Port->InterruptStatus = (u32)-1;
     Port->CommandIssue = 1;
-    // Wait until command is completed.
-    // TODO: Possibly support yielding here instead of spinning
-    // (requires interrupt handler or something...)
-    while (Port->CommandIssue != 0)
-        if (Port->InterruptStatus & HBA_PxIS_TFES)
-            return false;
-    // Check once more after break that read did not fail.
-    if (Port->InterruptStatus & HBA_PxIS_TFES)
+    const u64 maxSpin = 10000000;
+    u64 spin = 0;
+    while ((Port->CommandIssue & 1) && !(Port->InterruptStatus & HBA_PxIS_TFES) && spin < maxSpin)
+        spin++;
+    if ((Port->CommandIssue & 1) || (Port->TaskFileData & ATA_DEV_ERR)) {
+        DBGMSG("[AHCI]: Port {}: Command {:x} failed\n", PortNumber, u32(command));
+        // Take the command back from the HBA.
+        stop_commands();
+        Port->SataError = (u32)-1;
+        Port->InterruptStatus = (u32)-1;
+        start_commands();
         return false;
-
+    }
     return true;
 }
 
+auto PortController::layout(usz byteOffset, usz byteCount, void* buffer) -> Layout {
+    Layout layout;
+    layout.Sector = byteOffset / BYTES_PER_SECTOR;
+    layout.Head = byteOffset % BYTES_PER_SECTOR;
+    layout.Sectors = (layout.Head + byteCount + BYTES_PER_SECTOR - 1) / BYTES_PER_SECTOR;
+    const usz end = (layout.Head + byteCount) % BYTES_PER_SECTOR;
+
+    auto* data = static_cast<u8*>(buffer);
+    usz left = byteCount;
+    if (layout.Head || (layout.Sectors == 1 && end)) {
+        layout.HeadBounced = true;
+        layout.Vectors[layout.VectorCount++] = { Buffer, BYTES_PER_SECTOR };
+        const usz bytes = std::min(left, usz(BYTES_PER_SECTOR - layout.Head));
+        data += bytes;
+        left -= bytes;
+    }
+    if (left && end) {
+        layout.TailBounced = true;
+        layout.Tail = end;
+        left -= end;
+    }
+    if (left) layout.Vectors[layout.VectorCount++] = { data, left };
+    if (layout.TailBounced) layout.Vectors[layout.VectorCount++] = { Buffer + BYTES_PER_SECTOR, BYTES_PER_SECTOR };
+    return layout;
+}
+
 ssz PortController::read(FileMetadata*, usz byteOffset, usz byteCount, void* buffer) {
     return read_raw(byteOffset, byteCount, buffer);
 }
 
-/// Convert bytes to sectors, then read into and copy from intermediate
-/// `Buffer` to given `buffer` until all data is read and copied.
 ssz PortController::read_raw(usz byteOffset, usz byteCount, void* buffer) {
     DBGMSG("[AHCI]: Port {} -- read()  byteOffset={}, byteCount={}, buffer={}\n"
            , PortNumber
@@ -133,97 +557,26 @@ ssz PortController::read_raw(usz byteOffset, usz byteCount, void* buffer) {
         std::print("  \033[31mERROR\033[0m: `read()`  buffer can not be nullptr\n");
         return -1;
     }
-    // TODO: Don't reject reads over port buffer max size, just do multiple reads and copy as you go.
-    if (byteCount > MAX_READ_BYTES) {
-        std::print("  \033[31mERROR\033[0m: `read()`  byteCount can not be larger than maximum readable bytes.\n");
-        return -1;
-    }
-
-    u64 sector = byteOffset / BYTES_PER_SECTOR;
-    u64 byteOffsetWithinSector = byteOffset % BYTES_PER_SECTOR;
-    u64 sectors = (byteOffsetWithinSector + byteCount + BYTES_PER_SECTOR - 1) / BYTES_PER_SECTOR;
-
-    if (byteOffsetWithinSector + byteCount <= BYTES_PER_SECTOR)
-        sectors = 1;
+    if (!byteCount) return 0;
 
+    const Layout sectors = layout(byteOffset, byteCount, buffer);
     DBGMSG("  Calculated sector data: sector={}, sectors={}, byteOffsetWithinSector={}\n"
-           , sector
-           , sectors
-           , byteOffsetWithinSector
+           , sectors.Sector
+           , sectors.Sectors
+           , sectors.Head
            );
 
-    if (sectors * BYTES_PER_SECTOR > PORT_BUFFER_BYTES) {
-        std::print("  \033[31mERROR\033[0m: `read()`  can not read more bytes than internal buffer size.\n");
+    if (transfer(StorageRequest::Operation::READ, sectors.Sector, sectors.Sectors, sectors.Vectors, sectors.VectorCount) < 0) {
+        DBGMSG("  \033[31mERROR\033[0m: `read()` FAILED\n");
         return -1;
     }
-
-    if (read_low_level(sector, sectors)) {
-        DBGMSG("  \033[32mSUCCESS\033[0m: `read_low_level()` SUCCEEDED\n");
-        void* bufferAddress = (void*)((u64)&Buffer[0] + byteOffsetWithinSector);
-        memcpy(buffer, bufferAddress, byteCount);
-    } else DBGMSG("  \033[31mERROR\033[0m: `read_low_level()` FAILED\n");
-
+    if (sectors.HeadBounced)
+        memcpy(buffer, Buffer + sectors.Head, std::min(byteCount, usz(BYTES_PER_SECTOR - sectors.Head)));
+    if (sectors.TailBounced)
+        memcpy(static_cast<u8*>(buffer) + byteCount - sectors.Tail, Buffer + BYTES_PER_SECTOR, sectors.Tail);
     return byteCount;
 }
 
-bool PortController::write_low_level(u64 sector, u64 sectors) {
-    // Ensure hardware port is not busy by spinning until it isn't, or
-    // giving up.
-    const u64 maxSpin = 1000000;
-    u64 spin = 0;
-    while ((Port->TaskFileData & (ATA_DEV_BUSY | ATA_DEV_DRQ)) && spin < maxSpin)
-        spin++;
-
-    if (spin >= maxSpin) {
-        std::print("[AHCI]:write_low_level(): Device busy, sorry\n");
-        return false;
-    }
-
-    // Disable interrupts during command construction.
-    Port->InterruptStatus = (u32)-1;
-    auto* commandHeader = reinterpret_cast<HBACommandHeader*>(Port->command_list_base());
-    commandHeader->CommandFISLength = sizeof(FIS_REG_H2D)/sizeof(u32);
-    commandHeader->Write = 1;
-    commandHeader->PRDTLength = 1;
-
-    auto* commandTable = reinterpret_cast<HBACommandTable*>(commandHeader->command_table_base());
-    memset(commandTable, 0, sizeof(HBACommandTable) + ((commandHeader->PRDTLength - 1) * sizeof(HBA_PRDTEntry)));
-    commandTable->PRDTEntry[0].set_data_base((u64)Buffer);
-    commandTable->PRDTEntry[0].set_byte_count((sectors << 9) - 1);
-    commandTable->PRDTEntry[0].set_interrupt_on_completion(true);
-    auto* commandFIS = reinterpret_cast<FIS_REG_H2D*>(&commandTable->CommandFIS);
-    commandFIS->Type = FIS_TYPE::REG_H2D;
-    // Take control of command structure.
-    commandFIS->CommandControl = 1;
-    commandFIS->Command = ATA_CMD_WRITE_DMA_EXT;
-    commandFIS->set_logical_block_addresses(sector);
-    // Use lba mode.
-    commandFIS->DeviceRegister = 1 << 6;
-    // Set sector count.
-    commandFIS->set_count(static_cast<u16>(sectors));
-    // Issue command in first slot.
-    Port->CommandIssue = 1;
-
-    // TODO: Possibly support yielding here instead of spinning
-    // (requires interrupt handler or something...)
-
-    // Wait until command is completed.
-    while (Port->CommandIssue != 0)
-        if (Port->InterruptStatus & HBA_PxIS_TFES) {
-            std::print("[AHCI]:write_low_level(): Task File Error, sorry\n");
-            return false;
-        }
-    // Check once more after break that write did not fail.
-    if (Port->InterruptStatus & HBA_PxIS_TFES) {
-        std::print("[AHCI]:write_low_level(): Task File Error, sorry\n");
-        return false;
-    }
-
-    DBGMSG("[AHCI]:write_low_level(): Issued command; no errors\n");
-
-    return true;
-}
-
 ssz PortController::write_raw(usz byteOffset, usz byteCount, void* buffer) {
     DBGMSG("[AHCI]: Port {} -- write()  byteOffset={}, byteCount={}, buffer={}\n"
                , PortNumber
@@ -241,58 +594,40 @@ ssz PortController::write_raw(usz byteOffset, usz byteCount, void* buffer) {
         std::print("  \033[31mERROR\033[0m: `write()`  buffer can not be nullptr\n");
         return -1;
     }
-    // TODO: Don't reject writes over port buffer max size, just do multiple low level writes.
-    if (byteCount > MAX_READ_BYTES) {
-        std::print("  \033[31mERROR\033[0m: `write()`  byteCount can not be larger than maximum readable bytes.\n");
-        return -1;
-    }
-
-    u64 sector = byteOffset / BYTES_PER_SECTOR;
-    u64 byteOffsetWithinSector = byteOffset % BYTES_PER_SECTOR;
-    u64 sectors = (byteOffsetWithinSector + byteCount + BYTES_PER_SECTOR - 1) / BYTES_PER_SECTOR;
-
-    if (byteOffsetWithinSector + byteCount <= BYTES_PER_SECTOR)
-        sectors = 1;
+    if (!byteCount) return 0;
 
+    const Layout sectors = layout(byteOffset, byteCount, buffer);
     DBGMSG("  Calculated sector data: sector={}, sectors={}, byteOffsetWithinSector={}\n"
-               , sector
-               , sectors
-               , byteOffsetWithinSector
+               , sectors.Sector
+               , sectors.Sectors
+               , sectors.Head
                );
 
-    if (sectors * BYTES_PER_SECTOR > PORT_BUFFER_BYTES) {
-        std::print("  \033[31mERROR\033[0m: `write()`  can not write more bytes than internal buffer size.\n");
-        return -1;
-    }
-
-    if (byteOffsetWithinSector || byteCount % BYTES_PER_SECTOR != 0) {
-        // NOTE: We can't just simply call write, because we have to write
-        // a sector at a time. This means we first have to read from the
-        // disk to fill the buffer with the data that *was* there, update
-        // the data within the buffer that needs updating, then write it
-        // back. We can get away with not doing this if both the byte
-        // offset and byte size are equal to zero when modulo sector size.
-        if (!read_low_level(sector, sectors)) {
-            std::print("WRITE: read_low_level(): \033[31mFAILED!\033[m\n");
+    // NOTE: We can't just simply write, because we have to write a
+    // sector at a time. This means we first have to read what *was*
+    // there in the sectors that are only partly overwritten, update
+    // them, then write them back along with the rest.
+    const u64 last = sectors.Sector + sectors.Sectors - 1;
+    if (sectors.HeadBounced) {
+        IOVector head { Buffer, BYTES_PER_SECTOR };
+        if (transfer(StorageRequest::Operation::READ, sectors.Sector, 1, &head, 1) < 0) {
+            std::print("write_raw(): Reading first sector \033[31mFAILED!\033[m\n");
             return -1;
         }
-        DBGMSG("WRITE: read_low_level(): \033[32mSUCCEEDED!\033[m\n");
-
-        // Write overwritten data to buffer.
-        memcpy((u8*)Buffer + byteOffsetWithinSector, (u8*)buffer, byteCount);
-
-        if (!write_low_level(sector, sectors)) {
-            std::print("write_low_level(): \033[31mFAILED!\033[m\n");
+        memcpy(Buffer + sectors.Head, buffer, std::min(byteCount, usz(BYTES_PER_SECTOR - sectors.Head)));
+    }
+    if (sectors.TailBounced) {
+        IOVector tail { Buffer + BYTES_PER_SECTOR, BYTES_PER_SECTOR };
+        if (transfer(StorageRequest::Operation::READ, last, 1, &tail, 1) < 0) {
+            std::print("write_raw(): Reading last sector \033[31mFAILED!\033[m\n");
             return -1;
         }
-        DBGMSG("write_low_level(): \033[32mSUCCEEDED!\033[m\n");
+        memcpy(Buffer + BYTES_PER_SECTOR, static_cast<u8*>(buffer) + byteCount - sectors.Tail, sectors.Tail);
+    }
 
-    } else {
-        if (!write_low_level(sector, sectors)) {
-            std::print("write_low_level(): \033[31mFAILED!\033[m\n");
-            return -1;
-        }
-        DBGMSG("write_low_level(): \033[32mSUCCEEDED!\033[m\n");
+    if (transfer(StorageRequest::Operation::WRITE, sectors.Sector, sectors.Sectors, sectors.Vectors, sectors.VectorCount) < 0) {
+        std::print("write_raw(): \033[31mFAILED!\033[m\n");
+        return -1;
     }
     DBGMSG("write_raw(): \033[32mSUCCEEDED!\033[m\n");
 
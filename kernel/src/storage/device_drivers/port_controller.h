@@ -24,7 +24,7 @@
 namespace AHCI {
 
 struct PortController final : StorageDeviceDriver {
-    PortController(PortType type, u64 portNumber, HBAPort* portAddress);
+    PortController(PortType type, u64 portNumber, HBAMemory* hba);
 
     /// Not valid for this driver, but required by the interface.
     void close(FileMetadata*) final {}
@@ -32,13 +32,35 @@ struct PortController final : StorageDeviceDriver {
         return std::shared_ptr<FileMetadata>{nullptr};
     }
 
-    /// Convert bytes to sectors, then read into and copy from intermediate
-    /// `Buffer` to given `buffer` until all data is read and copied.
+    /// Convert bytes to sectors and have the device transfer them straight
+    /// to or from `buffer`, through `Buffer` only the first and last
+    /// sector if the byte range covers just part of them.
     ssz read(FileMetadata*,usz byteOffset, usz byteCount, void* buffer) final;
     ssz read_raw(usz byteOffset, usz byteCount, void* buffer) final;
     ssz write(FileMetadata*,usz byteOffset, usz byteCount, void* buffer) final;
     ssz write_raw(usz byteOffset, usz byteCount, void* buffer);
 
+    /// Requests are issued as soon as a command slot is free, up to
+    /// `SlotCount` at once. The device transfers the request's buffers
+    /// directly, page by page; a request too big for one command takes
+    /// as many as it needs. When the device supports NCQ, they are
+    /// queued commands it may carry out in any order. Nothing waits for
+    /// the device: finished slots are picked up in `poll_completions()`,
+    /// from the controller's interrupt if it has one, otherwise on each
+    /// timer tick.
+    bool submit(StorageRequest*) final;
+    void poll_completions() final;
+
+    /// Have the port raise an interrupt once a command is done.
+    void enable_interrupts();
+    /// Whether the timer has to call `poll_completions()`: nothing else
+    /// will, or requests wait for the device to stop being busy.
+    bool needs_polling() const { return !Interrupts || (QueueHead && !InFlight); }
+    auto hba() const -> HBAMemory* { return HBA; }
+    auto sector_size() -> usz final { return BYTES_PER_SECTOR; }
+    /// From IDENTIFY; 0 if the device didn't answer it.
+    auto sector_count() -> u64 final { return SectorCount; }
+
     // FIXME: I think there are a max of 32 ports, no? We can
     // probably use something smaller than a u64 here.
     u64 port_number() { return PortNumber; }
@@ -46,22 +68,132 @@ struct PortController final : StorageDeviceDriver {
 private:
     PortType Type { PortType::None };
     u64 PortNumber { 99 };
+    HBAMemory* HBA { nullptr };
     volatile HBAPort* Port { nullptr };
+    bool Interrupts { false };
+    /// The first and last sectors of byte-granular transfers, one
+    /// after the other, and the result of IDENTIFY.
     u8* Buffer { nullptr };
     const u64 BYTES_PER_SECTOR = 512;
-    const u64 PORT_BUFFER_PAGES = 0x100;
-    const u64 PORT_BUFFER_BYTES = PORT_BUFFER_PAGES * 0x1000;
+    u64 SectorCount { 0 };
+
+    /// Each command table is a page: the command FIS, then this many
+    /// PRDT entries, each a physically contiguous run of memory.
+    const u64 PRDT_ENTRIES = (PAGE_SIZE - sizeof(HBACommandTable)) / sizeof(HBA_PRDTEntry);
+    /// At most this many bytes per PRDT entry, and per command that goes
+    /// through a bounce buffer.
+    const u64 MAX_PRDT_BYTES = 4 * 1024 * 1024;
+    const u64 MAX_BOUNCE_BYTES = 0x100 * PAGE_SIZE;
+
+    /// How many command slots are used; the fewest of what the HBA
+    /// and (with NCQ) the device's queue can take.
+    u32 SlotCount { 1 };
+    /// Whether commands are issued as READ/WRITE FPDMA QUEUED.
+    bool Queued { false };
+
+    /// A command in flight: which sectors of which request it carries.
+    struct Command {
+        StorageRequest* Request { nullptr };
+        /// First sector of the command, from the start of the request.
+        u64 Sector { 0 };
+        u64 Sectors { 0 };
+        /// Whether the data goes through the slot's bounce buffer, as
+        /// the request's buffers can't be handed to the device as-is.
+        bool Bounced { false };
+    };
+
+    /// Slots with a command in flight, and the command in each. A
+    /// slot's bounce buffer is allocated the first time it's needed,
+    /// and grown to fit.
+    u32 InFlight { 0 };
+    Command Slots[32] {};
+    u8* SlotBuffers[32] {};
+    u64 SlotBufferPages[32] {};
+
+    /// Requests waiting for a free slot, in the order submitted. Only
+    /// the head may already have some of its commands issued.
+    StorageRequest* QueueHead { nullptr };
+    StorageRequest* QueueTail { nullptr };
+
+    /// How many times in a row the device was found busy with nothing
+    /// of ours in flight; past the limit, the next request fails.
+    u64 BusyPolls { 0 };
+    const u64 MAX_BUSY_POLLS = 1000;
 
-    /// Populate `Buffer` with `sectors` amount of data starting at `sector`.
-    bool read_low_level(u64 sector, u64 sectors);
+    /// Issue queued requests while there are free slots.
+    void start_next();
+    /// Take the head off of the queue.
+    void dequeue();
+    /// Free `slot`, and finish its request if that was the last of it.
+    void complete(u32 slot, bool success);
+    /// Set `Done` and call the completion.
+    void finish(StorageRequest* request);
+    /// Whether what's left of `request` must wait for a command in
+    /// flight: it overlaps it, and one of the two is a write.
+    bool conflicts(const StorageRequest& request);
 
-    /// Write `sectors` data in `Buffer` starting at `sector`.
-    bool write_low_level(u64 sector, u64 sectors);
+    auto command_table(u32 slot) -> HBACommandTable*;
+    /// Fill the PRDT of `slot` with the physical pages behind the
+    /// buffers of `request`, starting `sector` sectors into it, for up
+    /// to `sectors` sectors. Returns how many sectors the entries cover,
+    /// and `entries`; zero if the buffers can't be transferred directly.
+    auto map_vectors(u32 slot, const StorageRequest& request, u64 sector, u64 sectors, u16& entries) -> u64;
+    /// The bounce buffer of `slot`, at least `bytes` large.
+    auto slot_buffer(u32 slot, u64 bytes) -> u8*;
+
+    /// Issue `sectors` sectors starting at `sector` in `slot`, whose
+    /// PRDT has `entries` entries set up.
+    bool issue(u32 slot, u64 sector, u64 sectors, u16 entries, bool write);
+
+    /// Run a non-queued command (IDENTIFY, READ LOG EXT) that reads at
+    /// most one sector into `Buffer`, and spin until it's done. Only
+    /// valid while no other command is in flight.
+    bool command(u8 command, u64 lba, u16 count);
+
+    /// Fail every command in flight after a task file error, and get
+    /// the port (and the device's queue) going again.
+    void recover();
+
+    /// Submit `request` and wait until it completes, for callers that
+    /// can't be put to sleep. The CPU halts until the port interrupts,
+    /// if it can, rather than spin on its registers.
+    ssz transfer(StorageRequest& request);
+    ssz transfer(StorageRequest::Operation op, u64 sector, u64 sectors, const IOVector* vectors, usz count);
+
+    /// A byte range laid out as whole sectors: the first and last one
+    /// go through `Buffer` if only part of them is wanted, everything
+    /// in between straight to or from the caller's buffer.
+    struct Layout {
+        u64 Sector { 0 };
+        u64 Sectors { 0 };
+        /// Bytes of the first sector before the range, and of the last
+        /// one within it if it ends part way through.
+        usz Head { 0 };
+        usz Tail { 0 };
+        bool HeadBounced { false };
+        bool TailBounced { false };
+        IOVector Vectors[3] {};
+        usz VectorCount { 0 };
+    };
+    auto layout(usz byteOffset, usz byteCount, void* buffer) -> Layout;
 
     void start_commands();
     void stop_commands();
 };
 
+/// Check the ports that need it for finished commands; called on each
+/// timer tick.
+void poll_completions();
+
+/// Route the interrupts of every port of `hba` to IRQ `line`, whose
+/// handler is `handle_interrupt()`. Only one controller can interrupt;
+/// the ports of any other are polled.
+void enable_interrupts(HBAMemory* hba, u8 line);
+/// Finish whatever the controller says is done. Called from the IRQ
+/// handler, which then acknowledges `interrupt_line()`.
+void handle_interrupt();
+auto interrupt_line() -> u8;
+
 }
 
 #endif // LENSOROS_PORT_CONTROLLER_H
@@ -0,0 +1,62 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#ifndef LENSOR_OS_RAM_DISK_DRIVER_H
+#define LENSOR_OS_RAM_DISK_DRIVER_H
+
+#include <integers.h>
+#include <memory.h>
+#include <storage/storage_device_driver.h>
+
+#include <algorithm>
+
+/// A read-only disk image the bootloader left in memory. Byte offsets
+/// are offsets into the image, so filesystem drivers can be layered
+/// on top of it just as on a block cache.
+struct RamDiskDriver final : StorageDeviceDriver {
+    RamDiskDriver(const void* image, usz size)
+        : Image(static_cast<const u8*>(image)), Size(size) {}
+
+    /// Required by the interface but not valid for this driver.
+    void close(FileMetadata*) final {}
+    auto open(std::string_view) -> std::shared_ptr<FileMetadata> final { return {}; }
+
+    ssz read(FileMetadata*, usz offs, usz bytes, void* buffer) final {
+        return read_raw(offs, bytes, buffer);
+    }
+    ssz read_raw(usz offs, usz bytes, void* buffer) final {
+        if (!buffer) return -1;
+        if (offs >= Size) return 0;
+        bytes = std::min(bytes, Size - offs);
+        memcpy(buffer, Image + offs, bytes);
+        return ssz(bytes);
+    }
+    ssz write(FileMetadata*, usz, usz, void*) final { return -1; }
+    IOVector borrow(FileMetadata*, usz offs, usz bytes) final {
+        if (offs >= Size) return { nullptr, 0 };
+        return { const_cast<u8*>(Image + offs), std::min(bytes, Size - offs) };
+    }
+
+private:
+    const u8* Image;
+    usz Size;
+};
+
+#endif /* LENSOR_OS_RAM_DISK_DRIVER_H */
@@ -0,0 +1,94 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#ifndef LENSOR_OS_DIRECTORY_ENTRY_H
+#define LENSOR_OS_DIRECTORY_ENTRY_H
+
+#include <integers.h>
+#include <memory.h>
+
+#include <stddef.h>
+#include <string_view>
+
+/* Directory Listing
+ *
+ * `sys$26_getdents` fills a buffer with as many packed `DirectoryEntry`
+ * records as fit, so listing a directory takes one syscall per buffer
+ * rather than one per entry. Each record is `Length` bytes long (a
+ * multiple of eight), and holds the NUL-terminated name of the entry.
+ *
+ * NOTE: Values and layout must match `user/libc/dirent.h`.
+ */
+
+#define DIRECTORY_ENTRY_UNKNOWN   0
+#define DIRECTORY_ENTRY_DIRECTORY 4
+#define DIRECTORY_ENTRY_FILE      8
+
+struct DirectoryEntry {
+    /// Filesystem specific identity of the entry.
+    u64 Inode;
+    /// Cursor of the entry that follows this one.
+    u64 Next;
+    /// Length of the whole record, name and padding included.
+    u16 Length;
+    /// DIRECTORY_ENTRY_*
+    u8 Type;
+    char Name[];
+};
+
+/// Packs `DirectoryEntry` records into a buffer; see
+/// `FilesystemDriver::read_directory`.
+class DirectoryEntryWriter {
+    u8* Buffer;
+    usz Capacity;
+    usz Used { 0 };
+    bool Full { false };
+
+public:
+    DirectoryEntryWriter(void* buffer, usz capacity)
+        : Buffer(static_cast<u8*>(buffer)), Capacity(capacity) {}
+
+    /// Append a record, unless it doesn't fit, in which case nothing is
+    /// written and the writer is full; stop adding and leave the entry
+    /// for the next call.
+    bool add(u64 inode, u64 next, u8 type, std::string_view name) {
+        const usz length = (offsetof(DirectoryEntry, Name) + name.size() + 1 + 7) & ~usz(7);
+        if (Full || length > Capacity - Used || length > u16(-1)) {
+            Full = true;
+            return false;
+        }
+        auto* entry = reinterpret_cast<DirectoryEntry*>(Buffer + Used);
+        entry->Inode = inode;
+        entry->Next = next;
+        entry->Length = u16(length);
+        entry->Type = type;
+        memcpy(entry->Name, name.data(), name.size());
+        memset(entry->Name + name.size(), 0, length - offsetof(DirectoryEntry, Name) - name.size());
+        Used += length;
+        return true;
+    }
+
+    /// Bytes of records written so far.
+    auto size() const -> usz { return Used; }
+    /// Whether an entry was left out for lack of space.
+    bool full() const { return Full; }
+};
+
+#endif /* LENSOR_OS_DIRECTORY_ENTRY_H */
@@ -36,8 +36,10 @@ struct FileMetadata {
                  , std::shared_ptr<StorageDeviceDriver> dev_driver
                  , u64 file_size
                  , void* driver_data
+                 , bool directory = false
                  )
         : Name(std::move(name)), Invalid(false)
+        , Directory(directory)
         , DeviceDriver(std::move(dev_driver))
         , FileSize(file_size)
         , DriverData(driver_data) {}
@@ -50,17 +52,21 @@ struct FileMetadata {
         }
     }
 
-    usz offset { 0 };
-
     auto name() -> std::string_view { return Name; }
     auto invalid() -> bool { return Invalid; }
-    auto device_driver() -> std::shared_ptr<StorageDeviceDriver>  { return DeviceDriver; }
+    /// Only filesystem drivers create directories, so the device
+    /// driver of one is always a `FilesystemDriver`.
+    auto directory() -> bool { return Directory; }
+    auto device_driver() -> const std::shared_ptr<StorageDeviceDriver>& { return DeviceDriver; }
     auto file_size() -> u64 { return FileSize; }
+    /// For drivers whose files change size while open.
+    void set_file_size(u64 size) { FileSize = size; }
     auto driver_data() -> void* { return DriverData; }
 
 private:
     std::string Name;
     bool Invalid = true;
+    bool Directory = false;
     // The device driver is used for reading and writing from and to
     // the file.
     std::shared_ptr<StorageDeviceDriver> DeviceDriver { nullptr };
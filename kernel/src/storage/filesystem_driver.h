@@ -20,12 +20,29 @@
 #ifndef LENSOR_OS_FILESYSTEM_DRIVER_H
 #define LENSOR_OS_FILESYSTEM_DRIVER_H
 
+#include <storage/directory_entry.h>
 #include <storage/storage_device_driver.h>
 #include <string>
 
 struct FilesystemDriver : StorageDeviceDriver {
     virtual auto device() -> std::shared_ptr<StorageDeviceDriver> = 0;
     virtual auto name() -> const char* = 0;
+
+    /// Create an empty file (directory) at `path`, whose parent
+    /// directory must exist. Filesystems that can't, don't.
+    virtual auto create(std::string_view /* path */) -> std::shared_ptr<FileMetadata> { return {}; }
+    virtual bool make_directory(std::string_view /* path */) { return false; }
+
+    /// Make `file` exactly `size` bytes long. What it grows by reads
+    /// as zeroes.
+    virtual bool truncate(FileMetadata* /* file */, usz /* size */) { return false; }
+
+    /// Add records to `out` for the entries of `directory`, beginning
+    /// with the one at `cursor`, until it is full or there are no more.
+    /// Then set `cursor` to the first entry not added. What a cursor
+    /// means is up to the driver; zero is always the first entry.
+    /// @return false if the directory can't be read.
+    virtual bool read_directory(FileMetadata* /* directory */, usz& /* cursor */, DirectoryEntryWriter&) { return false; }
 };
 
 #endif /* LENSOR_OS_FILESYSTEM_DRIVER_H */
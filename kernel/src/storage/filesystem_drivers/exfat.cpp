@@ -0,0 +1,434 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#include <storage/filesystem_drivers/exfat.h>
+
+#include <fat_definitions.h>
+#include <integers.h>
+#include <memory.h>
+#include <system.h>
+#include <virtual_filesystem.h>
+
+#include <algorithm>
+#include <format>
+#include <memory>
+#include <string_view>
+
+// Uncomment the following directive for extra debug information output.
+//#define DEBUG_EXFAT
+
+#ifdef DEBUG_EXFAT
+#   define DBGMSG(...) std::print(__VA_ARGS__)
+#else
+#   define DBGMSG(...)
+#endif
+
+/// An entry set is a file entry, a stream extension entry, and up to
+/// 17 file name entries (of 15 characters each).
+#define ExFAT_MAX_ENTRY_SET 19
+#define ExFAT_ENTRY_SIZE 32
+
+/// Only ASCII is up-cased; the volume's up-case table isn't read.
+static auto upcase(u16 c) -> u16 {
+    return c >= 'a' && c <= 'z' ? u16(c - 32) : c;
+}
+
+/// The NameHash of a stream extension entry whose name is `name`.
+static auto name_hash(std::string_view name) -> u16 {
+    u16 hash = 0;
+    for (usz i = 0; i < name.size(); ++i) {
+        const u16 c = upcase(u8(name[i]));
+        hash = u16(((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c & 0xff));
+        hash = u16(((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c >> 8));
+    }
+    return hash;
+}
+
+/// Character `i` of the name spread over the file name entries of `set`.
+static auto name_character(const u8* set, usz i) -> u16 {
+    const u8* entry = set + (2 + i / 15) * ExFAT_ENTRY_SIZE;
+    const usz at = 2 + (i % 15) * 2;
+    return u16(entry[at] | entry[at + 1] << 8);
+}
+
+auto ExFATDriver::try_create(std::shared_ptr<StorageDeviceDriver> device) -> std::shared_ptr<FilesystemDriver> {
+    if (!device) return nullptr;
+
+    u8 sector[512];
+    if (device->read_raw(0, sizeof sector, sector) != sizeof sector) return nullptr;
+    ExFATBootRecord br;
+    memcpy(&br, sector, sizeof br);
+    const u16 magic = u16(sector[510] | sector[511] << 8);
+    if (magic != 0xaa55
+        || std::string_view(reinterpret_cast<const char*>(br.OEMID), 8) != std::string_view("EXFAT   ")
+        || br.SectorShift < 9 || br.SectorShift > 12
+        || br.ClusterShift > 25 - br.SectorShift
+        || br.NumFATsPresent < 1 || br.NumFATsPresent > 2
+        || br.NumClusters == 0
+        || br.RootDirectoryCluster < 2 || br.RootDirectoryCluster >= u64(br.NumClusters) + 2)
+        return nullptr;
+
+    auto fs = std::shared_ptr<ExFATDriver>(new ExFATDriver(std::move(device), br));
+    fs->This = fs;
+    if (!fs->load_bitmap()) return nullptr;
+    std::print("[EXFAT]: {} clusters of {} bytes, {} free\n", u32(br.NumClusters), fs->cluster_bytes(), fs->FreeClusters);
+    return std::static_pointer_cast<FilesystemDriver>(fs);
+}
+
+auto ExFATDriver::next_cluster(u32 cluster) -> u32 {
+    if (cluster < 2 || cluster >= u64(BR.NumClusters) + 2) return ExFAT_END_OF_CHAIN;
+    u32 value = 0;
+    const u64 offset = u64(BR.FATsectorOffset) * sector_bytes() + u64(cluster) * 4;
+    if (Device->read_raw(offset, sizeof value, &value) != sizeof value) return ExFAT_END_OF_CHAIN;
+    // Bad clusters, the end of a chain, and nonsense all end it.
+    if (value < 2 || value >= u64(BR.NumClusters) + 2) return ExFAT_END_OF_CHAIN;
+    return value;
+}
+
+auto ExFATDriver::root() -> ExFATFile {
+    ExFATFile file;
+    file.FirstCluster = BR.RootDirectoryCluster;
+    file.DataLength = u64(-1);
+    file.ValidDataLength = u64(-1);
+    return file;
+}
+
+void ExFATDriver::map_extents(ExFATFile* file) {
+    if (file->Mapped || file->Contiguous) return;
+    file->Mapped = true;
+    if (file->FirstCluster < 2) return;
+
+    // Guard against cycles in a corrupt FAT: no chain is longer than
+    // the volume has clusters.
+    const u64 limit = BR.NumClusters;
+    u64 index = 0;
+    for (u32 cluster = file->FirstCluster; cluster != ExFAT_END_OF_CHAIN && index < limit; cluster = next_cluster(cluster), ++index) {
+        if (file->Extents.size()) {
+            ExFATExtent& last = file->Extents[file->Extents.size() - 1];
+            if (cluster == last.Cluster + last.Length) {
+                ++last.Length;
+                continue;
+            }
+        }
+        file->Extents.push_back({ index, cluster, 1 });
+    }
+    DBGMSG("[EXFAT]: Mapped {} clusters in {} extents\n", index, file->Extents.size());
+}
+
+auto ExFATDriver::locate(ExFATFile* file, usz offs, usz bytes, usz& contiguous) -> u64 {
+    contiguous = 0;
+    if (file->FirstCluster < 2) return u64(-1);
+    const u64 clusterSize = cluster_bytes();
+
+    // No FAT walk at all: the file is one run from its first cluster.
+    if (file->Contiguous) {
+        const u64 allocated = (file->DataLength + clusterSize - 1) / clusterSize * clusterSize;
+        if (offs >= allocated) return u64(-1);
+        contiguous = std::min(usz(allocated - offs), bytes);
+        return cluster_offset(file->FirstCluster) + offs;
+    }
+
+    map_extents(file);
+    const auto& extents = file->Extents;
+    if (extents.empty()) return u64(-1);
+
+    // Last extent that begins at or before the cluster `offs` is in.
+    const u64 fileCluster = offs / clusterSize;
+    usz low = 0;
+    usz high = extents.size();
+    while (high - low > 1) {
+        usz middle = low + (high - low) / 2;
+        if (extents[middle].FileCluster <= fileCluster) low = middle;
+        else high = middle;
+    }
+    const ExFATExtent& extent = extents[low];
+    if (fileCluster >= extent.FileCluster + extent.Length) return u64(-1);
+
+    const u64 offsetInExtent = offs - extent.FileCluster * clusterSize;
+    contiguous = std::min(usz(extent.Length * clusterSize - offsetInExtent), bytes);
+    return cluster_offset(extent.Cluster) + offsetInExtent;
+}
+
+auto ExFATDriver::read_clusters(ExFATFile* file, usz offs, usz bytes, void* buffer) -> ssz {
+    usz done = 0;
+    while (done < bytes) {
+        usz contiguous = 0;
+        const u64 at = locate(file, offs + done, bytes - done, contiguous);
+        if (at == u64(-1)) break;
+        ssz n = Device->read_raw(at, contiguous, static_cast<u8*>(buffer) + done);
+        if (n < 0) return done ? ssz(done) : n;
+        done += usz(n);
+        if (usz(n) < contiguous) break;
+    }
+    return ssz(done);
+}
+
+bool ExFATDriver::load_bitmap() {
+    // The bitmap has an entry of its own in the root directory.
+    ExFATFile directory = root();
+    ExFATBitmapEntry entry{};
+    bool found = false;
+    std::vector<u8> chunk;
+    chunk.resize(cluster_bytes());
+    for (u64 offs = 0; !found; offs += chunk.size()) {
+        ssz n = read_clusters(&directory, offs, chunk.size(), chunk.data());
+        if (n <= 0) break;
+        for (usz i = 0; i + ExFAT_ENTRY_SIZE <= usz(n); i += ExFAT_ENTRY_SIZE) {
+            if (chunk[i] == ExFAT_ENTRY_END_OF_DIRECTORY) break;
+            // With two FATs, there are two bitmaps; the first is for the first.
+            if (chunk[i] == ExFAT_ENTRY_BITMAP && !(chunk[i + 1] & 1)) {
+                memcpy(&entry, &chunk[i], sizeof entry);
+                found = true;
+                break;
+            }
+        }
+        if (usz(n) < chunk.size()) break;
+    }
+    if (!found) {
+        std::print("[EXFAT]: No allocation bitmap in root directory\n");
+        return false;
+    }
+
+    const u64 bytes = (u64(BR.NumClusters) + 7) / 8;
+    if (entry.DataLength < bytes) return false;
+    Bitmap.resize(bytes);
+    ExFATFile bitmap;
+    bitmap.FirstCluster = entry.FirstCluster;
+    bitmap.DataLength = entry.DataLength;
+    bitmap.ValidDataLength = entry.DataLength;
+    if (read_clusters(&bitmap, 0, bytes, Bitmap.data()) != ssz(bytes)) {
+        std::print("[EXFAT]: Failed to read allocation bitmap\n");
+        return false;
+    }
+
+    u64 used = 0;
+    for (u64 cluster = 0; cluster < BR.NumClusters; ++cluster)
+        if (Bitmap[cluster / 8] & (1 << (cluster % 8))) ++used;
+    FreeClusters = BR.NumClusters - used;
+    return true;
+}
+
+template <typename Visit>
+void ExFATDriver::scan_directory(ExFATFile* directory, Visit visit) {
+    std::vector<u8> chunk;
+    chunk.resize(cluster_bytes());
+    // A set may straddle clusters, so it's collected by copy.
+    u8 set[ExFAT_MAX_ENTRY_SET * ExFAT_ENTRY_SIZE];
+    usz collected = 0;
+    usz wanted = 0;
+    u64 setIndex = 0;
+    u64 index = 0;
+    for (u64 offs = 0; offs < directory->DataLength; offs += chunk.size()) {
+        const usz bytes = usz(std::min(u64(chunk.size()), directory->DataLength - offs));
+        ssz n = read_clusters(directory, offs, bytes, chunk.data());
+        if (n <= 0) return;
+        for (usz i = 0; i + ExFAT_ENTRY_SIZE <= usz(n); i += ExFAT_ENTRY_SIZE, ++index) {
+            const u8 type = chunk[i];
+            if (type == ExFAT_ENTRY_END_OF_DIRECTORY) return;
+            if (wanted) {
+                // Secondary entries in use all have the top two bits set.
+                if ((type & 0xc0) == 0xc0) {
+                    memcpy(set + collected * ExFAT_ENTRY_SIZE, &chunk[i], ExFAT_ENTRY_SIZE);
+                    if (++collected == wanted) {
+                        wanted = 0;
+                        if (!visit(static_cast<const u8*>(set), collected, setIndex)) return;
+                    }
+                    continue;
+                }
+                // A broken set; whatever this is starts afresh.
+                wanted = 0;
+            }
+            if (type == ExFAT_ENTRY_FILE) {
+                const usz secondaries = chunk[i + 1];
+                if (secondaries < 2 || secondaries >= ExFAT_MAX_ENTRY_SET) continue;
+                memcpy(set, &chunk[i], ExFAT_ENTRY_SIZE);
+                collected = 1;
+                wanted = secondaries + 1;
+                setIndex = index;
+            }
+        }
+        if (usz(n) < bytes) return;
+    }
+}
+
+auto ExFATDriver::find_in_directory(ExFATFile* directory, std::string_view name) -> DentryCacheEntry {
+    DentryCacheEntry result{};
+    result.Negative = true;
+
+    // The length and hash of a name are in its stream entry, so only
+    // names that match both are ever compared.
+    const u16 hash = name_hash(name);
+    scan_directory(directory, [&](const u8* set, usz count, u64) {
+        auto* stream = reinterpret_cast<const ExFATStreamExtensionEntry*>(set + ExFAT_ENTRY_SIZE);
+        if (stream->Type != ExFAT_ENTRY_STREAM || stream->NameLength != name.size() || stream->NameHash != hash)
+            return true;
+        if (name.size() > (count - 2) * 15) return true;
+        for (usz i = 0; i < name.size(); ++i)
+            if (upcase(name_character(set, i)) != upcase(u8(name[i]))) return true;
+
+        auto* file = reinterpret_cast<const ExFATFileEntry*>(set);
+        result.Negative = false;
+        result.Directory = file->Attributes & ExFAT_ATTR_DIRECTORY;
+        result.Inode = stream->FirstCluster;
+        result.FileSize = stream->DataLength;
+        // Enough to read the file without finding its entry again.
+        result.DriverData = stream->ValidDataLength << 1 | (stream->SecondaryFlags & ExFAT_FLAG_NO_FAT_CHAIN ? 1 : 0);
+        return false;
+    });
+    return result;
+}
+
+auto ExFATDriver::open(std::string_view path) -> std::shared_ptr<FileMetadata> {
+    DentryCache& dentries = SYSTEM->virtual_filesystem().dentries();
+    auto file_of = [](const DentryCacheEntry& entry) {
+        ExFATFile file;
+        file.FirstCluster = u32(entry.Inode);
+        file.DataLength = entry.FileSize;
+        file.ValidDataLength = entry.DriverData >> 1;
+        file.Contiguous = entry.DriverData & 1;
+        return file;
+    };
+
+    ExFATFile directory = root();
+    DentryCacheEntry found{};
+    std::string_view name;
+    bool any = false;
+    while (path.size()) {
+        if (path[0] == '/') {
+            path.remove_prefix(1);
+            continue;
+        }
+        if (any) {
+            if (!found.Directory) return {};
+            directory = file_of(found);
+        }
+        const usz end = std::min(path.find('/'), path.size());
+        name = path.substr(0, end);
+        path.remove_prefix(end);
+
+        if (const auto* cached = dentries.lookup(this, directory.FirstCluster, name))
+            found = *cached;
+        else {
+            found = find_in_directory(&directory, name);
+            dentries.insert(this, directory.FirstCluster, name, found);
+        }
+        if (found.Negative) return {};
+        any = true;
+    }
+
+    if (!any) return std::make_shared<FileMetadata>("", sdd(This.lock()), 0, new ExFATFile(root()), true);
+    return std::make_shared<FileMetadata>(std::string(name), sdd(This.lock()), found.FileSize, new ExFATFile(file_of(found)), found.Directory);
+}
+
+bool ExFATDriver::read_directory(FileMetadata* directory, usz& cursor, DirectoryEntryWriter& out) {
+    if (!directory->directory()) return false;
+    auto* data = static_cast<ExFATFile*>(directory->driver_data());
+
+    // The cursor counts entries (not sets) from the start of the directory.
+    scan_directory(data, [&](const u8* set, usz count, u64 index) {
+        if (index < cursor) return true;
+        auto* file = reinterpret_cast<const ExFATFileEntry*>(set);
+        auto* stream = reinterpret_cast<const ExFATStreamExtensionEntry*>(set + ExFAT_ENTRY_SIZE);
+        if (stream->Type != ExFAT_ENTRY_STREAM) return true;
+        std::string name;
+        for (usz i = 0; i < stream->NameLength && i < (count - 2) * 15; ++i) {
+            const u16 c = name_character(set, i);
+            name += c < 0x80 ? char(c) : '?';
+        }
+        u8 type = file->Attributes & ExFAT_ATTR_DIRECTORY ? DIRECTORY_ENTRY_DIRECTORY : DIRECTORY_ENTRY_FILE;
+        if (!out.add(stream->FirstCluster, index + count, type, name)) return false;
+        cursor = usz(index + count);
+        return true;
+    });
+    return true;
+}
+
+ssz ExFATDriver::read(FileMetadata* file, usz offs, usz bytes, void* buffer) {
+    if (file->directory()) return -1;
+    auto* data = static_cast<ExFATFile*>(file->driver_data());
+    if (offs >= data->DataLength) return 0;
+    bytes = std::min(bytes, usz(data->DataLength - offs));
+
+    // Past the valid data length, nothing was ever written.
+    const usz valid = offs < data->ValidDataLength ? std::min(bytes, usz(data->ValidDataLength - offs)) : 0;
+    usz done = 0;
+    while (done < valid) {
+        usz contiguous = 0;
+        const u64 at = locate(data, offs + done, valid - done, contiguous);
+        if (at == u64(-1)) break;
+        ssz n = Device->read(file, at, contiguous, static_cast<u8*>(buffer) + done);
+        if (n < 0) return done ? ssz(done) : n;
+        done += usz(n);
+        if (usz(n) < contiguous) break;
+    }
+    if (done < valid) return ssz(done);
+    memset(static_cast<u8*>(buffer) + valid, 0, bytes - valid);
+    return ssz(bytes);
+}
+
+IOVector ExFATDriver::borrow(FileMetadata* file, usz offs, usz bytes) {
+    if (file->directory()) return { nullptr, 0 };
+    auto* data = static_cast<ExFATFile*>(file->driver_data());
+    if (offs >= data->ValidDataLength || offs >= data->DataLength) return { nullptr, 0 };
+    usz contiguous = 0;
+    const u64 at = locate(data, offs, std::min(bytes, usz(std::min(data->ValidDataLength, data->DataLength) - offs)), contiguous);
+    if (at == u64(-1)) return { nullptr, 0 };
+    return Device->borrow(file, at, contiguous);
+}
+
+void ExFATDriver::prefetch(FileMetadata* file, usz offs, usz bytes) {
+    if (file->directory()) return;
+    auto* data = static_cast<ExFATFile*>(file->driver_data());
+    const u64 end = std::min(data->ValidDataLength, data->DataLength);
+    if (offs >= end) return;
+    bytes = std::min(bytes, usz(end - offs));
+    // One batch for the device, however fragmented the file.
+    Device->plug();
+    usz done = 0;
+    while (done < bytes) {
+        usz contiguous = 0;
+        const u64 at = locate(data, offs + done, bytes - done, contiguous);
+        if (at == u64(-1)) break;
+        Device->prefetch(file, at, contiguous);
+        done += contiguous;
+    }
+    Device->unplug();
+}
+
+ssz ExFATDriver::write(FileMetadata* file, usz offs, usz bytes, void* buffer) {
+    // Only what the file already holds can be overwritten; growing it
+    // would mean allocating from the bitmap and rewriting its entry set.
+    if (file->directory()) return -1;
+    auto* data = static_cast<ExFATFile*>(file->driver_data());
+    const u64 end = std::min(data->ValidDataLength, data->DataLength);
+    if (offs >= end) return -1;
+    bytes = std::min(bytes, usz(end - offs));
+    usz done = 0;
+    while (done < bytes) {
+        usz contiguous = 0;
+        const u64 at = locate(data, offs + done, bytes - done, contiguous);
+        if (at == u64(-1)) break;
+        ssz n = Device->write(file, at, contiguous, static_cast<u8*>(buffer) + done);
+        if (n < 0) return done ? ssz(done) : n;
+        done += usz(n);
+        if (usz(n) < contiguous) break;
+    }
+    return done ? ssz(done) : -1;
+}
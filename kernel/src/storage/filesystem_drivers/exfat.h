@@ -0,0 +1,150 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#ifndef LENSOR_OS_EXFAT_DRIVER_H
+#define LENSOR_OS_EXFAT_DRIVER_H
+
+#include <fat_definitions.h>
+#include <integers.h>
+#include <storage/dentry_cache.h>
+#include <storage/file_metadata.h>
+#include <storage/filesystem_driver.h>
+#include <storage/storage_device_driver.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Returned by `ExFATDriver::next_cluster()` past the last cluster of
+/// a chain.
+#define ExFAT_END_OF_CHAIN u32(-1)
+
+/// A run of physically contiguous clusters of a file.
+struct ExFATExtent {
+    /// Index of the first cluster of the run within the file.
+    u64 FileCluster;
+    u32 Cluster;
+    u32 Length;
+};
+
+/// What an `ExFATDriver` keeps per open file, as the file's driver data.
+struct ExFATFile {
+    u32 FirstCluster { 0 };
+    /// Bytes allocated to the file; for the root directory, which has
+    /// no stream entry to say, -1 (its chain ends it).
+    u64 DataLength { 0 };
+    /// Bytes written; anything past this up to DataLength reads as zeroes.
+    u64 ValidDataLength { 0 };
+    /// NoFatChain: the clusters are contiguous and not in the FAT.
+    bool Contiguous { false };
+    /// For files that do have a chain, the whole of it, in order. Built
+    /// by walking the FAT the first time the file's data is needed.
+    std::vector<ExFATExtent> Extents{};
+    bool Mapped { false };
+};
+
+/// Extended File Allocation Table filesystem. Unlike FAT12/16/32 there
+/// is no limit of 4GiB to a file, files whose clusters are contiguous
+/// (most of them) aren't in the FAT at all, and which clusters are in
+/// use is kept in an allocation bitmap rather than the FAT.
+///
+/// Files can be read, and overwritten within what they already hold;
+/// nothing can be created or grown yet.
+class ExFATDriver final : public FilesystemDriver {
+    explicit ExFATDriver(std::shared_ptr<StorageDeviceDriver>&& device, const ExFATBootRecord& br)
+        : Device(std::move(device)), BR(br) {}
+
+    /// Weak reference to ourselves, handed to every file we open.
+    /// See `FileAllocationTableDriver::This`.
+    std::weak_ptr<ExFATDriver> This{};
+
+    std::shared_ptr<StorageDeviceDriver> Device{};
+    ExFATBootRecord BR{};
+
+    /// One bit per cluster of the heap (cluster 2 is bit zero), set if
+    /// the cluster is in use. Read from the volume at mount time.
+    std::vector<u8> Bitmap{};
+    u64 FreeClusters { 0 };
+
+    auto sector_bytes() const -> u64 { return u64(1) << BR.SectorShift; }
+    auto cluster_bytes() const -> u64 { return u64(1) << (BR.SectorShift + BR.ClusterShift); }
+    /// Byte offset of `cluster` on the device.
+    auto cluster_offset(u32 cluster) const -> u64 {
+        return u64(BR.ClusterHeapSectorOffset) * sector_bytes() + u64(cluster - 2) * cluster_bytes();
+    }
+
+    /// The cluster after `cluster` in its chain, or ExFAT_END_OF_CHAIN.
+    auto next_cluster(u32 cluster) -> u32;
+
+    /// Find the allocation bitmap in the root directory and read it.
+    bool load_bitmap();
+
+    /// Build the extent map of `file`, if it has a chain and that wasn't
+    /// done yet.
+    void map_extents(ExFATFile* file);
+
+    /// Where the data of `file` at `offs` is on the device, and how many
+    /// bytes from there on are contiguous (up to `bytes`). For NoFatChain
+    /// files, plain arithmetic; otherwise a search of the extents.
+    /// Returns -1 past the end of the file's clusters.
+    auto locate(ExFATFile* file, usz offs, usz bytes, usz& contiguous) -> u64;
+
+    /// Read up to `bytes` bytes of `file`'s clusters at `offs`, without
+    /// regard to its lengths (for directories).
+    auto read_clusters(ExFATFile* file, usz offs, usz bytes, void* buffer) -> ssz;
+
+    /// Call `visit(entries, count, index)` for each set of directory
+    /// entries (a file entry and its secondaries, `count` in all) in
+    /// `directory`, as long as it returns true. `index` counts entries
+    /// from the start of the directory.
+    template <typename Visit>
+    void scan_directory(ExFATFile* directory, Visit visit);
+
+    /// Look `name` up in `directory`.
+    auto find_in_directory(ExFATFile* directory, std::string_view name) -> DentryCacheEntry;
+
+    auto root() -> ExFATFile;
+
+public:
+    /// Returns nullptr unless there is an exFAT volume on `device`.
+    static auto try_create(std::shared_ptr<StorageDeviceDriver> device) -> std::shared_ptr<FilesystemDriver>;
+
+    auto open(std::string_view path) -> std::shared_ptr<FileMetadata> final;
+    void close(FileMetadata* file) final {
+        delete static_cast<ExFATFile*>(file->driver_data());
+        Device->close(file);
+    }
+    bool read_directory(FileMetadata* directory, usz& cursor, DirectoryEntryWriter& out) final;
+
+    ssz read(FileMetadata* file, usz offs, usz bytes, void* buffer) final;
+    ssz read_raw(usz offs, usz bytes, void* buffer) final { return Device->read_raw(offs, bytes, buffer); }
+    ssz write(FileMetadata* file, usz offs, usz bytes, void* buffer) final;
+    IOVector borrow(FileMetadata* file, usz offs, usz bytes) final;
+    void prefetch(FileMetadata* file, usz offs, usz bytes) final;
+
+    const char* name() final { return "Extended File Allocation Table"; }
+
+    auto device() -> std::shared_ptr<StorageDeviceDriver> final { return Device; }
+
+    auto free_clusters() const -> u64 { return FreeClusters; }
+};
+
+#endif /* LENSOR_OS_EXFAT_DRIVER_H */
@@ -17,13 +17,17 @@
  * along with LensorOS. If not, see <https://www.gnu.org/licenses
  */
 
+#include <algorithm>
 #include <fat_definitions.h>
 #include <format>
 #include <integers.h>
 #include <memory>
 #include <storage/file_metadata.h>
+#include <storage/filesystem_drivers/exfat.h>
 #include <storage/filesystem_drivers/file_allocation_table.h>
 #include <string>
+#include <system.h>
+#include <virtual_filesystem.h>
 #include <vector>
 
 // Uncomment the following directive for extra debug information output.
@@ -93,6 +97,10 @@ auto FileAllocationTableDriver::try_create(std::shared_ptr<StorageDeviceDriver>
         return nullptr;
     }
 
+    // exFAT only looks like FAT from afar; it has a driver of its own.
+    if (std::string_view(reinterpret_cast<const char*>(br.BPB.OEMID), 8) == std::string_view("EXFAT   "))
+        return ExFATDriver::try_create(std::move(driver));
+
     u64 totalSectors = br.BPB.TotalSectors16 == 0
                        ? br.BPB.TotalSectors32
                        : br.BPB.TotalSectors16;
@@ -134,6 +142,7 @@ auto FileAllocationTableDriver::try_create(std::shared_ptr<StorageDeviceDriver>
 
     auto fs = std::make_shared<FileAllocationTableDriver>(std::move(driver), std::move(br));
     fs->This = fs;
+    if (!fs->load_table() || !fs->load_free_map()) return nullptr;
     return std::static_pointer_cast<FilesystemDriver>(fs);
 }
 
@@ -147,6 +156,13 @@ auto FileAllocationTableDriver::translate_filename(std::string_view raw_filename
     for (usz i = 0; i < path.size(); ++i)
         if (path[i] >= 97 && path[i] <= 122) path[i] -= 32;
 
+    // "." and ".." are stored as they are, padded.
+    if (path == "." || path == "..") {
+        for (usz i = path.size(); i < 11; ++i)
+            path += ' ';
+        return path;
+    }
+
     // Check if filename is in valid 8.3 format already
     if (path.size() == 12 && path[8] == '.') {
         // Erase period from name (i.e. "ABCDEFGH.IJK" -> "ABCDEFGHIJK")
@@ -174,7 +190,7 @@ auto FileAllocationTableDriver::translate_filename(std::string_view raw_filename
             // Need to return computer-generated filename or the LFN,
             // or something.
             if (last_dot > 8) {
-                std::print("[FAT]: TODO: translate_filename() computer-generated 8.3 filenames... (path short, name long)\n");
+                DBGMSG("[FAT]: TODO: translate_filename() computer-generated 8.3 filenames... (path short, name long)\n");
                 return "INVALID_TRANSLATION";
             }
 
@@ -192,7 +208,10 @@ auto FileAllocationTableDriver::translate_filename(std::string_view raw_filename
             // Truncate to three bytes (over-long extension).
             extension = extension.substr(0, 3);
 
-            name = path.substr(0, 8);
+            // The name is padded with spaces to eight bytes, too.
+            name = path.substr(0, last_dot);
+            for (size_t i = name.size(); i < 8; ++i)
+                name += ' ';
 
             DBGMSG("[FAT]: Got name \"{}\" and extension \"{}\"\n", name, extension);
 
@@ -203,7 +222,7 @@ auto FileAllocationTableDriver::translate_filename(std::string_view raw_filename
 
             // If it is longer than eight bytes, make computer-generated filename...
             if (path.size() > 11) {
-                std::print("[FAT]: TODO: translate_filename() computer-generated 8.3 filenames... (path short, name long, no extension)\n");
+                DBGMSG("[FAT]: TODO: translate_filename() computer-generated 8.3 filenames... (path short, name long, no extension)\n");
                 return "INVALID_TRANSLATION";
             }
 
@@ -219,113 +238,507 @@ auto FileAllocationTableDriver::translate_filename(std::string_view raw_filename
         // Name is too long, have to do computer-generated short file
         // name, or look for long file name entry... it really depends
         // on where this is called from.
-        std::print("[FAT]: TODO: translate_filename() computer-generated 8.3 filenames... (path long)\n");
+        DBGMSG("[FAT]: TODO: translate_filename() computer-generated 8.3 filenames... (path long)\n");
 
         return "INVALID_TRANSLATION";
     }
     // UNREACHABLE();
 }
 
+bool FileAllocationTableDriver::load_table() {
+    if (Type != FATType::FAT12 && Type != FATType::FAT16) return true;
+    const u64 bytes = BR.fat_sectors() * BR.BPB.NumBytesPerSector;
+    Table.resize(bytes);
+    const u64 offset = BR.BPB.first_fat_sector() * BR.BPB.NumBytesPerSector;
+    if (Device->read_raw(offset, bytes, Table.data()) != ssz(bytes)) {
+        std::print("[FAT]: Failed to read {} byte FAT\n", bytes);
+        return false;
+    }
+    return true;
+}
+
+bool FileAllocationTableDriver::load_free_map() {
+    const u64 clusters = BR.total_clusters() + 2;
+    FreeMap.clear();
+    FreeMap.resize((clusters + 63) / 64, 0);
+    FreeClusters = 0;
+    auto mark_free = [this](u64 cluster) {
+        FreeMap[cluster / 64] |= u64(1) << (cluster % 64);
+        ++FreeClusters;
+    };
+
+    if (Type == FATType::FAT32) {
+        // Stream the table through one buffer rather than the windows;
+        // all of it is needed exactly once.
+        std::vector<u8> chunk;
+        chunk.resize(FAT_TABLE_WINDOW_SIZE);
+        const u64 tableBytes = std::min(clusters * 4, BR.fat_sectors() * BR.BPB.NumBytesPerSector);
+        const u64 tableOffset = BR.BPB.first_fat_sector() * BR.BPB.NumBytesPerSector;
+        for (u64 offset = 0; offset < tableBytes; offset += FAT_TABLE_WINDOW_SIZE) {
+            const u64 bytes = std::min(u64(FAT_TABLE_WINDOW_SIZE), tableBytes - offset);
+            if (Device->read_raw(tableOffset + offset, bytes, chunk.data()) != ssz(bytes)) {
+                std::print("[FAT]: Failed to read FAT at byte {}\n", offset);
+                return false;
+            }
+            const auto* entries = reinterpret_cast<const u32*>(chunk.data());
+            for (u64 i = 0; i < bytes / 4; ++i) {
+                const u64 cluster = offset / 4 + i;
+                if (cluster >= 2 && !(entries[i] & 0x0fffffff)) mark_free(cluster);
+            }
+        }
+
+        // The FSInfo sector says where the last allocation left off.
+        FATFSInformation info;
+        const u16 sector = reinterpret_cast<BootRecordExtension32*>(BR.Extended)->FATInformation;
+        if (sector && Device->read_raw(u64(sector) * BR.BPB.NumBytesPerSector, sizeof info, &info) == sizeof info
+            && info.LeadSignature == FAT_FSINFO_LEAD_SIGNATURE
+            && info.StructSignature == FAT_FSINFO_STRUCT_SIGNATURE) {
+            if (info.NextFreeCluster >= 2 && info.NextFreeCluster < clusters)
+                NextFree = info.NextFreeCluster;
+            // Correct a stale count the next time the FAT is written.
+            FSInfoDirty = info.FreeClusters != FreeClusters;
+        }
+    } else {
+        for (u32 cluster = 2; cluster < clusters; ++cluster)
+            if (!table_entry(cluster)) mark_free(cluster);
+    }
+
+    DBGMSG("[FAT]: {} of {} clusters free, first search at {}\n", FreeClusters, clusters - 2, NextFree);
+    return true;
+}
+
+auto FileAllocationTableDriver::table_bytes(u64 offset) -> u8* {
+    if (Table.size()) return offset < Table.size() ? &Table[offset] : nullptr;
+
+    const u64 tableBytes = BR.fat_sectors() * BR.BPB.NumBytesPerSector;
+    if (offset >= tableBytes) return nullptr;
+    const u64 windowOffset = offset - offset % FAT_TABLE_WINDOW_SIZE;
+
+    TableWindow* victim = &Windows[0];
+    for (auto& window : Windows) {
+        if (window.Offset == windowOffset) {
+            window.LastUse = ++WindowClock;
+            return &window.Data[offset - windowOffset];
+        }
+        if (window.LastUse < victim->LastUse) victim = &window;
+    }
+
+    // Changes to the evicted window mustn't be lost.
+    if (victim->Dirty) {
+        const u64 victimBytes = std::min(u64(FAT_TABLE_WINDOW_SIZE), tableBytes - victim->Offset);
+        if (!write_table(victim->Offset, victimBytes, victim->Data.data())) return nullptr;
+        victim->Dirty = false;
+    }
+
+    const u64 bytes = std::min(u64(FAT_TABLE_WINDOW_SIZE), tableBytes - windowOffset);
+    victim->Data.resize(FAT_TABLE_WINDOW_SIZE);
+    const u64 deviceOffset = BR.BPB.first_fat_sector() * BR.BPB.NumBytesPerSector + windowOffset;
+    if (Device->read_raw(deviceOffset, bytes, victim->Data.data()) != ssz(bytes)) {
+        victim->Offset = u64(-1);
+        victim->LastUse = 0;
+        return nullptr;
+    }
+    victim->Offset = windowOffset;
+    victim->LastUse = ++WindowClock;
+    return &victim->Data[offset - windowOffset];
+}
+
+bool FileAllocationTableDriver::write_table(u64 offset, u64 bytes, const u8* data) {
+    const u64 tableBytes = BR.fat_sectors() * BR.BPB.NumBytesPerSector;
+    const u64 first = BR.BPB.first_fat_sector() * BR.BPB.NumBytesPerSector;
+    u64 copies = BR.BPB.NumFATsPresent;
+    u64 only = 0;
+    // FAT32 may have mirroring turned off, with only one FAT in use.
+    if (Type == FATType::FAT32) {
+        const u16 flags = reinterpret_cast<BootRecordExtension32*>(BR.Extended)->ExtendFlags;
+        if (flags & 0x80) {
+            only = flags & 0x0f;
+            copies = 1;
+        }
+    }
+    for (u64 i = only; i < only + copies; ++i) {
+        if (Device->write(nullptr, first + i * tableBytes + offset, bytes, const_cast<u8*>(data)) != ssz(bytes)) {
+            std::print("[FAT]: Failed to write {} bytes of FAT {}\n", bytes, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+auto FileAllocationTableDriver::table_entry(u32 cluster) -> u32 {
+    switch (Type) {
+        case FATType::FAT12: {
+            // Entries are a byte and a half, so may straddle two bytes
+            // that don't share an alignment; the table is whole, though.
+            const u64 offset = cluster + cluster / 2;
+            if (offset + 1 >= Table.size()) return FAT_END_OF_CHAIN;
+            const u32 value = u32(Table[offset]) | u32(Table[offset + 1]) << 8;
+            return cluster & 1 ? value >> 4 : value & 0x0fff;
+        }
+        case FATType::FAT16: {
+            const u8* entry = table_bytes(u64(cluster) * 2);
+            if (!entry) return FAT_END_OF_CHAIN;
+            return *reinterpret_cast<const u16*>(entry);
+        }
+        case FATType::FAT32: {
+            const u8* entry = table_bytes(u64(cluster) * 4);
+            if (!entry) return FAT_END_OF_CHAIN;
+            return *reinterpret_cast<const u32*>(entry) & 0x0fffffff;
+        }
+        default: return FAT_END_OF_CHAIN;
+    }
+}
+
+auto FileAllocationTableDriver::next_cluster(u32 cluster) -> u32 {
+    if (cluster < 2 || cluster >= BR.total_clusters() + 2) return FAT_END_OF_CHAIN;
+
+    const u32 value = table_entry(cluster);
+    if (value == FAT_END_OF_CHAIN) return FAT_END_OF_CHAIN;
+    switch (Type) {
+        case FATType::FAT12: if (value >= 0x0ff7) return FAT_END_OF_CHAIN; break;
+        case FATType::FAT16: if (value >= 0xfff7) return FAT_END_OF_CHAIN; break;
+        default: if (value >= 0x0ffffff7) return FAT_END_OF_CHAIN; break;
+    }
+    // Free and reserved values don't belong in a chain.
+    if (value < 2) return FAT_END_OF_CHAIN;
+    return value;
+}
+
+bool FileAllocationTableDriver::set_cluster(u32 cluster, u32 value) {
+    if (cluster < 2 || cluster >= BR.total_clusters() + 2) return false;
+
+    u64 offset = 0;
+    u64 bytes = 0;
+    switch (Type) {
+        case FATType::FAT12: {
+            offset = cluster + cluster / 2;
+            bytes = 2;
+            if (offset + 1 >= Table.size()) return false;
+            u16 raw = u16(Table[offset] | Table[offset + 1] << 8);
+            const u16 entry = value == FAT_END_OF_CHAIN ? 0x0fff : u16(value & 0x0fff);
+            raw = cluster & 1 ? u16((raw & 0x000f) | entry << 4) : u16((raw & 0xf000) | entry);
+            Table[offset] = u8(raw);
+            Table[offset + 1] = u8(raw >> 8);
+        } break;
+        case FATType::FAT16: {
+            offset = u64(cluster) * 2;
+            bytes = 2;
+            u8* entry = table_bytes(offset);
+            if (!entry) return false;
+            *reinterpret_cast<u16*>(entry) = value == FAT_END_OF_CHAIN ? u16(0xffff) : u16(value);
+        } break;
+        case FATType::FAT32: {
+            offset = u64(cluster) * 4;
+            bytes = 4;
+            u8* entry = table_bytes(offset);
+            if (!entry) return false;
+            // The top four bits are reserved, and must be preserved.
+            u32& raw = *reinterpret_cast<u32*>(entry);
+            raw = (raw & 0xf0000000) | (value == FAT_END_OF_CHAIN ? 0x0fffffff : value & 0x0fffffff);
+        } break;
+        default: return false;
+    }
+
+    if (Table.size()) {
+        DirtyLow = std::min(DirtyLow, offset);
+        DirtyHigh = std::max(DirtyHigh, offset + bytes);
+    } else {
+        const u64 windowOffset = offset - offset % FAT_TABLE_WINDOW_SIZE;
+        for (auto& window : Windows)
+            if (window.Offset == windowOffset) window.Dirty = true;
+    }
+
+    const bool free = value == 0;
+    if (free != cluster_free(cluster)) {
+        FreeMap[cluster / 64] ^= u64(1) << (cluster % 64);
+        if (free) ++FreeClusters;
+        else --FreeClusters;
+        FSInfoDirty = true;
+    }
+    return true;
+}
+
+bool FileAllocationTableDriver::flush_table() {
+    bool ok = true;
+    if (Table.size()) {
+        if (DirtyLow < DirtyHigh) {
+            // Whole sectors, so the device needn't read any back first.
+            const u64 bps = BR.BPB.NumBytesPerSector;
+            const u64 low = DirtyLow - DirtyLow % bps;
+            const u64 high = std::min(u64(Table.size()), (DirtyHigh + bps - 1) / bps * bps);
+            ok = write_table(low, high - low, &Table[low]);
+        }
+        DirtyLow = u64(-1);
+        DirtyHigh = 0;
+    } else {
+        const u64 tableBytes = BR.fat_sectors() * BR.BPB.NumBytesPerSector;
+        for (auto& window : Windows) {
+            if (!window.Dirty) continue;
+            const u64 bytes = std::min(u64(FAT_TABLE_WINDOW_SIZE), tableBytes - window.Offset);
+            if (write_table(window.Offset, bytes, window.Data.data())) window.Dirty = false;
+            else ok = false;
+        }
+    }
+
+    if (FSInfoDirty && Type == FATType::FAT32) {
+        FATFSInformation info;
+        const u16 sector = reinterpret_cast<BootRecordExtension32*>(BR.Extended)->FATInformation;
+        const u64 at = u64(sector) * BR.BPB.NumBytesPerSector;
+        if (sector && Device->read_raw(at, sizeof info, &info) == sizeof info
+            && info.LeadSignature == FAT_FSINFO_LEAD_SIGNATURE
+            && info.StructSignature == FAT_FSINFO_STRUCT_SIGNATURE) {
+            info.FreeClusters = u32(FreeClusters);
+            info.NextFreeCluster = NextFree;
+            if (Device->write(nullptr, at, sizeof info, &info) != sizeof info) ok = false;
+        }
+        FSInfoDirty = false;
+    }
+    return ok;
+}
+
+auto FileAllocationTableDriver::find_free_run(u32 goal, u32 count, u32& length) -> u32 {
+    length = 0;
+    const u32 limit = u32(BR.total_clusters() + 2);
+    if (!FreeClusters || !count) return 0;
+
+    // Growing the last run of a file keeps it in one extent.
+    if (goal >= 2 && goal < limit && cluster_free(goal)) {
+        while (length < count && goal + length < limit && cluster_free(goal + length)) ++length;
+        return goal;
+    }
+
+    u32 best = 0;
+    u32 bestLength = 0;
+    auto scan = [&](u32 from, u32 to) {
+        u32 cluster = from;
+        while (cluster < to) {
+            // Skip clusters in use a word at a time.
+            const u64 word = FreeMap[cluster / 64] >> (cluster % 64);
+            if (!word) {
+                cluster = (cluster / 64 + 1) * 64;
+                continue;
+            }
+            if (!(word & 1)) {
+                cluster += u32(__builtin_ctzll(word));
+                continue;
+            }
+            const u32 start = cluster;
+            while (cluster < to && cluster - start < count && cluster_free(cluster)) ++cluster;
+            if (cluster - start > bestLength) {
+                best = start;
+                bestLength = cluster - start;
+                if (bestLength == count) return true;
+            }
+        }
+        return false;
+    };
+    const u32 start = NextFree >= 2 && NextFree < limit ? NextFree : 2;
+    if (!scan(start, limit)) scan(2, start);
+
+    length = bestLength;
+    return best;
+}
+
+bool FileAllocationTableDriver::extend(FATFile* file, u64 clusters) {
+    map_extents(file);
+    auto& extents = file->Extents;
+    u64 have = 0;
+    u32 previous = 0;
+    if (extents.size()) {
+        const FATExtent& last = extents[extents.size() - 1];
+        have = last.FileCluster + last.Length;
+        previous = last.Cluster + last.Length - 1;
+    }
+
+    const u32 limit = u32(BR.total_clusters() + 2);
+    while (have < clusters) {
+        u32 length = 0;
+        const u32 wanted = u32(std::min(clusters - have, u64(limit)));
+        const u32 start = find_free_run(previous ? previous + 1 : 0, wanted, length);
+        if (!start) {
+            std::print("[FAT]: Out of space\n");
+            return false;
+        }
+
+        // Link the run up before pointing the chain at it.
+        for (u32 i = 0; i < length; ++i)
+            if (!set_cluster(start + i, i + 1 < length ? start + i + 1 : FAT_END_OF_CHAIN)) return false;
+        if (previous) {
+            if (!set_cluster(previous, start)) return false;
+        } else file->FirstCluster = start;
+
+        if (extents.size() && previous + 1 == start) extents[extents.size() - 1].Length += length;
+        else extents.push_back({ have, start, length });
+
+        have += length;
+        previous = start + length - 1;
+        NextFree = previous + 1 < limit ? previous + 1 : 2;
+        FSInfoDirty = true;
+    }
+    return true;
+}
+
+bool FileAllocationTableDriver::shrink(FATFile* file, u64 clusters) {
+    map_extents(file);
+    auto& extents = file->Extents;
+    while (extents.size()) {
+        FATExtent& last = extents[extents.size() - 1];
+        if (last.FileCluster + last.Length <= clusters) break;
+        const u32 keep = last.FileCluster < clusters ? u32(clusters - last.FileCluster) : 0;
+        for (u32 i = keep; i < last.Length; ++i)
+            if (!set_cluster(last.Cluster + i, 0)) return false;
+        if (keep) {
+            last.Length = keep;
+            break;
+        }
+        extents.pop_back();
+    }
+
+    if (extents.empty()) {
+        file->FirstCluster = 0;
+        return true;
+    }
+    const FATExtent& last = extents[extents.size() - 1];
+    return set_cluster(last.Cluster + last.Length - 1, FAT_END_OF_CHAIN);
+}
+
+auto FileAllocationTableDriver::root_cluster() -> u32 {
+    if (Type == FATType::FAT32)
+        return reinterpret_cast<BootRecordExtension32*>(BR.Extended)->RootCluster;
+    return 0;
+}
+
+auto FileAllocationTableDriver::first_cluster(FileMetadata* file) -> u32 {
+    return static_cast<FATFile*>(file->driver_data())->FirstCluster;
+}
+
+void FileAllocationTableDriver::map_extents(FATFile* file) {
+    if (file->Mapped) return;
+    file->Mapped = true;
+    if (file->FirstCluster < 2) return;
+
+    // Guard against cycles in a corrupt FAT: no chain is longer than
+    // the volume has clusters.
+    const u64 limit = BR.total_clusters();
+    u64 index = 0;
+    for (u32 cluster = file->FirstCluster; cluster != FAT_END_OF_CHAIN && index < limit; cluster = next_cluster(cluster), ++index) {
+        if (file->Extents.size()) {
+            FATExtent& last = file->Extents[file->Extents.size() - 1];
+            if (cluster == last.Cluster + last.Length) {
+                ++last.Length;
+                continue;
+            }
+        }
+        file->Extents.push_back({ index, cluster, 1 });
+    }
+    DBGMSG("[FAT]: Mapped {} clusters in {} extents\n", index, file->Extents.size());
+}
+
+auto FileAllocationTableDriver::locate(FileMetadata* file, usz offs, usz bytes, usz& contiguous) -> u64 {
+    contiguous = 0;
+    auto* data = static_cast<FATFile*>(file->driver_data());
+    map_extents(data);
+    const auto& extents = data->Extents;
+    if (extents.empty()) return u64(-1);
+
+    // Last extent that begins at or before the cluster `offs` is in.
+    const usz clusterSize = BR.BPB.cluster_size();
+    const u64 fileCluster = offs / clusterSize;
+    usz low = 0;
+    usz high = extents.size();
+    while (high - low > 1) {
+        usz middle = low + (high - low) / 2;
+        if (extents[middle].FileCluster <= fileCluster) low = middle;
+        else high = middle;
+    }
+    const FATExtent& extent = extents[low];
+    if (fileCluster >= extent.FileCluster + extent.Length) return u64(-1);
+
+    const u64 offsetInExtent = offs - extent.FileCluster * clusterSize;
+    contiguous = std::min(usz(extent.Length * clusterSize - offsetInExtent), bytes);
+    return BR.cluster_to_sector(extent.Cluster) * BR.BPB.NumBytesPerSector + offsetInExtent;
+}
+
 FileAllocationTableDriver::DirIteratorHelper::Iterator::Iterator(FileAllocationTableDriver& driver, u32 directoryCluster)
-: Driver(driver), ClusterIndex(directoryCluster) {
+: Driver(driver), ClusterIndex(directoryCluster ? directoryCluster : driver.root_cluster()) {
     /// Read first entry. This MUST initialise MoreClusters to false
     /// if there are are no entries at all. In other words, when this
     /// function returns, either MoreClusters is false or Entry contains
     /// a valid entry.
-    ReadNextCluster();
+    ReadCluster();
     ++*this;
 }
 
-void FileAllocationTableDriver::DirIteratorHelper::Iterator::ReadNextCluster() {
-    const u64 clusterSector = Driver.BR.cluster_to_sector(ClusterIndex);
-    Driver.Device->read_raw(clusterSector * Driver.BR.BPB.NumBytesPerSector, ClusterSize, ClusterContents.data());
-    Entry.CE = reinterpret_cast<ClusterEntry*>(ClusterContents.data());
-    Entry.LongFileName.clear();
-    ClearLFN = false;
-}
-
-void FileAllocationTableDriver::DirIteratorHelper::Iterator::TryReadNextCluster() {
-    // Check if this is the last cluster in the chain.
-    const u64 clusterNumber = Entry.CE->get_cluster_number();
-    u64 FAToffset = 0;
-    switch (Driver.Type) {
-        case FATType::FAT12: FAToffset = clusterNumber + (clusterNumber / 2); break;
-        case FATType::FAT16: FAToffset = clusterNumber * 2; break;
-        case FATType::ExFAT:
-        case FATType::FAT32:
-        default:
-            FAToffset = clusterNumber * 4;
-            break;
+void FileAllocationTableDriver::DirIteratorHelper::Iterator::ReadCluster() {
+    auto& BR = Driver.BR;
+    u64 offset = 0;
+    u64 bytes = 0;
+    if (ClusterIndex == 0) {
+        offset = BR.first_root_directory_sector() * BR.BPB.NumBytesPerSector;
+        bytes = BR.BPB.root_directory_sectors() * BR.BPB.NumBytesPerSector;
+    } else {
+        offset = BR.cluster_to_sector(ClusterIndex) * BR.BPB.NumBytesPerSector;
+        bytes = BR.BPB.cluster_size();
     }
-
-    const u64 FATsector = Driver.BR.BPB.first_fat_sector() + (FAToffset / Driver.BR.BPB.NumBytesPerSector);
-    const u64 entryOffset = FAToffset % Driver.BR.BPB.NumBytesPerSector;
-    if (entryOffset <= 1 || FATsector == LastFATSector) {
+    ClusterContents.resize(bytes);
+    ClusterOffset = offset;
+    if (!bytes || Driver.Device->read_raw(offset, bytes, ClusterContents.data()) != ssz(bytes)) {
         MoreClusters = false;
         return;
     }
+    EntryCount = bytes / sizeof(ClusterEntry);
+    /// operator++() increments before looking at an entry.
+    EntryIndex = usz(-1);
+}
 
-    std::vector<u8> FAT(Driver.BR.BPB.NumBytesPerSector);
-    LastFATSector = FATsector;
-    Driver.Device->read_raw(FATsector * Driver.BR.BPB.NumBytesPerSector, Driver.BR.fat_sectors() * Driver.BR.BPB.NumBytesPerSector, FAT.data());
-    u64 tableValue = 0;
-    switch (Driver.Type) {
-        case FATType::FAT12:
-            tableValue = *(reinterpret_cast<u16*>(&FAT[entryOffset]));
-            if (clusterNumber & 0b1) tableValue >>= 4;
-            else tableValue &= 0x0fff;
-            if (tableValue >= 0x0ff8) MoreClusters = false;
-            // TODO: Hande tableValue == 0x0ff7 (bad cluster)
-            break;
-        case FATType::FAT16:
-            tableValue = *(reinterpret_cast<u16*>(&FAT[entryOffset]));
-            tableValue &= 0xffff;
-            if (tableValue >= 0xfff8) MoreClusters = false;
-            // TODO: Hande tableValue == 0xfff7 (bad cluster)
-            break;
-        case FATType::FAT32:
-            tableValue = *(reinterpret_cast<u32*>(&FAT[entryOffset]));
-            tableValue &= 0xfffffff;
-            if (tableValue >= 0x0ffffff8) MoreClusters = false;
-            // TODO: Hande tableValue == 0x0ffffff7 (bad cluster)
-            break;
-        case FATType::ExFAT:
-            tableValue = *(reinterpret_cast<u32*>(&FAT[entryOffset]));
-            break;
-        default:
-            break;
+void FileAllocationTableDriver::DirIteratorHelper::Iterator::TryReadNextCluster() {
+    // The fixed root directory region isn't part of any chain.
+    const u32 next = ClusterIndex ? Driver.next_cluster(ClusterIndex) : FAT_END_OF_CHAIN;
+    if (next == FAT_END_OF_CHAIN) {
+        MoreClusters = false;
+        return;
     }
-
-    ClusterIndex = tableValue;
-    if (MoreClusters) ReadNextCluster();
+    ClusterIndex = next;
+    ReadCluster();
 }
 
 auto FileAllocationTableDriver::DirIteratorHelper::Iterator::operator++() -> Iterator& {
-    // TODO: ExFAT will need it's own code flow, essentially.
-    Entry.CE++;
     while (MoreClusters) {
-        while (Entry.CE->FileName[0] != 0) {
-            if (Entry.CE->FileName[0] == 0xe5)
-                continue;
+        if (++EntryIndex >= EntryCount) {
+            TryReadNextCluster();
+            continue;
+        }
+        Entry.CE = reinterpret_cast<ClusterEntry*>(ClusterContents.data()) + EntryIndex;
 
-            if (ClearLFN) {
-                Entry.LongFileName.clear();
-                ClearLFN = false;
-            }
+        // A free entry ends the directory.
+        if (Entry.CE->FileName[0] == 0) {
+            MoreClusters = false;
+            break;
+        }
 
-            if (Entry.CE->long_file_name()) {
-                auto* lfn = reinterpret_cast<LFNClusterEntry*>(Entry.CE);
-                Entry.LongFileName += std::string((const char*) &lfn->Characters1[0], sizeof(u16) * 5);
-                Entry.LongFileName += std::string((const char*) &lfn->Characters2[0], sizeof(u16) * 6);
-                Entry.LongFileName += std::string((const char*) &lfn->Characters3[0], sizeof(u16) * 2);
-                Entry.CE++;
-                continue;
-            }
+        if (ClearLFN) {
+            Entry.LongFileName.clear();
+            ClearLFN = false;
+        }
 
-            // Remove 0xff and then two 0x00 from end of longFileName.
+        // Deleted entry; any long name before it went with it.
+        if (Entry.CE->FileName[0] == 0xe5) {
             ClearLFN = true;
-            Entry.FileName = std::string_view{reinterpret_cast<char*>(Entry.CE->FileName), 11};
-            Entry.LongFileName.__remove_trailing("\xff\0");
+            continue;
+        }
+
+        if (Entry.CE->long_file_name()) {
+            auto* lfn = reinterpret_cast<LFNClusterEntry*>(Entry.CE);
+            Entry.LongFileName += std::string((const char*) &lfn->Characters1[0], sizeof(u16) * 5);
+            Entry.LongFileName += std::string((const char*) &lfn->Characters2[0], sizeof(u16) * 6);
+            Entry.LongFileName += std::string((const char*) &lfn->Characters3[0], sizeof(u16) * 2);
+            continue;
+        }
+
+        // Remove 0xff and then two 0x00 from end of longFileName.
+        ClearLFN = true;
+        Entry.FileName = std::string_view{reinterpret_cast<char*>(Entry.CE->FileName), 11};
+        Entry.LongFileName.__remove_trailing("\xff\0");
 
 #ifdef DEBUG_FAT
             std::string fileType;
@@ -342,11 +755,8 @@ auto FileAllocationTableDriver::DirIteratorHelper::Iterator::operator++() -> Ite
             std::print("    Found {}named \"{}\" (\"{}\")\n", fileType, Entry.FileName, Entry.LongFileName);
 #endif
 
-            Entry.ByteOffset = Driver.BR.cluster_to_sector(Entry.CE->get_cluster_number()) * Driver.BR.BPB.NumBytesPerSector;
-            return *this;
-        }
-
-        TryReadNextCluster();
+        Entry.EntryOffset = ClusterOffset + EntryIndex * sizeof(ClusterEntry);
+        return *this;
     }
 
     return *this;
@@ -355,7 +765,7 @@ auto FileAllocationTableDriver::DirIteratorHelper::Iterator::operator++() -> Ite
 std::shared_ptr<FileMetadata> FileAllocationTableDriver::traverse_path(std::string_view raw_path, u32 directoryCluster) {
     // If directoryCluster == -1, replace it with the root directory.
     if (directoryCluster == u32(-1))
-        directoryCluster = BR.sector_to_cluster(BR.first_root_directory_sector());
+        directoryCluster = root_cluster();
 
     /// Strip leading slash.
     if (raw_path.starts_with("/")) raw_path = raw_path.substr(1);
@@ -372,46 +782,385 @@ std::shared_ptr<FileMetadata> FileAllocationTableDriver::traverse_path(std::stri
     auto raw_filename = pop_filename_from_front_of_path(path);
     DBGMSG("[FAT]:open(): Got filename \"{}\" and path \"{}\" from \"{}\"\n", raw_filename, path, raw_path);
 
+    // Only read and parse the directory if this name hasn't been
+    // looked up in it before.
+    DentryCache& dentries = SYSTEM->virtual_filesystem().dentries();
+    DentryCacheEntry found{};
+    if (const auto* cached = dentries.lookup(this, directoryCluster, raw_filename))
+        found = *cached;
+    else {
+        found = find_in_directory(raw_filename, directoryCluster);
+        dentries.insert(this, directoryCluster, raw_filename, found);
+    }
+
+    if (found.Negative) {
+        /// No such file.
+        std::print("[FAT]: Could not find file at \"{}\", sorry\n", raw_filename);
+        return {};
+    }
+
+    // If path and raw_filename are equal, we can not resolve any more
+    // filenames from full path; we have found the file.
+    if (path == raw_filename) {
+        return shared_file(std::move(raw_filename), u32(found.Inode), found.DriverData, found.FileSize, found.Directory);
+    }
+
+    // Otherwise, we need to recurse into the directory.
+    if (!found.Directory) {
+        std::print(R"([FAT]: Cannot follow path "{}" because "{}" is not a directory)", path, raw_filename);
+        return {};
+    }
+
+    //std::print("Recursing! Following {} at cluster {}\n", path, found.Inode);
+    return traverse_path(path, u32(found.Inode));
+}
+
+/// Long names are stored as UCS-2, in chunks of 13 characters that
+/// come last chunk first. Anything past ASCII becomes '?'.
+static auto decode_long_name(std::string_view raw) -> std::string {
+    constexpr usz chunk = 13 * sizeof(u16);
+    std::string name;
+    for (usz end = raw.size(); end; ) {
+        usz begin = end > chunk ? end - chunk : 0;
+        for (usz i = begin; i + 1 < end; i += 2) {
+            u16 c = u16(u8(raw[i]) | u16(u8(raw[i + 1])) << 8);
+            if (c == 0 || c == 0xffff) break;
+            name += c < 0x80 ? char(c) : '?';
+        }
+        end = begin;
+    }
+    return name;
+}
+
+/// "FOO     TXT" -> "FOO.TXT"
+static auto decode_short_name(std::string_view raw) -> std::string {
+    std::string name;
+    for (usz i = 0; i < 8 && i < raw.size() && raw[i] != ' '; ++i) name += raw[i];
+    if (raw.size() > 8 && raw[8] != ' ') {
+        name += '.';
+        for (usz i = 8; i < 11 && i < raw.size() && raw[i] != ' '; ++i) name += raw[i];
+    }
+    return name;
+}
+
+/// Names are matched without regard to (ASCII) case.
+static auto fold(char c) -> char {
+    return c >= 'A' && c <= 'Z' ? char(c + 32) : c;
+}
+
+static auto fold_hash(std::string_view name) -> u64 {
+    u64 hash = 0xcbf29ce484222325;
+    for (usz i = 0; i < name.size(); ++i) {
+        hash ^= u8(fold(name[i]));
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+static bool folded_equals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (usz i = 0; i < a.size(); ++i)
+        if (fold(a[i]) != fold(b[i])) return false;
+    return true;
+}
+
+/// What every long name entry of a short name carries, so they can be
+/// told apart from stale ones.
+static auto short_name_checksum(const u8* name) -> u8 {
+    u8 sum = 0;
+    for (usz i = 0; i < 11; ++i) sum = u8(((sum & 1) << 7) + (sum >> 1) + name[i]);
+    return sum;
+}
+
+/// Compare two 11-byte short names with two (overlapping) word loads.
+static bool short_name_equals(const u8* a, const u8* b) {
+    u64 a0, b0;
+    u32 a1, b1;
+    memcpy(&a0, a, sizeof a0);
+    memcpy(&b0, b, sizeof b0);
+    memcpy(&a1, a + 7, sizeof a1);
+    memcpy(&b1, b + 7, sizeof b1);
+    return a0 == b0 && a1 == b1;
+}
+
+/// Character `i` of the 13 in a long name entry.
+static auto lfn_character(const LFNClusterEntry& entry, usz i) -> u16 {
+    if (i < 5) return entry.Characters1[i];
+    if (i < 11) return entry.Characters2[i - 5];
+    return entry.Characters3[i - 11];
+}
+
+/// Whether the long name in `entries` (as they are on disk, last chunk
+/// first) is `name`, decoding no more of it than needed to tell.
+static bool lfn_equals(const LFNClusterEntry* entries, usz count, std::string_view name) {
+    usz at = 0;
+    for (usz e = count; e--; ) {
+        for (usz i = 0; i < 13; ++i) {
+            const u16 c = lfn_character(entries[e], i);
+            if (c == 0 || c == 0xffff) return at == name.size();
+            if (at >= name.size() || c >= 0x80 || fold(char(c)) != fold(name[at])) return false;
+            ++at;
+        }
+    }
+    return at == name.size();
+}
+
+static auto lfn_decode(const LFNClusterEntry* entries, usz count) -> std::string {
+    std::string name;
+    for (usz e = count; e--; ) {
+        for (usz i = 0; i < 13; ++i) {
+            const u16 c = lfn_character(entries[e], i);
+            if (c == 0 || c == 0xffff) return name;
+            name += c < 0x80 ? char(c) : '?';
+        }
+    }
+    return name;
+}
+
+/// Collects the long name entries that precede a short one, by copy,
+/// as they may be in an earlier cluster.
+struct LFNCollector {
+    LFNClusterEntry Entries[FAT_LFN_MAX_ENTRIES];
+    usz Count { 0 };
+    u8 Checksum { 0 };
+    bool Valid { false };
+
+    void reset() {
+        Count = 0;
+        Valid = false;
+    }
+
+    void add(const LFNClusterEntry& entry) {
+        // The first entry on disk holds the last chunk, and starts a name.
+        if (entry.Order & 0x40) {
+            Count = 0;
+            Checksum = entry.Checksum;
+            Valid = true;
+        }
+        if (!Valid || entry.Checksum != Checksum || Count >= FAT_LFN_MAX_ENTRIES) {
+            reset();
+            return;
+        }
+        Entries[Count++] = entry;
+    }
+
+    /// Whether what was collected is the long name of `entry`.
+    bool belongs_to(const ClusterEntry& entry) const {
+        return Valid && Count && Checksum == short_name_checksum(entry.FileName);
+    }
+};
+
+template <typename Visit>
+void FileAllocationTableDriver::scan_directory(u32 directoryCluster, Visit visit) {
+    if (!directoryCluster) directoryCluster = root_cluster();
+    std::vector<u8> contents;
+    u32 cluster = directoryCluster;
+    const u64 limit = BR.total_clusters();
+    for (u64 clusters = 0; clusters < limit; ++clusters) {
+        u64 offset = 0;
+        u64 bytes = 0;
+        if (cluster == 0) {
+            offset = BR.first_root_directory_sector() * BR.BPB.NumBytesPerSector;
+            bytes = BR.BPB.root_directory_sectors() * BR.BPB.NumBytesPerSector;
+        } else {
+            offset = BR.cluster_to_sector(cluster) * BR.BPB.NumBytesPerSector;
+            bytes = BR.BPB.cluster_size();
+        }
+        contents.resize(bytes);
+        if (!bytes || Device->read_raw(offset, bytes, contents.data()) != ssz(bytes)) return;
+
+        auto* entries = reinterpret_cast<ClusterEntry*>(contents.data());
+        for (usz i = 0; i < bytes / sizeof(ClusterEntry); ++i)
+            if (!visit(entries[i], offset + i * sizeof(ClusterEntry))) return;
+
+        // The fixed root directory region isn't part of any chain.
+        if (cluster == 0) return;
+        cluster = next_cluster(cluster);
+        if (cluster == FAT_END_OF_CHAIN) return;
+    }
+}
+
+void FATDirectoryIndex::add(std::string_view name, u64 entryOffset) {
+    if (Names.size() * 2 >= Buckets.size()) {
+        const usz buckets = Buckets.size() ? Buckets.size() * 2 : 64;
+        Buckets.clear();
+        Buckets.resize(buckets, 0);
+        for (usz i = 0; i < Names.size(); ++i) {
+            u32& head = Buckets[Names[i].Hash & (Buckets.size() - 1)];
+            Names[i].Next = head;
+            head = u32(i + 1);
+        }
+    }
+    const u64 hash = fold_hash(name);
+    std::string folded;
+    for (usz i = 0; i < name.size(); ++i) folded += fold(name[i]);
+    u32& head = Buckets[hash & (Buckets.size() - 1)];
+    Names.push_back({ hash, std::move(folded), entryOffset, head });
+    head = u32(Names.size());
+}
+
+auto FATDirectoryIndex::lookup(std::string_view name) const -> u64 {
+    if (Buckets.empty()) return 0;
+    const u64 hash = fold_hash(name);
+    for (u32 i = Buckets[hash & (Buckets.size() - 1)]; i; i = Names[i - 1].Next) {
+        const Name& candidate = Names[i - 1];
+        if (candidate.Hash == hash && folded_equals(candidate.Folded, name)) return candidate.EntryOffset;
+    }
+    return 0;
+}
+
+void FATDirectoryIndex::clear() {
+    Directory = u32(-1);
+    Scans = 0;
+    Built = false;
+    LastUse = 0;
+    Names.clear();
+    Buckets.clear();
+}
+
+auto FileAllocationTableDriver::directory_index(u32 directoryCluster) -> FATDirectoryIndex& {
+    if (!directoryCluster) directoryCluster = root_cluster();
+    FATDirectoryIndex* victim = &Indexes[0];
+    for (auto& index : Indexes) {
+        if (index.Directory == directoryCluster) {
+            index.LastUse = ++IndexClock;
+            return index;
+        }
+        if (index.LastUse < victim->LastUse) victim = &index;
+    }
+    victim->clear();
+    victim->Directory = directoryCluster;
+    victim->LastUse = ++IndexClock;
+    return *victim;
+}
+
+void FileAllocationTableDriver::forget_index(u32 directoryCluster) {
+    if (!directoryCluster) directoryCluster = root_cluster();
+    for (auto& index : Indexes)
+        if (index.Directory == directoryCluster) index.clear();
+}
+
+void FileAllocationTableDriver::build_index(FATDirectoryIndex& index) {
+    LFNCollector lfn;
+    scan_directory(index.Directory, [&](ClusterEntry& entry, u64 offset) {
+        if (entry.FileName[0] == 0) return false;
+        if (entry.FileName[0] == 0xe5) {
+            lfn.reset();
+            return true;
+        }
+        if (entry.long_file_name()) {
+            lfn.add(reinterpret_cast<LFNClusterEntry&>(entry));
+            return true;
+        }
+        if (!entry.volume_id()) {
+            index.add(decode_short_name(std::string_view(reinterpret_cast<char*>(entry.FileName), 11)), offset);
+            if (lfn.belongs_to(entry)) index.add(lfn_decode(lfn.Entries, lfn.Count), offset);
+        }
+        lfn.reset();
+        return true;
+    });
+    index.Built = true;
+    DBGMSG("[FAT]: Indexed {} names of directory at cluster {}\n", index.Names.size(), index.Directory);
+}
+
+auto FileAllocationTableDriver::shared_file(std::string name, u32 firstCluster, u64 entryOffset, u64 size, bool directory)
+    -> std::shared_ptr<FileMetadata>
+{
+    for (auto& open : OpenFiles)
+        if (open.EntryOffset == entryOffset)
+            if (auto meta = open.Meta.lock()) return meta;
+
+    // Forget files that have since been closed.
+    for (usz i = OpenFiles.size(); i--; )
+        if (OpenFiles[i].Meta.expired()) OpenFiles.erase(OpenFiles.begin() + i);
+
+    auto meta = std::make_shared<FileMetadata>(std::move(name), sdd(This.lock()), size, new FATFile(firstCluster, entryOffset), directory);
+    OpenFiles.push_back({ entryOffset, meta });
+    return meta;
+}
+
+bool FileAllocationTableDriver::reload_entry(FileMetadata* file) {
+    auto* data = static_cast<FATFile*>(file->driver_data());
+    // The root directory has no entry to reload.
+    if (!data->EntryOffset) return true;
+    ClusterEntry entry;
+    if (Device->read_raw(data->EntryOffset, sizeof entry, &entry) != sizeof entry) return false;
+    if (!entry.directory()) file->set_file_size(entry.FileSizeInBytes);
+    if (entry.get_cluster_number() != data->FirstCluster) {
+        data->FirstCluster = entry.get_cluster_number();
+        data->Extents.clear();
+        data->Mapped = false;
+    }
+    return true;
+}
+
+auto FileAllocationTableDriver::entry_at(u64 offset) -> DentryCacheEntry {
+    ClusterEntry entry;
+    if (Device->read_raw(offset, sizeof entry, &entry) != sizeof entry) {
+        DentryCacheEntry missing{};
+        missing.Negative = true;
+        return missing;
+    }
+    DentryCacheEntry found{};
+    found.Directory = entry.directory();
+    found.Inode = entry.get_cluster_number();
+    found.FileSize = entry.FileSizeInBytes;
+    found.DriverData = offset;
+    return found;
+}
+
+auto FileAllocationTableDriver::find_in_directory(std::string_view raw_filename, u32 directoryCluster) -> DentryCacheEntry {
+    DentryCacheEntry missing{};
+    missing.Negative = true;
+
+    FATDirectoryIndex& index = directory_index(directoryCluster);
+    if (!index.Built && index.Scans) build_index(index);
+    if (index.Built) {
+        const u64 offset = index.lookup(raw_filename);
+        return offset ? entry_at(offset) : missing;
+    }
+    ++index.Scans;
+
     // Translate path (FAT has very limited file names).
     std::string filename = translate_filename(raw_filename);
+    const bool shortName = filename.size() == 11;
     DBGMSG("[FAT]:open(): Translated filename \"{}\" from \"{}\"\n", filename, raw_filename);
 
-    for (const auto& Entry : for_each_dir_entry_in(directoryCluster)) {
-        // If path and raw_filename are equal, we can not resolve any more
-        // filenames from full path; we have found the file.
-        if (Entry.FileName != filename && (Entry.LongFileName.empty() || Entry.LongFileName != filename)) continue;
-        if (path == raw_filename) {
-            DBGMSG("  Found file at {}!\n"
-                   "    Name: \"{}\"\n"
-                   "    Long: \"{}\"\n"
-                   , path
-                   , Entry.FileName
-                   , Entry.LongFileName
-                   );
-            // TODO: directory vs. file metadata
-            return std::make_shared<FileMetadata>
-                       (std::move(filename),
-                        sdd(This.lock()),
-                        u32(Entry.CE->FileSizeInBytes),
-                        (void*) Entry.ByteOffset
-                        );
-        }
-
-        // Otherwise, we need to recurse into the directory.
-        if (!Entry.CE->directory()) {
-            std::print(R"([FAT]: Cannot follow path "{}" because "{}" is not a directory)", path, filename);
-            return {};
+    LFNCollector lfn;
+    u64 found = 0;
+    scan_directory(directoryCluster, [&](ClusterEntry& entry, u64 offset) {
+        if (entry.FileName[0] == 0) return false;
+        if (entry.FileName[0] == 0xe5) {
+            lfn.reset();
+            return true;
         }
+        if (entry.long_file_name()) {
+            lfn.add(reinterpret_cast<LFNClusterEntry&>(entry));
+            return true;
+        }
+        if (!entry.volume_id()) {
+            if (shortName && short_name_equals(entry.FileName, reinterpret_cast<const u8*>(filename.data()))) {
+                found = offset;
+                return false;
+            }
+            // Only a long name of the right length is worth decoding.
+            if (lfn.belongs_to(entry)
+                && raw_filename.size() > (lfn.Count - 1) * 13
+                && raw_filename.size() <= lfn.Count * 13
+                && lfn_equals(lfn.Entries, lfn.Count, raw_filename)) {
+                found = offset;
+                return false;
+            }
+        }
+        lfn.reset();
+        return true;
+    });
 
-        // Recurse into directory...
-        u32 dirCluster = Entry.CE->get_cluster_number();
-        //std::print("Recursing! Following {} at cluster {}\n", path, dirCluster);
-        return traverse_path(path, dirCluster);
-    }
+    return found ? entry_at(found) : missing;
+}
 
-    /// No such file.
-    std::print("[FAT]: Could not find file at \"{}\", sorry\n", filename);
-    return {};
+void FileAllocationTableDriver::invalidate_dentries() {
+    SYSTEM->virtual_filesystem().dentries().invalidate(this);
 }
 
 auto FileAllocationTableDriver::open(std::string_view raw_path) -> std::shared_ptr<FileMetadata> {
@@ -431,5 +1180,257 @@ auto FileAllocationTableDriver::open(std::string_view raw_path) -> std::shared_p
     }
 #endif
 
+    // The root directory has no entry of its own to find.
+    std::string_view path = raw_path;
+    while (path.size() && path[0] == '/') path.remove_prefix(1);
+    if (!path.size()) {
+        return shared_file("", 0, 0, 0, true);
+    }
+
     return traverse_path(raw_path);
 }
+
+ssz FileAllocationTableDriver::read(FileMetadata* file, usz offs, usz size, void* buffer) {
+    if (file->directory()) return -1;
+    if (offs >= file->file_size()) return 0;
+    size = std::min(size, usz(file->file_size() - offs));
+
+    // One device read per physically contiguous run of clusters.
+    usz done = 0;
+    while (done < size) {
+        usz contiguous = 0;
+        const u64 at = locate(file, offs + done, size - done, contiguous);
+        if (at == u64(-1)) break;
+        ssz n = Device->read(file, at, contiguous, static_cast<u8*>(buffer) + done);
+        if (n < 0) return done ? ssz(done) : n;
+        done += usz(n);
+        if (usz(n) < contiguous) break;
+    }
+    return ssz(done);
+}
+
+IOVector FileAllocationTableDriver::borrow(FileMetadata* file, usz offs, usz bytes) {
+    if (file->directory() || offs >= file->file_size()) return { nullptr, 0 };
+    usz contiguous = 0;
+    const u64 at = locate(file, offs, std::min(bytes, usz(file->file_size() - offs)), contiguous);
+    if (at == u64(-1)) return { nullptr, 0 };
+    return Device->borrow(file, at, contiguous);
+}
+
+bool FileAllocationTableDriver::update_entry(FATFile* file, u64 size) {
+    // The root directory has no entry to update.
+    if (!file->EntryOffset) return true;
+    ClusterEntry entry;
+    if (Device->read_raw(file->EntryOffset, sizeof entry, &entry) != sizeof entry) return false;
+    if (!entry.directory()) entry.FileSizeInBytes = u32(size);
+    entry.set_cluster_number(file->FirstCluster);
+    entry.Attributes |= FAT_ATTR_ARCHIVE;
+    return Device->write(nullptr, file->EntryOffset, sizeof entry, &entry) == sizeof entry;
+}
+
+bool FileAllocationTableDriver::zero_fill(FileMetadata* file, usz from, usz to) {
+    if (from >= to) return true;
+    std::vector<u8> zeroes;
+    zeroes.resize(std::min(to - from, usz(BR.BPB.cluster_size())), 0);
+    while (from < to) {
+        usz contiguous = 0;
+        const u64 at = locate(file, from, std::min(to - from, zeroes.size()), contiguous);
+        if (at == u64(-1)) return false;
+        if (Device->write(file, at, contiguous, zeroes.data()) != ssz(contiguous)) return false;
+        from += contiguous;
+    }
+    return true;
+}
+
+void FileAllocationTableDriver::prefetch(FileMetadata* file, usz offs, usz bytes) {
+    if (file->directory() || offs >= file->file_size()) return;
+    bytes = std::min(bytes, usz(file->file_size() - offs));
+    // One batch for the device, however fragmented the file.
+    Device->plug();
+    usz done = 0;
+    while (done < bytes) {
+        usz contiguous = 0;
+        const u64 at = locate(file, offs + done, bytes - done, contiguous);
+        if (at == u64(-1)) break;
+        Device->prefetch(file, at, contiguous);
+        done += contiguous;
+    }
+    Device->unplug();
+}
+
+ssz FileAllocationTableDriver::write(FileMetadata* file, usz offs, usz size, void* buffer) {
+    if (file->directory()) return -1;
+    if (!size) return 0;
+
+    // Growing the file starts from what its directory entry says, the
+    // same as every other allocation on the volume does.
+    auto* data = static_cast<FATFile*>(file->driver_data());
+    if (offs + size > file->file_size() && !reload_entry(file)) return -1;
+    const u64 oldSize = file->file_size();
+    const u32 oldFirstCluster = data->FirstCluster;
+    const usz clusterSize = BR.BPB.cluster_size();
+    if (offs + size > oldSize) {
+        // That's as big as a FAT file gets.
+        if (offs >= u32(-1)) return -1;
+        size = std::min(size, usz(u32(-1) - offs));
+
+        // Allocate everything this write needs at once, so it ends up
+        // in as few runs as possible. If the volume fills up, as much
+        // as did fit is written.
+        extend(data, (offs + size + clusterSize - 1) / clusterSize);
+        if (offs > oldSize && !zero_fill(file, oldSize, offs)) {
+            shrink(data, (oldSize + clusterSize - 1) / clusterSize);
+            flush_table();
+            return -1;
+        }
+    }
+
+    // One device write per physically contiguous run of clusters.
+    usz done = 0;
+    while (done < size) {
+        usz contiguous = 0;
+        const u64 at = locate(file, offs + done, size - done, contiguous);
+        if (at == u64(-1)) break;
+        ssz n = Device->write(file, at, contiguous, static_cast<u8*>(buffer) + done);
+        if (n < 0) break;
+        done += usz(n);
+        if (usz(n) < contiguous) break;
+    }
+
+    // However many clusters were allocated, the directory entry and
+    // the FAT are written once per call.
+    if (offs + done > oldSize) file->set_file_size(offs + done);
+    if (file->file_size() != oldSize || data->FirstCluster != oldFirstCluster) {
+        update_entry(data, file->file_size());
+        invalidate_dentries();
+    }
+    flush_table();
+    return done ? ssz(done) : -1;
+}
+
+bool FileAllocationTableDriver::truncate(FileMetadata* file, usz size) {
+    if (file->directory() || size > u32(-1) || !reload_entry(file)) return false;
+    const u64 oldSize = file->file_size();
+    if (size == oldSize) return true;
+
+    auto* data = static_cast<FATFile*>(file->driver_data());
+    const usz clusterSize = BR.BPB.cluster_size();
+    const u64 clusters = (size + clusterSize - 1) / clusterSize;
+    if (size > oldSize && (!extend(data, clusters) || !zero_fill(file, oldSize, size))) {
+        shrink(data, (oldSize + clusterSize - 1) / clusterSize);
+        flush_table();
+        return false;
+    }
+
+    file->set_file_size(size);
+    bool ok = size > oldSize || shrink(data, clusters);
+    ok = update_entry(data, size) && ok;
+    invalidate_dentries();
+    return flush_table() && ok;
+}
+
+auto FileAllocationTableDriver::free_entry(u32 directoryCluster) -> u64 {
+    if (!directoryCluster) directoryCluster = root_cluster();
+
+    std::vector<u8> contents;
+    u32 cluster = directoryCluster;
+    u64 clusters = 0;
+    const u64 limit = BR.total_clusters();
+    for (;;) {
+        u64 offset = 0;
+        u64 bytes = 0;
+        if (cluster == 0) {
+            offset = BR.first_root_directory_sector() * BR.BPB.NumBytesPerSector;
+            bytes = BR.BPB.root_directory_sectors() * BR.BPB.NumBytesPerSector;
+        } else {
+            offset = BR.cluster_to_sector(cluster) * BR.BPB.NumBytesPerSector;
+            bytes = BR.BPB.cluster_size();
+        }
+        contents.resize(bytes);
+        if (!bytes || Device->read_raw(offset, bytes, contents.data()) != ssz(bytes)) return 0;
+
+        // Unused and deleted entries are both free for the taking.
+        for (u64 i = 0; i < bytes; i += sizeof(ClusterEntry))
+            if (contents[i] == 0 || contents[i] == 0xe5) return offset + i;
+
+        // The fixed root directory of FAT12/16 can't grow.
+        if (cluster == 0) return 0;
+        ++clusters;
+        cluster = next_cluster(cluster);
+        if (cluster == FAT_END_OF_CHAIN || clusters >= limit) break;
+    }
+
+    // Grow the directory by a cluster of unused entries.
+    FATFile directory(directoryCluster);
+    if (!extend(&directory, clusters + 1)) return 0;
+    const FATExtent& last = directory.Extents[directory.Extents.size() - 1];
+    const u64 offset = BR.cluster_to_sector(last.Cluster + last.Length - 1) * BR.BPB.NumBytesPerSector;
+    contents.clear();
+    contents.resize(BR.BPB.cluster_size(), 0);
+    if (Device->write(nullptr, offset, contents.size(), contents.data()) != ssz(contents.size())) return 0;
+    return offset;
+}
+
+auto FileAllocationTableDriver::create(std::string_view path) -> std::shared_ptr<FileMetadata> {
+    while (path.size() && path[path.size() - 1] == '/') path.remove_suffix(1);
+    usz slash = path.size();
+    while (slash && path[slash - 1] != '/') --slash;
+    std::string_view name = path.substr(slash);
+    if (!name.size() || name == std::string_view(".") || name == std::string_view("..")) return {};
+
+    // Only names that fit 8.3 as they are; there's no LFN support here yet.
+    std::string shortName = translate_filename(name);
+    if (shortName.size() != 11) return {};
+
+    u32 directoryCluster = root_cluster();
+    std::string_view parentPath = path.substr(0, slash);
+    while (parentPath.size() && parentPath[0] == '/') parentPath.remove_prefix(1);
+    while (parentPath.size() && parentPath[parentPath.size() - 1] == '/') parentPath.remove_suffix(1);
+    if (parentPath.size()) {
+        auto parent = traverse_path(parentPath);
+        if (!parent || !parent->directory()) {
+            DBGMSG("[FAT]: No directory to create \"{}\" in\n", path);
+            return {};
+        }
+        directoryCluster = first_cluster(parent.get());
+    }
+    if (!find_in_directory(name, directoryCluster).Negative) return {};
+
+    const u64 at = free_entry(directoryCluster);
+    if (!at) {
+        flush_table();
+        return {};
+    }
+    ClusterEntry entry{};
+    memcpy(entry.FileName, shortName.data(), sizeof entry.FileName);
+    entry.Attributes = FAT_ATTR_ARCHIVE;
+    const bool written = Device->write(nullptr, at, sizeof entry, &entry) == sizeof entry;
+    // The directory may have grown to make room.
+    flush_table();
+    forget_index(directoryCluster);
+    invalidate_dentries();
+    if (!written) return {};
+
+    DBGMSG("[FAT]: Created \"{}\" as \"{}\"\n", path, shortName);
+    return shared_file(std::string(name), 0, at, 0, false);
+}
+
+bool FileAllocationTableDriver::read_directory(FileMetadata* directory, usz& cursor, DirectoryEntryWriter& out) {
+    if (!directory->directory()) return false;
+    const u32 cluster = first_cluster(directory);
+
+    // The cursor counts short entries from the start of the directory.
+    usz index = 0;
+    for (auto& Entry : for_each_dir_entry_in(cluster)) {
+        if (index++ < cursor) continue;
+        if (!Entry.CE->volume_id()) {
+            auto name = Entry.LongFileName.empty()
+                ? decode_short_name(Entry.FileName)
+                : decode_long_name(Entry.LongFileName);
+            u8 type = Entry.CE->directory() ? DIRECTORY_ENTRY_DIRECTORY : DIRECTORY_ENTRY_FILE;
+            if (!out.add(Entry.CE->get_cluster_number(), index, type, name)) return true;
+        }
+        cursor = index;
+    }
+    return true;
+}
@@ -21,11 +21,82 @@
 #define LENSOR_OS_FILE_ALLOCATION_TABLE_DRIVER_H
 
 #include <fat_definitions.h>
+#include <storage/dentry_cache.h>
 #include <storage/filesystem_driver.h>
 #include <storage/storage_device_driver.h>
 #include <string>
 #include <vector>
 
+/// Returned by `FileAllocationTableDriver::next_cluster()` past the last
+/// cluster of a chain.
+#define FAT_END_OF_CHAIN u32(-1)
+
+/// The FAT of a FAT32 volume is cached in this many windows of
+/// `FAT_TABLE_WINDOW_SIZE` bytes each (least recently used is evicted).
+/// FAT12/16 tables are at most 128KiB and are kept whole.
+#define FAT_TABLE_WINDOWS 16
+#define FAT_TABLE_WINDOW_SIZE 16384
+
+/// Directories whose names are indexed at once (least recently used
+/// is dropped); see `FileAllocationTableDriver::find_in_directory`.
+#define FAT_DIRECTORY_INDEXES 16
+/// A long name is spread over at most this many entries.
+#define FAT_LFN_MAX_ENTRIES 20
+
+/// Hash index of the names in one directory: short names ("FOO.TXT")
+/// and long names, both case-folded, to the offset of their entry.
+struct FATDirectoryIndex {
+    /// First cluster of the directory; -1 if the slot is unused.
+    u32 Directory { u32(-1) };
+    /// Lookups that had to read the directory. The second one indexes
+    /// it, so directories looked in only once are never indexed.
+    u32 Scans { 0 };
+    bool Built { false };
+    u64 LastUse { 0 };
+
+    struct Name {
+        u64 Hash;
+        std::string Folded;
+        u64 EntryOffset;
+        /// Index + 1 of the next name in the same bucket; 0 ends the chain.
+        u32 Next;
+    };
+    std::vector<Name> Names{};
+    /// Index + 1 of the first name in each bucket; a power of two.
+    std::vector<u32> Buckets{};
+
+    void add(std::string_view name, u64 entryOffset);
+    /// @return Offset of the entry named `name`, or zero.
+    auto lookup(std::string_view name) const -> u64;
+    void clear();
+};
+
+/// A run of physically contiguous clusters of a file.
+struct FATExtent {
+    /// Index of the first cluster of the run within the file.
+    u64 FileCluster;
+    /// Where it is on the volume.
+    u32 Cluster;
+    u32 Length;
+};
+
+/// What a `FileAllocationTableDriver` keeps per open file, as the
+/// file's driver data.
+struct FATFile {
+    explicit FATFile(u32 firstCluster, u64 entryOffset = 0)
+        : FirstCluster(firstCluster), EntryOffset(entryOffset) {}
+
+    /// Zero for a file without clusters, or the root directory.
+    u32 FirstCluster;
+    /// Byte offset of the file's directory entry on the device; zero
+    /// for the root directory, which has none.
+    u64 EntryOffset;
+    /// The whole cluster chain, in order. Built by walking the chain
+    /// the first time the file's data is needed.
+    std::vector<FATExtent> Extents{};
+    bool Mapped { false };
+};
+
 class FileAllocationTableDriver final : public FilesystemDriver {
     /// This constructor is only used internally in try_create() and is always
     /// invoked via std::make_shared().
@@ -64,30 +135,130 @@ class FileAllocationTableDriver final : public FilesystemDriver {
 
     static auto fat_type(BootRecord& br) -> FATType;
 
+    /// The whole FAT, for FAT12/16.
+    std::vector<u8> Table{};
+
+    /// Bytes of `Table` changed since it was last written back.
+    u64 DirtyLow { u64(-1) };
+    u64 DirtyHigh { 0 };
+
+    /// Windows onto the FAT, for FAT32.
+    struct TableWindow {
+        /// Byte offset of the window within the FAT, or -1 if unused.
+        u64 Offset { u64(-1) };
+        u64 LastUse { 0 };
+        /// Changed since it was last written back.
+        bool Dirty { false };
+        std::vector<u8> Data{};
+    };
+    TableWindow Windows[FAT_TABLE_WINDOWS]{};
+    u64 WindowClock { 0 };
+
+    /// One bit per cluster number, set if the cluster is free. Built
+    /// from the FAT at mount time, and kept in step with it since.
+    std::vector<u64> FreeMap{};
+    u64 FreeClusters { 0 };
+    /// Where searches for free clusters begin; seeded from the FSInfo
+    /// sector of FAT32, and moved past every allocation.
+    u32 NextFree { 2 };
+    /// The FSInfo sector needs writing back along with the FAT.
+    bool FSInfoDirty { false };
+
+    /// Read the FAT (or nothing, for FAT32) into memory.
+    bool load_table();
+
+    /// Build `FreeMap` by reading the whole FAT once.
+    bool load_free_map();
+
+    /// Pointer to the bytes of the FAT at `offset`, caching them first if need be.
+    auto table_bytes(u64 offset) -> u8*;
+
+    /// The FAT entry of `cluster` as it is stored (zero if free), or
+    /// FAT_END_OF_CHAIN if it can't be read.
+    auto table_entry(u32 cluster) -> u32;
+
+    /// Write the FAT bytes at `offset` back to every copy of the FAT.
+    bool write_table(u64 offset, u64 bytes, const u8* data);
+
+    /// Set the FAT entry of `cluster` to `value` (0 frees it, and
+    /// FAT_END_OF_CHAIN ends a chain) in memory. Nothing reaches the
+    /// device until `flush_table()`.
+    bool set_cluster(u32 cluster, u32 value);
+
+    /// Write every change to the FAT (and FSInfo) back to the device.
+    bool flush_table();
+
+    bool cluster_free(u32 cluster) const {
+        return FreeMap[cluster / 64] & (u64(1) << (cluster % 64));
+    }
+
+    /// Find a run of up to `count` free clusters, preferably starting
+    /// at `goal` (just past the end of the file being extended), or
+    /// else the first run of `count` from `NextFree` on. If there is
+    /// none that long, the longest there is.
+    /// @return The first cluster of the run, or zero if the volume is full.
+    auto find_free_run(u32 goal, u32 count, u32& length) -> u32;
+
+    /// Grow the chain of `file` to at least `clusters` clusters.
+    bool extend(FATFile* file, u64 clusters);
+
+    /// Free every cluster of `file` past the first `clusters`.
+    bool shrink(FATFile* file, u64 clusters);
+
+    /// Write the size and first cluster of `file` to its directory entry.
+    bool update_entry(FATFile* file, u64 size);
+
+    /// Write zeroes to `file` from `from` up to `to`.
+    bool zero_fill(FileMetadata* file, usz from, usz to);
+
+    /// Find (or make, by growing the directory) room for one more entry
+    /// in the directory at `directoryCluster`.
+    /// @return Byte offset of the entry on the device, or zero.
+    auto free_entry(u32 directoryCluster) -> u64;
+
+    /// First cluster of the root directory; zero stands for the fixed
+    /// root directory region of FAT12/16.
+    auto root_cluster() -> u32;
+
+    /// First cluster of `file`, or zero if it has none (see `root_cluster()`).
+    auto first_cluster(FileMetadata* file) -> u32;
+
+    /// Build the extent map of `file`, if that wasn't done yet.
+    void map_extents(FATFile* file);
+
+    /// Where the data of `file` at `offs` is on the device, and how
+    /// many bytes from there on are contiguous (up to `bytes`). A
+    /// binary search of the file's extents.
+    /// Returns -1 past the end of the chain.
+    auto locate(FileMetadata* file, usz offs, usz bytes, usz& contiguous) -> u64;
+
     /// This is so we have something that we can call begin() and end() on because
     /// calling begin()/end() on the driver itself would be a bit weird semantically.
     struct DirIteratorHelper {
         FileAllocationTableDriver& Driver;
-        u32 ClusterIndex = Driver.BR.sector_to_cluster(Driver.BR.first_root_directory_sector());
+        u32 ClusterIndex = Driver.root_cluster();
 
         /// This does the actual iterating.
         struct Iterator {
             FileAllocationTableDriver& Driver;
+            /// The cluster being iterated; zero is the fixed root
+            /// directory region of FAT12/16.
             u32 ClusterIndex;
 
-            /// Constants.
-            const u64 ClusterSize = Driver.BR.BPB.NumSectorsPerCluster * Driver.BR.BPB.NumBytesPerSector;
-
             /// Iteration data.
-            std::vector<u8> ClusterContents{ClusterSize};
-            u64 LastFATSector = 0;
+            std::vector<u8> ClusterContents{};
+            /// Where ClusterContents is on the device.
+            u64 ClusterOffset = 0;
+            usz EntryCount = 0;
+            usz EntryIndex = 0;
             bool MoreClusters = true;
             bool ClearLFN = false;
 
             /// The current entry.
             struct EntryType {
                 ClusterEntry* CE{};
-                u64 ByteOffset{};
+                /// Where `CE` itself is on the device.
+                u64 EntryOffset{};
                 std::string FileName;
                 std::string LongFileName;
             } Entry{};
@@ -99,10 +270,11 @@ class FileAllocationTableDriver final : public FilesystemDriver {
             bool operator!=(std::default_sentinel_t) const { return MoreClusters; }
 
         private:
-            /// Read the next cluster unconditionally.
-            void ReadNextCluster();
+            /// Read the cluster at ClusterIndex unconditionally.
+            void ReadCluster();
 
-            /// Read the next cluster if there is one. If there isn’t, set MoreClusters to false.
+            /// Follow the FAT to the next cluster and read it, if there
+            /// is one. If there isn’t, set MoreClusters to false.
             void TryReadNextCluster();
         };
 
@@ -123,27 +295,79 @@ class FileAllocationTableDriver final : public FilesystemDriver {
     /// NOTE: If directoryCluster == -1, it will be replaced with the directory cluster of the root directory.
     std::shared_ptr<FileMetadata> traverse_path(std::string_view raw_path, u32 directoryCluster = -1);
 
+    /// Find `raw_filename` in the directory starting at `directoryCluster`,
+    /// by its index if it has one, or else by reading it: short names
+    /// are compared whole, and long names only decoded (and compared)
+    /// when their checksum says they belong to the short name.
+    auto find_in_directory(std::string_view raw_filename, u32 directoryCluster) -> DentryCacheEntry;
+
+    FATDirectoryIndex Indexes[FAT_DIRECTORY_INDEXES]{};
+    u64 IndexClock { 0 };
+
+    /// The index slot of `directoryCluster`, taking over the least
+    /// recently used one if it has none.
+    auto directory_index(u32 directoryCluster) -> FATDirectoryIndex&;
+    void build_index(FATDirectoryIndex& index);
+    /// Drop the index of a directory that was changed.
+    void forget_index(u32 directoryCluster);
+
+    /// Call `visit(entry, offset)` for each entry of the directory at
+    /// `directoryCluster` in turn, as long as it returns true.
+    template <typename Visit>
+    void scan_directory(u32 directoryCluster, Visit visit);
+
+    /// What the directory entry at `offset` on the device says.
+    auto entry_at(u64 offset) -> DentryCacheEntry;
+
+    /// Every file open on this volume, by the device offset of its
+    /// directory entry (zero for the root directory). Opening a file
+    /// twice gets the same metadata, so its size, first cluster and
+    /// extents are only ever kept in one place.
+    struct OpenFile {
+        u64 EntryOffset;
+        std::weak_ptr<FileMetadata> Meta;
+    };
+    std::vector<OpenFile> OpenFiles{};
+
+    /// The metadata of the file whose directory entry is at
+    /// `entryOffset`; created from the rest if it isn't open already.
+    auto shared_file(std::string name, u32 firstCluster, u64 entryOffset, u64 size, bool directory)
+        -> std::shared_ptr<FileMetadata>;
+
+    /// Take the size and first cluster of `file` from its directory
+    /// entry, if the entry says otherwise.
+    bool reload_entry(FileMetadata* file);
+
 public:
     static void print_fat(BootRecord&);
 
-    auto open(std::string_view path) -> std::shared_ptr<FileMetadata> final;
-    void close(FileMetadata* file) final { Device->close(file); }
+    /// The cluster after `cluster` in its chain, or FAT_END_OF_CHAIN.
+    /// Served from the in-memory copy of the FAT.
+    auto next_cluster(u32 cluster) -> u32;
 
-    ssz read(FileMetadata* file, usz offs, usz size, void* buffer) final {
-        return Device->read_raw(usz(file->driver_data()) + offs, size, buffer);
+    auto open(std::string_view path) -> std::shared_ptr<FileMetadata> final;
+    void close(FileMetadata* file) final {
+        delete static_cast<FATFile*>(file->driver_data());
+        Device->close(file);
     }
+    bool read_directory(FileMetadata* directory, usz& cursor, DirectoryEntryWriter& out) final;
+
+    ssz read(FileMetadata* file, usz offs, usz size, void* buffer) final;
 
     ssz read_raw(usz offs, usz bytes, void* buffer) final {
         return Device->read_raw(offs, bytes, buffer);
     }
 
-    ssz write(FileMetadata* file, usz offset, usz size, void* buffer) final {
-        // TODO: Fail? if this would increase file size. I feel like we
-        // don't want to write past the end of the file, just in case
-        // there is stuff there, right? So we will have to figure out
-        // how to make a file bigger in FAT.
-        return Device->write(file, usz(file->driver_data()) + offset, size, buffer);
-    }
+    IOVector borrow(FileMetadata* file, usz offs, usz bytes) final;
+    void prefetch(FileMetadata* file, usz offs, usz bytes) final;
+
+    /// Past the end of the file, clusters are allocated as needed.
+    ssz write(FileMetadata* file, usz offset, usz size, void* buffer) final;
+
+    /// Create an empty file with an 8.3 name (long names can't be
+    /// created yet).
+    auto create(std::string_view path) -> std::shared_ptr<FileMetadata> final;
+    bool truncate(FileMetadata* file, usz size) final;
 
     const char* name() final { return "File Allocation Table"; }
 
@@ -153,6 +377,10 @@ public:
     static auto try_create(std::shared_ptr<StorageDeviceDriver>) -> std::shared_ptr<FilesystemDriver>;
 
     static auto translate_filename(std::string_view path) -> std::string;
+
+private:
+    /// Drop cached lookups, once a directory or the size of a file changed.
+    void invalidate_dentries();
 };
 
 #endif /* LENSOR_OS_FILE_ALLOCATION_TABLE_DRIVER_H */
@@ -0,0 +1,294 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#include <storage/filesystem_drivers/initramfs.h>
+
+#include <integers.h>
+#include <memory.h>
+
+#include <algorithm>
+#include <format>
+#include <memory>
+#include <string_view>
+
+// Uncomment the following directive for extra debug information output.
+//#define DEBUG_INITRAMFS
+
+#ifdef DEBUG_INITRAMFS
+#   define DBGMSG(...) std::print(__VA_ARGS__)
+#else
+#   define DBGMSG(...)
+#endif
+
+#define get_entry(meta) static_cast<InitRamFSEntry*>((meta)->driver_data())
+
+namespace {
+constexpr usz TAR_BLOCK_SIZE = 512;
+
+struct [[gnu::packed]] TarHeader {
+    char Name[100];
+    char Mode[8];
+    char UID[8];
+    char GID[8];
+    char Size[12];
+    char ModifiedTime[12];
+    char Checksum[8];
+    char Type;
+    char LinkName[100];
+    /// "ustar\0" (POSIX) or "ustar " (GNU).
+    char Magic[6];
+    char Version[2];
+    char UserName[32];
+    char GroupName[32];
+    char DeviceMajor[8];
+    char DeviceMinor[8];
+    char Prefix[155];
+    char Padding[12];
+};
+static_assert(sizeof(TarHeader) == TAR_BLOCK_SIZE);
+
+auto octal(const char* field, usz length) -> usz {
+    usz value = 0;
+    for (usz i = 0; i < length && field[i] >= '0' && field[i] <= '7'; ++i)
+        value = value * 8 + usz(field[i] - '0');
+    return value;
+}
+
+/// A NUL-padded field that may use every byte of its length.
+auto field(const char* field, usz length) -> std::string_view {
+    usz size = 0;
+    while (size < length && field[size]) ++size;
+    return { field, size };
+}
+
+bool valid(const TarHeader& header) {
+    if (memcmp(header.Magic, "ustar", 5) != 0) return false;
+    // The checksum is calculated with the checksum field itself as spaces.
+    auto* bytes = reinterpret_cast<const u8*>(&header);
+    usz sum = 0;
+    for (usz i = 0; i < TAR_BLOCK_SIZE; ++i) {
+        if (i >= offsetof(TarHeader, Checksum) && i < offsetof(TarHeader, Type)) sum += u8(' ');
+        else sum += bytes[i];
+    }
+    return sum == octal(header.Checksum, sizeof header.Checksum);
+}
+
+/// Strip the "./" and "/" that archivers like to put in front of
+/// paths, and the slash they put after directories.
+auto normalise(std::string_view path) -> std::string_view {
+    for (;;) {
+        if (path.starts_with("./")) path.remove_prefix(2);
+        else if (path.starts_with("/")) path.remove_prefix(1);
+        else break;
+    }
+    while (path.size() && path[path.size() - 1] == '/') path.remove_suffix(1);
+    if (path.size() == 1 && path[0] == '.') return {};
+    return path;
+}
+} // namespace
+
+auto InitialRamFilesystemDriver::try_create(const void* archive, usz size) -> std::shared_ptr<FilesystemDriver> {
+    if (!archive || size < TAR_BLOCK_SIZE) return nullptr;
+    if (!valid(*static_cast<const TarHeader*>(archive))) return nullptr;
+
+    auto fs = std::shared_ptr<InitialRamFilesystemDriver>(new InitialRamFilesystemDriver(static_cast<const u8*>(archive), size));
+    fs->This = fs;
+    if (!fs->parse()) return nullptr;
+    std::print("[INITRAMFS]: Indexed {} entries of {} byte archive at {}\n",
+               fs->Entries.size() - 1, size, (void*) archive);
+    return std::static_pointer_cast<FilesystemDriver>(fs);
+}
+
+auto InitialRamFilesystemDriver::hash(std::string_view path) -> usz {
+    // FNV-1a
+    u64 hash = 0xcbf29ce484222325ull;
+    for (char c : path) {
+        hash ^= u8(c);
+        hash *= 0x100000001b3ull;
+    }
+    return usz(hash ^ (hash >> 29));
+}
+
+auto InitialRamFilesystemDriver::lookup(std::string_view path) -> InitRamFSEntry* {
+    if (Buckets.empty()) return nullptr;
+    for (usz i = Buckets[hash(path) & (Buckets.size() - 1)]; i != usz(-1); i = Entries[i].Next)
+        if (std::string_view(Entries[i].Path) == path) return &Entries[i];
+    return nullptr;
+}
+
+void InitialRamFilesystemDriver::link(usz index) {
+    usz& bucket = Buckets[hash(Entries[index].Path) & (Buckets.size() - 1)];
+    Entries[index].Next = bucket;
+    bucket = index;
+}
+
+auto InitialRamFilesystemDriver::insert(std::string_view path, bool directory) -> usz {
+    if (InitRamFSEntry* existing = lookup(path)) return usz(existing - Entries.data());
+
+    usz slash = path.size();
+    while (slash && path[slash - 1] != '/') --slash;
+    usz parent = slash ? insert(path.substr(0, slash - 1), true) : 0;
+
+    InitRamFSEntry entry;
+    entry.Path = std::string(path);
+    entry.Directory = directory;
+    entry.Parent = parent;
+    Entries.push_back(std::move(entry));
+
+    // Power of two buckets, at most half full.
+    if (Entries.size() * 2 > Buckets.size()) {
+        usz buckets = Buckets.size() * 2;
+        Buckets.clear();
+        Buckets.resize(buckets, usz(-1));
+        for (usz i = 0; i < Entries.size(); ++i) link(i);
+    } else link(Entries.size() - 1);
+    return Entries.size() - 1;
+}
+
+bool InitialRamFilesystemDriver::parse() {
+    InitRamFSEntry root;
+    root.Directory = true;
+    Entries.push_back(std::move(root));
+    Buckets.resize(16, usz(-1));
+    link(0);
+
+    // Paths too long for the header come in a record of their own
+    // (pax extended header or GNU long name) just before the entry.
+    std::string_view longPath;
+    usz offset = 0;
+    while (offset + TAR_BLOCK_SIZE <= ArchiveSize) {
+        const auto& header = *reinterpret_cast<const TarHeader*>(Archive + offset);
+        // The archive ends with (at least) one block of zeroes.
+        if (header.Name[0] == '\0') break;
+        if (!valid(header)) {
+            std::print("[INITRAMFS]: Invalid header at offset {}, ignoring rest of archive\n", offset);
+            break;
+        }
+
+        const usz size = octal(header.Size, sizeof header.Size);
+        const u8* data = Archive + offset + TAR_BLOCK_SIZE;
+        if (size > ArchiveSize - offset - TAR_BLOCK_SIZE) {
+            std::print("[INITRAMFS]: Entry at offset {} runs past the end of the archive\n", offset);
+            break;
+        }
+        offset += TAR_BLOCK_SIZE + (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+
+        if (header.Type == 'L') {
+            longPath = field(reinterpret_cast<const char*>(data), size);
+            continue;
+        }
+        if (header.Type == 'x') {
+            // Records of the form "<length> <key>=<value>\n".
+            std::string_view records(reinterpret_cast<const char*>(data), size);
+            while (records.size()) {
+                usz length = 0;
+                usz i = 0;
+                while (i < records.size() && records[i] >= '0' && records[i] <= '9')
+                    length = length * 10 + usz(records[i++] - '0');
+                if (!length || length > records.size()) break;
+                std::string_view record = records.substr(i + 1, length - i - 2);
+                if (record.starts_with("path=")) longPath = record.substr(5);
+                records.remove_prefix(length);
+            }
+            continue;
+        }
+
+        std::string path;
+        if (longPath.size()) path = std::string(longPath);
+        else {
+            auto prefix = field(header.Prefix, sizeof header.Prefix);
+            if (prefix.size()) path = std::format("{}/{}", prefix, field(header.Name, sizeof header.Name));
+            else path = std::string(field(header.Name, sizeof header.Name));
+        }
+        longPath = {};
+
+        auto normalised = normalise(path);
+        if (!normalised.size()) continue;
+        if (header.Type == '0' || header.Type == '\0') {
+            usz i = insert(normalised, false);
+            Entries[i].Data = data;
+            Entries[i].Size = size;
+        } else if (header.Type == '5') insert(normalised, true);
+        else {
+            DBGMSG("[INITRAMFS]: Skipping \"{}\" of unsupported type '{}'\n", normalised, header.Type);
+        }
+    }
+
+    return true;
+}
+
+auto InitialRamFilesystemDriver::metadata(InitRamFSEntry* entry) -> std::shared_ptr<FileMetadata> {
+    if (auto meta = entry->Meta.lock()) return meta;
+    std::string_view path = entry->Path;
+    usz slash = path.size();
+    while (slash && path[slash - 1] != '/') --slash;
+    auto meta = std::make_shared<FileMetadata>(std::string(path.substr(slash)), sdd(This.lock()), entry->Size, entry, entry->Directory);
+    entry->Meta = meta;
+    return meta;
+}
+
+auto InitialRamFilesystemDriver::open(std::string_view path) -> std::shared_ptr<FileMetadata> {
+    InitRamFSEntry* entry = lookup(normalise(path));
+    if (!entry) return {};
+    return metadata(entry);
+}
+
+bool InitialRamFilesystemDriver::read_directory(FileMetadata* directory, usz& cursor, DirectoryEntryWriter& out) {
+    InitRamFSEntry* entry = get_entry(directory);
+    if (!entry || !entry->Directory) return false;
+    // The cursor is the index of the next entry to look at; the root
+    // (entry zero) is nobody's child.
+    const usz parent = usz(entry - Entries.data());
+    for (usz i = std::max(cursor, usz(1)); i < Entries.size(); ++i) {
+        cursor = i;
+        const InitRamFSEntry& child = Entries[i];
+        if (child.Parent != parent) continue;
+        std::string_view name = child.Path;
+        usz slash = name.size();
+        while (slash && name[slash - 1] != '/') --slash;
+        u8 type = child.Directory ? DIRECTORY_ENTRY_DIRECTORY : DIRECTORY_ENTRY_FILE;
+        if (!out.add(i, i + 1, type, name.substr(slash))) return true;
+    }
+    cursor = Entries.size();
+    return true;
+}
+
+ssz InitialRamFilesystemDriver::read(FileMetadata* file, usz offs, usz bytes, void* buffer) {
+    InitRamFSEntry* entry = get_entry(file);
+    if (!entry || entry->Directory || !buffer) return -1;
+    if (offs >= entry->Size) return 0;
+    bytes = std::min(bytes, entry->Size - offs);
+    memcpy(buffer, entry->Data + offs, bytes);
+    return ssz(bytes);
+}
+
+ssz InitialRamFilesystemDriver::read_raw(usz offs, usz bytes, void* buffer) {
+    if (!buffer) return -1;
+    if (offs >= ArchiveSize) return 0;
+    bytes = std::min(bytes, ArchiveSize - offs);
+    memcpy(buffer, Archive + offs, bytes);
+    return ssz(bytes);
+}
+
+IOVector InitialRamFilesystemDriver::borrow(FileMetadata* file, usz offs, usz bytes) {
+    InitRamFSEntry* entry = get_entry(file);
+    if (!entry || entry->Directory || offs >= entry->Size) return { nullptr, 0 };
+    return { const_cast<u8*>(entry->Data + offs), std::min(bytes, entry->Size - offs) };
+}
@@ -0,0 +1,102 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#ifndef LENSOR_OS_INITRAMFS_DRIVER_H
+#define LENSOR_OS_INITRAMFS_DRIVER_H
+
+#include <integers.h>
+#include <storage/file_metadata.h>
+#include <storage/filesystem_driver.h>
+#include <storage/storage_device_driver.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// A file or directory within the archive of an `InitialRamFilesystemDriver`.
+struct InitRamFSEntry {
+    /// Path relative to the root, without leading or trailing slashes;
+    /// empty for the root itself.
+    std::string Path;
+    bool Directory { false };
+    /// Contents of a file, pointing straight into the archive.
+    const u8* Data { nullptr };
+    usz Size { 0 };
+    /// Index of the containing directory's entry.
+    usz Parent { 0 };
+    /// Index of the next entry in the same bucket of the path index.
+    usz Next { usz(-1) };
+    /// Every open of the entry shares this.
+    std::weak_ptr<FileMetadata> Meta;
+};
+
+/// Read-only filesystem over a ustar archive that the bootloader left
+/// in memory (an "initrd"). The archive is walked once, when mounted,
+/// to build a hash index of every path in it; after that, an open is
+/// a single lookup and file data is read (or borrowed) in place,
+/// without ever being copied out of the archive.
+class InitialRamFilesystemDriver final : public FilesystemDriver {
+    InitialRamFilesystemDriver(const u8* archive, usz size)
+        : Archive(archive), ArchiveSize(size) {}
+
+    /// Weak reference to ourselves, handed to every file we open.
+    /// See `FileAllocationTableDriver::This`.
+    std::weak_ptr<InitialRamFilesystemDriver> This{};
+
+    const u8* Archive;
+    usz ArchiveSize;
+
+    /// Entry zero is the root directory.
+    std::vector<InitRamFSEntry> Entries;
+    std::vector<usz> Buckets;
+
+    static auto hash(std::string_view path) -> usz;
+    auto lookup(std::string_view path) -> InitRamFSEntry*;
+    /// Chain entry `index` into its bucket of the path index.
+    void link(usz index);
+    /// Add an entry for `path`, and for any of its parent directories
+    /// that the archive didn't list first. Returns its index.
+    auto insert(std::string_view path, bool directory) -> usz;
+    /// Parse the archive into `Entries` and build the index.
+    bool parse();
+
+    auto metadata(InitRamFSEntry* entry) -> std::shared_ptr<FileMetadata>;
+
+public:
+    /// Returns nullptr unless `archive` holds a valid ustar archive.
+    static auto try_create(const void* archive, usz size) -> std::shared_ptr<FilesystemDriver>;
+
+    auto open(std::string_view path) -> std::shared_ptr<FileMetadata> final;
+    bool read_directory(FileMetadata* directory, usz& cursor, DirectoryEntryWriter& out) final;
+    /// The archive lives as long as the kernel; there's nothing to close.
+    void close(FileMetadata*) final {}
+
+    ssz read(FileMetadata* file, usz offs, usz bytes, void* buffer) final;
+    ssz read_raw(usz offs, usz bytes, void* buffer) final;
+    ssz write(FileMetadata*, usz, usz, void*) final { return -1; }
+    IOVector borrow(FileMetadata* file, usz offs, usz bytes) final;
+
+    const char* name() final { return "Initial RAM Filesystem"; }
+
+    auto device() -> std::shared_ptr<StorageDeviceDriver> final { return nullptr; }
+};
+
+#endif /* LENSOR_OS_INITRAMFS_DRIVER_H */
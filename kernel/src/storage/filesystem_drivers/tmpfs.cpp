@@ -0,0 +1,267 @@
+/* Copyright 2022, Contributors To LensorOS.
+* All rights reserved.
+*
+* This file is part of LensorOS.
+*
+* LensorOS is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LensorOS is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LensorOS. If not, see <https://www.gnu.org/licenses
+*/
+
+#include <storage/filesystem_drivers/tmpfs.h>
+
+#include <integers.h>
+#include <memory.h>
+#include <memory/common.h>
+#include <memory/physical_memory_manager.h>
+
+#include <algorithm>
+#include <format>
+#include <memory>
+#include <string_view>
+
+// Uncomment the following directive for extra debug information output.
+//#define DEBUG_TMPFS
+
+#ifdef DEBUG_TMPFS
+#   define DBGMSG(...) std::print(__VA_ARGS__)
+#else
+#   define DBGMSG(...)
+#endif
+
+#define get_node(meta) static_cast<TmpFSNode*>((meta)->driver_data())
+
+auto TemporaryFilesystemDriver::create() -> std::shared_ptr<FilesystemDriver> {
+    auto fs = std::shared_ptr<TemporaryFilesystemDriver>(new TemporaryFilesystemDriver);
+    fs->This = fs;
+    return std::static_pointer_cast<FilesystemDriver>(fs);
+}
+
+TemporaryFilesystemDriver::~TemporaryFilesystemDriver() {
+    for (TmpFSNode* head : Root.Buckets) {
+        while (head) {
+            TmpFSNode* next = head->Next;
+            destroy(head);
+            head = next;
+        }
+    }
+}
+
+void TemporaryFilesystemDriver::destroy(TmpFSNode* node) {
+    for (TmpFSNode* head : node->Buckets) {
+        while (head) {
+            TmpFSNode* next = head->Next;
+            destroy(head);
+            head = next;
+        }
+    }
+    for (u8* page : node->Pages)
+        if (page) Memory::free_page(page);
+    delete node;
+}
+
+auto TemporaryFilesystemDriver::hash(std::string_view name) -> usz {
+    // FNV-1a
+    u64 hash = 0xcbf29ce484222325ull;
+    for (char c : name) {
+        hash ^= u8(c);
+        hash *= 0x100000001b3ull;
+    }
+    return usz(hash ^ (hash >> 29));
+}
+
+auto TemporaryFilesystemDriver::lookup(TmpFSNode* directory, std::string_view name) -> TmpFSNode* {
+    if (directory->Buckets.empty()) return nullptr;
+    TmpFSNode* node = directory->Buckets[hash(name) % directory->Buckets.size()];
+    while (node && std::string_view(node->Name) != name) node = node->Next;
+    return node;
+}
+
+void TemporaryFilesystemDriver::link(TmpFSNode* directory, TmpFSNode* node) {
+    if (directory->Children >= directory->Buckets.size()) {
+        std::vector<TmpFSNode*> buckets(std::max(directory->Buckets.size() * 2, usz(8)), nullptr);
+        for (TmpFSNode* head : directory->Buckets) {
+            while (head) {
+                TmpFSNode* next = head->Next;
+                TmpFSNode*& bucket = buckets[hash(head->Name) % buckets.size()];
+                head->Next = bucket;
+                bucket = head;
+                head = next;
+            }
+        }
+        directory->Buckets = std::move(buckets);
+    }
+    TmpFSNode*& bucket = directory->Buckets[hash(node->Name) % directory->Buckets.size()];
+    node->Parent = directory;
+    node->Next = bucket;
+    bucket = node;
+    ++directory->Children;
+}
+
+auto TemporaryFilesystemDriver::resolve(std::string_view path) -> TmpFSNode* {
+    TmpFSNode* node = &Root;
+    while (node && path.size()) {
+        if (path[0] == '/') {
+            path.remove_prefix(1);
+            continue;
+        }
+        if (!node->Directory) return nullptr;
+        usz end = std::min(path.find('/'), path.size());
+        node = lookup(node, path.substr(0, end));
+        path.remove_prefix(end);
+    }
+    return node;
+}
+
+auto TemporaryFilesystemDriver::make_node(std::string_view path, bool directory) -> TmpFSNode* {
+    while (path.size() && path[path.size() - 1] == '/') path.remove_suffix(1);
+    usz slash = path.size();
+    while (slash && path[slash - 1] != '/') --slash;
+    std::string_view name = path.substr(slash);
+    if (!name.size() || name == std::string_view(".") || name == std::string_view("..")) return nullptr;
+
+    TmpFSNode* parent = slash ? resolve(path.substr(0, slash - 1)) : &Root;
+    if (!parent || !parent->Directory) {
+        DBGMSG("[TMPFS]: No directory to create \"{}\" in\n", path);
+        return nullptr;
+    }
+    if (TmpFSNode* existing = lookup(parent, name))
+        return existing->Directory == directory ? existing : nullptr;
+
+    auto* node = new TmpFSNode;
+    node->Name = std::string(name);
+    node->Directory = directory;
+    link(parent, node);
+    DBGMSG("[TMPFS]: Created {} \"{}\"\n", directory ? "directory" : "file", path);
+    return node;
+}
+
+auto TemporaryFilesystemDriver::metadata(TmpFSNode* node) -> std::shared_ptr<FileMetadata> {
+    if (auto meta = node->Meta.lock()) return meta;
+    auto meta = std::make_shared<FileMetadata>(node->Name, sdd(This.lock()), node->Size, node, node->Directory);
+    node->Meta = meta;
+    return meta;
+}
+
+auto TemporaryFilesystemDriver::open(std::string_view path) -> std::shared_ptr<FileMetadata> {
+    TmpFSNode* node = resolve(path);
+    if (!node) return {};
+    return metadata(node);
+}
+
+auto TemporaryFilesystemDriver::create(std::string_view path) -> std::shared_ptr<FileMetadata> {
+    TmpFSNode* node = make_node(path, false);
+    if (!node) return {};
+    return metadata(node);
+}
+
+bool TemporaryFilesystemDriver::make_directory(std::string_view path) {
+    return make_node(path, true) != nullptr;
+}
+
+bool TemporaryFilesystemDriver::truncate(FileMetadata* file, usz size) {
+    TmpFSNode* node = get_node(file);
+    if (!node || node->Directory) return false;
+
+    // Pages past the new end are freed; growing leaves a hole.
+    const usz pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (usz i = pages; i < node->Pages.size(); ++i)
+        if (node->Pages[i]) Memory::free_page(node->Pages[i]);
+    node->Pages.resize(pages, nullptr);
+    // What's left of the last page must read as zeroes if it grows again.
+    if (size < node->Size && size % PAGE_SIZE && node->Pages[pages - 1])
+        memset(node->Pages[pages - 1] + size % PAGE_SIZE, 0, PAGE_SIZE - size % PAGE_SIZE);
+
+    node->Size = size;
+    file->set_file_size(size);
+    return true;
+}
+
+bool TemporaryFilesystemDriver::read_directory(FileMetadata* directory, usz& cursor, DirectoryEntryWriter& out) {
+    TmpFSNode* node = get_node(directory);
+    if (!node || !node->Directory) return false;
+    // The cursor counts children in bucket order, which holds as long
+    // as nothing is added to the directory in between calls.
+    usz index = 0;
+    for (TmpFSNode* head : node->Buckets) {
+        for (TmpFSNode* child = head; child; child = child->Next, ++index) {
+            if (index < cursor) continue;
+            u8 type = child->Directory ? DIRECTORY_ENTRY_DIRECTORY : DIRECTORY_ENTRY_FILE;
+            if (!out.add(u64(child), index + 1, type, child->Name)) return true;
+            cursor = index + 1;
+        }
+    }
+    return true;
+}
+
+ssz TemporaryFilesystemDriver::read(FileMetadata* file, usz offs, usz bytes, void* buffer) {
+    TmpFSNode* node = get_node(file);
+    if (!node || node->Directory || !buffer) return -1;
+    if (offs >= node->Size) return 0;
+    bytes = std::min(bytes, node->Size - offs);
+
+    auto* out = static_cast<u8*>(buffer);
+    usz remaining = bytes;
+    while (remaining) {
+        usz within = offs % PAGE_SIZE;
+        usz chunk = std::min(PAGE_SIZE - within, remaining);
+        if (u8* page = node->Pages[offs / PAGE_SIZE]) memcpy(out, page + within, chunk);
+        else memset(out, 0, chunk);
+        out += chunk;
+        offs += chunk;
+        remaining -= chunk;
+    }
+    return ssz(bytes);
+}
+
+ssz TemporaryFilesystemDriver::write(FileMetadata* file, usz offs, usz bytes, void* buffer) {
+    TmpFSNode* node = get_node(file);
+    if (!node || node->Directory || !buffer) return -1;
+    if (!bytes) return 0;
+
+    // Pages past the old end are holes until written to.
+    const usz end = offs + bytes;
+    const usz pages = (end + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (node->Pages.size() < pages) node->Pages.resize(pages, nullptr);
+
+    auto* in = static_cast<const u8*>(buffer);
+    usz done = 0;
+    while (done < bytes) {
+        usz within = offs % PAGE_SIZE;
+        usz chunk = std::min(PAGE_SIZE - within, bytes - done);
+        u8*& page = node->Pages[offs / PAGE_SIZE];
+        if (!page) {
+            page = static_cast<u8*>(Memory::request_page());
+            if (!page) break;
+            memset(page, 0, PAGE_SIZE);
+        }
+        memcpy(page + within, in, chunk);
+        in += chunk;
+        offs += chunk;
+        done += chunk;
+    }
+
+    if (offs > node->Size) {
+        node->Size = offs;
+        file->set_file_size(offs);
+    }
+    return done ? ssz(done) : -1;
+}
+
+IOVector TemporaryFilesystemDriver::borrow(FileMetadata* file, usz offs, usz bytes) {
+    TmpFSNode* node = get_node(file);
+    if (!node || node->Directory || offs >= node->Size) return { nullptr, 0 };
+    u8* page = node->Pages[offs / PAGE_SIZE];
+    if (!page) return { nullptr, 0 };
+    usz within = offs % PAGE_SIZE;
+    return { page + within, std::min(usz(PAGE_SIZE - within), bytes, usz(node->Size - offs)) };
+}
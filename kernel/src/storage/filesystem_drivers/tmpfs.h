@@ -0,0 +1,105 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#ifndef LENSOR_OS_TMPFS_DRIVER_H
+#define LENSOR_OS_TMPFS_DRIVER_H
+
+#include <integers.h>
+#include <storage/file_metadata.h>
+#include <storage/filesystem_driver.h>
+#include <storage/storage_device_driver.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// A file or directory of a `TemporaryFilesystemDriver`.
+struct TmpFSNode {
+    std::string Name;
+    bool Directory { false };
+    TmpFSNode* Parent { nullptr };
+    /// Next node in the same bucket of the parent's directory index.
+    TmpFSNode* Next { nullptr };
+
+    /// File contents, a page per entry. Pages that were never written
+    /// to are null, and read as zeroes.
+    std::vector<u8*> Pages;
+    usz Size { 0 };
+
+    /// Directory index: children chained by name hash, and rehashed
+    /// into twice the buckets once there are as many children.
+    std::vector<TmpFSNode*> Buckets;
+    usz Children { 0 };
+
+    /// Every open of the node shares this, so all see its current size.
+    std::weak_ptr<FileMetadata> Meta;
+};
+
+/// Filesystem that lives entirely in memory and is gone on reboot.
+/// File data is kept in whole pages that are only allocated when first
+/// written, so appending is O(1) (amortized) and files may grow with
+/// holes in them.
+class TemporaryFilesystemDriver final : public FilesystemDriver {
+    TemporaryFilesystemDriver() { Root.Directory = true; }
+
+    /// Weak reference to ourselves, handed to every file we open.
+    /// See `FileAllocationTableDriver::This`.
+    std::weak_ptr<TemporaryFilesystemDriver> This{};
+
+    TmpFSNode Root;
+
+    static auto hash(std::string_view name) -> usz;
+    static auto lookup(TmpFSNode* directory, std::string_view name) -> TmpFSNode*;
+    static void link(TmpFSNode* directory, TmpFSNode* node);
+    static void destroy(TmpFSNode* node);
+
+    /// Find the node at `path`, relative to the root of this filesystem.
+    auto resolve(std::string_view path) -> TmpFSNode*;
+
+    /// Create a new, empty node at `path`, whose parent must already
+    /// exist. Returns an existing node of the same name and kind.
+    auto make_node(std::string_view path, bool directory) -> TmpFSNode*;
+
+    auto metadata(TmpFSNode* node) -> std::shared_ptr<FileMetadata>;
+
+public:
+    ~TemporaryFilesystemDriver() override;
+
+    static auto create() -> std::shared_ptr<FilesystemDriver>;
+
+    auto open(std::string_view path) -> std::shared_ptr<FileMetadata> final;
+    auto create(std::string_view path) -> std::shared_ptr<FileMetadata> final;
+    bool make_directory(std::string_view path) final;
+    bool truncate(FileMetadata* file, usz size) final;
+    bool read_directory(FileMetadata* directory, usz& cursor, DirectoryEntryWriter& out) final;
+    /// Nodes live until the filesystem does; there's nothing to close.
+    void close(FileMetadata*) final {}
+
+    ssz read(FileMetadata* file, usz offs, usz bytes, void* buffer) final;
+    ssz read_raw(usz, usz, void*) final { return -1; }
+    ssz write(FileMetadata* file, usz offs, usz bytes, void* buffer) final;
+    IOVector borrow(FileMetadata* file, usz offs, usz bytes) final;
+
+    const char* name() final { return "Temporary Filesystem"; }
+
+    auto device() -> std::shared_ptr<StorageDeviceDriver> final { return nullptr; }
+};
+
+#endif /* LENSOR_OS_TMPFS_DRIVER_H */
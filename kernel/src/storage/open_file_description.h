@@ -0,0 +1,85 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#ifndef LENSOR_OS_OPEN_FILE_DESCRIPTION_H
+#define LENSOR_OS_OPEN_FILE_DESCRIPTION_H
+
+#include <integers.h>
+#include <storage/file_metadata.h>
+
+#include <memory>
+
+/// Smallest and largest number of bytes read ahead of a sequential reader.
+#define READAHEAD_MIN_WINDOW (16 * 1024)
+#define READAHEAD_MAX_WINDOW (256 * 1024)
+
+/// What a system file descriptor (an index into the VFS `Files` table)
+/// refers to: an opened file plus the state that every file descriptor
+/// duplicated from it shares, whether by `dup`, `dup2`, or `fork`.
+///
+/// The reference count is intrusive and counts process file
+/// descriptors that map to this description, not C++ references. Code
+/// that only needs the description for the duration of a syscall (the
+/// read/write fast path) borrows a raw pointer and never touches it.
+struct OpenFileDescription {
+    explicit OpenFileDescription(std::shared_ptr<FileMetadata> file, u32 flags = 0)
+        : Flags(flags), File(std::move(file)) {}
+
+    /// Copying would break the reference count.
+    OpenFileDescription(const OpenFileDescription&) = delete;
+    OpenFileDescription& operator=(const OpenFileDescription&) = delete;
+
+    /// Byte offset used by read, write, and seek.
+    usz Offset { 0 };
+
+    /// Open flags. Reserved; `sys$0_open` doesn't take any yet.
+    u32 Flags { 0 };
+
+    /// Sequential access detection for readahead; see `VFS::read_ahead`.
+    struct ReadaheadState {
+        /// Where a read continuing the last one would start.
+        usz NextOffset { 0 };
+        /// How far ahead of the reader to prefetch. Zero until reads
+        /// are found to be sequential; doubles with each one that is.
+        usz Window { 0 };
+        /// Everything before this has been prefetched.
+        usz End { 0 };
+        /// Sequential reads that were (or weren't) entirely prefetched.
+        u64 Hits { 0 };
+        u64 Misses { 0 };
+    } Readahead{};
+
+    auto file() -> FileMetadata* { return File.get(); }
+
+    void ref() { ++RefCount; }
+
+    /// @return true iff that was the last reference, in which case the
+    ///         caller is responsible for deleting the description.
+    [[nodiscard]] bool unref() { return --RefCount == 0; }
+
+    auto references() const -> usz { return RefCount; }
+
+private:
+    /// Closed on the device driver once the last description (or
+    /// other owner) of the file lets go of it.
+    std::shared_ptr<FileMetadata> File;
+    usz RefCount { 1 };
+};
+
+#endif /* LENSOR_OS_OPEN_FILE_DESCRIPTION_H */
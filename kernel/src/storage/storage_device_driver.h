@@ -24,9 +24,60 @@
 #include <memory>
 
 #include <integers.h>
+#include <poll.h>
 #include <pure_virtuals.h>
 
 struct FileMetadata;
+namespace Memory {
+struct PageTable;
+}
+
+/// One buffer of a scatter/gather list. Layout matches the userspace
+/// `struct iovec`, so syscalls may pass the caller's array through as-is.
+struct IOVector {
+    void* Base;
+    usz Length;
+};
+
+/// An asynchronous transfer of a range of whole sectors between a
+/// device and a list of buffers. The submitter owns the request, and
+/// must keep it and every buffer it refers to alive until `Done` is set.
+struct StorageRequest {
+    enum class Operation : u8 {
+        READ,
+        WRITE,
+    };
+    Operation Op { Operation::READ };
+    /// First sector and number of sectors to transfer, in units of the
+    /// driver's `sector_size()`.
+    u64 LBA { 0 };
+    u64 Sectors { 0 };
+    /// Buffers filled (or drained) in order; together they must hold
+    /// at least `Sectors * sector_size()` bytes.
+    const IOVector* Vectors { nullptr };
+    usz VectorCount { 0 };
+    /// The page map the buffers are mapped in, for drivers that have
+    /// the device transfer them directly. If null, `submit()` takes the
+    /// active one, so only requests submitted on behalf of another
+    /// process (or from an interrupt) need to set it.
+    Memory::PageTable* PageMap { nullptr };
+
+    /// Called by the driver once the request is done, with interrupts
+    /// masked. May be null, in which case the submitter polls `Done`.
+    void (*Completion)(StorageRequest*) { nullptr };
+    void* Context { nullptr };
+
+    /// Bytes transferred, or -1 on error. Valid once `Done` is set.
+    ssz Result { 0 };
+    volatile bool Done { false };
+
+    /// Owned by the driver while the request is queued.
+    StorageRequest* Next { nullptr };
+    /// Also the driver's, for requests it carries out as several device
+    /// commands: sectors issued so far, and commands still in flight.
+    u64 Issued { 0 };
+    u32 Commands { 0 };
+};
 
 struct StorageDeviceDriver {
     virtual ~StorageDeviceDriver() = default;
@@ -35,6 +86,73 @@ struct StorageDeviceDriver {
     [[gnu::nonnull(2)]] virtual auto read(FileMetadata* file, usz offs, usz bytes, void* buffer) -> ssz = 0;
     virtual auto read_raw(usz offs, usz bytes, void* buffer) -> ssz = 0;
     virtual auto write(FileMetadata* file, usz offs, usz bytes, void* buffer) -> ssz = 0;
+
+    /// Scatter/gather variants of `read` and `write` that transfer a
+    /// whole list of buffers starting at `offs`. The default issues one
+    /// call per buffer and stops at the first short transfer; drivers
+    /// that can do better (one request for the whole list) override it.
+    /// @return Total bytes transferred, or the error of the first call.
+    [[gnu::nonnull(2)]] virtual auto readv(FileMetadata* file, usz offs, const IOVector* vectors, usz count) -> ssz {
+        ssz total = 0;
+        for (usz i = 0; i < count; ++i) {
+            ssz n = read(file, offs + usz(total), vectors[i].Length, vectors[i].Base);
+            if (n < 0) return total ? total : n;
+            total += n;
+            if (usz(n) < vectors[i].Length) break;
+        }
+        return total;
+    }
+    virtual auto writev(FileMetadata* file, usz offs, const IOVector* vectors, usz count) -> ssz {
+        ssz total = 0;
+        for (usz i = 0; i < count; ++i) {
+            ssz n = write(file, offs + usz(total), vectors[i].Length, vectors[i].Base);
+            if (n < 0) return total ? total : n;
+            total += n;
+            if (usz(n) < vectors[i].Length) break;
+        }
+        return total;
+    }
+
+    /// Return up to `bytes` bytes of `file` at `offs` that the driver
+    /// already holds in memory (i.e. a cached block), without copying
+    /// them. The memory is only valid until the driver is next used.
+    /// Returns an empty vector when the data isn't at hand; the caller
+    /// should then `read` it instead.
+    virtual auto borrow(FileMetadata*, usz /* offs */, usz /* bytes */) -> IOVector { return { nullptr, 0 }; }
+
+    /// Start bringing `bytes` bytes of `file` at `offs` into memory
+    /// without waiting for them, so a `read` of them soon after needn't
+    /// wait as long (or at all). Purely a hint; by default, nothing.
+    virtual void prefetch(FileMetadata*, usz /* offs */, usz /* bytes */) {}
+
+    /// Readiness hooks used by `sys$23_poll`. `poll` returns the POLL_*
+    /// events currently ready on `file`. `poll_wait` asks the driver to
+    /// wake process `pid` (RAX = -2, state RUNNING) once that may have
+    /// changed, and `poll_cancel` withdraws such a request. By default a
+    /// file is always readable and writable, so there is never anything
+    /// to wait for.
+    virtual auto poll(FileMetadata*) -> u16 { return POLL_IN | POLL_OUT; }
+    virtual void poll_wait(FileMetadata*, u64 /* pid */) {}
+    virtual void poll_cancel(FileMetadata*, u64 /* pid */) {}
+
+    /// Queue `request` on the device and return without waiting for
+    /// it. Drivers that can't do asynchronous I/O return false, as does
+    /// a driver given a request it can't carry out; either way the
+    /// request was not queued and its completion will never be called.
+    virtual bool submit(StorageRequest*) { return false; }
+    /// Complete whatever submitted requests the device has finished,
+    /// and start the next ones.
+    virtual void poll_completions() {}
+    /// Hold back whatever is submitted from now on until the matching
+    /// `unplug()`, so the device gets it as one batch it can merge and
+    /// sort. Calls nest. Drivers layered over another pass them down;
+    /// by default, nothing is held back.
+    virtual void plug() {}
+    virtual void unplug() {}
+    virtual auto sector_size() -> usz { return 512; }
+    /// How many sectors the device holds, or 0 if the driver doesn't
+    /// know; nothing past the last one may be transferred.
+    virtual auto sector_count() -> u64 { return 0; }
 };
 
 /// Helper function to convert a Driver to a StorageDeviceDriver.
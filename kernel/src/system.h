@@ -59,6 +59,8 @@ inline constexpr u64 SYSDEV_MAJOR_STORAGE_SEARCH = 0;
 /* STORAGE DEVICE MINOR NUMBERS */
 inline constexpr u64 SYSDEV_MINOR_AHCI_CONTROLLER = 0;
 inline constexpr u64 SYSDEV_MINOR_AHCI_PORT       = 1;
+inline constexpr u64 SYSDEV_MINOR_NVME_CONTROLLER = 2;
+inline constexpr u64 SYSDEV_MINOR_NVME_NAMESPACE  = 3;
 inline constexpr u64 SYSDEV_MINOR_GPT_PARTITION   = 10;
 /* NETWORK DEVICE MAJOR NUMBERS */
 inline constexpr u64 SYSDEV_MAJOR_NETWORK = 2;
@@ -0,0 +1,145 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#include <time_page.h>
+
+#include <format>
+#include <hpet.h>
+#include <link_definitions.h>
+#include <memory/common.h>
+#include <memory/virtual_memory_manager.h>
+#include <pit.h>
+#include <rtc.h>
+
+namespace Time {
+    /// The time page gets a physical page all to itself, as the entire
+    /// page is visible to userspace.
+    __attribute__((aligned(PAGE_SIZE)))
+    static u8 time_page_storage[PAGE_SIZE];
+    static TimePage& page = *reinterpret_cast<TimePage*>(time_page_storage);
+
+    static bool Initialized { false };
+
+    static inline u64 rdtsc() {
+        u32 low;
+        u32 high;
+        asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+        return ((u64)high << 32) | low;
+    }
+
+    static inline void write_begin() {
+        page.Sequence = page.Sequence + 1;
+        asm volatile ("" ::: "memory");
+    }
+
+    static inline void write_end() {
+        asm volatile ("" ::: "memory");
+        page.Sequence = page.Sequence + 1;
+    }
+
+    /// Nanoseconds since boot as counted by the PIT.
+    static u64 tick_nanoseconds() {
+        return (u64)((unsigned __int128)gPIT.get() * 1000000000 * PIT_DIVISOR / PIT_MAX_FREQ);
+    }
+
+    /// Days since 1970-01-01 of the given proleptic Gregorian date.
+    static s64 days_from_civil(s64 year, u32 month, u32 day) {
+        year -= month <= 2;
+        const s64 era = (year >= 0 ? year : year - 399) / 400;
+        const u32 yearOfEra = (u32)(year - era * 400);
+        const u32 dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        const u32 dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return era * 146097 + (s64)dayOfEra - 719468;
+    }
+
+    /// Measure TSC frequency against the HPET main counter.
+    /// Returns zero if the HPET is unavailable.
+    static u64 calibrate_tsc() {
+        if (!gHPET.initialized() || gHPET.frequency() == 0)
+            return 0;
+
+        // Ten milliseconds worth of HPET ticks.
+        const u64 window = gHPET.frequency() / 100;
+        u64 hpetStart = gHPET.get();
+        u64 tscStart = rdtsc();
+        u64 hpetEnd = hpetStart;
+        while (hpetEnd - hpetStart < window)
+            hpetEnd = gHPET.get();
+        u64 tscEnd = rdtsc();
+
+        return (u64)((unsigned __int128)(tscEnd - tscStart) * gHPET.frequency() / (hpetEnd - hpetStart));
+    }
+
+    void initialize_time_page() {
+        u64 tscFrequency = calibrate_tsc();
+
+        gRTC.update_data();
+        s64 days = days_from_civil(gRTC.Time.year, gRTC.Time.month, gRTC.Time.date);
+        u64 now = (u64)(days * 86400
+                        + gRTC.Time.hour * 3600
+                        + gRTC.Time.minute * 60
+                        + gRTC.Time.second);
+
+        write_begin();
+        page.NanosecondsBase = tick_nanoseconds();
+        page.EpochSeconds = now - page.NanosecondsBase / 1000000000;
+        if (tscFrequency) {
+            page.Source = TIME_PAGE_SOURCE_TSC;
+            page.Shift = 32;
+            page.Multiplier = (1000000000ull << page.Shift) / tscFrequency;
+            page.CounterBase = rdtsc();
+        } else page.Source = TIME_PAGE_SOURCE_TICKS;
+        write_end();
+
+        Initialized = true;
+        std::print("[TIME]: Time page initialized\n"
+                   "  Source: {}\n"
+                   "  TSC Frequency: {}hz\n"
+                   "  Epoch: {}\n"
+                   , page.Source == TIME_PAGE_SOURCE_TSC ? "TSC" : "Timer Ticks"
+                   , tscFrequency
+                   , page.EpochSeconds
+                   );
+    }
+
+    void update_time_page() {
+        if (!Initialized)
+            return;
+
+        write_begin();
+        if (page.Source == TIME_PAGE_SOURCE_TSC) {
+            // Fold elapsed TSC cycles into the base so that the
+            // multiplication done by readers never overflows.
+            u64 tsc = rdtsc();
+            page.NanosecondsBase += ((unsigned __int128)(tsc - page.CounterBase) * page.Multiplier) >> page.Shift;
+            page.CounterBase = tsc;
+        } else page.NanosecondsBase = tick_nanoseconds();
+        write_end();
+    }
+
+    void map_time_page(Memory::PageTable* pageTable) {
+        Memory::map(pageTable
+                    , (void*)LENSOR_OS_TIME_PAGE_VADDR
+                    , (void*)V2P(time_page_storage)
+                    , (u64)Memory::PageTableFlag::Present
+                    | (u64)Memory::PageTableFlag::UserSuper
+                    , Memory::ShowDebug::No
+                    );
+    }
+}
@@ -0,0 +1,72 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+#ifndef LENSOR_OS_TIME_PAGE_H
+#define LENSOR_OS_TIME_PAGE_H
+
+#include <integers.h>
+#include <memory/paging.h>
+
+/// Userspace virtual address of the read-only time page.
+/// NOTE: Keep in sync with `user/libc/bits/time_page.h`.
+#define LENSOR_OS_TIME_PAGE_VADDR 0x7fffffe00000
+
+/// `TimePage::Source` values.
+#define TIME_PAGE_SOURCE_TICKS 0
+#define TIME_PAGE_SOURCE_TSC   1
+
+namespace Time {
+    /* Calibration data shared read-only with every process.
+     *
+     * The kernel is the only writer. It increments `Sequence` to an odd
+     * value before touching any other field, and to an even value once
+     * done; readers retry while it is odd or if it changed underneath them.
+     *
+     * Monotonic nanoseconds since boot are computed as
+     *   NanosecondsBase + (((rdtsc() - CounterBase) * Multiplier) >> Shift)
+     * when `Source` is TIME_PAGE_SOURCE_TSC; otherwise `NanosecondsBase`
+     * alone is used, which only advances once per timer tick.
+     * Wall-clock time is `EpochSeconds` plus monotonic time.
+     *
+     * NOTE: Layout must match `struct __time_page` in libc.
+     */
+    struct TimePage {
+        volatile u32 Sequence;
+        u32 Source;
+        u64 CounterBase;
+        u64 NanosecondsBase;
+        u64 Multiplier;
+        u32 Shift;
+        u32 Reserved;
+        /// UNIX time (seconds) at which monotonic time was zero.
+        u64 EpochSeconds;
+    };
+
+    /// Calibrate the TSC against the HPET (if present) and populate the
+    /// time page from the RTC. Call after the HPET is initialized.
+    void initialize_time_page();
+
+    /// Advance the time page's base values; called on every timer tick.
+    void update_time_page();
+
+    /// Map the time page, read-only, at LENSOR_OS_TIME_PAGE_VADDR.
+    void map_time_page(Memory::PageTable*);
+}
+
+#endif /* LENSOR_OS_TIME_PAGE_H */
@@ -38,20 +38,20 @@ jump_to_userland_function:
     ltr ax                      ; Load GDT offset into task register (TSSR).
 
     xor rax, rax                ; Zero out entire 64-bit 'A' register.
-    mov ax, 0x20 | 0b11         ; Store Ring 3 User Data GDT offset in segment registers.
+    mov ax, 0x18 | 0b11         ; Store Ring 3 User Data GDT offset in segment registers.
     mov ds, ax
     mov es, ax
     mov fs, ax
     mov gs, ax
 
     mov rax, rcx
-    push 0x20 | 0b11            ; GDT Offset of Ring 3 User Data entry.
+    push 0x18 | 0b11            ; GDT Offset of Ring 3 User Data entry.
     push rax
     pushfq                      ; Store the CPU Flags register on the stack.
     pop rax                     ; `rax` = CPU Flags register.
     or rax, 0b1000000000        ; Re-enable interrupts when after jump.
     push rax                    ; Set CPU Flags state to this after `iretq` jumps.
-    push 0x18 | 0b11            ; GDT Offset of Ring 3 User Code entry.
+    push 0x20 | 0b11            ; GDT Offset of Ring 3 User Code entry.
     push rdi                    ; Address to return to
     iretq
 
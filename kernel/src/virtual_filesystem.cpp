@@ -19,6 +19,7 @@
 
 #include <virtual_filesystem.h>
 
+#include <algorithm>
 #include <cstr.h>
 #include <format>
 #include <storage/file_metadata.h>
@@ -33,6 +34,19 @@
 #   define DBGMSG(...)
 #endif
 
+/// Find the part of `path` that lies within the filesystem mounted at
+/// `mount`. The root mount holds every path as-is; any other holds
+/// only those below its mount point.
+static bool within(const MountPoint& mount, std::string_view path, std::string_view& fs_path) {
+    if (mount.Path.size() == 1 && mount.Path[0] == '/') {
+        fs_path = path;
+        return true;
+    }
+    if (!path.starts_with(mount.Path)) return false;
+    fs_path = path.substr(mount.Path.size());
+    return !fs_path.size() || fs_path[0] == '/';
+}
+
 SysFD VFS::procfd_to_fd(ProcFD procfd) const {
     return procfd_to_fd(Scheduler::CurrentProcess->value(), procfd);
 }
@@ -47,7 +61,7 @@ SysFD VFS::procfd_to_fd(Process* process, ProcFD procfd) const {
     return *sysfd;
 }
 
-auto VFS::file(ProcFD procfd) -> std::shared_ptr<FileMetadata> {
+auto VFS::description(ProcFD procfd) -> OpenFileDescription* {
     // TODO: We should probably have the implementation take a process
     // as a parameter, that way we can actually free fds other than
     // within the currently scheduled process. :p
@@ -65,20 +79,30 @@ auto VFS::file(ProcFD procfd) -> std::shared_ptr<FileMetadata> {
     auto sysfd = proc->FileDescriptors[procfd];
     if (!sysfd) {
         std::print("[VFS]: ERROR: {} (pid {}) is unmapped.\n", procfd, proc->ProcessID);
-        return {};
+        return nullptr;
     }
 
     DBGMSG("[VFS]: file: {} ({}) is mapped to SysFD {}.\n", procfd, proc->ProcessID, *sysfd);
-    return file(static_cast<SysFD>(*sysfd));
+    return description(static_cast<SysFD>(*sysfd));
 }
 
-auto VFS::file(SysFD fd) -> std::shared_ptr<FileMetadata> {
+auto VFS::description(SysFD fd) -> OpenFileDescription* {
     auto f = Files[fd];
-    if (!f) {
+    if (!f || !*f) {
         std::print("[VFS]: ERROR: {} is unmapped.\n", fd);
-        return {};
+        return nullptr;
     }
-    return f;
+    return *f;
+}
+
+auto VFS::file(ProcFD procfd) -> FileMetadata* {
+    OpenFileDescription* f = description(procfd);
+    return f ? f->file() : nullptr;
+}
+
+auto VFS::file(SysFD fd) -> FileMetadata* {
+    OpenFileDescription* f = description(fd);
+    return f ? f->file() : nullptr;
 }
 
 bool VFS::valid(Process *proc, ProcFD procfd) const {
@@ -91,34 +115,44 @@ bool VFS::valid(ProcFD procfd) const {
 
 bool VFS::valid(SysFD fd) const {
     auto f = Files[fd];
-    if (!f) {
+    if (!f || !*f) {
         std::print("[VFS]: ERROR: {} is unmapped.\n", fd);
         return false;
     }
     return true;
 }
 
-/// Erasing the last shared_ptr holding the file metadata will call
-/// the destructor of FileMetadata, which will then close the file.
 void VFS::free_fd(Process* process, SysFD fd, ProcFD procfd) {
     if (!process) return;
     DBGMSG("Freeing ProcFD={} SysFD={} in process {}\n", procfd, fd, process->ProcessID);
     // Remove file descriptor from process's list of open file
     // descriptors using Process File Descriptor.
     process->FileDescriptors.erase(procfd);
+    // Drop the reference it held on the kernel file description.
+    release(fd);
+}
+
+/// Deleting the open file description releases the shared_ptr holding
+/// the file metadata; if that was the last, the destructor of
+/// FileMetadata will then close the file.
+void VFS::release(SysFD fd) {
+    OpenFileDescription* f = description(fd);
+    if (!f || !f->unref()) return;
+    DBGMSG("[VFS]: Freeing open file description {}\n", fd);
     // Remove kernel file description from VFS list of open files using
     // System File Descriptor.
     Files.erase(fd);
+    delete f;
 }
 
 void VFS::free_fd(SysFD fd, ProcFD procfd) {
     free_fd(Scheduler::CurrentProcess->value(), fd, procfd);
 }
 
-FileDescriptors VFS::open(std::string_view path) {
+FileDescriptors VFS::open(std::string_view path, u32 flags) {
     u64 fullPathLength = path.size();
 
-    if (fullPathLength <= 1) {
+    if (fullPathLength < 1) {
         std::print("[VFS]: path is not long enough.\n");
         return {};
     }
@@ -133,8 +167,8 @@ FileDescriptors VFS::open(std::string_view path) {
         /// It makes no sense to search file systems whose mount point does not
         /// match the beginning of the path. And even if they’re mounted twice,
         /// we’ll still find the second mount.
-        if (!path.starts_with(mount.Path)) continue;
-        auto fs_path = path.substr(mount.Path.size());
+        std::string_view fs_path;
+        if (!within(mount, path, fs_path)) continue;
 
         /// Try to open the file.
         DBGMSG("[VFS]: Attempting to open file at path {} on mount {}\n", fs_path, mount.Path);
@@ -151,13 +185,39 @@ FileDescriptors VFS::open(std::string_view path) {
                    , (void*) meta->device_driver().get()
                    , meta->invalid()
             );
+            if (flags & VFS_OPEN_TRUNCATE && !meta->directory() && meta->file_size()
+                && !mount.FS->truncate(meta.get(), 0)) {
+                DBGMSG("[VFS]: Could not truncate {}\n", path);
+                return {};
+            }
             return add_file(std::move(meta));
         }
     }
 
+    if (flags & VFS_OPEN_CREATE) {
+        for (const auto& mount : Mounts) {
+            std::string_view fs_path;
+            if (!within(mount, path, fs_path)) continue;
+            if (auto meta = mount.FS->create(fs_path)) {
+                DBGMSG("[VFS]: Created file at path {} on mount {}\n", fs_path, mount.Path);
+                return add_file(std::move(meta));
+            }
+        }
+    }
+
     return {};
 }
 
+bool VFS::make_directory(std::string_view path) {
+    if (path.size() <= 1 || path[0] != '/') return false;
+    for (const auto& mount : Mounts) {
+        std::string_view fs_path;
+        if (!within(mount, path, fs_path)) continue;
+        if (mount.FS->make_directory(fs_path)) return true;
+    }
+    return false;
+}
+
 
 bool VFS::close(Process* process, ProcFD procfd) {
     if (!process) return false;
@@ -167,7 +227,7 @@ bool VFS::close(Process* process, ProcFD procfd) {
         return false;
     }
 
-    auto f = file(fd);
+    auto* f = file(fd);
     if (!f) {
         DBGMSG("[VFS]: Cannot close invalid {}.\n", fd);
         return false;
@@ -194,32 +254,50 @@ ssz VFS::read(ProcFD fd, u8* buffer, usz byteCount, usz byteOffset) {
            , byteOffset
            );
 
-    // Scheduler::yield() is noreturn, but that doesn't mean the stackframe(s)
-    // will be cleaned up. So we either have to
-    //   A. not take the shared_ptr here, and instead a weak_ptr,
-    //      possibly risking a race condition of the file being closed
-    //      while it's being read from (not good), or
-    //   B. Take a shared ptr but instead of passing it, move it to the
-    //      device driver. This would mean the device driver could unlock
-    //      it or whatever before yielding, or
-    //   C. Have the device driver `read()` function return a value
-    //      that indicates whether or not we should yield; take the
-    //      shared_ptr in a nested scope, call read, then outside of
-    //      that scope, conditionally call yield.
-
-    // Discussed with Sirraide: I think that we should pass a weak_ptr
-    // to the `read` device driver virtual function, and it locks it as
-    // long as it needs it, unlocks it when it doesn't.
-    FileMetadata* meta = nullptr;
-    {
-        auto f = file(fd);
-        meta = f.get();
-    }
-    if (!meta) return -1;
+    // Scheduler::yield() is noreturn, so nothing on this stack frame
+    // is ever destroyed if the driver blocks. That's fine, because we
+    // only borrow the open file description and its metadata here; the
+    // file descriptor table holds the reference that keeps them alive.
+    OpenFileDescription* description = this->description(fd);
+    if (!description) return -1;
+    FileMetadata* meta = description->file();
+
+    DBGMSG("  file offset:     {}\n", description->Offset);
+
+    const usz offset = byteOffset + description->Offset;
+    ssz result = meta->device_driver()->read(meta, offset, byteCount, buffer);
+    read_ahead(description, offset, result);
+    return result;
+}
 
-    DBGMSG("  file offset:     {}\n", f.get()->offset);
+void VFS::read_ahead(OpenFileDescription* description, usz offset, ssz bytes) {
+    if (bytes <= 0) return;
+    auto& ahead = description->Readahead;
+    const usz end = offset + usz(bytes);
+    if (offset != ahead.NextOffset) {
+        // Not where the last read left off; start over from here.
+        ahead.NextOffset = end;
+        ahead.Window = 0;
+        ahead.End = end;
+        return;
+    }
 
-    return meta->device_driver()->read(meta, byteOffset + meta->offset, byteCount, buffer);
+    ahead.NextOffset = end;
+    if (ahead.Window) {
+        if (end <= ahead.End) ++ahead.Hits;
+        else ++ahead.Misses;
+        ahead.Window = std::min(ahead.Window * 2, usz(READAHEAD_MAX_WINDOW));
+    } else ahead.Window = std::min(std::max(usz(READAHEAD_MIN_WINDOW), 2 * usz(bytes)), usz(READAHEAD_MAX_WINDOW));
+    if (ahead.End < end) ahead.End = end;
+
+    // Top up once the reader is half way through what was prefetched,
+    // so it rarely catches up with the device.
+    if (ahead.End - end >= ahead.Window / 2) return;
+    FileMetadata* meta = description->file();
+    const usz until = std::min(end + ahead.Window, usz(meta->file_size()));
+    if (until <= ahead.End) return;
+    meta->device_driver()->prefetch(meta, ahead.End, until - ahead.End);
+    ahead.End = until;
 }
 
 ssz VFS::write(ProcFD fd, u8* buffer, u64 byteCount, u64 byteOffset) {
@@ -236,13 +314,10 @@ ssz VFS::write(ProcFD fd, u8* buffer, u64 byteCount, u64 byteOffset) {
            );
     */
 
-    // SEE COMMENTS ON CONCURRENCY AND (B)LOCKING IN VFS::read()
-    FileMetadata* meta = nullptr;
-    {
-        auto f = file(fd);
-        meta = f.get();
-    }
-    if (!meta) return -1;
+    // SEE COMMENTS ON (B)LOCKING IN VFS::read()
+    OpenFileDescription* description = this->description(fd);
+    if (!description) return -1;
+    FileMetadata* meta = description->file();
 
     DBGMSG("[VFS]: write\n"
            "  name:            {}\n"
@@ -256,10 +331,195 @@ ssz VFS::write(ProcFD fd, u8* buffer, u64 byteCount, u64 byteOffset) {
            , (void*) buffer
            , byteCount
            , byteOffset
-           , meta->offset
+           , description->Offset
+           );
+
+    return meta->device_driver()->write(meta, byteOffset + description->Offset, byteCount, buffer);
+}
+
+ssz VFS::readv(ProcFD fd, const IOVector* vectors, usz count, usz byteOffset) {
+    DBGMSG("[VFS]: readv\n"
+           "  file descriptor: {}\n"
+           "  vector count:    {}\n"
+           "  byte offset:     {}\n"
+           , fd
+           , count
+           , byteOffset
            );
 
-    return meta->device_driver()->write(meta, byteOffset + meta->offset, byteCount, buffer);
+    // SEE COMMENTS ON (B)LOCKING IN VFS::read()
+    OpenFileDescription* description = this->description(fd);
+    if (!description) return -1;
+    FileMetadata* meta = description->file();
+
+    const usz offset = byteOffset + description->Offset;
+    ssz result = meta->device_driver()->readv(meta, offset, vectors, count);
+    read_ahead(description, offset, result);
+    return result;
+}
+
+ssz VFS::writev(ProcFD fd, const IOVector* vectors, usz count, usz byteOffset) {
+    DBGMSG("[VFS]: writev\n"
+           "  file descriptor: {}\n"
+           "  vector count:    {}\n"
+           "  byte offset:     {}\n"
+           , fd
+           , count
+           , byteOffset
+           );
+
+    // SEE COMMENTS ON (B)LOCKING IN VFS::read()
+    OpenFileDescription* description = this->description(fd);
+    if (!description) return -1;
+    FileMetadata* meta = description->file();
+
+    return meta->device_driver()->writev(meta, byteOffset + description->Offset, vectors, count);
+}
+
+ssz VFS::pread(ProcFD fd, u8* buffer, usz byteCount, usz fileOffset) {
+    DBGMSG("[VFS]: pread\n"
+           "  file descriptor: {}\n"
+           "  buffer address:  {}\n"
+           "  byte count:      {}\n"
+           "  file offset:     {}\n"
+           , fd
+           , (void*) buffer
+           , byteCount
+           , fileOffset
+           );
+
+    // SEE COMMENTS ON (B)LOCKING IN VFS::read()
+    OpenFileDescription* description = this->description(fd);
+    if (!description) return -1;
+    FileMetadata* meta = description->file();
+    if (!seekable(meta)) return -1;
+
+    ssz result = meta->device_driver()->read(meta, fileOffset, byteCount, buffer);
+    read_ahead(description, fileOffset, result);
+    return result;
+}
+
+ssz VFS::pwrite(ProcFD fd, u8* buffer, usz byteCount, usz fileOffset) {
+    DBGMSG("[VFS]: pwrite\n"
+           "  file descriptor: {}\n"
+           "  buffer address:  {}\n"
+           "  byte count:      {}\n"
+           "  file offset:     {}\n"
+           , fd
+           , (void*) buffer
+           , byteCount
+           , fileOffset
+           );
+
+    // SEE COMMENTS ON (B)LOCKING IN VFS::read()
+    OpenFileDescription* description = this->description(fd);
+    if (!description) return -1;
+    FileMetadata* meta = description->file();
+    if (!seekable(meta)) return -1;
+
+    return meta->device_driver()->write(meta, fileOffset, byteCount, buffer);
+}
+
+bool VFS::seekable(FileMetadata* file) const {
+    const StorageDeviceDriver* driver = file->device_driver().get();
+    return driver != PipesDriver.get() && driver != StdinDriver.get() && driver != StdoutDriver.get();
+}
+
+ssz VFS::read_directory(ProcFD procfd, void* buffer, usz byteCount) {
+    OpenFileDescription* f = description(procfd);
+    if (!f || !buffer) return -1;
+    FileMetadata* meta = f->file();
+    if (!meta || !meta->directory()) return -1;
+
+    auto* fs = static_cast<FilesystemDriver*>(meta->device_driver().get());
+    DirectoryEntryWriter out(buffer, byteCount);
+    usz cursor = f->Offset;
+    if (!fs->read_directory(meta, cursor, out)) return -1;
+    if (!out.size() && out.full()) return -1;
+    f->Offset = cursor;
+    return ssz(out.size());
+}
+
+ssz VFS::sendfile(ProcFD outfd, ProcFD infd, usz* inOffset, usz byteCount) {
+    DBGMSG("[VFS]: sendfile\n"
+           "  out:             {}\n"
+           "  in:              {}\n"
+           "  byte count:      {}\n"
+           , outfd
+           , infd
+           , byteCount
+           );
+
+    // SEE COMMENTS ON (B)LOCKING IN VFS::read()
+    OpenFileDescription* in = description(infd);
+    OpenFileDescription* out = description(outfd);
+    if (!in || !out) return -1;
+    FileMetadata* source = in->file();
+    FileMetadata* sink = out->file();
+    const auto& inDriver = source->device_driver();
+    const auto& outDriver = sink->device_driver();
+
+    // Regular files end at their size; a pipe's size is its capacity.
+    const bool seekableSource = seekable(source);
+    usz offset = inOffset ? *inOffset : in->Offset;
+    if (seekableSource) {
+        if (offset >= source->file_size()) return 0;
+        byteCount = std::min(byteCount, source->file_size() - offset);
+    }
+
+    // Either side may yield, which never returns, so nothing is
+    // allocated here. Syscalls don't nest (they run with interrupts
+    // masked), so one bounce page serves every sendfile.
+    __attribute__((aligned(PAGE_SIZE)))
+    static u8 bounce[PAGE_SIZE];
+    ssz total = 0;
+    ssz error = 0;
+    while (usz(total) < byteCount) {
+        // Once anything has been moved, don't let the source block:
+        // the syscall would be retried and move it all again.
+        if (total && !(inDriver->poll(source) & (POLL_IN | POLL_HUP))) break;
+
+        // A pipe takes only what fits, so take no more than that out of
+        // the source; whatever didn't fit would be lost.
+        usz wanted = byteCount - usz(total);
+        if (outDriver.get() == PipesDriver.get()) {
+            wanted = std::min(wanted, PipesDriver->space(sink));
+            if (!wanted) break;
+        }
+
+        IOVector chunk = inDriver->borrow(source, offset, wanted);
+        if (!chunk.Base) {
+            ssz n = inDriver->read(source, offset, std::min(wanted, usz(PAGE_SIZE)), bounce);
+            if (n <= 0) {
+                error = n;
+                break;
+            }
+            chunk = { bounce, usz(n) };
+        } else if (outDriver.get() != PipesDriver.get()) {
+            // A borrowed block may be in the block cache, and a write
+            // to a device completes other requests while it waits,
+            // which may evict the block and reuse its slot. A pipe
+            // only ever copies out of it.
+            chunk.Length = std::min(chunk.Length, usz(PAGE_SIZE));
+            memcpy(bounce, chunk.Base, chunk.Length);
+            chunk.Base = bounce;
+        }
+
+        // A pipe has no offset; anything else is written to in order.
+        ssz n = outDriver->write(sink, out->Offset + usz(total), chunk.Length, chunk.Base);
+        if (n < 0) error = n;
+        if (n > 0) {
+            offset += usz(n);
+            total += n;
+        }
+        if (n <= 0 || usz(n) < chunk.Length) break;
+    }
+
+    if (seekableSource) {
+        if (inOffset) *inOffset = offset;
+        else in->Offset = offset;
+    }
+    return total ? total : error;
 }
 
 void VFS::print_debug() {
@@ -282,21 +542,32 @@ void VFS::print_debug() {
     i = 0;
     for (const auto& f : Files) {
         std::print("    Open File {}:\n"
+                   "      Name: {}\n"
                    "      Driver Address: {}\n"
+                   "      Offset: {}\n"
+                   "      References: {}\n"
+                   "      Readahead: {} hits, {} misses, {} byte window\n"
                    , i
-                   , (void*) f->device_driver().get()
+                   , f->file()->name()
+                   , (void*) f->file()->device_driver().get()
+                   , f->Offset
+                   , f->references()
+                   , f->Readahead.Hits
+                   , f->Readahead.Misses
+                   , f->Readahead.Window
         );
         i++;
     }
     std::print("\n");
+    Dentries.print_debug();
 }
 
 FileDescriptors VFS::add_file(std::shared_ptr<FileMetadata> file, Process* proc) {
     if (!proc) proc = Scheduler::CurrentProcess->value();
     DBGMSG("[VFS]: Creating file descriptor mapping\n");
 
-    /// Add the file descriptor to the global file table.
-    auto [fd, _] = Files.push_back(std::move(file));
+    /// Add a new open file description to the global file table.
+    auto [fd, _] = Files.push_back(new OpenFileDescription(std::move(file)));
     DBGMSG("[VFS]: Allocated new {}\n", fd);
 
     /// Add the file descriptor to the local process table.
@@ -307,3 +578,13 @@ FileDescriptors VFS::add_file(std::shared_ptr<FileMetadata> file, Process* proc)
     DBGMSG("[VFS]: Mapped {} (pid {}) to {}\n", procfd, proc->ProcessID, fd);
     return {static_cast<ProcFD>(procfd), static_cast<SysFD>(fd)};
 }
+
+FileDescriptors VFS::share(SysFD fd, Process* proc) {
+    if (!proc) proc = Scheduler::CurrentProcess->value();
+    OpenFileDescription* f = description(fd);
+    if (!f) return {};
+    f->ref();
+    auto [procfd, _] = proc->FileDescriptors.push_back(fd);
+    DBGMSG("[VFS]: Mapped {} (pid {}) to existing {} ({} references)\n", procfd, proc->ProcessID, fd, f->references());
+    return {static_cast<ProcFD>(procfd), fd};
+}
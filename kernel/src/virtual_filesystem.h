@@ -23,8 +23,10 @@
 
 #include <file.h>
 #include <linked_list.h>
+#include <storage/dentry_cache.h>
 #include <storage/file_metadata.h>
 #include <storage/filesystem_driver.h>
+#include <storage/open_file_description.h>
 #include <storage/storage_device_driver.h>
 #include <storage/device_drivers/dbgout.h>
 #include <storage/device_drivers/input.h>
@@ -84,6 +86,13 @@ struct FileDescriptors {
     }
 };
 
+/// Create the file if it doesn't exist (and its filesystem can).
+/// Matches `O_CREAT` in the libc.
+#define VFS_OPEN_CREATE 0100
+/// Truncate the file to zero bytes once it's opened.
+/// Matches `O_TRUNC` in the libc.
+#define VFS_OPEN_TRUNCATE 01000
+
 struct VFS {
     std::shared_ptr<InputDriver> StdinDriver;
     std::shared_ptr<DbgOutDriver> StdoutDriver;
@@ -106,9 +115,8 @@ struct VFS {
     FileDescriptors dup(Process* proc, ProcFD fd) {
         if (!proc || !valid(proc, fd)) return {};
         SysFD sysfd = procfd_to_fd(proc, fd);
-        auto f = file(sysfd);
-        if (!f) return {};
-        return add_file(std::move(f), proc);
+        if (!description(sysfd)) return {};
+        return share(sysfd, proc);
     }
 
     /// The second file descriptor given will be associated with the file
@@ -133,41 +141,28 @@ struct VFS {
             return true;
         }
         SysFD sysfd = procfd_to_fd(proc, fd);
-        auto f = file(sysfd);
+        OpenFileDescription* f = description(sysfd);
         if (!f) {
-            std::print("[VFS]:dup2: ProcFD {} mapped to SysFD {} did not return a valid FileMetadata\n", fd, sysfd);
+            std::print("[VFS]:dup2: ProcFD {} mapped to SysFD {} did not return a valid OpenFileDescription\n", fd, sysfd);
             return false;
         }
 
-        // Get meta currently associated with `replaced` ProcFD.
+        // Point `replaced` at the same open file description as `fd`,
+        // then drop the reference `replaced` held on its old one. That
+        // *may* close the file it referred to, if it was the last.
         SysFD replaced_sysfd = procfd_to_fd(proc, replaced);
-        //auto replaced_file = file(replaced_sysfd);
-        //std::print("[VFS]:dup2: Replacing \"{}\" (ProcFD {}) with \"{}\" (ProcFD {})\n", replaced_file->name(), replaced, f->name(), fd);
-
-        // FIXME: This assumes that each and every process file
-        // descriptor refers to a unique FileMetadata in the VFS Files
-        // vector. However! We should allow multiple processes to have
-        // fds that refer to *one* entry in the VFS Files vector. To
-        // accomplish this, we will need to maybe add an intrusive
-        // refcount to filemetadata, or something similar.
-
-        // Remove kernel file description from VFS list of open files using
-        // System File Descriptor. This decrements the refcount of the
-        // shared_ptr, which *may* call the destructor on the driver of
-        // the actual file, if it's the last occurence.
-        // FIXME: In the future, this should probably be an intrusive
-        // refcount that just gets decremented, that way we don't need
-        // copies of shared_ptrs in the kernel Files table.
-        Files.replace(replaced_sysfd, std::move(f));
-        // NOTE: Because we are replacing the file metadata in the VFS
-        // Files table, this means that the process' FileDescriptor
-        // still maps to the same SysFD. It's just the data stored *at*
-        // that SysFD that changes. This may change in the future, and
-        // the proc->FileDesriptors mappings may need altered.
+        if (replaced_sysfd == sysfd) return true;
+        f->ref();
+        proc->FileDescriptors.replace(replaced, sysfd);
+        release(replaced_sysfd);
         return true;
     }
 
-    FileDescriptors open(std::string_view);
+    /// @param flags VFS_OPEN_* flags.
+    FileDescriptors open(std::string_view, u32 flags = 0);
+
+    /// Create a directory at `path` on the filesystem mounted there.
+    bool make_directory(std::string_view path);
 
     bool close(ProcFD procfd);
     bool close(Process*, ProcFD procfd);
@@ -175,21 +170,76 @@ struct VFS {
     ssz read(ProcFD procfd, u8* buffer, usz byteCount, usz byteOffset = 0);
     ssz write(ProcFD procfd, u8* buffer, usz byteCount, usz byteOffset);
 
+    /// Like `read`/`write`, but for a whole list of buffers at once.
+    ssz readv(ProcFD procfd, const IOVector* vectors, usz count, usz byteOffset = 0);
+    ssz writev(ProcFD procfd, const IOVector* vectors, usz count, usz byteOffset = 0);
+
+    /// Like `read`/`write`, but `fileOffset` is absolute; the file's
+    /// own offset is neither used nor modified. Fails (like ESPIPE) on
+    /// anything without offsets, see `seekable`.
+    ssz pread(ProcFD procfd, u8* buffer, usz byteCount, usz fileOffset);
+    ssz pwrite(ProcFD procfd, u8* buffer, usz byteCount, usz fileOffset);
+
+    /// Move up to `byteCount` bytes from `in` to `out` without going
+    /// through userspace. If `inOffset` is given, read from there and
+    /// update it; otherwise read from, and advance, the offset of `in`.
+    /// Like `write`, `out` is written starting at its own offset.
+    /// Data the source driver already holds in memory (cached blocks)
+    /// is handed straight to a pipe; anything else goes through a
+    /// single kernel page. Into a pipe, no more is taken out of `in`
+    /// than the pipe has room for.
+    /// @return Bytes moved, or -1.
+    ssz sendfile(ProcFD out, ProcFD in, usz* inOffset, usz byteCount);
+
+    /// Fill `buffer` with as many `DirectoryEntry` records of the open
+    /// directory `procfd` as fit, continuing where the last call left
+    /// off (the offset of a directory is a cursor, not a byte offset).
+    /// @return Bytes filled, zero once every entry has been listed, or
+    ///         -1 if it isn't a directory or not even one entry fits.
+    ssz read_directory(ProcFD procfd, void* buffer, usz byteCount);
+
     void print_debug();
 
+    /// Create a new open file description for `file`, and a file
+    /// descriptor in `proc` that refers to it.
     FileDescriptors add_file(std::shared_ptr<FileMetadata>, Process* proc = nullptr);
 
+    /// Create a file descriptor in `proc` that refers to the existing
+    /// open file description `fd`.
+    FileDescriptors share(SysFD fd, Process* proc);
+
     auto procfd_to_fd(ProcFD procfd) const -> SysFD;
     auto procfd_to_fd(Process*, ProcFD procfd) const -> SysFD;
-    auto file(ProcFD fd) -> std::shared_ptr<FileMetadata>;
-    auto file(SysFD fd) -> std::shared_ptr<FileMetadata>;
+
+    /// These borrow; the returned pointers are valid until the file
+    /// descriptor is closed, and must not be kept past that.
+    auto description(ProcFD fd) -> OpenFileDescription*;
+    auto description(SysFD fd) -> OpenFileDescription*;
+    auto file(ProcFD fd) -> FileMetadata*;
+    auto file(SysFD fd) -> FileMetadata*;
+
+    /// Path component lookups of every mounted filesystem.
+    auto dentries() -> DentryCache& { return Dentries; }
 
 private:
-    std::sparse_vector<std::shared_ptr<FileMetadata>, nullptr, SysFD> Files;
+    DentryCache Dentries;
+    std::sparse_vector<OpenFileDescription*, nullptr, SysFD> Files;
     std::vector<MountPoint> Mounts;
 
+    /// Called with the result of every read of `description` at
+    /// `offset`. While reads follow on from one another, keep up to a
+    /// window ahead of them prefetched, doubling the window each time.
+    void read_ahead(OpenFileDescription* description, usz offset, ssz bytes);
+
+    /// Whether offsets into `file` mean anything; they don't for pipes,
+    /// stdin or the debug output, which are read and written in order.
+    bool seekable(FileMetadata* file) const;
+
     void free_fd(SysFD fd, ProcFD procfd);
     void free_fd(Process*, SysFD fd, ProcFD procfd);
+    /// Drop one reference to the open file description `fd`, freeing it
+    /// (and possibly closing the file) if it was the last.
+    void release(SysFD fd);
     bool valid(Process *proc, ProcFD procfd) const;
     bool valid(ProcFD procfd) const;
     bool valid(SysFD fd) const;
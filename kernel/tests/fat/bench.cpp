@@ -0,0 +1,224 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+/* FAT driver benchmarks
+ *
+ * Usage: fat_bench <image path>
+ *
+ * Writes a FAT32 image with a contiguous and a fragmented file, a big
+ * directory and a deep tree, then times reads, lookups and writes
+ * through the driver. Besides time, it reports how many requests the
+ * device got, which doesn't depend on the host.
+ */
+
+#include <fat/common.h>
+#include <fat/image.h>
+#include <host/file_device.h>
+#include <host/host_io.h>
+
+#include <integers.h>
+#include <storage/file_metadata.h>
+#include <storage/filesystem_driver.h>
+#include <system.h>
+
+#include <format>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define BENCH_SECTORS           600000
+#define BENCH_SECTORS_PER_CLUSTER 8
+#define BENCH_FILE_SIZE         (32 * 1024 * 1024)
+#define BENCH_WRITE_SIZE        (16 * 1024 * 1024)
+#define BENCH_DIRECTORY_ENTRIES 4000
+#define BENCH_DEPTH             32
+#define BENCH_RANDOM_READS      4096
+
+static std::shared_ptr<FileDevice> Device;
+
+struct Timer {
+    u64 Start { host_now_ns() };
+    u64 Reads { Device ? Device->Reads : 0 };
+    u64 Writes { Device ? Device->Writes : 0 };
+
+    auto elapsed() const -> u64 { return host_now_ns() - Start + 1; }
+};
+
+static void report_throughput(const char* what, const Timer& timer, u64 bytes) {
+    const u64 ns = timer.elapsed();
+    std::print("  {}: {} MiB/s, {} device reads, {} device writes\n"
+               , what
+               , bytes * 1000000000 / ns / (1024 * 1024)
+               , Device->Reads - timer.Reads
+               , Device->Writes - timer.Writes);
+}
+
+static void report_rate(const char* what, const Timer& timer, u64 operations) {
+    const u64 ns = timer.elapsed();
+    std::print("  {}: {} ns each, {} device reads\n"
+               , what
+               , ns / operations
+               , (Device->Reads - timer.Reads) / operations);
+}
+
+static bool build(const char* path, std::string& deepPath) {
+    const int fd = host_create(path, u64(BENCH_SECTORS) * 512);
+    if (fd < 0) return false;
+    FATImage image(fd, 32, BENCH_SECTORS, BENCH_SECTORS_PER_CLUSTER);
+    if (!image.valid()) return false;
+
+    auto data = contents(1, BENCH_FILE_SIZE);
+    bool built = image.add_file(FATImage::ROOT, "contiguous.bin", data.data(), BENCH_FILE_SIZE)
+        && image.add_file(FATImage::ROOT, "fragmented.bin", data.data(), BENCH_FILE_SIZE, 1);
+
+    u8 small[100];
+    for (usz i = 0; i < sizeof small; ++i) small[i] = u8(i);
+    const u32 big = image.mkdir(FATImage::ROOT, "big");
+    for (u32 i = 0; built && big != FATImage::INVALID && i < BENCH_DIRECTORY_ENTRIES; ++i)
+        built = image.add_file(big, std::format("file-{}.txt", i), small, sizeof small);
+    built = built && big != FATImage::INVALID;
+
+    u32 directory = FATImage::ROOT;
+    for (u32 level = 0; built && level < BENCH_DEPTH; ++level) {
+        const std::string name = std::format("directory level {}", level);
+        directory = image.mkdir(directory, name);
+        built = directory != FATImage::INVALID;
+        if (level) deepPath += "/";
+        deepPath += name;
+    }
+    built = built && image.add_file(directory, "leaf.txt", small, sizeof small) && image.finish();
+    host_close(fd);
+    return built;
+}
+
+static void bench_read(FilesystemDriver* fs, const char* path, usz chunk) {
+    auto file = fs->open(path);
+    if (!file) return;
+    std::vector<u8> buffer;
+    buffer.resize(chunk);
+    Timer timer;
+    u64 total = 0;
+    for (usz offs = 0; offs < file->file_size(); offs += chunk) {
+        ssz n = fs->read(file.get(), offs, chunk, buffer.data());
+        if (n <= 0) break;
+        total += u64(n);
+    }
+    report_throughput(std::format("{}, {} KiB reads", path, chunk / 1024).data(), timer, total);
+}
+
+static void bench_random_read(FilesystemDriver* fs, const char* path) {
+    auto file = fs->open(path);
+    if (!file) return;
+    u8 buffer[4096];
+    const u64 blocks = file->file_size() / sizeof buffer;
+    u64 state = 0x2545f4914f6cdd1d;
+    Timer timer;
+    for (u32 i = 0; i < BENCH_RANDOM_READS; ++i) {
+        state = state * 6364136223846793005 + 1442695040888963407;
+        fs->read(file.get(), (state >> 33) % blocks * sizeof buffer, sizeof buffer, buffer);
+    }
+    report_rate(std::format("{}, random 4 KiB reads", path).data(), timer, BENCH_RANDOM_READS);
+}
+
+static void bench_lookup(FilesystemDriver* fs, const std::string& deepPath) {
+    DentryCache& dentries = SYSTEM->virtual_filesystem().dentries();
+
+    // Without the dentry cache, every lookup is the driver's own.
+    {
+        Timer timer;
+        for (u32 i = 0; i < BENCH_DIRECTORY_ENTRIES; ++i) {
+            dentries.invalidate(fs);
+            fs->open(std::format("big/file-{}.txt", BENCH_DIRECTORY_ENTRIES - 1 - i));
+        }
+        report_rate("lookup in big directory, uncached", timer, BENCH_DIRECTORY_ENTRIES);
+    }
+    {
+        Timer timer;
+        for (u32 i = 0; i < BENCH_DIRECTORY_ENTRIES; ++i)
+            fs->open(std::format("big/file-{}.txt", i));
+        report_rate("lookup in big directory, cached", timer, BENCH_DIRECTORY_ENTRIES);
+    }
+
+    const std::string leaf = deepPath + "/leaf.txt";
+    for (u32 cached = 0; cached < 2; ++cached) {
+        Timer timer;
+        for (u32 i = 0; i < 100; ++i) {
+            if (!cached) dentries.invalidate(fs);
+            fs->open(leaf);
+        }
+        report_rate(cached ? "open 33 components deep, cached" : "open 33 components deep, uncached", timer, 100);
+    }
+}
+
+static void bench_write(FilesystemDriver* fs) {
+    auto file = fs->create("written.bin");
+    if (!file) return;
+    auto data = contents(2, 64 * 1024);
+    Timer timer;
+    u64 total = 0;
+    while (total < BENCH_WRITE_SIZE) {
+        ssz n = fs->write(file.get(), total, data.size(), data.data());
+        if (n <= 0) break;
+        total += u64(n);
+    }
+    report_throughput("append, 64 KiB writes", timer, total);
+
+    Timer overwrite;
+    for (u64 offs = 0; offs < total; offs += data.size())
+        fs->write(file.get(), offs, data.size(), data.data());
+    report_throughput("overwrite, 64 KiB writes", overwrite, total);
+    fs->truncate(file.get(), 0);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::print("Usage: {} <image path>\n", argc ? argv[0] : "fat_bench");
+        return 2;
+    }
+    const char* path = argv[1];
+
+    std::string deepPath;
+    std::print("Building image...\n");
+    if (!build(path, deepPath)) {
+        std::print("Could not build the image\n");
+        return 2;
+    }
+
+    Timer mountTimer;
+    auto fs = mount(path, Device);
+    if (!fs) {
+        std::print("Could not mount the image\n");
+        return 1;
+    }
+    std::print("FAT32, {} byte clusters\n", BENCH_SECTORS_PER_CLUSTER * 512);
+    report_rate("mount", mountTimer, 1);
+
+    for (usz chunk = 4 * 1024; chunk <= 64 * 1024; chunk *= 16) {
+        bench_read(fs.get(), "contiguous.bin", chunk);
+        bench_read(fs.get(), "fragmented.bin", chunk);
+    }
+    bench_random_read(fs.get(), "contiguous.bin");
+    bench_random_read(fs.get(), "fragmented.bin");
+    bench_lookup(fs.get(), deepPath);
+    bench_write(fs.get());
+
+    SYSTEM->virtual_filesystem().dentries().invalidate(fs.get());
+    return 0;
+}
@@ -0,0 +1,67 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#ifndef LENSOR_OS_TESTS_FAT_COMMON_H
+#define LENSOR_OS_TESTS_FAT_COMMON_H
+
+#include <host/file_device.h>
+#include <host/host_io.h>
+
+#include <integers.h>
+#include <storage/filesystem_drivers/file_allocation_table.h>
+#include <system.h>
+
+#include <format>
+#include <memory>
+#include <vector>
+
+/// Byte `i` of the contents of the file made from `seed`.
+inline auto pattern(u32 seed, usz i) -> u8 {
+    return u8(((u64(seed) << 32 | i) * 0x9e3779b97f4a7c15) >> 56);
+}
+
+inline auto contents(u32 seed, usz size) -> std::vector<u8> {
+    std::vector<u8> data;
+    data.resize(size);
+    for (usz i = 0; i < size; ++i) data[i] = pattern(seed, i);
+    return data;
+}
+
+inline auto parse_number(const char* text) -> u64 {
+    u64 value = 0;
+    while (*text >= '0' && *text <= '9') value = value * 10 + u64(*text++ - '0');
+    return value;
+}
+
+/// The drivers keep their path lookups in the VFS's dentry cache.
+inline void boot() {
+    if (!SYSTEM) SYSTEM = new System();
+}
+
+/// Mount the image at `path` with a driver of its own.
+inline auto mount(const char* path, std::shared_ptr<FileDevice>& device) -> std::shared_ptr<FilesystemDriver> {
+    boot();
+    const int fd = host_open(path);
+    if (fd < 0) return {};
+    device = std::make_shared<FileDevice>(fd);
+    return FileAllocationTableDriver::try_create(sdd(device));
+}
+
+#endif /* LENSOR_OS_TESTS_FAT_COMMON_H */
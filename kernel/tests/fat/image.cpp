@@ -0,0 +1,372 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#include <fat/image.h>
+#include <host/host_io.h>
+
+#include <fat_definitions.h>
+#include <integers.h>
+#include <memory.h>
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+#define FAT_IMAGE_SECTOR_SIZE 512
+#define FAT_IMAGE_ENTRY_SIZE 32
+/// 2022-01-01, as a FAT date.
+#define FAT_IMAGE_DATE (((2022 - 1980) << 9) | (1 << 5) | 1)
+
+static void put16(u8* at, u16 value) {
+    at[0] = u8(value);
+    at[1] = u8(value >> 8);
+}
+
+static void put32(u8* at, u32 value) {
+    put16(at, u16(value));
+    put16(at + 2, u16(value >> 16));
+}
+
+static auto upper(char c) -> char {
+    return c >= 'a' && c <= 'z' ? char(c - 32) : c;
+}
+
+static bool short_name_character(char c) {
+    if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) return true;
+    for (char allowed : std::string_view("!#$%&'()-@^_`{}~"))
+        if (c == allowed) return true;
+    return false;
+}
+
+/// The 8.3 name of `name`, if it has one as it is (regardless of case).
+static bool fits_short_name(std::string_view name, u8* out) {
+    usz dot = name.size();
+    for (usz i = 0; i < name.size(); ++i)
+        if (name[i] == '.') {
+            if (dot != name.size()) return false;
+            dot = i;
+        }
+    const usz extension = dot == name.size() ? 0 : name.size() - dot - 1;
+    if (dot == 0 || dot > 8 || extension > 3 || (dot != name.size() && !extension)) return false;
+    memset(out, ' ', 11);
+    for (usz i = 0; i < dot; ++i) {
+        if (!short_name_character(name[i])) return false;
+        out[i] = u8(upper(name[i]));
+    }
+    for (usz i = 0; i < extension; ++i) {
+        if (!short_name_character(name[dot + 1 + i])) return false;
+        out[8 + i] = u8(upper(name[dot + 1 + i]));
+    }
+    return true;
+}
+
+/// A "BASIS~N.EXT" name for `name`, which has no 8.3 name of its own.
+static void generate_short_name(std::string_view name, u32 number, u8* out) {
+    memset(out, ' ', 11);
+    usz dot = name.size();
+    for (usz i = 0; i < name.size(); ++i)
+        if (name[i] == '.') dot = i;
+
+    char digits[10];
+    usz length = 0;
+    do digits[length++] = char('0' + number % 10);
+    while (number /= 10);
+
+    const usz basis = 7 - length;
+    usz at = 0;
+    for (usz i = 0; i < dot && at < basis; ++i)
+        if (short_name_character(name[i])) out[at++] = u8(upper(name[i]));
+    if (!at) out[at++] = '_';
+    out[at++] = '~';
+    while (length) out[at++] = u8(digits[--length]);
+
+    at = 8;
+    for (usz i = dot + 1; i < name.size() && at < 11; ++i)
+        if (short_name_character(name[i])) out[at++] = u8(upper(name[i]));
+}
+
+static auto short_name_checksum(const u8* name) -> u8 {
+    u8 sum = 0;
+    for (usz i = 0; i < 11; ++i) sum = u8(((sum & 1) << 7) + (sum >> 1) + name[i]);
+    return sum;
+}
+
+FATImage::FATImage(int fd, u8 bits, u32 sectors, u8 sectorsPerCluster)
+    : FD(fd), Bits(bits), TotalSectors(sectors), SectorsPerCluster(sectorsPerCluster)
+    , ReservedSectors(bits == 32 ? 32 : 1)
+    , RootEntries(bits == 32 ? 0 : 512)
+{
+    // The FAT has to cover the clusters that are left once it has been
+    // laid out; grow it until it does.
+    const u32 rootSectors = RootEntries * FAT_IMAGE_ENTRY_SIZE / FAT_IMAGE_SECTOR_SIZE;
+    for (;;) {
+        const u32 overhead = ReservedSectors + 2 * FATSectors + rootSectors;
+        if (overhead >= TotalSectors) return;
+        Clusters = (TotalSectors - overhead) / SectorsPerCluster;
+        const u64 tableBytes = Bits == 12 ? (u64(Clusters + 2) * 3 + 1) / 2 : u64(Clusters + 2) * Bits / 8;
+        const u32 needed = u32((tableBytes + FAT_IMAGE_SECTOR_SIZE - 1) / FAT_IMAGE_SECTOR_SIZE);
+        if (needed <= FATSectors) break;
+        FATSectors = needed;
+    }
+    Valid = (Bits == 12 && Clusters < 4085)
+            || (Bits == 16 && Clusters >= 4085 && Clusters < 65525)
+            || (Bits == 32 && Clusters >= 65525 && Clusters < 0x0ffffff5);
+    if (!Valid) return;
+
+    Table.resize(Clusters + 2, 0);
+    Table[0] = 0x0ffffff8 & end_of_chain();
+    Table[1] = end_of_chain();
+
+    Directory root;
+    if (Bits == 32) {
+        root.Clusters = allocate(1, 0);
+        Valid = root.Clusters.size();
+    }
+    Directories.push_back(std::move(root));
+}
+
+auto FATImage::end_of_chain() const -> u32 {
+    return Bits == 12 ? 0xfff : Bits == 16 ? 0xffff : 0x0fffffff;
+}
+
+auto FATImage::root_offset() const -> u64 {
+    return u64(ReservedSectors + 2 * FATSectors) * FAT_IMAGE_SECTOR_SIZE;
+}
+
+auto FATImage::cluster_offset(u32 cluster) const -> u64 {
+    return root_offset() + u64(RootEntries) * FAT_IMAGE_ENTRY_SIZE + u64(cluster - 2) * cluster_size();
+}
+
+auto FATImage::free_clusters() const -> u32 {
+    u32 free = 0;
+    for (u32 cluster = 2; cluster < Clusters + 2; ++cluster)
+        if (!Table[cluster]) ++free;
+    return free;
+}
+
+auto FATImage::allocate(u32 count, u32 run) -> std::vector<u32> {
+    std::vector<u32> clusters;
+    u32 inRun = 0;
+    while (clusters.size() < count) {
+        if (Next >= Clusters + 2) return {};
+        if (run && inRun == run) {
+            ++Next;
+            inRun = 0;
+            continue;
+        }
+        clusters.push_back(Next++);
+        ++inRun;
+    }
+    for (usz i = 0; i < clusters.size(); ++i)
+        Table[clusters[i]] = i + 1 < clusters.size() ? clusters[i + 1] : end_of_chain();
+    return clusters;
+}
+
+bool FATImage::add_entry(u32 directory, std::string_view name, u8 attributes, u32 cluster, u32 size) {
+    if (directory >= Directories.size() || !name.size() || name.size() > 255) return false;
+    Directory& parent = Directories[directory];
+
+    // Names that aren't 8.3 as they are, or aren't in upper case, get
+    // a long name too; for those, a short name is made up.
+    u8 shortName[11];
+    bool longName = false;
+    for (usz i = 0; i < name.size(); ++i)
+        if (name[i] >= 'a' && name[i] <= 'z') longName = true;
+    if (name == std::string_view(".") || name == std::string_view("..")) {
+        memset(shortName, ' ', 11);
+        memcpy(shortName, name.data(), name.size());
+        longName = false;
+    } else if (!fits_short_name(name, shortName)) {
+        generate_short_name(name, ++parent.Generated, shortName);
+        longName = true;
+    }
+
+    const usz longEntries = longName ? (name.size() + 12) / 13 : 0;
+    if (directory == ROOT && RootEntries
+        && parent.Entries.size() / FAT_IMAGE_ENTRY_SIZE + longEntries + 1 > RootEntries)
+        return false;
+
+    const usz start = parent.Entries.size();
+    parent.Entries.resize(start + (longEntries + 1) * FAT_IMAGE_ENTRY_SIZE, 0);
+    u8* entry = parent.Entries.data() + start;
+
+    // Long name entries come first, last part of the name first.
+    const u8 checksum = short_name_checksum(shortName);
+    for (usz n = longEntries; n; --n, entry += FAT_IMAGE_ENTRY_SIZE) {
+        static constexpr u8 characterOffsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+        entry[0] = u8(n | (n == longEntries ? 0x40 : 0));
+        entry[11] = FAT_ATTR_READ_ONLY | FAT_ATTR_HIDDEN | FAT_ATTR_SYSTEM | FAT_ATTR_VOLUME_ID;
+        entry[13] = checksum;
+        for (usz i = 0; i < 13; ++i) {
+            const usz at = (n - 1) * 13 + i;
+            const u16 c = at < name.size() ? u8(name[at]) : at == name.size() ? 0 : 0xffff;
+            put16(entry + characterOffsets[i], c);
+        }
+    }
+
+    memcpy(entry, shortName, 11);
+    entry[11] = attributes;
+    put16(entry + 16, FAT_IMAGE_DATE);
+    put16(entry + 18, FAT_IMAGE_DATE);
+    put16(entry + 20, u16(cluster >> 16));
+    put16(entry + 24, FAT_IMAGE_DATE);
+    put16(entry + 26, u16(cluster));
+    put32(entry + 28, size);
+    return true;
+}
+
+auto FATImage::mkdir(u32 parent, std::string_view name) -> u32 {
+    if (!Valid || parent >= Directories.size()) return INVALID;
+    Directory directory;
+    directory.Clusters = allocate(1, 0);
+    if (directory.Clusters.empty()) return INVALID;
+    const u32 cluster = directory.Clusters[0];
+    if (!add_entry(parent, name, FAT_ATTR_DIRECTORY, cluster, 0)) return INVALID;
+
+    const u32 handle = u32(Directories.size());
+    Directories.push_back(std::move(directory));
+    // ".." of a directory in the root is cluster zero, whatever the FAT.
+    const u32 parentCluster = parent == ROOT ? 0 : Directories[parent].Clusters[0];
+    add_entry(handle, ".", FAT_ATTR_DIRECTORY, cluster, 0);
+    add_entry(handle, "..", FAT_ATTR_DIRECTORY, parentCluster, 0);
+    return handle;
+}
+
+bool FATImage::add_file(u32 parent, std::string_view name, const u8* data, u32 size, u32 run) {
+    if (!Valid) return false;
+    const u32 count = (size + cluster_size() - 1) / cluster_size();
+    std::vector<u32> clusters;
+    if (count) {
+        clusters = allocate(count, run);
+        if (clusters.empty()) return false;
+    }
+    if (!add_entry(parent, name, FAT_ATTR_ARCHIVE, count ? clusters[0] : 0, size)) return false;
+
+    // One write per run of consecutive clusters.
+    for (usz i = 0; i < clusters.size(); ) {
+        usz end = i + 1;
+        while (end < clusters.size() && clusters[end] == clusters[end - 1] + 1) ++end;
+        const u64 offset = u64(i) * cluster_size();
+        const u64 bytes = std::min(u64(end - i) * cluster_size(), size - offset);
+        if (host_pwrite(FD, data + offset, bytes, cluster_offset(clusters[i])) != ssz(bytes)) return false;
+        i = end;
+    }
+    return true;
+}
+
+bool FATImage::finish() {
+    if (!Valid) return false;
+
+    // Directories get what more clusters they need last, so the bigger
+    // ones end up fragmented.
+    for (usz i = 0; i < Directories.size(); ++i) {
+        Directory& directory = Directories[i];
+        if (directory.Clusters.empty()) {
+            directory.Entries.resize(usz(RootEntries) * FAT_IMAGE_ENTRY_SIZE, 0);
+            if (host_pwrite(FD, directory.Entries.data(), directory.Entries.size(), root_offset()) != ssz(directory.Entries.size()))
+                return false;
+            continue;
+        }
+        const u32 needed = u32((directory.Entries.size() + cluster_size() - 1) / cluster_size());
+        if (needed > directory.Clusters.size()) {
+            std::vector<u32> more = allocate(needed - u32(directory.Clusters.size()), 0);
+            if (more.empty()) return false;
+            Table[directory.Clusters[directory.Clusters.size() - 1]] = more[0];
+            for (u32 cluster : more) directory.Clusters.push_back(cluster);
+        }
+        directory.Entries.resize(directory.Clusters.size() * cluster_size(), 0);
+        for (usz c = 0; c < directory.Clusters.size(); ++c)
+            if (host_pwrite(FD, directory.Entries.data() + c * cluster_size(), cluster_size(), cluster_offset(directory.Clusters[c])) != ssz(cluster_size()))
+                return false;
+    }
+
+    std::vector<u8> table;
+    table.resize(usz(FATSectors) * FAT_IMAGE_SECTOR_SIZE, 0);
+    for (u32 cluster = 0; cluster < Clusters + 2; ++cluster) {
+        const u32 value = Table[cluster];
+        if (Bits == 12) {
+            u8* at = table.data() + cluster + cluster / 2;
+            if (cluster & 1) {
+                at[0] = u8((at[0] & 0x0f) | (value << 4));
+                at[1] = u8(value >> 4);
+            } else {
+                at[0] = u8(value);
+                at[1] = u8((at[1] & 0xf0) | ((value >> 8) & 0x0f));
+            }
+        } else if (Bits == 16) put16(table.data() + cluster * 2, u16(value));
+        else put32(table.data() + cluster * 4, value);
+    }
+    for (u32 copy = 0; copy < 2; ++copy) {
+        const u64 offset = (ReservedSectors + u64(copy) * FATSectors) * FAT_IMAGE_SECTOR_SIZE;
+        if (host_pwrite(FD, table.data(), table.size(), offset) != ssz(table.size())) return false;
+    }
+
+    BootRecord br;
+    memset(&br, 0, sizeof br);
+    br.BPB.JumpCode[0] = 0xeb;
+    br.BPB.JumpCode[1] = Bits == 32 ? 0x58 : 0x3c;
+    br.BPB.JumpCode[2] = 0x90;
+    memcpy(br.BPB.OEMID, "LENSOROS", 8);
+    br.BPB.NumBytesPerSector = FAT_IMAGE_SECTOR_SIZE;
+    br.BPB.NumSectorsPerCluster = SectorsPerCluster;
+    br.BPB.NumReservedSectors = ReservedSectors;
+    br.BPB.NumFATsPresent = 2;
+    br.BPB.NumEntriesInRoot = RootEntries;
+    if (TotalSectors < 0x10000) br.BPB.TotalSectors16 = u16(TotalSectors);
+    else br.BPB.TotalSectors32 = TotalSectors;
+    br.BPB.MediaDescriptorType = 0xf8;
+    br.BPB.NumSectorsPerTrack = 32;
+    br.BPB.NumHeadsOrSides = 64;
+    if (Bits == 32) {
+        auto* extension = reinterpret_cast<BootRecordExtension32*>(br.Extended);
+        extension->NumSectorsPerFAT = FATSectors;
+        extension->RootCluster = Directories[ROOT].Clusters[0];
+        extension->FATInformation = 1;
+        extension->BackupBootRecordSector = 6;
+        extension->DriveNumber = 0x80;
+        extension->BootSignature = 0x29;
+        extension->VolumeID = 0x4c4f5321;
+        memcpy(extension->VolumeLabel, "NO NAME    ", 11);
+        memcpy(extension->FatTypeLabel, "FAT32   ", 8);
+    } else {
+        br.BPB.NumSectorsPerFAT = u16(FATSectors);
+        auto* extension = reinterpret_cast<BootRecordExtension16*>(br.Extended);
+        extension->BIOSDriveNumber = 0x80;
+        extension->BootSignature = 0x29;
+        extension->VolumeID = 0x4c4f5321;
+        memcpy(extension->VolumeLabel, "NO NAME    ", 11);
+        memcpy(extension->FatTypeLabel, Bits == 12 ? "FAT12   " : "FAT16   ", 8);
+    }
+    br.Magic = 0xaa55;
+    if (host_pwrite(FD, &br, sizeof br, 0) != sizeof br) return false;
+
+    if (Bits == 32) {
+        if (host_pwrite(FD, &br, sizeof br, 6 * FAT_IMAGE_SECTOR_SIZE) != sizeof br) return false;
+        FATFSInformation information;
+        memset(&information, 0, sizeof information);
+        information.LeadSignature = FAT_FSINFO_LEAD_SIGNATURE;
+        information.StructSignature = FAT_FSINFO_STRUCT_SIGNATURE;
+        information.FreeClusters = free_clusters();
+        information.NextFreeCluster = Next;
+        information.TrailSignature = FAT_FSINFO_TRAIL_SIGNATURE;
+        if (host_pwrite(FD, &information, sizeof information, FAT_IMAGE_SECTOR_SIZE) != sizeof information) return false;
+    }
+    return true;
+}
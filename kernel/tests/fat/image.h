@@ -0,0 +1,97 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#ifndef LENSOR_OS_TESTS_FAT_IMAGE_H
+#define LENSOR_OS_TESTS_FAT_IMAGE_H
+
+#include <integers.h>
+
+#include <string_view>
+#include <vector>
+
+/// Writes FAT12, FAT16 and FAT32 images from scratch into a host file.
+/// It shares nothing with the driver but `fat_definitions.h`, so the
+/// two can't agree on a misreading of the format.
+///
+/// File data is written as files are added; directories, the FATs and
+/// the boot sector are written by `finish`.
+class FATImage {
+public:
+    /// Handle of the root directory.
+    static constexpr u32 ROOT = 0;
+    static constexpr u32 INVALID = u32(-1);
+
+    /// Lay out a volume of `sectors` 512-byte sectors with a FAT of
+    /// `bits` bits per entry in the (empty) file `fd`.
+    FATImage(int fd, u8 bits, u32 sectors, u8 sectorsPerCluster);
+
+    /// Whether that geometry has the cluster count FAT`bits` must have.
+    bool valid() const { return Valid; }
+    auto clusters() const -> u32 { return Clusters; }
+    auto cluster_size() const -> u32 { return SectorsPerCluster * 512u; }
+    auto free_clusters() const -> u32;
+
+    /// @return Handle of the new directory, or INVALID.
+    auto mkdir(u32 parent, std::string_view name) -> u32;
+
+    /// Add a file that holds `size` bytes of `data`. Unless `run` is
+    /// zero, a cluster is left free after every `run` clusters of it,
+    /// so it is fragmented.
+    bool add_file(u32 parent, std::string_view name, const u8* data, u32 size, u32 run = 0);
+
+    /// Leave the next `clusters` clusters free.
+    void skip(u32 clusters) { Next += clusters; }
+
+    /// Write the directories, both FATs, and the boot sector.
+    bool finish();
+
+private:
+    struct Directory {
+        /// Empty for the fixed FAT12/16 root directory.
+        std::vector<u32> Clusters;
+        std::vector<u8> Entries;
+        /// Short names generated so far, to keep them unique.
+        u32 Generated { 0 };
+    };
+
+    int FD;
+    u8 Bits;
+    u32 TotalSectors;
+    u8 SectorsPerCluster;
+    u16 ReservedSectors;
+    u16 RootEntries;
+    u32 FATSectors { 1 };
+    u32 Clusters { 0 };
+    u32 Next { 2 };
+    bool Valid { false };
+    std::vector<u32> Table;
+    std::vector<Directory> Directories;
+
+    auto end_of_chain() const -> u32;
+    auto root_offset() const -> u64;
+    auto cluster_offset(u32 cluster) const -> u64;
+
+    /// Take `count` clusters from the next free one on, and chain them.
+    /// @return The clusters, or nothing if the volume is full.
+    auto allocate(u32 count, u32 run) -> std::vector<u32>;
+    bool add_entry(u32 directory, std::string_view name, u8 attributes, u32 cluster, u32 size);
+};
+
+#endif /* LENSOR_OS_TESTS_FAT_IMAGE_H */
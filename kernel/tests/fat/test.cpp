@@ -0,0 +1,328 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+/* FAT driver correctness
+ *
+ * Usage: fat_test <12|16|32> <image path>
+ *
+ * Writes an image of the given FAT type with deep, wide and fragmented
+ * trees, checks the driver reads every file of it back, then writes,
+ * grows and truncates files and checks that all of it is still there
+ * after mounting the image afresh.
+ */
+
+#include <fat/common.h>
+#include <fat/image.h>
+#include <host/file_device.h>
+#include <host/host_io.h>
+
+#include <integers.h>
+#include <storage/directory_entry.h>
+#include <storage/file_metadata.h>
+#include <storage/filesystem_driver.h>
+#include <system.h>
+
+#include <format>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static u32 Failures = 0;
+
+static void check(bool condition, const char* what, int line) {
+    if (condition) return;
+    ++Failures;
+    std::print("  \033[31mFAILED\033[m line {}: {}\n", line, what);
+}
+
+#define ensure(condition) check(bool(condition), #condition, __LINE__)
+
+struct Expected {
+    std::string Path;
+    u32 Seed;
+    u32 Size;
+};
+
+static std::vector<Expected> Files;
+
+static bool add(FATImage& image, u32 directory, std::string_view path, std::string_view name, u32 seed, u32 size, u32 run = 0) {
+    auto data = contents(seed, size);
+    if (!image.add_file(directory, name, data.data(), size, run)) return false;
+    Files.push_back({ std::string(path), seed, size });
+    return true;
+}
+
+/// Read all of `file` in pieces of `chunk` bytes and compare it with
+/// what `seed` makes.
+static bool verify(FilesystemDriver* fs, FileMetadata* file, u32 seed, usz size, usz chunk) {
+    if (file->file_size() != size) return false;
+    std::vector<u8> buffer;
+    buffer.resize(chunk);
+    for (usz offs = 0; offs < size; offs += chunk) {
+        const usz bytes = std::min(chunk, size - offs);
+        if (fs->read(file, offs, chunk, buffer.data()) != ssz(bytes)) return false;
+        for (usz i = 0; i < bytes; ++i)
+            if (buffer[i] != pattern(seed, offs + i)) return false;
+    }
+    return fs->read(file, size, chunk, buffer.data()) == 0;
+}
+
+static void verify_all(FilesystemDriver* fs) {
+    for (auto& expected : Files) {
+        auto file = fs->open(expected.Path);
+        ensure(file);
+        if (!bool(file)) {
+            std::print("    missing: {}\n", expected.Path);
+            continue;
+        }
+        ensure(!file->directory());
+        if (!verify(fs, file.get(), expected.Seed, expected.Size, 777)) {
+            ensure(!"contents as written");
+            std::print("    differs: {} ({} bytes, {} expected)\n", expected.Path, file->file_size(), expected.Size);
+        }
+    }
+}
+
+static auto count_entries(FilesystemDriver* fs, std::string_view path, std::string_view prefix) -> usz {
+    auto directory = fs->open(path);
+    if (!directory || !directory->directory()) return 0;
+    // Small enough that listing takes many calls.
+    u8 buffer[256];
+    usz cursor = 0;
+    usz count = 0;
+    for (;;) {
+        DirectoryEntryWriter out(buffer, sizeof buffer);
+        if (!fs->read_directory(directory.get(), cursor, out) || !out.size()) break;
+        for (usz at = 0; at < out.size(); ) {
+            auto* entry = reinterpret_cast<DirectoryEntry*>(buffer + at);
+            if (std::string_view(entry->Name).starts_with(prefix)) ++count;
+            at += entry->Length;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::print("Usage: {} <12|16|32> <image path>\n", argc ? argv[0] : "fat_test");
+        return 2;
+    }
+    const u32 bits = u32(parse_number(argv[1]));
+    const char* path = argv[2];
+
+    // Sizes and clusters that give each FAT type a volume of its own.
+    u32 sectors = 8192;
+    u8 sectorsPerCluster = 4;
+    if (bits == 16) {
+        sectors = 32768;
+        sectorsPerCluster = 1;
+    } else if (bits == 32) {
+        sectors = 70000;
+        sectorsPerCluster = 1;
+    }
+
+    const int fd = host_create(path, u64(sectors) * 512);
+    if (fd < 0) {
+        std::print("Could not create {}\n", path);
+        return 2;
+    }
+    FATImage image(fd, u8(bits), sectors, sectorsPerCluster);
+    if (!image.valid()) {
+        std::print("No FAT{} volume of {} sectors\n", bits, sectors);
+        return 2;
+    }
+    const u32 cluster = image.cluster_size();
+    std::print("FAT{}: {} clusters of {} bytes\n", bits, image.clusters(), cluster);
+
+    bool built = add(image, FATImage::ROOT, "README.TXT", "README.TXT", 1, 1000)
+        && add(image, FATImage::ROOT, "notes.txt", "notes.txt", 2, 3 * cluster + 17)
+        && add(image, FATImage::ROOT, "A much longer name for a file.data", "A much longer name for a file.data", 3, 5000)
+        && add(image, FATImage::ROOT, "empty", "empty", 4, 0)
+        && add(image, FATImage::ROOT, "fragment.bin", "fragment.bin", 5, 37 * cluster + 5, 1);
+
+    std::string deepPath = "deep";
+    u32 directory = image.mkdir(FATImage::ROOT, "deep");
+    for (u32 level = 0; built && directory != FATImage::INVALID && level < 10; ++level) {
+        const std::string name = std::format("level {} of a deep tree", level);
+        directory = image.mkdir(directory, name);
+        deepPath += "/";
+        deepPath += name;
+        built = add(image, directory, deepPath + "/leaf.bin", "leaf.bin", 100 + level, 2 * cluster + 100, 1);
+    }
+    built = built && directory != FATImage::INVALID;
+
+    const u32 wide = image.mkdir(FATImage::ROOT, "wide");
+    for (u32 i = 0; built && wide != FATImage::INVALID && i < 300; ++i) {
+        const std::string name = std::format("entry-{}.dat", i);
+        built = add(image, wide, std::format("wide/{}", name), name, 1000 + i, (i * 37) % 700 + 1);
+    }
+    built = built && wide != FATImage::INVALID && image.finish();
+    if (!built) {
+        std::print("Could not build the image\n");
+        return 2;
+    }
+    host_close(fd);
+
+    std::shared_ptr<FileDevice> device;
+    auto fs = mount(path, device);
+    ensure(fs);
+    if (!bool(fs)) return 1;
+    DentryCache& dentries = SYSTEM->virtual_filesystem().dentries();
+
+    std::print("Reading...\n");
+    verify_all(fs.get());
+
+    // Names match regardless of case, be they short or long ones.
+    ensure(fs->open("readme.txt"));
+    ensure(fs->open("NOTES.TXT"));
+    ensure(fs->open("a MUCH longer NAME for a file.DATA"));
+    ensure(fs->open("/deep/LEVEL 0 OF A DEEP TREE/leaf.bin"));
+    ensure(!fs->open("nothing"));
+    ensure(!fs->open("deep/nothing"));
+    ensure(!fs->open("README.TXT/nothing"));
+    ensure(fs->open("deep")->directory());
+
+    // Past the end, there is nothing to read.
+    {
+        auto file = fs->open("README.TXT");
+        u8 byte;
+        ensure(fs->read(file.get(), 1000, 1, &byte) == 0);
+        ensure(fs->read(file.get(), 5000, 1, &byte) == 0);
+    }
+
+    // Look up every name of a big directory twice without the dentry
+    // cache; the second time, the driver has an index of it.
+    for (u32 pass = 0; pass < 2; ++pass) {
+        dentries.invalidate(fs.get());
+        for (u32 i = 0; i < 300; ++i) {
+            auto file = fs->open(std::format("wide/entry-{}.dat", i));
+            ensure(file && file->file_size() == (i * 37) % 700 + 1);
+        }
+    }
+    ensure(count_entries(fs.get(), "wide", "entry-") == 300);
+    ensure(count_entries(fs.get(), "/", "") >= 7);
+
+    std::print("Writing...\n");
+    {
+        auto file = fs->create("new.txt");
+        ensure(file);
+        if (file) {
+            // Many small appends.
+            auto data = contents(7, 3 * cluster + cluster / 2);
+            for (usz offs = 0; offs < data.size(); offs += 1000) {
+                const usz bytes = std::min(usz(1000), data.size() - offs);
+                ensure(fs->write(file.get(), offs, bytes, data.data() + offs) == ssz(bytes));
+            }
+            ensure(verify(fs.get(), file.get(), 7, data.size(), 4096));
+            ensure(!fs->create("new.txt"));
+
+            // Overwrite across a cluster boundary, then cut it short.
+            auto other = contents(8, 500);
+            ensure(fs->write(file.get(), cluster - 250, 500, other.data()) == 500);
+            std::vector<u8> back;
+            back.resize(500);
+            ensure(fs->read(file.get(), cluster - 250, 500, back.data()) == 500);
+            bool same = true;
+            for (usz i = 0; i < back.size(); ++i) same = same && back[i] == other[i];
+            ensure(same);
+            ensure(fs->truncate(file.get(), cluster + 10));
+            ensure(file->file_size() == cluster + 10);
+
+            // Whatever a file grows by, by truncation or by a write past
+            // its end, reads as zeroes.
+            ensure(fs->truncate(file.get(), 2 * cluster));
+            ensure(fs->read(file.get(), cluster + 10, 500, back.data()) == 500);
+            bool zeroes = true;
+            for (u8 byte : back) zeroes = zeroes && !byte;
+            ensure(zeroes);
+
+            auto tail = contents(9, 100);
+            ensure(fs->write(file.get(), 3 * cluster, 100, tail.data()) == 100);
+            ensure(file->file_size() == 3 * cluster + 100);
+            ensure(fs->read(file.get(), 2 * cluster + 7, 500, back.data()) == 500);
+            zeroes = true;
+            for (u8 byte : back) zeroes = zeroes && !byte;
+            ensure(zeroes);
+        }
+    }
+
+    // A new file in a directory with no room left in it.
+    {
+        auto file = fs->create("wide/EXTRA.DAT");
+        ensure(file);
+        auto data = contents(10, 2 * cluster);
+        if (file) ensure(fs->write(file.get(), 0, data.size(), data.data()) == ssz(data.size()));
+        Files.push_back({ "wide/EXTRA.DAT", 10, 2 * cluster });
+    }
+
+    // Two opens of a file are the same file: each append lands after
+    // the last, whichever of them made it, in one cluster chain.
+    {
+        auto first = fs->create("twice.bin");
+        ensure(first);
+        auto data = contents(11, 3 * cluster);
+        if (first) ensure(fs->write(first.get(), 0, cluster, data.data()) == ssz(cluster));
+        auto second = fs->open("twice.bin");
+        ensure(second && second->file_size() == cluster);
+        if (first && second) {
+            ensure(fs->write(second.get(), cluster, cluster, data.data() + cluster) == ssz(cluster));
+            ensure(fs->write(first.get(), first->file_size(), cluster, data.data() + 2 * cluster) == ssz(cluster));
+            ensure(verify(fs.get(), second.get(), 11, 3 * cluster, cluster));
+        }
+        Files.push_back({ "twice.bin", 11, 3 * cluster });
+    }
+
+    // Grow a fragmented file, wherever the driver finds room.
+    {
+        auto file = fs->open("fragment.bin");
+        Expected* expected = nullptr;
+        for (auto& e : Files)
+            if (e.Path == "fragment.bin") expected = &e;
+        const usz size = expected->Size;
+        auto data = contents(expected->Seed, size + 10 * cluster);
+        ensure(fs->write(file.get(), size, 10 * cluster, data.data() + size) == ssz(10 * cluster));
+        expected->Size = u32(size + 10 * cluster);
+        ensure(verify(fs.get(), file.get(), expected->Seed, expected->Size, cluster));
+    }
+
+    // All of it has to be on the disk, not just in the driver.
+    std::print("Remounting...\n");
+    dentries.invalidate(fs.get());
+    fs = {};
+    device = {};
+    fs = mount(path, device);
+    ensure(fs);
+    if (!bool(fs)) return 1;
+    verify_all(fs.get());
+    {
+        auto file = fs->open("new.txt");
+        ensure(file && file->file_size() == 3 * cluster + 100);
+    }
+    ensure(count_entries(fs.get(), "wide", "entry-") == 300);
+
+    dentries.invalidate(fs.get());
+    if (Failures) {
+        std::print("FAT{}: {} checks failed\n", bits, Failures);
+        return 1;
+    }
+    std::print("FAT{}: all checks passed\n", bits);
+    return 0;
+}
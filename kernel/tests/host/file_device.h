@@ -0,0 +1,76 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#ifndef LENSOR_OS_TESTS_FILE_DEVICE_H
+#define LENSOR_OS_TESTS_FILE_DEVICE_H
+
+#include <host/host_io.h>
+
+#include <integers.h>
+#include <storage/file_metadata.h>
+#include <storage/storage_device_driver.h>
+
+#include <memory>
+#include <string_view>
+
+/// A disk image in a host file, as a storage device. Counts what is
+/// asked of it, so tests can tell how much I/O something took.
+class FileDevice final : public StorageDeviceDriver {
+    int FD;
+
+public:
+    u64 Reads { 0 };
+    u64 Writes { 0 };
+    u64 BytesRead { 0 };
+    u64 BytesWritten { 0 };
+
+    explicit FileDevice(int fd) : FD(fd) {}
+    ~FileDevice() override { host_close(FD); }
+
+    void reset_counters() {
+        Reads = 0;
+        Writes = 0;
+        BytesRead = 0;
+        BytesWritten = 0;
+    }
+
+    void close(FileMetadata*) final {}
+    auto open(std::string_view) -> std::shared_ptr<FileMetadata> final { return {}; }
+
+    ssz read(FileMetadata*, usz offs, usz bytes, void* buffer) final {
+        return read_raw(offs, bytes, buffer);
+    }
+
+    ssz read_raw(usz offs, usz bytes, void* buffer) final {
+        ++Reads;
+        ssz n = host_pread(FD, buffer, bytes, offs);
+        if (n > 0) BytesRead += usz(n);
+        return n;
+    }
+
+    ssz write(FileMetadata*, usz offs, usz bytes, void* buffer) final {
+        ++Writes;
+        ssz n = host_pwrite(FD, buffer, bytes, offs);
+        if (n > 0) BytesWritten += usz(n);
+        return n;
+    }
+};
+
+#endif /* LENSOR_OS_TESTS_FILE_DEVICE_H */
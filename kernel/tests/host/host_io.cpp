@@ -0,0 +1,73 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#include <host/host_io.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+int host_create(const char* path, unsigned long long bytes) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    // Sparse; whatever isn't written reads as zeroes.
+    if (ftruncate(fd, off_t(bytes)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int host_open(const char* path) {
+    return open(path, O_RDWR);
+}
+
+void host_close(int fd) {
+    close(fd);
+}
+
+long host_pread(int fd, void* buffer, unsigned long bytes, unsigned long long offset) {
+    return pread(fd, buffer, bytes, off_t(offset));
+}
+
+long host_pwrite(int fd, const void* buffer, unsigned long bytes, unsigned long long offset) {
+    return pwrite(fd, buffer, bytes, off_t(offset));
+}
+
+void host_write(int fd, const void* buffer, unsigned long bytes) {
+    const char* at = static_cast<const char*>(buffer);
+    while (bytes) {
+        ssize_t n = write(fd, at, bytes);
+        if (n <= 0) return;
+        at += n;
+        bytes -= size_t(n);
+    }
+}
+
+unsigned long long host_now_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ull + (unsigned long long)now.tv_nsec;
+}
+
+void host_exit(int status) {
+    exit(status);
+}
@@ -0,0 +1,52 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+#ifndef LENSOR_OS_TESTS_HOST_IO_H
+#define LENSOR_OS_TESTS_HOST_IO_H
+
+/* Host I/O
+ *
+ * Kernel sources under test are built against the kernel's own headers
+ * and std, not the host's, so they can't include anything of the host.
+ * These few functions are all of the host they get; `host_io.cpp` is the
+ * only file built against the host's headers.
+ */
+
+extern "C" {
+
+/// Create (or empty) the file at `path`, `bytes` long and all zeroes.
+/// @return A file descriptor open for reading and writing, or -1.
+int host_create(const char* path, unsigned long long bytes);
+/// @return A file descriptor open for reading and writing, or -1.
+int host_open(const char* path);
+void host_close(int fd);
+
+long host_pread(int fd, void* buffer, unsigned long bytes, unsigned long long offset);
+long host_pwrite(int fd, const void* buffer, unsigned long bytes, unsigned long long offset);
+void host_write(int fd, const void* buffer, unsigned long bytes);
+
+/// Nanoseconds of a monotonic clock.
+unsigned long long host_now_ns();
+
+[[noreturn]] void host_exit(int status);
+
+}
+
+#endif /* LENSOR_OS_TESTS_HOST_IO_H */
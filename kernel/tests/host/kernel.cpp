@@ -0,0 +1,64 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+/* What the kernel sources under test need of the rest of the kernel,
+ * for a host process: the log goes to standard output, and there are
+ * no processes to schedule (so nothing ever waits).
+ */
+
+#include <host/host_io.h>
+
+#include <debug.h>
+#include <integers.h>
+#include <panic.h>
+#include <scheduler.h>
+#include <system.h>
+
+#include <cstring>
+#include <format>
+#include <new>
+
+System* SYSTEM { nullptr };
+
+namespace Scheduler {
+    SinglyLinkedListNode<Process*>* CurrentProcess { nullptr };
+
+    Process* process(pid_t) { return nullptr; }
+
+    void yield() {
+        panic("Nothing to yield to on the host");
+        host_exit(2);
+    }
+}
+
+void dbgmsg_buf(const u8* buffer, u64 byteCount) {
+    host_write(1, buffer, byteCount);
+}
+
+/// Like the kernel's, built with general registers only (see CMakeLists.txt).
+void panic(const char* panicMessage) {
+    host_write(1, "PANIC: ", 7);
+    host_write(1, panicMessage, strlen(panicMessage));
+    host_write(1, "\n", 1);
+    host_exit(2);
+}
+
+void* operator new(size_t, void* ptr) noexcept { return ptr; }
+void* operator new[](size_t, void* ptr) noexcept { return ptr; }
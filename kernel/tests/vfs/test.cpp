@@ -0,0 +1,136 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses
+ */
+
+
+/* VFS correctness
+ *
+ * Usage: vfs_test
+ *
+ * Runs the file descriptor level of the VFS on pipes, as a single
+ * process that never has to wait.
+ */
+
+#include <host/host_io.h>
+
+#include <integers.h>
+#include <linked_list.h>
+#include <scheduler.h>
+#include <storage/device_drivers/pipe.h>
+#include <system.h>
+#include <virtual_filesystem.h>
+
+#include <format>
+
+static u32 Failures = 0;
+
+static void check(bool condition, const char* what, int line) {
+    if (condition) return;
+    ++Failures;
+    std::print("  \033[31mFAILED\033[m line {}: {}\n", line, what);
+}
+
+#define ensure(condition) check(bool(condition), #condition, __LINE__)
+
+struct Pipe {
+    ProcFD Read;
+    ProcFD Write;
+};
+
+static auto lay_pipe(VFS& vfs) -> Pipe {
+    auto ends = vfs.PipesDriver->lay_pipe();
+    const FileDescriptors read = vfs.add_file(std::move(ends.Read));
+    const FileDescriptors write = vfs.add_file(std::move(ends.Write));
+    return { read.Process, write.Process };
+}
+
+/// Write `count` bytes counting up from `first` to `fd`.
+static auto fill(VFS& vfs, ProcFD fd, usz count, u8 first = 0) -> ssz {
+    u8 data[PIPE_BUFSZ];
+    for (usz i = 0; i < count; ++i) data[i] = u8(first + i);
+    return vfs.write(fd, data, count, 0);
+}
+
+/// Read `count` bytes from `fd`, and whether they count up from `first`.
+static bool drain(VFS& vfs, ProcFD fd, usz count, u8 first) {
+    u8 data[PIPE_BUFSZ];
+    if (vfs.read(fd, data, count, 0) != ssz(count)) return false;
+    for (usz i = 0; i < count; ++i)
+        if (data[i] != u8(first + i)) return false;
+    return true;
+}
+
+/// A pipe only takes what fits, and what doesn't fit must stay in the
+/// source rather than be lost.
+static void sendfile_into_full_pipe(VFS& vfs) {
+    std::print("sendfile from a pipe into a nearly full pipe\n");
+    const Pipe source = lay_pipe(vfs);
+    const Pipe sink = lay_pipe(vfs);
+    ensure(fill(vfs, sink.Write, PIPE_BUFSZ - 10) == PIPE_BUFSZ - 10);
+    ensure(fill(vfs, source.Write, 100) == 100);
+
+    ensure(vfs.sendfile(sink.Write, source.Read, nullptr, 100) == 10);
+    ensure(vfs.PipesDriver->space(vfs.file(sink.Write)) == 0);
+    // Full: nothing moves, and nothing is taken out of the source.
+    ensure(vfs.sendfile(sink.Write, source.Read, nullptr, 100) == 0);
+
+    ensure(drain(vfs, sink.Read, PIPE_BUFSZ - 10, 0));
+    ensure(drain(vfs, sink.Read, 10, 0));
+    ensure(vfs.sendfile(sink.Write, source.Read, nullptr, 100) == 90);
+    ensure(drain(vfs, sink.Read, 90, 10));
+
+    vfs.close(source.Read);
+    vfs.close(source.Write);
+    vfs.close(sink.Read);
+    vfs.close(sink.Write);
+}
+
+/// A pipe has no offsets, so pread and pwrite on it must fail without
+/// touching what's in it.
+static void positional_io_on_pipe(VFS& vfs) {
+    std::print("pread and pwrite on a pipe\n");
+    const Pipe pipe = lay_pipe(vfs);
+    ensure(fill(vfs, pipe.Write, 20) == 20);
+
+    u8 data[20] {};
+    ensure(vfs.pwrite(pipe.Write, data, sizeof data, 5) == -1);
+    ensure(vfs.PipesDriver->space(vfs.file(pipe.Write)) == PIPE_BUFSZ - 20);
+    ensure(vfs.pread(pipe.Read, data, sizeof data, 0) == -1);
+    ensure(drain(vfs, pipe.Read, 20, 0));
+
+    vfs.close(pipe.Read);
+    vfs.close(pipe.Write);
+}
+
+int main() {
+    SYSTEM = new System();
+    Process process;
+    SinglyLinkedListNode<Process*> node(&process);
+    Scheduler::CurrentProcess = &node;
+    VFS& vfs = SYSTEM->virtual_filesystem();
+
+    sendfile_into_full_pipe(vfs);
+    positional_io_on_pipe(vfs);
+
+    if (Failures) {
+        std::print("VFS: {} checks failed\n", Failures);
+        return 1;
+    }
+    std::print("VFS: all checks passed\n");
+    return 0;
+}
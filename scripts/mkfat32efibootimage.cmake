@@ -20,6 +20,22 @@ function(mcopy_file filename_to_copy directory)
   execute_process(COMMAND mcopy -i ${IMAGE_DIR}/LensorOS.img ${filename_to_copy} ::${directory})
 endfunction()
 
+# The initrd: a ustar archive of userspace programs and the default
+# font, that the kernel mounts as the root filesystem.
+set(INITRD_DIR ${BOOT_DIR}/initrd)
+file(REMOVE_RECURSE ${INITRD_DIR})
+file(GLOB USER_PROGRAMS ${REPO_DIR}/user/bin/*)
+if (USER_PROGRAMS)
+  message(STATUS "Generating initrd...")
+  file(MAKE_DIRECTORY ${INITRD_DIR}/bin ${INITRD_DIR}/res/fonts/psf1)
+  file(COPY ${USER_PROGRAMS} DESTINATION ${INITRD_DIR}/bin PATTERN "*.cache" EXCLUDE)
+  file(COPY ${REPO_DIR}/kernel/res/dfltfont.psf DESTINATION ${INITRD_DIR}/res/fonts/psf1)
+  execute_process(
+    COMMAND ${CMAKE_COMMAND} -E tar cf ${BOOT_DIR}/LensorOS/initrd --format=paxr bin res
+    WORKING_DIRECTORY ${INITRD_DIR}
+  )
+endif()
+
 message(STATUS "Generating FAT32 UEFI boot media...")
 file(MAKE_DIRECTORY ${IMAGE_DIR})
 execute_process(COMMAND ${DD_PROGRAM} if=/dev/zero of=${IMAGE_DIR}/LensorOS.img count=93750)
@@ -31,4 +47,7 @@ mcopy_file(${SCRIPTS_DIR}/startup.nsh "")
 mcopy_file(${BOOT_DIR}/EFI/BOOT/main.efi /EFI/BOOT)
 mcopy_file(${BOOT_DIR}/LensorOS/kernel.elf /LensorOS)
 mcopy_file(${BOOT_DIR}/LensorOS/dfltfont.psf /LensorOS)
+if (EXISTS ${BOOT_DIR}/LensorOS/initrd)
+  mcopy_file(${BOOT_DIR}/LensorOS/initrd /LensorOS)
+endif()
 
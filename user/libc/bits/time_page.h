@@ -0,0 +1,43 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LENSOR_OS_LIBC_TIME_PAGE_H
+#define _LENSOR_OS_LIBC_TIME_PAGE_H
+
+#include <stdint.h>
+
+/// Read-only page of clock calibration data the kernel maps into every
+/// process. Layout must match `Time::TimePage` in `kernel/src/time_page.h`.
+#define __TIME_PAGE_VADDR 0x7fffffe00000
+
+#define __TIME_PAGE_SOURCE_TICKS 0
+#define __TIME_PAGE_SOURCE_TSC   1
+
+struct __time_page {
+    volatile uint32_t __sequence;
+    uint32_t __source;
+    uint64_t __counter_base;
+    uint64_t __nanoseconds_base;
+    uint64_t __multiplier;
+    uint32_t __shift;
+    uint32_t __reserved;
+    uint64_t __epoch_seconds;
+};
+
+#endif /* _LENSOR_OS_LIBC_TIME_PAGE_H */
@@ -0,0 +1,95 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "dirent.h"
+
+#include "errno.h"
+#include "fcntl.h"
+#include "stddef.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "sys/syscalls.h"
+#include "unistd.h"
+
+/// Enough for dozens of entries, so most directories are listed in
+/// a syscall or two.
+#define DIRSTREAM_BUFFER_SIZE 4096
+
+struct __dirstream {
+    int fd;
+    /// Records in `buffer` run from `position` to `size`.
+    size_t position;
+    size_t size;
+    alignas(8) char buffer[DIRSTREAM_BUFFER_SIZE];
+};
+
+extern "C" {
+    ssize_t getdents(int fd, void *buffer, size_t bytes) {
+        /// TODO: check return value and set errno.
+        return syscall<ssize_t>(SYS_getdents, fd, buffer, bytes);
+    }
+
+    DIR *opendir(const char *path) {
+        int fd = open(path, O_RDONLY, 0);
+        if (fd < 0) return NULL;
+        auto *dirp = static_cast<DIR *>(malloc(sizeof(DIR)));
+        if (!dirp) {
+            close(fd);
+            errno = ENOMEM;
+            return NULL;
+        }
+        dirp->fd = fd;
+        dirp->position = 0;
+        dirp->size = 0;
+        return dirp;
+    }
+
+    struct dirent *readdir(DIR *dirp) {
+        if (dirp->position >= dirp->size) {
+            ssize_t n = getdents(dirp->fd, dirp->buffer, sizeof dirp->buffer);
+            if (n <= 0) return NULL;
+            dirp->position = 0;
+            dirp->size = size_t(n);
+        }
+        auto *entry = reinterpret_cast<struct dirent *>(dirp->buffer + dirp->position);
+        dirp->position += entry->d_reclen;
+        return entry;
+    }
+
+    void rewinddir(DIR *dirp) {
+        syscall(SYS_seek, dirp->fd, 0, SEEK_SET);
+        dirp->position = 0;
+        dirp->size = 0;
+    }
+
+    int closedir(DIR *dirp) {
+        if (!dirp) {
+            errno = EBADF;
+            return -1;
+        }
+        close(dirp->fd);
+        free(dirp);
+        return 0;
+    }
+
+    int dirfd(DIR *dirp) {
+        return dirp->fd;
+    }
+}
@@ -0,0 +1,69 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _DIRENT_H
+#define _DIRENT_H
+
+#include <bits/decls.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS__
+
+/// NOTE: Values and layout must match `kernel/src/storage/directory_entry.h`.
+#define DT_UNKNOWN 0
+#define DT_DIR     4
+#define DT_REG     8
+
+/// The kernel packs these back to back, each only `d_reclen` bytes
+/// long; `d_name` is NUL-terminated, and only as long as it needs to be.
+struct dirent {
+    ino_t d_ino;
+    off_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[256];
+};
+
+typedef struct __dirstream DIR;
+
+/// Open the directory at PATH for reading with `readdir`.
+/// Return NULL on error.
+DIR *opendir(const char *path);
+
+/// Return the next entry of DIRP, or NULL once there are no more. The
+/// entry is only valid until the next call on DIRP.
+struct dirent *readdir(DIR *dirp);
+
+/// Start reading DIRP from its first entry again.
+void rewinddir(DIR *dirp);
+
+int closedir(DIR *dirp);
+
+int dirfd(DIR *dirp);
+
+/// Fill BUFFER with as many packed `struct dirent` records of the open
+/// directory FD as fit in BYTES; the next call continues after them.
+/// Return the number of bytes filled, 0 at the end of the directory,
+/// or -1 on error (including BUFFER being too small for even one).
+ssize_t getdents(int fd, void *buffer, size_t bytes);
+
+__END_DECLS__
+
+#endif /* _DIRENT_H */
@@ -0,0 +1,44 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FCNTL_H
+#define _FCNTL_H
+
+#include <bits/decls.h>
+
+/// Access modes; the kernel doesn't enforce these (yet).
+#define O_RDONLY 00
+#define O_WRONLY 01
+#define O_RDWR   02
+#define O_ACCMODE 03
+
+/// Create the file if it doesn't exist. Must match VFS_OPEN_CREATE in
+/// `kernel/src/virtual_filesystem.h`.
+#define O_CREAT 0100
+/// Truncate an existing file to zero bytes. Must match
+/// VFS_OPEN_TRUNCATE in `kernel/src/virtual_filesystem.h`.
+#define O_TRUNC 01000
+
+__BEGIN_DECLS__
+
+int open(const char* path, int flags, int mode);
+
+__END_DECLS__
+
+#endif /* _FCNTL_H */
@@ -0,0 +1,73 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "sys/io_ring.h"
+
+#include "stddef.h"
+#include "string.h"
+#include "sys/syscalls.h"
+
+extern "C" {
+    int io_ring_init(struct io_ring *ring, uint32_t entries) {
+        if (!ring) return -1;
+        auto* header = syscall<io_ring_header*>(SYS_ioring_setup, entries);
+        if (!header) return -1;
+        ring->header = header;
+        ring->sqes = reinterpret_cast<io_ring_sqe*>(reinterpret_cast<uint8_t*>(header) + IORING_HEADER_SIZE);
+        ring->cqes = reinterpret_cast<io_ring_cqe*>(ring->sqes + header->sq_entries);
+        ring->sq_pending = 0;
+        return 0;
+    }
+
+    struct io_ring_sqe *io_ring_get_sqe(struct io_ring *ring) {
+        io_ring_header* header = ring->header;
+        uint32_t tail = header->sq_tail + ring->sq_pending;
+        if (tail - header->sq_head >= header->sq_entries) return NULL;
+        io_ring_sqe* sqe = &ring->sqes[tail & header->sq_mask];
+        memset(sqe, 0, sizeof(io_ring_sqe));
+        ring->sq_pending += 1;
+        return sqe;
+    }
+
+    int io_ring_submit(struct io_ring *ring) {
+        io_ring_header* header = ring->header;
+        /// Entries must be visible before the tail moves past them.
+        __asm__ __volatile__ ("" ::: "memory");
+        header->sq_tail = header->sq_tail + ring->sq_pending;
+        ring->sq_pending = 0;
+
+        uint32_t queued = header->sq_tail - header->sq_head;
+        if (!queued) return 0;
+        /// -2 means an operation blocked and we have been woken; retry it.
+        ssize_t rc = 0;
+        while ((rc = syscall<ssize_t>(SYS_ioring_enter, queued)) == -2);
+        return (int)rc;
+    }
+
+    struct io_ring_cqe *io_ring_peek_cqe(struct io_ring *ring) {
+        io_ring_header* header = ring->header;
+        if (header->cq_head == header->cq_tail) return NULL;
+        __asm__ __volatile__ ("" ::: "memory");
+        return &ring->cqes[header->cq_head & header->cq_mask];
+    }
+
+    void io_ring_cqe_seen(struct io_ring *ring) {
+        ring->header->cq_head = ring->header->cq_head + 1;
+    }
+}
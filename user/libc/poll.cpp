@@ -0,0 +1,45 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "poll.h"
+
+#include "sys/syscalls.h"
+#include "time.h"
+
+extern "C" {
+    int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+        /// The kernel returns -2 whenever it wakes us, be it because a
+        /// file may have become ready or because the timeout expired;
+        /// call again with whatever is left of the timeout.
+        struct timespec start{};
+        if (timeout > 0) clock_gettime(CLOCK_MONOTONIC, &start);
+        long remaining = timeout;
+        for (;;) {
+            int rc = syscall<int>(SYS_poll, fds, nfds, remaining);
+            if (rc != -2) return rc;
+            if (timeout <= 0) continue;
+
+            struct timespec now{};
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long elapsed = long(now.tv_sec - start.tv_sec) * 1000
+                + (now.tv_nsec - start.tv_nsec) / 1000000;
+            remaining = elapsed >= timeout ? 0 : timeout - elapsed;
+        }
+    }
+}
@@ -0,0 +1,53 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _POLL_H
+#define _POLL_H
+
+#include <bits/decls.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS__
+
+/// NOTE: Values and layout must match `kernel/src/poll.h`.
+#define POLLIN   0x01
+#define POLLPRI  0x02
+#define POLLOUT  0x04
+#define POLLERR  0x08
+#define POLLHUP  0x10
+#define POLLNVAL 0x20
+
+typedef unsigned long nfds_t;
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+/// Wait until at least one of the NFDS file descriptors in FDS is
+/// ready for one of its requested events, or TIMEOUT milliseconds have
+/// passed. A negative TIMEOUT waits forever; zero returns immediately.
+/// Return the number of entries with non-zero `revents` (0 on
+/// timeout), or -1 on error.
+int poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+__END_DECLS__
+
+#endif /* _POLL_H */
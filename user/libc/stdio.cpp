@@ -24,11 +24,13 @@
 #include "bits/stub.h"
 #include "errno.h"
 #include "extensions"
+#include "fcntl.h"
 #include "stdarg.h"
 #include "stdlib.h"
 #include "string.h"
 #include "unistd.h"
 #include "sys/syscalls.h"
+#include "sys/uio.h"
 
 #include <algorithm>
 #include <atomic>
@@ -484,20 +486,28 @@ bool _IO_File::write(char c) { return write(&c, 1) == 1; }
 
 ssize_t _IO_File::write_internal(const char* __restrict__ buffer, size_t count) {
     /// TODO: Check if the stream is open for writing.
-    /// Flush the buffer if this operation would overflow it.
-    if (__wbuf.__offs + count > __wbuf.__cap && !flush()) { return EOF; }
-
-    /// Write data directly to the stream if it doesn't fit in the buffer.
+    /// Write the buffered data and the new data to the stream together
+    /// if the new data doesn't fit in the buffer anyway.
     if (count > __wbuf.__cap) {
-        auto written = ::write(__fd, buffer, count);
-        if (written < 0 || size_t(written) != count) {
+        struct iovec iov[2] = {
+            { __wbuf.__buf, __wbuf.__offs },
+            { const_cast<char*>(buffer), count },
+        };
+        const bool buffered = __wbuf.__offs != 0;
+        const size_t total = __wbuf.__offs + count;
+        auto written = ::writev(__fd, buffered ? iov : iov + 1, buffered ? 2 : 1);
+        if (written < 0 || size_t(written) != total) {
             __f_error = true;
             return EOF;
         }
 
+        __wbuf.__offs = 0;
         return ssize_t(count);
     }
 
+    /// Flush the buffer if this operation would overflow it.
+    if (__wbuf.__offs + count > __wbuf.__cap && !flush()) { return EOF; }
+
     /// Write data to the buffer.
     memcpy(__wbuf.__buf + __wbuf.__offs, buffer, count);
     __wbuf.__offs += count;
@@ -576,12 +586,12 @@ int fflush(FILE* stream) {
 }
 
 FILE* fopen(const char* __restrict__ filename, const char* __restrict__ mode) {
-    /// TODO: Parse mode.
-    (void)mode;
-
     /// TODO: Allocate a new file and buffer.
-    /// TODO: Parse mode and set the right flags.
-    auto fd = open(filename, 0, 0);
+    /// TODO: Parse the rest of the mode and set the right flags.
+    int flags = O_RDONLY;
+    if (mode && mode[0] == 'w') flags = O_WRONLY | O_CREAT | O_TRUNC;
+    else if (mode && mode[0] == 'a') flags = O_WRONLY | O_CREAT;
+    auto fd = open(filename, flags, 0);
     if (fd < 0) return nullptr;
     return FILE::create(fd);
 }
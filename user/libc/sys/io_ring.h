@@ -0,0 +1,109 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SYS_IO_RING_H
+#define _SYS_IO_RING_H
+
+#include <bits/decls.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS__
+
+/// Batched I/O through submission/completion rings shared with the
+/// kernel. Layout must match `kernel/src/io_ring.h`.
+///
+/// Usage:
+///   struct io_ring ring;
+///   io_ring_init(&ring, 32);
+///   struct io_ring_sqe *sqe = io_ring_get_sqe(&ring);
+///   sqe->opcode = IORING_OP_READ; ...
+///   io_ring_submit(&ring);
+///   struct io_ring_cqe *cqe;
+///   while ((cqe = io_ring_peek_cqe(&ring))) { ...; io_ring_cqe_seen(&ring); }
+
+#define IORING_HEADER_SIZE 64
+
+#define IORING_OP_NOP   0
+#define IORING_OP_READ  1
+#define IORING_OP_WRITE 2
+#define IORING_OP_OPEN  3
+#define IORING_OP_CLOSE 4
+#define IORING_OP_SEEK  5
+
+struct io_ring_header {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t cq_mask;
+    uint32_t cq_entries;
+};
+
+struct io_ring_sqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t reserved;
+    int32_t fd;
+    /// READ/WRITE: byte offset from the file's current offset.
+    /// SEEK: offset to seek to.
+    uint64_t offset;
+    /// READ/WRITE: buffer. OPEN: NUL-terminated path.
+    uint64_t addr;
+    /// READ/WRITE: byte count. SEEK: whence.
+    uint64_t len;
+    uint64_t user_data;
+};
+
+struct io_ring_cqe {
+    uint64_t user_data;
+    int64_t res;
+};
+
+struct io_ring {
+    struct io_ring_header *header;
+    struct io_ring_sqe *sqes;
+    struct io_ring_cqe *cqes;
+    /// Submissions queued locally but not yet handed to the kernel.
+    uint32_t sq_pending;
+};
+
+/// Set up rings with ENTRIES submission entries (a power of two).
+/// Return 0 on success, or -1 on failure.
+int io_ring_init(struct io_ring *ring, uint32_t entries);
+
+/// Return the next free submission queue entry, or NULL if the queue is full.
+/// The entry is zeroed; it is queued by the next call to io_ring_submit().
+struct io_ring_sqe *io_ring_get_sqe(struct io_ring *ring);
+
+/// Hand all queued submissions to the kernel with a single system call.
+/// Return the number of entries consumed by the kernel, or -1 on failure.
+int io_ring_submit(struct io_ring *ring);
+
+/// Return the oldest unconsumed completion, or NULL if there is none.
+struct io_ring_cqe *io_ring_peek_cqe(struct io_ring *ring);
+
+/// Mark the completion returned by io_ring_peek_cqe() as consumed.
+void io_ring_cqe_seen(struct io_ring *ring);
+
+__END_DECLS__
+
+#endif /* _SYS_IO_RING_H */
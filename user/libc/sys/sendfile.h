@@ -0,0 +1,37 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SYS_SENDFILE_H
+#define _SYS_SENDFILE_H
+
+#include <bits/decls.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS__
+
+/// Copy up to `count` bytes from `in_fd` to `out_fd` within the kernel.
+/// If `offset` is not NULL, read from `*offset` and update it, leaving
+/// the file offset of `in_fd` alone; otherwise, read from and advance
+/// the file offset of `in_fd`.
+/// Return the number of bytes copied, or -1 on error.
+ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count);
+
+__END_DECLS__
+
+#endif /* _SYS_SENDFILE_H */
@@ -41,7 +41,17 @@
 #define SYS_seek    14
 #define SYS_pwd     15
 #define SYS_dup     16
-#define SYS_MAXSYSCALL 16
+#define SYS_ioring_setup 17
+#define SYS_ioring_enter 18
+#define SYS_readv   19
+#define SYS_writev  20
+#define SYS_pread   21
+#define SYS_pwrite  22
+#define SYS_poll    23
+#define SYS_sendfile 24
+#define SYS_mkdir   25
+#define SYS_getdents 26
+#define SYS_MAXSYSCALL 26
 #else
 #define SYS_read  0
 #define SYS_write 1
@@ -59,14 +69,16 @@ __BEGIN_DECLS__
 #define __a uintptr_t
 
 /// Syscall argument registers.
+/// NOTE: `syscall` overwrites `rcx` (return address) and `r11` (RFLAGS),
+///       so the fourth argument is passed in `r10` instead.
 #if defined(__lensor__)
 #define _R1 "D"
 #define _R2 "S"
 #define _R3 "d"
-#define _R4 "rcx"
+#define _R4 "r10"
 #define _R5 "r8"
 #define _R6 "r9"
-#define _SYSCALL "int $0x80"
+#define _SYSCALL "syscall"
 #elif defined(__linux__)
 #define _R1 "D"
 #define _R2 "S"
@@ -86,7 +98,7 @@ __BEGIN_DECLS__
             (_SYSCALL "\n"                                                              \
              : "=a"(__result)                                                           \
              : "a"(__n) __VA_OPT__(, ) __VA_ARGS__                                      \
-             : "memory"                                                                 \
+             : "memory", "rcx", "r11"                                                   \
         );                                                                              \
         return __result;                                                                \
     }
@@ -101,39 +113,39 @@ _DEFINE_SYSCALL(3, _DEFINE_SYSCALL_ARGS(__a __1, __a __2, __a __3), _R1(__1), _R
 __attribute__((__always_inline__, __artificial__))
 inline __a __syscall4(__a __n, __a __1, __a __2, __a __3, __a __4) {
     __a __result;
+    register __a __r4 __asm__(_R4) = __4;
     __asm__ __volatile__
-        ("movq %0, %%" _R4 "\n"
-         _SYSCALL "\n"
+        (_SYSCALL "\n"
          : "=a"(__result)
-         : "a"(__n), _R1(__1), _R2(__2), _R3(__3), "r"(__4)
-         : "memory", _R4);
+         : "a"(__n), _R1(__1), _R2(__2), _R3(__3), "r"(__r4)
+         : "memory", "rcx", "r11");
     return __result;
 }
 
 __attribute__((__always_inline__, __artificial__))
 inline __a __syscall5(__a __n, __a __1, __a __2, __a __3, __a __4, __a __5) {
     __a __result;
+    register __a __r4 __asm__(_R4) = __4;
+    register __a __r5 __asm__(_R5) = __5;
     __asm__ __volatile__
-        ("movq %0, %%" _R4 "\n"
-         "movq %1, %%" _R5 "\n"
-         _SYSCALL "\n"
+        (_SYSCALL "\n"
          : "=a"(__result)
-         : "a"(__n), _R1(__1), _R2(__2), _R3(__3), "r"(__4), "r"(__5)
-         : "memory", _R4, _R5);
+         : "a"(__n), _R1(__1), _R2(__2), _R3(__3), "r"(__r4), "r"(__r5)
+         : "memory", "rcx", "r11");
     return __result;
 }
 
 __attribute__((__always_inline__, __artificial__))
 inline __a __syscall6(__a __n, __a __1, __a __2, __a __3, __a __4, __a __5, __a __6) {
     __a __result;
+    register __a __r4 __asm__(_R4) = __4;
+    register __a __r5 __asm__(_R5) = __5;
+    register __a __r6 __asm__(_R6) = __6;
     __asm__ __volatile__
-        ("movq %0, %%" _R4 "\n"
-         "movq %1, %%" _R5 "\n"
-         "movq %2, %%" _R6 "\n"
-         _SYSCALL "\n"
+        (_SYSCALL "\n"
          : "=a"(__result)
-         : "a"(__n), _R1(__1), _R2(__2), _R3(__3), "r"(__4), "r"(__5), "r"(__6)
-         : "memory", _R4, _R5, _R6);
+         : "a"(__n), _R1(__1), _R2(__2), _R3(__3), "r"(__r4), "r"(__r5), "r"(__r6)
+         : "memory", "rcx", "r11");
     return __result;
 }
 
@@ -0,0 +1,42 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SYS_UIO_H
+#define _SYS_UIO_H
+
+#include <bits/decls.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS__
+
+/// One buffer of a scatter/gather list. Layout must match `IOVector`
+/// in `kernel/src/storage/storage_device_driver.h`.
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+
+/// Read into (write from) each buffer in `iov` in order, as one call.
+/// Return the total number of bytes transferred, or -1 on error.
+ssize_t readv(int fd, const struct iovec* iov, int iovcnt);
+ssize_t writev(int fd, const struct iovec* iov, int iovcnt);
+
+__END_DECLS__
+
+#endif /* _SYS_UIO_H */
@@ -0,0 +1,81 @@
+/* Copyright 2022, Contributors To LensorOS.
+ * All rights reserved.
+ *
+ * This file is part of LensorOS.
+ *
+ * LensorOS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LensorOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LensorOS. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "time.h"
+
+#include "bits/time_page.h"
+#include "errno.h"
+#include "stddef.h"
+
+namespace {
+__extension__ typedef unsigned __int128 uint128_t;
+
+inline uint64_t rdtsc() {
+    uint32_t low;
+    uint32_t high;
+    __asm__ __volatile__ ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/// Read monotonic nanoseconds and the epoch from the kernel time page.
+/// This never enters the kernel: if the kernel updates the page while
+/// we read it (sequence odd or changed), simply try again.
+void read_time_page(uint64_t& nanoseconds, uint64_t& epoch) {
+    const auto* page = reinterpret_cast<const __time_page*>(__TIME_PAGE_VADDR);
+    uint32_t sequence;
+    do {
+        do sequence = page->__sequence;
+        while (sequence & 1);
+        __asm__ __volatile__ ("" ::: "memory");
+
+        nanoseconds = page->__nanoseconds_base;
+        if (page->__source == __TIME_PAGE_SOURCE_TSC) {
+            uint64_t delta = rdtsc() - page->__counter_base;
+            nanoseconds += (uint64_t)(((uint128_t)delta * page->__multiplier) >> page->__shift);
+        }
+        epoch = page->__epoch_seconds;
+
+        __asm__ __volatile__ ("" ::: "memory");
+    } while (sequence != page->__sequence);
+}
+} // namespace
+
+extern "C" {
+    int clock_gettime(clockid_t clockid, struct timespec *tp) {
+        if (!tp || (clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC)) {
+            errno = EINVAL;
+            return -1;
+        }
+        uint64_t nanoseconds = 0;
+        uint64_t epoch = 0;
+        read_time_page(nanoseconds, epoch);
+        tp->tv_sec = (time_t)(nanoseconds / 1000000000);
+        tp->tv_nsec = (long)(nanoseconds % 1000000000);
+        if (clockid == CLOCK_REALTIME)
+            tp->tv_sec += epoch;
+        return 0;
+    }
+
+    time_t time(time_t *t) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        if (t) *t = ts.tv_sec;
+        return ts.tv_sec;
+    }
+}
@@ -21,11 +21,27 @@
 #ifndef _TIME_H
 #define _TIME_H
 
+#include <sys/types.h>
+
 #if defined (__cplusplus)
 extern "C" {
 #endif
 
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+
+struct timespec {
+    time_t tv_sec;
+    long tv_nsec;
+};
+
+/// Store the current time of CLOCKID in TP.
+/// Return 0 on success, or -1 with errno set to EINVAL if CLOCKID
+/// is not supported.
+int clock_gettime(clockid_t clockid, struct timespec *tp);
 
+/// Return seconds since the UNIX epoch, also storing it in T if non-NULL.
+time_t time(time_t *t);
 
 #if defined (__cplusplus)
 } /* extern "C" */
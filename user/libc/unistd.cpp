@@ -23,13 +23,20 @@
 #include "errno.h"
 #include "stddef.h"
 #include "stdlib.h"
+#include "sys/sendfile.h"
+#include "sys/stat.h"
 #include "sys/syscalls.h"
+#include "sys/uio.h"
 
 extern "C" {
     int open(const char *path, int flags, int mode) {
-        (void)flags;
         (void)mode;
-        return syscall<int>(SYS_open, path);
+        return syscall<int>(SYS_open, path, flags);
+    }
+
+    int mkdir(const char* path, mode_t mode) {
+        (void)mode;
+        return syscall<int>(SYS_mkdir, path);
     }
 
     /// FIXME: close() should return an int.
@@ -50,6 +57,37 @@ extern "C" {
         return syscall<ssize_t>(SYS_write, fd, buffer, count);
     }
 
+    ssize_t pread(int fd, void* buffer, size_t count, off_t offset) {
+        /// TODO: check return value and set errno.
+        ssize_t rc = 0;
+        while ((rc = syscall<ssize_t>(SYS_pread, fd, buffer, count, offset)) == -2);
+        return rc;
+    }
+
+    ssize_t pwrite(int fd, const void* buffer, size_t count, off_t offset) {
+        /// TODO: check return value and set errno.
+        return syscall<ssize_t>(SYS_pwrite, fd, buffer, count, offset);
+    }
+
+    ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
+        /// TODO: check return value and set errno.
+        ssize_t rc = 0;
+        while ((rc = syscall<ssize_t>(SYS_readv, fd, iov, iovcnt)) == -2);
+        return rc;
+    }
+
+    ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+        /// TODO: check return value and set errno.
+        return syscall<ssize_t>(SYS_writev, fd, iov, iovcnt);
+    }
+
+    ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
+        /// TODO: check return value and set errno.
+        ssize_t rc = 0;
+        while ((rc = syscall<ssize_t>(SYS_sendfile, out_fd, in_fd, offset, count)) == -2);
+        return rc;
+    }
+
     char *getcwd(char *buf, size_t size) {
         if (!size) {
             errno = EINVAL;
@@ -36,6 +36,11 @@ void close(int fd);
 ssize_t read(int fd, const void* buffer, size_t count);
 ssize_t write(int fd, const void* buffer, size_t count);
 
+/// Like read()/write(), but at the absolute file `offset`. The file
+/// offset used by read() and write() is left unchanged.
+ssize_t pread(int fd, void* buffer, size_t count, off_t offset);
+ssize_t pwrite(int fd, const void* buffer, size_t count, off_t offset);
+
 /// On success, `buf` will be filled with the absolute path of the
 /// current process' working directory.
 /// On failure, return NULL, and errno is set to indicate the
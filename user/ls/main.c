@@ -0,0 +1,25 @@
+#include <dirent.h>
+#include <stdio.h>
+
+static int list(const char *path) {
+  DIR *dir = opendir(path);
+  if (!dir) {
+    printf("ls: cannot open directory %s\n", path);
+    return 1;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)))
+    printf("%s%s\n", entry->d_name, entry->d_type == DT_DIR ? "/" : "");
+  closedir(dir);
+  return 0;
+}
+
+int main(int argc, const char **argv) {
+  if (argc < 2) return list("/");
+  int status = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (argc > 2) printf("%s:\n", argv[i]);
+    status |= list(argv[i]);
+  }
+  return status;
+}
@@ -410,8 +410,12 @@ int main(int argc, const char **argv) {
   puts("\n\n<===!= WELCOME TO LensorOS SHELL [WIP] =!=!==>\n");
   puts("  LensorOS  Copyright (C) 2022, Contributors To LensorOS.");
 
-  const char *const fontpath = "/fs0/res/fonts/psf1/dfltfont.psf";
+  const char *fontpath = "/res/fonts/psf1/dfltfont.psf";
   FILE *fontfile = fopen(fontpath, "rb");
+  if (!fontfile) {
+    fontpath = "/fs0/res/fonts/psf1/dfltfont.psf";
+    fontfile = fopen(fontpath, "rb");
+  }
   if (!fontfile) {
     printf("Could not open font at %s\n", fontpath);
     return 1;
@@ -569,13 +573,17 @@ int main(int argc, const char **argv) {
     // If file exists, attempt to load it as an executable (pass to exec).
     // TODO: To prevent failures, we should check valid elf64 file header, as well.
     if (parsed_command_length) {
-      const char fs0_prefix[] = "/fs0/bin/";
-      const size_t prefix_length = sizeof(fs0_prefix) - 1;
-      // Includes null terminator
-      const size_t path_length = sizeof(fs0_prefix) + parsed_command_length;
-      char *const path = malloc(path_length);
-      if (path) {
-        memcpy(path, fs0_prefix, prefix_length);
+      // Programs on the initial RAM filesystem (the root) take
+      // precedence over those on the first disk.
+      const char *const prefixes[] = { "/bin/", "/fs0/bin/" };
+      bool ran = false;
+      for (size_t i = 0; !ran && i < sizeof(prefixes) / sizeof(*prefixes); ++i) {
+        const size_t prefix_length = strlen(prefixes[i]);
+        // Includes null terminator
+        const size_t path_length = prefix_length + parsed_command_length + 1;
+        char *const path = malloc(path_length);
+        if (!path) break;
+        memcpy(path, prefixes[i], prefix_length);
         memcpy(path + prefix_length, parsed_command, path_length - prefix_length);
         path[path_length - 1] = '\0';
 
@@ -583,11 +591,11 @@ int main(int argc, const char **argv) {
         if (exists) {
           fclose(exists);
           run_program_waitpid(path, (const char **)args);
-          free(path);
-          continue;
+          ran = true;
         }
         free(path);
       }
+      if (ran) continue;
     }
 
     command_status = 0;
@@ -1,7 +1,9 @@
 #include <filesystem>
 #include <format>
+#include <string_view>
 #include <vector>
 
+#include <poll.h>
 #include <stdio.h>
 #include <sys/syscalls.h>
 #include <unistd.h>
@@ -30,9 +32,17 @@ int run_program_waitpid(const char *const filepath, const char **args) {
         //puts("Parent");
         close(fds[1]);
 
-        char c;
-        while (read(fds[0], &c, 1) != EOF && c)
-            std::print("{}", c);
+        // Reading blocks until the child writes something, so there's
+        // no need to go a byte at a time.
+        char buf[512];
+        for (;;) {
+            ssize_t n = read(fds[0], buf, sizeof(buf));
+            if (n <= 0) break;
+            auto output = std::string_view(buf, size_t(n));
+            auto nul = output.find('\0');
+            std::print("{}", output.substr(0, nul));
+            if (nul != std::string_view::npos) break;
+        }
 
         close(fds[0]);
 
@@ -82,9 +92,15 @@ int main(int argc, char **argv) {
         bool got_backslash = false;
         int c = 0;
         while ((c = getc(input)) != '\n') {
-            // If we get end of file, spin!
+            // If we get end of file, there is no input yet; sleep until
+            // there is instead of spinning.
             // NOTE: We should probably just quit/finish command here.
-            if (c == EOF || feof(input)) continue;
+            if (c == EOF || feof(input)) {
+                clearerr(input);
+                struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
             // Handle escape sequences
 
             // 2.2.1 Escape Character (Backslash)